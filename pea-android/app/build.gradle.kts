@@ -13,6 +13,7 @@ android {
         targetSdk = 34
         versionCode = 1
         versionName = "1.0"
+        testInstrumentationRunner = "androidx.benchmark.junit4.AndroidBenchmarkRunner"
         externalNativeBuild {
             cmake {
                 cppFlags += ""
@@ -41,7 +42,15 @@ android {
                 signingConfig = releaseConfig
             }
         }
+        // Release code, debug-signed and not debuggable, for the androidTest benchmarks (-PpeaBench)
+        create("benchmark") {
+            initWith(getByName("release"))
+            signingConfig = signingConfigs.getByName("debug")
+            matchingFallbacks += listOf("release")
+            isDebuggable = false
+        }
     }
+    testBuildType = if (project.hasProperty("peaBench")) "benchmark" else "debug"
     buildFeatures {
         viewBinding = true
     }
@@ -65,4 +74,6 @@ dependencies {
     implementation("androidx.core:core-ktx:1.12.0")
     implementation("androidx.appcompat:appcompat:1.6.1")
     implementation("com.google.android.material:material:1.11.0")
+    androidTestImplementation("androidx.benchmark:benchmark-junit4:1.2.3")
+    androidTestImplementation("androidx.test.ext:junit:1.1.5")
 }
@@ -0,0 +1,114 @@
+package dev.peapod.android.bench
+
+import androidx.benchmark.junit4.BenchmarkRule
+import androidx.benchmark.junit4.measureRepeated
+import androidx.test.ext.junit.runners.AndroidJUnit4
+import dev.peapod.android.PeaCore
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import org.junit.After
+import org.junit.Assert.assertEquals
+import org.junit.Assert.assertNotEquals
+import org.junit.Before
+import org.junit.Rule
+import org.junit.Test
+import org.junit.runner.RunWith
+
+/**
+ * Per-call latency of nativeOnMessageReceived and nativeOnChunkReceived against a live core: what one frame or
+ * chunk costs end to end, JNI marshalling included. Whole transfers against synthetic peers run in pea_bench.
+ */
+@RunWith(AndroidJUnit4::class)
+class CoreCallBenchmark {
+    @get:Rule
+    val benchmarkRule = BenchmarkRule()
+
+    private var handle = 0L
+    private val peerId = ByteArray(16) { 0xa0.toByte() }
+    private val out = ByteArray(64 * 1024)
+
+    @Before
+    fun setUp() {
+        handle = PeaCore.nativeCreate()
+        assertNotEquals("pea_jni linked against the stub", 0L, handle)
+        assertEquals(0, PeaCore.nativePeerJoined(handle, peerId, ByteArray(32) { 0x40 }))
+    }
+
+    @After
+    fun tearDown() {
+        PeaCore.nativeDestroy(handle)
+    }
+
+    /** A ChunkData frame (bincode layout, docs/PROTOCOL.md) for a transfer the core does not know: copied in, decoded, hash-checked and dropped. */
+    private fun unknownChunkData(size: Int): ByteArray {
+        val frame = ByteBuffer.allocate(80 + size).order(ByteOrder.LITTLE_ENDIAN)
+        frame.putInt(76 + size).putInt(6).put(ByteArray(16) { 0xee.toByte() })
+        frame.putLong(0).putLong(size.toLong()).put(ByteArray(32)).putLong(size.toLong())
+        return frame.array()
+    }
+
+    @Test
+    fun onMessageReceivedNack() {
+        val frame = ByteBuffer.allocate(40).order(ByteOrder.LITTLE_ENDIAN)
+            .putInt(36).putInt(7).put(ByteArray(16) { 0xee.toByte() }).putLong(0).putLong(1024).array()
+        benchmarkRule.measureRepeated {
+            PeaCore.nativeOnMessageReceived(handle, peerId, frame, out)
+        }
+    }
+
+    @Test
+    fun onMessageReceivedChunkData64k() {
+        val frame = unknownChunkData(64 * 1024)
+        benchmarkRule.measureRepeated {
+            PeaCore.nativeOnMessageReceived(handle, peerId, frame, out)
+        }
+    }
+
+    @Test
+    fun onMessageReceivedChunkData256k() {
+        val frame = unknownChunkData(256 * 1024)
+        benchmarkRule.measureRepeated {
+            PeaCore.nativeOnMessageReceived(handle, peerId, frame, out)
+        }
+    }
+
+    /** One self chunk per iteration: hashed by the core and stored. A finished transfer is replaced untimed. */
+    @Test
+    fun onChunkReceived() {
+        val range = LongArray(2)
+        val payloads = HashMap<Int, Pair<ByteArray, ByteArray>>()
+        var tid = startTransfer()
+        benchmarkRule.measureRepeated {
+            val chunk = runWithTimingDisabled {
+                if (PeaCore.nativeNextSelfChunk(handle, tid, range) != 1) {
+                    PeaCore.nativeCancelTransfer(handle, tid)
+                    tid = startTransfer()
+                    assertEquals(1, PeaCore.nativeNextSelfChunk(handle, tid, range))
+                }
+                val len = (range[1] - range[0]).toInt()
+                payloads.getOrPut(len) { ByteArray(len).let { it to hashOf(it) } }
+            }
+            PeaCore.nativeOnChunkReceived(handle, tid, range[0], range[1], chunk.second, chunk.first, null)
+        }
+    }
+
+    private fun startTransfer(): ByteArray {
+        val plan = ByteArray(64 * 1024)
+        assertEquals(1, PeaCore.nativeOnRequest(handle, URL, 0, TRANSFER_BYTES - 1, plan))
+        return plan.copyOfRange(0, 16)
+    }
+
+    private fun hashOf(payload: ByteArray): ByteArray {
+        val buf = ByteBuffer.allocateDirect(payload.size).put(payload)
+        val verifier = PeaCore.nativeChunkVerifyBegin()
+        PeaCore.nativeChunkVerifyUpdate(verifier, buf, 0, payload.size)
+        val hash = ByteArray(32)
+        PeaCore.nativeChunkVerifyFinish(verifier, null, hash)
+        return hash
+    }
+
+    private companion object {
+        const val URL = "http://bench.invalid/blob"
+        const val TRANSFER_BYTES = 64L * 1024 * 1024
+    }
+}
@@ -0,0 +1,68 @@
+package dev.peapod.android.bench
+
+import androidx.benchmark.junit4.BenchmarkRule
+import androidx.benchmark.junit4.measureRepeated
+import dev.peapod.android.PeaCore
+import java.nio.ByteBuffer
+import org.junit.Assert.assertEquals
+import org.junit.Rule
+import org.junit.Test
+import org.junit.runner.RunWith
+import org.junit.runners.Parameterized
+
+/**
+ * nativeEncryptWire/nativeDecryptWire per frame size, through Java arrays and through direct buffers, so the JNI
+ * copy cost shows next to the AEAD cost measured natively by pea_bench.
+ */
+@RunWith(Parameterized::class)
+class WireCryptoBenchmark(private val size: Int) {
+    @get:Rule
+    val benchmarkRule = BenchmarkRule()
+
+    private val key = ByteArray(32) { 0x5a }
+    private val plain = ByteArray(size) { (it * 31).toByte() }
+    private val cipher = ByteArray(size + 16).also {
+        assertEquals(size + 16, PeaCore.nativeEncryptWire(key, 0, plain, it))
+    }
+    private val out = ByteArray(size + 16)
+
+    @Test
+    fun encryptWire() {
+        var nonce = 0L
+        benchmarkRule.measureRepeated {
+            PeaCore.nativeEncryptWire(key, nonce++, plain, out)
+        }
+    }
+
+    @Test
+    fun decryptWire() {
+        benchmarkRule.measureRepeated {
+            PeaCore.nativeDecryptWire(key, 0, cipher, out)
+        }
+    }
+
+    @Test
+    fun encryptWireDirect() {
+        val src = ByteBuffer.allocateDirect(size).put(plain)
+        val dst = ByteBuffer.allocateDirect(size + 16)
+        var nonce = 0L
+        benchmarkRule.measureRepeated {
+            PeaCore.nativeEncryptWireDirect(key, nonce++, src, 0, size, dst, 0, size + 16)
+        }
+    }
+
+    @Test
+    fun decryptWireDirect() {
+        val src = ByteBuffer.allocateDirect(size + 16).put(cipher)
+        val dst = ByteBuffer.allocateDirect(size + 16)
+        benchmarkRule.measureRepeated {
+            PeaCore.nativeDecryptWireDirect(key, 0, src, 0, size + 16, dst, 0, size + 16)
+        }
+    }
+
+    companion object {
+        @JvmStatic
+        @Parameterized.Parameters(name = "size={0}")
+        fun sizes(): List<Int> = listOf(1024, 64 * 1024, 256 * 1024)
+    }
+}
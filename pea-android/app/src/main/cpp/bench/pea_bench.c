@@ -0,0 +1,362 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* clock_gettime under -std=c11 */
+#endif
+/* pea_bench: native harness for the core calls behind the JNI natives, so their cost can be told apart from the
+ * JNI marshalling the app's microbenchmarks add on top. Built with -DPEA_BENCH=ON (pea-android/README.md,
+ * Benchmarks) and run per ABI on a device (adb push, then ./pea_bench [seconds per case]) or on a host against a
+ * host build of libpea_core.a. Prints one JSON object per line, tagged with the ABI it was built for:
+ * - encrypt_wire, decrypt_wire: 1 KiB, 64 KiB and 256 KiB frames (nativeEncryptWire/nativeDecryptWire)
+ * - on_message_received_nack: a small frame the core decodes and drops (dispatch overhead alone)
+ * - full_transfer: a 64 MiB accelerated transfer against N synthetic peers that answer every ChunkRequest at once,
+ *   with the per-call latency of on_message_received (peer ChunkData) and on_chunk_received (self chunks) */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../pea_core_ffi.h"
+
+#ifndef PEA_BENCH_ABI
+#define PEA_BENCH_ABI "unknown"
+#endif
+
+#define TRANSFER_BYTES (64u * 1024 * 1024)
+#define MAX_SIM_PEERS 8
+/* bincode: 4 length, 4 tag, 16 transfer_id, 8 start, 8 end, 32 hash, 8 payload length. */
+#define CHUNK_DATA_HEADER 80
+#define TAG_CHUNK_REQUEST 5
+#define TAG_CHUNK_DATA 6
+#define TAG_NACK 7
+
+static double g_seconds = 0.5;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void put32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void put64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get64(const uint8_t* p) {
+    return (uint64_t)get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Per-call samples in ns. */
+struct samples {
+    uint64_t* ns;
+    size_t len, cap;
+    uint64_t bytes;
+};
+
+static void sample(struct samples* s, uint64_t ns, uint64_t bytes) {
+    if (s->len == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 1024;
+        uint64_t* p = realloc(s->ns, cap * sizeof(*p));
+        if (!p) return;
+        s->ns = p;
+        s->cap = cap;
+    }
+    s->ns[s->len++] = ns;
+    s->bytes += bytes;
+}
+
+static void print_latency(const char* bench, int peers, struct samples* s) {
+    if (s->len == 0) return;
+    qsort(s->ns, s->len, sizeof(*s->ns), cmp_u64);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < s->len; i++) sum += s->ns[i];
+    printf("{\"abi\":\"%s\",\"bench\":\"%s\",\"peers\":%d,\"calls\":%zu,\"bytes_per_call\":%llu,"
+           "\"ns_mean\":%llu,\"ns_p50\":%llu,\"ns_p99\":%llu}\n",
+        PEA_BENCH_ABI, bench, peers, s->len, (unsigned long long)(s->bytes / s->len),
+        (unsigned long long)(sum / s->len), (unsigned long long)s->ns[s->len / 2],
+        (unsigned long long)s->ns[s->len * 99 / 100]);
+}
+
+static void print_rate(const char* bench, size_t bytes, uint64_t calls, uint64_t ns) {
+    double per_call = (double)ns / (double)calls;
+    printf("{\"abi\":\"%s\",\"bench\":\"%s\",\"bytes\":%zu,\"calls\":%llu,\"ns_per_call\":%.1f,\"mb_per_s\":%.1f}\n",
+        PEA_BENCH_ABI, bench, bytes, (unsigned long long)calls, per_call,
+        bytes ? (double)bytes * 1e3 / per_call : 0.0);
+}
+
+struct crypto_case {
+    uint8_t key[32];
+    uint8_t* plain;
+    uint8_t* cipher;
+    uint8_t* out;
+    size_t len;
+};
+
+/* Run op in batches of 16 until g_seconds have passed; prints the mean. Returns -1 if any call failed. */
+static int run_timed(const char* bench, size_t bytes, int (*op)(struct crypto_case*, uint64_t), struct crypto_case* c) {
+    uint64_t budget = (uint64_t)(g_seconds * 1e9), calls = 0, start = now_ns(), elapsed;
+    do {
+        for (int i = 0; i < 16; i++)
+            if (op(c, calls + (uint64_t)i) < 0) return -1;
+        calls += 16;
+        elapsed = now_ns() - start;
+    } while (elapsed < budget);
+    print_rate(bench, bytes, calls, elapsed);
+    return 0;
+}
+
+static int op_encrypt(struct crypto_case* c, uint64_t nonce) {
+    return pea_core_encrypt_wire(c->key, nonce, c->plain, c->len, c->out, c->len + 16);
+}
+
+static int op_decrypt(struct crypto_case* c, uint64_t nonce) {
+    (void)nonce; /* c->cipher was sealed with nonce 0 */
+    return pea_core_decrypt_wire(c->key, 0, c->cipher, c->len + 16, c->out, c->len + 16);
+}
+
+static int bench_crypto(void) {
+    static const size_t sizes[] = { 1024, 64 * 1024, 256 * 1024 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        struct crypto_case c = { .len = sizes[i] };
+        memset(c.key, 0x5a, sizeof(c.key));
+        c.plain = malloc(c.len);
+        c.cipher = malloc(c.len + 16);
+        c.out = malloc(c.len + 16);
+        int r = -1;
+        if (c.plain && c.cipher && c.out) {
+            for (size_t j = 0; j < c.len; j++) c.plain[j] = (uint8_t)(j * 31);
+            if (pea_core_encrypt_wire(c.key, 0, c.plain, c.len, c.cipher, c.len + 16) == (int)(c.len + 16)
+                && run_timed("encrypt_wire", c.len, op_encrypt, &c) == 0
+                && run_timed("decrypt_wire", c.len, op_decrypt, &c) == 0)
+                r = 0;
+        }
+        free(c.plain);
+        free(c.cipher);
+        free(c.out);
+        if (r != 0) {
+            fprintf(stderr, "pea_bench: wire crypto failed at %zu bytes\n", sizes[i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void synthetic_peer(int i, uint8_t id[16], uint8_t pk[32]) {
+    memset(id, 0xa0 + i, 16);
+    memset(pk, 0x40 + i, 32);
+}
+
+/* A Nack for a transfer the core does not know: decoded, looked up and dropped, so only the call itself is timed. */
+static int bench_nack(void) {
+    void* h = pea_core_create();
+    if (!h) return -1;
+    uint8_t id[16], pk[32], frame[40], out[64];
+    synthetic_peer(0, id, pk);
+    pea_core_peer_joined(h, id, pk);
+    put32(frame, 36);
+    put32(frame + 4, TAG_NACK);
+    memset(frame + 8, 0xee, 16);
+    put64(frame + 24, 0);
+    put64(frame + 32, 1024);
+    uint64_t budget = (uint64_t)(g_seconds * 1e9), calls = 0, start = now_ns(), elapsed;
+    do {
+        for (int i = 0; i < 64; i++)
+            if (pea_core_on_message_received(h, id, frame, sizeof(frame), out, sizeof(out)) < 0) {
+                pea_core_destroy(h);
+                return -1;
+            }
+        calls += 64;
+        elapsed = now_ns() - start;
+    } while (elapsed < budget);
+    print_rate("on_message_received_nack", sizeof(frame), calls, elapsed);
+    pea_core_destroy(h);
+    return 0;
+}
+
+/* A chunk to deliver: worker -1 is self, else a synthetic peer index. */
+struct work {
+    int worker;
+    uint64_t start, end;
+};
+
+struct queue {
+    struct work* items;
+    size_t head, len, cap;
+};
+
+static int push(struct queue* q, int worker, uint64_t start, uint64_t end) {
+    if (q->len == q->cap) {
+        size_t cap = q->cap ? q->cap * 2 : 256;
+        struct work* p = realloc(q->items, cap * sizeof(*p));
+        if (!p) return -1;
+        q->items = p;
+        q->cap = cap;
+    }
+    q->items[q->len++] = (struct work){ worker, start, end };
+    return 0;
+}
+
+static void hash_of(const uint8_t* p, size_t len, uint8_t out[32]) {
+    void* v = pea_core_chunk_verify_begin();
+    pea_core_chunk_verify_update(v, p, len);
+    pea_core_chunk_verify_finish(v, NULL, out);
+}
+
+/* Queue the ChunkRequests among on_message_received's actions (after its 4 body length and body). */
+static int queue_requests(struct queue* q, const uint8_t* out, size_t out_len, const uint8_t ids[][16], int peers) {
+    size_t off = 4 + get32(out);
+    if (off + 4 > out_len) return -1;
+    uint32_t count = get32(out + off);
+    off += 4;
+    for (uint32_t i = 0; i < count; i++) {
+        if (off + 20 > out_len) return -1;
+        const uint8_t* peer = out + off;
+        uint32_t len = get32(out + off + 16);
+        const uint8_t* f = out + off + 20;
+        off += 20 + len;
+        if (off > out_len) return -1;
+        if (len < 40 || get32(f + 4) != TAG_CHUNK_REQUEST) continue;
+        for (int p = 0; p < peers; p++)
+            if (memcmp(peer, ids[p], 16) == 0 && push(q, p, get64(f + 24), get64(f + 32)) != 0) return -1;
+    }
+    return 0;
+}
+
+/* One accelerated transfer of the whole source; returns the timed core calls' total in ns, or 0 on failure.
+ * Hashing and frame building are host work and stay outside the timings. */
+static uint64_t simulate(int peers, const uint8_t* source, uint8_t* frame, uint8_t* out, size_t out_cap,
+    struct samples* msg_lat, struct samples* chunk_lat) {
+    void* h = pea_core_create();
+    if (!h) return 0;
+    uint8_t ids[MAX_SIM_PEERS][16], pk[32], tid[16], hash[32];
+    for (int p = 0; p < peers; p++) {
+        synthetic_peer(p, ids[p], pk);
+        pea_core_peer_joined(h, ids[p], pk);
+    }
+    static const char url[] = "http://bench.invalid/blob";
+    struct queue q = { 0 };
+    uint64_t core_ns = 0, t = now_ns();
+    int r = pea_core_on_request(h, (const uint8_t*)url, sizeof(url) - 1, 0, TRANSFER_BYTES - 1, out, out_cap);
+    core_ns += now_ns() - t;
+    int done = 0, failed = r != 1;
+    if (!failed) {
+        memcpy(tid, out, 16);
+        uint32_t n = get32(out + 24);
+        for (uint32_t i = 0; i < n && !failed; i++) {
+            const uint8_t* rec = out + 28 + (size_t)i * 32;
+            int worker = -1;
+            for (int p = 0; p < peers; p++)
+                if (memcmp(rec, ids[p], 16) == 0) worker = p;
+            failed = push(&q, worker, get64(rec + 16), get64(rec + 24)) != 0;
+        }
+    }
+    while (!failed && !done && q.head < q.len) {
+        struct work w = q.items[q.head++];
+        const uint8_t* payload = source + w.start;
+        size_t len = (size_t)(w.end - w.start);
+        hash_of(payload, len, hash);
+        if (w.worker < 0) {
+            t = now_ns();
+            r = pea_core_on_chunk_received(h, tid, w.start, w.end, hash, payload, len, out, out_cap);
+            uint64_t dt = now_ns() - t;
+            sample(chunk_lat, dt, len);
+            core_ns += dt;
+            if (r == 1) {
+                done = 1;
+                break;
+            }
+            uint64_t next[2];
+            t = now_ns();
+            int got = r == 0 ? pea_core_next_self_chunks(h, tid, next, 1) : -1;
+            core_ns += now_ns() - t;
+            failed = got < 0 || (got == 1 && push(&q, -1, next[0], next[1]) != 0);
+            continue;
+        }
+        put32(frame, (uint32_t)(CHUNK_DATA_HEADER - 4 + len));
+        put32(frame + 4, TAG_CHUNK_DATA);
+        memcpy(frame + 8, tid, 16);
+        put64(frame + 24, w.start);
+        put64(frame + 32, w.end);
+        memcpy(frame + 40, hash, 32);
+        put64(frame + 72, len);
+        memcpy(frame + CHUNK_DATA_HEADER, payload, len);
+        t = now_ns();
+        r = pea_core_on_message_received(h, ids[w.worker], frame, CHUNK_DATA_HEADER + len, out, out_cap);
+        uint64_t dt = now_ns() - t;
+        sample(msg_lat, dt, len);
+        core_ns += dt;
+        if (r < 0) failed = 1;
+        else if (get32(out) > 0) done = 1;
+        else failed = queue_requests(&q, out, (size_t)r, (const uint8_t(*)[16])ids, peers) != 0;
+    }
+    free(q.items);
+    pea_core_destroy(h);
+    return done && !failed ? core_ns : 0;
+}
+
+static int bench_transfers(void) {
+    static const int peer_counts[] = { 1, 4, 8 };
+    size_t out_cap = TRANSFER_BYTES + (1u << 20);
+    uint8_t* source = malloc(TRANSFER_BYTES);
+    uint8_t* out = malloc(out_cap);
+    /* The biggest chunk the default config cuts is 4 MiB. */
+    uint8_t* frame = malloc(CHUNK_DATA_HEADER + (4u << 20));
+    int r = source && out && frame ? 0 : -1;
+    if (r == 0)
+        for (size_t i = 0; i < TRANSFER_BYTES; i++) source[i] = (uint8_t)(i * 31 % 251);
+    for (size_t i = 0; r == 0 && i < sizeof(peer_counts) / sizeof(peer_counts[0]); i++) {
+        int peers = peer_counts[i];
+        struct samples msg_lat = { 0 }, chunk_lat = { 0 };
+        uint64_t budget = (uint64_t)(g_seconds * 1e9), runs = 0, core_ns = 0, start = now_ns(), elapsed;
+        do {
+            uint64_t ns = simulate(peers, source, frame, out, out_cap, &msg_lat, &chunk_lat);
+            if (ns == 0) {
+                fprintf(stderr, "pea_bench: transfer with %d peers did not complete\n", peers);
+                r = -1;
+                break;
+            }
+            core_ns += ns;
+            runs++;
+            elapsed = now_ns() - start;
+        } while (elapsed < budget);
+        if (r == 0) {
+            printf("{\"abi\":\"%s\",\"bench\":\"full_transfer\",\"peers\":%d,\"bytes\":%u,\"runs\":%llu,"
+                   "\"core_ns_per_run\":%llu,\"mb_per_s\":%.1f}\n",
+                PEA_BENCH_ABI, peers, TRANSFER_BYTES, (unsigned long long)runs,
+                (unsigned long long)(core_ns / runs), (double)TRANSFER_BYTES * 1e3 * (double)runs / (double)core_ns);
+            print_latency("on_message_received_chunk", peers, &msg_lat);
+            print_latency("on_chunk_received", peers, &chunk_lat);
+        }
+        free(msg_lat.ns);
+        free(chunk_lat.ns);
+    }
+    free(source);
+    free(out);
+    free(frame);
+    return r;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) g_seconds = atof(argv[1]);
+    if (g_seconds <= 0) g_seconds = 0.5;
+    void* probe = pea_core_create();
+    if (!probe) {
+        fprintf(stderr, "pea_bench: pea_core_create failed (linked against the stub?)\n");
+        return 1;
+    }
+    pea_core_destroy(probe);
+    if (bench_crypto() != 0 || bench_nack() != 0 || bench_transfers() != 0) return 1;
+    return 0;
+}
@@ -0,0 +1,57 @@
+/* Native buffer pool (see pea_bufpool.h). Each buffer carries a small header with its class, which also
+ * links it into the class's free list while it is not in use. */
+#include "pea_bufpool.h"
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdlib.h>
+
+/* Free buffers kept per class; beyond that a release frees the memory (every 16 MiB frame held is real RSS). */
+static const size_t class_size[] = { PEA_BUF_SMALL, PEA_BUF_CHUNK, PEA_BUF_FRAME };
+static const unsigned class_keep[] = { 16, 8, 2 };
+#define NCLASS (sizeof(class_size) / sizeof(class_size[0]))
+
+struct buf_hdr {
+    alignas(max_align_t) struct buf_hdr* next;
+    unsigned cls;
+};
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct buf_hdr* free_list[NCLASS];
+static unsigned free_count[NCLASS];
+
+void* pea_bufpool_acquire(size_t size, size_t* out_cap) {
+    unsigned cls = 0;
+    while (cls < NCLASS && class_size[cls] < size) cls++;
+    if (cls == NCLASS) return NULL;
+    pthread_mutex_lock(&pool_lock);
+    struct buf_hdr* b = free_list[cls];
+    if (b) {
+        free_list[cls] = b->next;
+        free_count[cls]--;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    if (!b) {
+        b = malloc(sizeof(*b) + class_size[cls]);
+        if (!b) return NULL;
+        b->cls = cls;
+    }
+    b->next = NULL;
+    if (out_cap) *out_cap = class_size[cls];
+    return b + 1;
+}
+
+void pea_bufpool_release(void* p) {
+    if (!p) return;
+    struct buf_hdr* b = (struct buf_hdr*)p - 1;
+    unsigned cls = b->cls;
+    pthread_mutex_lock(&pool_lock);
+    if (free_count[cls] < class_keep[cls]) {
+        b->next = free_list[cls];
+        free_list[cls] = b;
+        free_count[cls]++;
+        b = NULL;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    free(b);
+}
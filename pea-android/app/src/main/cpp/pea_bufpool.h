@@ -0,0 +1,22 @@
+/* Native buffer pool: fixed size classes of native memory, reused across calls so the JNI hot paths
+ * (request assignment, chunk payloads, whole frames) stop allocating a Java array per call.
+ * Kotlin sees a pooled buffer as a direct ByteBuffer (PeaCore.nativeBufferAcquire / nativeBufferRelease).
+ * Thread-safe; each class keeps a bounded free list and returns extra buffers to the allocator. */
+#ifndef PEA_BUFPOOL_H
+#define PEA_BUFPOOL_H
+
+#include <stddef.h>
+
+/* Size classes: JNI output buffers, one default chunk plus AEAD tag, and the largest wire frame. */
+#define PEA_BUF_SMALL (64u * 1024)
+#define PEA_BUF_CHUNK (256u * 1024 + 16)
+#define PEA_BUF_FRAME (16u * 1024 * 1024)
+
+/* A buffer of at least size bytes from the smallest class that fits; *out_cap gets the class size.
+ * NULL if size exceeds PEA_BUF_FRAME or memory is exhausted. */
+void* pea_bufpool_acquire(size_t size, size_t* out_cap);
+
+/* Return a buffer from pea_bufpool_acquire. No-op for NULL; anything else is undefined. */
+void pea_bufpool_release(void* p);
+
+#endif
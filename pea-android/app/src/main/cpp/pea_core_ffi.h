@@ -0,0 +1,111 @@
+/* pea-core C API (from pea-core/src/ffi.rs); stubbed in pea_stub.c when not linked. */
+#ifndef PEA_CORE_FFI_H
+#define PEA_CORE_FFI_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/* Chunk sizing for pea_core_set_config; a 0 field keeps its default. */
+typedef struct pea_config {
+    uint64_t min_chunk_size;
+    uint64_t max_chunk_size;
+    uint32_t chunks_per_worker;
+    uint32_t min_chunk_rtts;
+} pea_config;
+
+/* Tracer entry points for pea_core_set_trace_hooks, with ATrace's signatures; the async pair may be NULL. */
+typedef struct pea_trace_hooks {
+    void (*begin_section)(const char* name);
+    void (*end_section)(void);
+    void (*begin_async_section)(const char* name, int32_t cookie);
+    void (*end_async_section)(const char* name, int32_t cookie);
+} pea_trace_hooks;
+
+/* Out-buffer contract: a call whose out_buf is NULL or too small returns -n, n >= 3 the bytes needed (-1 is an
+ * error). Stateful calls (actions, bodies, a new transfer) keep that output for pea_core_take_output. */
+#define PEA_CORE_NEEDED(r) ((r) < -2 ? (size_t)-(r) : (size_t)0)
+
+/* One received frame for pea_core_on_messages_received_v. */
+typedef struct pea_message_ref {
+    const uint8_t* peer_id;
+    const uint8_t* frame;
+    size_t len;
+} pea_message_ref;
+
+extern uint8_t pea_core_version(void);
+extern void* pea_core_create(void);
+extern void pea_core_destroy(void* h);
+extern int pea_core_device_id(void* h, void* out_buf, size_t out_len);
+extern int pea_core_set_config(void* h, const pea_config* cfg);
+extern int pea_core_set_chunk_cache(void* h, uint64_t budget_bytes, uint8_t* arena, size_t arena_len);
+extern int pea_core_on_request(void* h, const uint8_t* url, size_t url_len,
+    uint64_t range_start, uint64_t range_end, uint8_t* out_buf, size_t out_buf_len);
+extern int pea_core_peer_joined(void* h, const uint8_t* device_id_16, const uint8_t* public_key_32);
+extern int pea_core_peer_left(void* h, const uint8_t* device_id_16, uint8_t* out_buf, size_t out_buf_len);
+extern int pea_core_on_message_received(void* h, const uint8_t* peer_id_16,
+    const uint8_t* msg, size_t msg_len, uint8_t* out_buf, size_t out_buf_len);
+extern int pea_core_on_messages_received_batch(void* h, const uint8_t* records, size_t records_len,
+    uint32_t record_count, uint8_t* out_buf, size_t out_buf_len);
+extern int pea_core_on_messages_received_v(void* h, const pea_message_ref* msgs, size_t msg_count,
+    uint8_t* out_buf, size_t out_buf_len);
+extern int pea_core_on_chunk_received(void* h, const uint8_t* transfer_id_16,
+    uint64_t start, uint64_t end, const uint8_t* hash_32,
+    const uint8_t* payload, size_t payload_len, uint8_t* out_buf, size_t out_buf_len);
+extern int pea_core_receive_cached_chunk(void* h, const uint8_t* transfer_id_16, uint64_t start, uint64_t end,
+    uint8_t* out_buf, size_t out_buf_len);
+extern int pea_core_set_transfer_validator(void* h, const uint8_t* transfer_id_16, const uint8_t* validator,
+    size_t validator_len);
+extern void* pea_core_chunk_verify_begin(void);
+extern int pea_core_chunk_verify_update(void* v, const uint8_t* data, size_t len);
+extern int pea_core_chunk_verify_finish(void* v, const uint8_t* expected_hash_32, uint8_t* out_hash_32);
+/* sink runs after the core lock is released, one call at a time per transfer, and may block. ctx stays in use until
+ * a NULL sink clears it or pea_core_cancel_transfer returns, which waits for an in-flight write. */
+extern int pea_core_set_transfer_sink(void* h, const uint8_t* transfer_id_16,
+    int (*sink)(void* ctx, const struct iovec* iov, size_t iov_count), void* ctx);
+extern int pea_core_set_transfer_spill(void* h, const uint8_t* transfer_id_16, uint8_t* area, size_t area_len,
+    uint64_t window_bytes, void (*release)(void* ctx), void* ctx);
+extern int pea_core_next_self_chunk(void* h, const uint8_t* transfer_id_16, uint64_t* out_start, uint64_t* out_end);
+extern int pea_core_next_self_chunks(void* h, const uint8_t* transfer_id_16, uint64_t* out_ranges, size_t max);
+extern int pea_core_cancel_transfer(void* h, const uint8_t* transfer_id_16);
+extern int pea_core_transfer_status(void* h, const uint8_t* transfer_id_16, uint8_t* out_buf, size_t out_buf_len);
+extern int pea_core_on_upload_request(void* h, const uint8_t* url, size_t url_len, uint64_t total_length,
+    uint8_t* out_buf, size_t out_buf_len);
+extern int pea_core_next_upload_parts(void* h, const uint8_t* transfer_id_16, uint8_t* out_buf, size_t out_buf_len);
+extern int pea_core_upload_part_frame(void* h, const uint8_t* transfer_id_16, uint64_t start, uint64_t end,
+    const uint8_t* payload, size_t payload_len, uint8_t* out_buf, size_t out_buf_len);
+extern int pea_core_upload_part_done(void* h, const uint8_t* transfer_id_16, uint64_t start, uint64_t end, int ok);
+extern int pea_core_upload_status(void* h, const uint8_t* transfer_id_16, uint8_t* out_buf, size_t out_buf_len);
+extern int pea_core_finish_upload(void* h, const uint8_t* transfer_id_16);
+extern int pea_core_take_upload_job(void* h, uint8_t* out_buf, size_t out_buf_len);
+extern int pea_core_upload_ack(const uint8_t* peer_id_16, const uint8_t* transfer_id_16, uint64_t start, uint64_t end,
+    int ok, uint8_t* out_buf, size_t out_buf_len);
+extern uint64_t pea_core_wait_upload_event(void* h, uint64_t seen, uint32_t timeout_ms);
+extern int pea_core_tick(void* h, uint8_t* out_buf, size_t out_buf_len);
+extern int pea_core_tick_at(void* h, uint64_t now_ms, uint8_t* out_buf, size_t out_buf_len);
+extern int pea_core_take_output(void* h, uint8_t* out_buf, size_t out_buf_len);
+extern uint32_t pea_core_tick_interval_ms(void* h);
+/* Hot-path counters in the pea-core stats layout, at most PEA_CORE_STATS_MAX_LEN (stats::MAX_SNAPSHOT_LEN) bytes;
+ * takes no lock. */
+#define PEA_CORE_STATS_MAX_LEN 7248
+extern int pea_core_stats(void* h, uint8_t* out_buf, size_t out_buf_len);
+/* Process-wide; NULL stops tracing. hooks must stay valid for the rest of the process. */
+extern void pea_core_set_trace_hooks(const pea_trace_hooks* hooks);
+extern int pea_core_beacon_frame(void* h, uint16_t listen_port, uint8_t* out_buf, size_t out_buf_len);
+extern int pea_core_discovery_response_frame(void* h, uint16_t listen_port, uint8_t* out_buf, size_t out_buf_len);
+extern int pea_core_decode_discovery_frame(const uint8_t* bytes, size_t len,
+    uint8_t* out_device_id_16, uint8_t* out_public_key_32, uint16_t* out_listen_port);
+extern int pea_core_handshake_bytes(void* h, uint8_t* out_buf, size_t out_buf_len);
+extern int pea_core_session_key(void* h, const uint8_t* peer_public_key_32, uint8_t* out_session_key_32);
+extern int pea_core_encrypt_wire(const uint8_t* session_key_32, uint64_t nonce,
+    const uint8_t* plain, size_t plain_len, uint8_t* out_buf, size_t out_buf_len);
+extern int pea_core_decrypt_wire(const uint8_t* session_key_32, uint64_t nonce,
+    const uint8_t* cipher, size_t cipher_len, uint8_t* out_buf, size_t out_buf_len);
+extern void* pea_core_cipher_create(const uint8_t* session_key_32);
+extern void pea_core_cipher_destroy(void* c);
+extern int pea_core_cipher_seal(void* c, const uint8_t* plain, size_t plain_len,
+    uint8_t* out_buf, size_t out_buf_len);
+extern int pea_core_cipher_open(void* c, const uint8_t* cipher, size_t cipher_len,
+    uint8_t* out_buf, size_t out_buf_len);
+
+#endif
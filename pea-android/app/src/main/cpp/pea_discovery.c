@@ -0,0 +1,348 @@
+/* Native discovery (see pea_discovery.h): epoll loop over the multicast socket, a wake eventfd for stop, and
+ * timerfds for the beacon and the peer timeout check. The peer table is touched only by the discovery thread. */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* recvmmsg, sendmmsg */
+#endif
+#include "pea_discovery.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pea_core_ffi.h"
+
+#define DISCOVERY_PORT 45678
+#define MULTICAST_GROUP "239.255.60.60"
+#define BEACON_INTERVAL_MS 4000
+#define BEACON_INTERVAL_THROTTLE_MS 12000
+#define PEER_TIMEOUT_MS 16000
+#define TIMEOUT_CHECK_MS 4000
+/* Beacon and response frames are about 260-270 bytes; anything longer is not discovery traffic. */
+#define FRAME_MAX 512
+#define RECV_BATCH 32
+#define SCRATCH_SIZE 65536
+#define MAX_EVENTS 8
+
+struct peer {
+    uint8_t device_id[16];
+    uint8_t public_key[32];
+    struct in_addr addr;
+    uint16_t port;
+    int64_t last_seen_ms;
+};
+
+struct pea_discovery {
+    void* core;
+    pea_discovery_callbacks cb;
+    void* cb_ctx;
+    int epfd;
+    int sock;
+    int wake_fd;
+    int beacon_fd;
+    int timeout_fd;
+    atomic_int running;
+    atomic_int throttle;
+    pthread_t thread;
+    uint8_t device_id[16];
+    uint8_t beacon[FRAME_MAX];
+    size_t beacon_len;
+    uint8_t response[FRAME_MAX];
+    size_t response_len;
+    struct peer* peers;
+    size_t peers_len;
+    size_t peers_cap;
+    /* recvmmsg slots; each datagram lands in its own FRAME_MAX + 1 bytes so truncation is visible. */
+    struct mmsghdr msgs[RECV_BATCH];
+    struct iovec iovs[RECV_BATCH];
+    struct sockaddr_in from[RECV_BATCH];
+    uint8_t bufs[RECV_BATCH][FRAME_MAX + 1];
+    /* Output of pea_core_peer_left; grown to what the core reports it needs and shrunk back after. */
+    uint8_t* scratch;
+    size_t scratch_cap;
+};
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void arm_timer(int fd, uint32_t value_ms, uint32_t interval_ms) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = value_ms / 1000;
+    its.it_value.tv_nsec = (long)(value_ms % 1000) * 1000000L;
+    /* A zero it_value disarms; fire "now" as 1 ns instead. */
+    if (value_ms == 0) its.it_value.tv_nsec = 1;
+    its.it_interval.tv_sec = interval_ms / 1000;
+    its.it_interval.tv_nsec = (long)(interval_ms % 1000) * 1000000L;
+    timerfd_settime(fd, 0, &its, NULL);
+}
+
+static void drain_timer(int fd) {
+    uint64_t expirations;
+    while (read(fd, &expirations, sizeof(expirations)) < 0 && errno == EINTR) {}
+}
+
+static struct peer* find_peer(pea_discovery* d, const uint8_t* device_id) {
+    for (size_t i = 0; i < d->peers_len; i++)
+        if (memcmp(d->peers[i].device_id, device_id, 16) == 0) return &d->peers[i];
+    return NULL;
+}
+
+static struct peer* add_peer(pea_discovery* d) {
+    if (d->peers_len == d->peers_cap) {
+        size_t cap = d->peers_cap ? d->peers_cap * 2 : 16;
+        struct peer* p = realloc(d->peers, cap * sizeof(*p));
+        if (!p) return NULL;
+        d->peers = p;
+        d->peers_cap = cap;
+    }
+    return &d->peers[d->peers_len++];
+}
+
+/* Same as the transport's: collect output that did not fit scratch (pea_core_take_output). Returns its length. */
+static size_t core_output(pea_discovery* d, int r) {
+    size_t need = PEA_CORE_NEEDED(r);
+    if (need > 0) {
+        if (need > d->scratch_cap) {
+            uint8_t* p = realloc(d->scratch, need);
+            if (!p) return 0;
+            d->scratch = p;
+            d->scratch_cap = need;
+        }
+        r = pea_core_take_output(d->core, d->scratch, d->scratch_cap);
+    }
+    return r > 0 ? (size_t)r : 0;
+}
+
+static void shrink_scratch(pea_discovery* d) {
+    if (d->scratch_cap <= SCRATCH_SIZE) return;
+    uint8_t* p = realloc(d->scratch, SCRATCH_SIZE);
+    if (!p) return;
+    d->scratch = p;
+    d->scratch_cap = SCRATCH_SIZE;
+}
+
+static void send_beacon(pea_discovery* d) {
+    drain_timer(d->beacon_fd);
+    struct sockaddr_in group;
+    memset(&group, 0, sizeof(group));
+    group.sin_family = AF_INET;
+    group.sin_port = htons(DISCOVERY_PORT);
+    inet_pton(AF_INET, MULTICAST_GROUP, &group.sin_addr);
+    sendto(d->sock, d->beacon, d->beacon_len, MSG_NOSIGNAL, (struct sockaddr*)&group, sizeof(group));
+    /* One-shot, re-armed each time so a throttle change applies from the next beacon. */
+    arm_timer(d->beacon_fd, atomic_load(&d->throttle) ? BEACON_INTERVAL_THROTTLE_MS : BEACON_INTERVAL_MS, 0);
+}
+
+/* Decode one datagram and update the table. Returns 1 if the sender should get a DiscoveryResponse. */
+static int handle_frame(pea_discovery* d, const uint8_t* frame, size_t len, const struct sockaddr_in* from,
+    int64_t now) {
+    uint8_t id[16], pk[32];
+    uint16_t port;
+    if (len < 5 || pea_core_decode_discovery_frame(frame, len, id, pk, &port) != 0) return 0;
+    if (memcmp(id, d->device_id, 16) == 0) return 0;
+    struct peer* p = find_peer(d, id);
+    if (p && p->port == port && p->addr.s_addr == from->sin_addr.s_addr && memcmp(p->public_key, pk, 32) == 0) {
+        p->last_seen_ms = now;
+        return 0;
+    }
+    int joined = !p;
+    if (!p && !(p = add_peer(d))) return 0;
+    memcpy(p->device_id, id, 16);
+    memcpy(p->public_key, pk, 32);
+    p->addr = from->sin_addr;
+    p->port = port;
+    p->last_seen_ms = now;
+    if (joined) {
+        pea_core_peer_joined(d->core, id, pk);
+        if (d->cb.on_peer_joined)
+            d->cb.on_peer_joined(d->cb_ctx, id, pk, (const uint8_t*)&from->sin_addr, 4, port);
+    }
+    return 1;
+}
+
+/* Drain the socket RECV_BATCH datagrams at a time; the batch's responses go out in one sendmmsg. */
+static void recv_all(pea_discovery* d) {
+    for (;;) {
+        for (int i = 0; i < RECV_BATCH; i++) {
+            d->iovs[i].iov_base = d->bufs[i];
+            d->iovs[i].iov_len = sizeof(d->bufs[i]);
+            memset(&d->msgs[i].msg_hdr, 0, sizeof(d->msgs[i].msg_hdr));
+            d->msgs[i].msg_hdr.msg_iov = &d->iovs[i];
+            d->msgs[i].msg_hdr.msg_iovlen = 1;
+            d->msgs[i].msg_hdr.msg_name = &d->from[i];
+            d->msgs[i].msg_hdr.msg_namelen = sizeof(d->from[i]);
+        }
+        int n = recvmmsg(d->sock, d->msgs, RECV_BATCH, MSG_DONTWAIT, NULL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        int64_t now = now_ms();
+        struct mmsghdr replies[RECV_BATCH];
+        struct iovec reply_iov = { d->response, d->response_len };
+        unsigned replies_len = 0;
+        for (int i = 0; i < n; i++) {
+            struct msghdr* h = &d->msgs[i].msg_hdr;
+            if ((h->msg_flags & MSG_TRUNC) || h->msg_namelen < sizeof(struct sockaddr_in)) continue;
+            if (!handle_frame(d, d->bufs[i], d->msgs[i].msg_len, &d->from[i], now)) continue;
+            struct msghdr* r = &replies[replies_len++].msg_hdr;
+            memset(r, 0, sizeof(*r));
+            r->msg_name = &d->from[i];
+            r->msg_namelen = sizeof(d->from[i]);
+            r->msg_iov = &reply_iov;
+            r->msg_iovlen = 1;
+        }
+        if (replies_len > 0) sendmmsg(d->sock, replies, replies_len, MSG_NOSIGNAL);
+        if (n < RECV_BATCH) return;
+    }
+}
+
+/* Drop peers not heard from for PEER_TIMEOUT_MS; their chunks are re-assigned through pea_core_peer_left. */
+static void expire_peers(pea_discovery* d) {
+    drain_timer(d->timeout_fd);
+    int64_t now = now_ms();
+    size_t i = 0;
+    while (i < d->peers_len) {
+        if (now - d->peers[i].last_seen_ms < PEER_TIMEOUT_MS) {
+            i++;
+            continue;
+        }
+        uint8_t id[16];
+        memcpy(id, d->peers[i].device_id, 16);
+        d->peers[i] = d->peers[--d->peers_len];
+        size_t n = core_output(d, pea_core_peer_left(d->core, id, d->scratch, d->scratch_cap));
+        if (d->cb.on_peer_left) d->cb.on_peer_left(d->cb_ctx, id, d->scratch, n);
+        shrink_scratch(d);
+    }
+}
+
+static void* discovery_main(void* arg) {
+    pea_discovery* d = arg;
+    if (d->cb.on_thread_start) d->cb.on_thread_start(d->cb_ctx);
+    struct epoll_event events[MAX_EVENTS];
+    while (atomic_load(&d->running)) {
+        int n = epoll_wait(d->epfd, events, MAX_EVENTS, -1);
+        for (int i = 0; i < n && atomic_load(&d->running); i++) {
+            void* p = events[i].data.ptr;
+            if (p == &d->sock)
+                recv_all(d);
+            else if (p == &d->beacon_fd)
+                send_beacon(d);
+            else if (p == &d->timeout_fd)
+                expire_peers(d);
+        }
+    }
+    if (d->cb.on_thread_exit) d->cb.on_thread_exit(d->cb_ctx);
+    return NULL;
+}
+
+static int open_socket(void) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in a4;
+    memset(&a4, 0, sizeof(a4));
+    a4.sin_family = AF_INET;
+    a4.sin_addr.s_addr = htonl(INADDR_ANY);
+    a4.sin_port = htons(DISCOVERY_PORT);
+    struct ip_mreq mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    inet_pton(AF_INET, MULTICAST_GROUP, &mreq.imr_multiaddr);
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (struct sockaddr*)&a4, sizeof(a4)) == 0
+        && setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == 0)
+        return fd;
+    close(fd);
+    return -1;
+}
+
+static int epoll_add_ptr(int epfd, int fd, void* ptr) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = ptr;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/* Frames are fixed for the session (device id, key and listen port do not change), so they are built once. */
+static int build_frames(pea_discovery* d, uint16_t listen_port) {
+    int b = pea_core_beacon_frame(d->core, listen_port, d->beacon, sizeof(d->beacon));
+    int r = pea_core_discovery_response_frame(d->core, listen_port, d->response, sizeof(d->response));
+    if (b <= 0 || r <= 0 || pea_core_device_id(d->core, d->device_id, 16) != 0) return -1;
+    d->beacon_len = (size_t)b;
+    d->response_len = (size_t)r;
+    return 0;
+}
+
+pea_discovery* pea_discovery_start(void* core, uint16_t listen_port, int throttle, const pea_discovery_callbacks* cb,
+    void* ctx) {
+    if (!core) return NULL;
+    pea_discovery* d = calloc(1, sizeof(*d));
+    if (!d) return NULL;
+    d->core = core;
+    if (cb) d->cb = *cb;
+    d->cb_ctx = ctx;
+    atomic_init(&d->running, 1);
+    atomic_init(&d->throttle, throttle ? 1 : 0);
+    d->epfd = epoll_create1(EPOLL_CLOEXEC);
+    d->sock = open_socket();
+    d->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    d->beacon_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    d->timeout_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    d->scratch = malloc(SCRATCH_SIZE);
+    d->scratch_cap = SCRATCH_SIZE;
+    /* First beacon right away, then every interval; the timeout check runs on its own period. */
+    if (d->beacon_fd >= 0) arm_timer(d->beacon_fd, 0, 0);
+    if (d->timeout_fd >= 0) arm_timer(d->timeout_fd, TIMEOUT_CHECK_MS, TIMEOUT_CHECK_MS);
+    if (!d->scratch || d->epfd < 0 || d->sock < 0 || d->wake_fd < 0 || d->beacon_fd < 0 || d->timeout_fd < 0
+        || build_frames(d, listen_port) != 0
+        || epoll_add_ptr(d->epfd, d->sock, &d->sock) != 0
+        || epoll_add_ptr(d->epfd, d->wake_fd, &d->wake_fd) != 0
+        || epoll_add_ptr(d->epfd, d->beacon_fd, &d->beacon_fd) != 0
+        || epoll_add_ptr(d->epfd, d->timeout_fd, &d->timeout_fd) != 0
+        || pthread_create(&d->thread, NULL, discovery_main, d) != 0) {
+        if (d->epfd >= 0) close(d->epfd);
+        if (d->sock >= 0) close(d->sock);
+        if (d->wake_fd >= 0) close(d->wake_fd);
+        if (d->beacon_fd >= 0) close(d->beacon_fd);
+        if (d->timeout_fd >= 0) close(d->timeout_fd);
+        free(d->scratch);
+        free(d);
+        return NULL;
+    }
+    return d;
+}
+
+void pea_discovery_stop(pea_discovery* d) {
+    if (!d) return;
+    atomic_store(&d->running, 0);
+    uint64_t one = 1;
+    while (write(d->wake_fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+    pthread_join(d->thread, NULL);
+    close(d->sock);
+    close(d->wake_fd);
+    close(d->beacon_fd);
+    close(d->timeout_fd);
+    close(d->epfd);
+    free(d->peers);
+    free(d->scratch);
+    free(d);
+}
+
+void pea_discovery_set_throttle(pea_discovery* d, int throttle) {
+    if (d) atomic_store(&d->throttle, throttle ? 1 : 0);
+}
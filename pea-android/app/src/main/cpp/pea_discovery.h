@@ -0,0 +1,38 @@
+/* Native LAN discovery: one thread owns the UDP multicast socket (239.255.60.60:45678).
+ * Datagrams are read in recvmmsg batches and decoded in place; a table of known device ids means a repeat beacon
+ * only refreshes its timestamp and never reaches the host. A peer seen for the first time (or with a new address,
+ * port or key) is answered with a DiscoveryResponse, one sendmmsg per batch. Beacons go out on a timerfd and a
+ * second timerfd expires silent peers, so the host only hears join/leave transitions. */
+#ifndef PEA_DISCOVERY_H
+#define PEA_DISCOVERY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct pea_discovery pea_discovery;
+
+/* Called on the discovery thread. Any may be NULL. */
+typedef struct pea_discovery_callbacks {
+    /* First and last thing the discovery thread does (e.g. attach to / detach from the JVM). */
+    void (*on_thread_start)(void* ctx);
+    void (*on_thread_exit)(void* ctx);
+    /* New peer; pea_core_peer_joined has already run. addr is 4 bytes (IPv4), port its transport listen port. */
+    void (*on_peer_joined)(void* ctx, const uint8_t* device_id_16, const uint8_t* public_key_32,
+        const uint8_t* addr, size_t addr_len, uint16_t port);
+    /* No beacon for the peer timeout; pea_core_peer_left has already run. actions (pea-core layout, the
+     * ChunkRequests re-assigning its chunks) are valid for the call only; actions_len is 0 if there are none. */
+    void (*on_peer_left)(void* ctx, const uint8_t* device_id_16, const uint8_t* actions, size_t actions_len);
+} pea_discovery_callbacks;
+
+/* Join the multicast group and start the discovery thread, advertising listen_port (local transport).
+ * core is a pea_core handle. throttle selects the long beacon interval. NULL on failure. */
+pea_discovery* pea_discovery_start(void* core, uint16_t listen_port, int throttle, const pea_discovery_callbacks* cb,
+    void* ctx);
+
+/* Stop the thread, close the socket and free d. Known peers are forgotten without pea_core_peer_left. */
+void pea_discovery_stop(pea_discovery* d);
+
+/* Beacon every 12 s instead of 4 s (battery saver). Applies from the next beacon; any thread. */
+void pea_discovery_set_throttle(pea_discovery* d, int throttle);
+
+#endif
@@ -0,0 +1,165 @@
+/* Native event queue (see pea_events.h): per-source SPSC rings, released with C11 atomics, plus one eventfd. */
+#include "pea_events.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/* Per source; the engines post a few events per peer, so this only fills if nobody polls. */
+#define RING_SLOTS 256
+#define FIXED_MAX 64
+#define RECORD_HEADER 5
+
+struct slot {
+    uint8_t type;
+    uint8_t fixed_len;
+    uint8_t fixed[FIXED_MAX];
+    uint8_t* data;
+    size_t data_len;
+};
+
+/* head is written only by the consumer, tail only by the producer; both count up and wrap with the slot mask. */
+struct ring {
+    struct slot slots[RING_SLOTS];
+    atomic_size_t head;
+    atomic_size_t tail;
+    atomic_uint dropped;
+};
+
+struct pea_events {
+    struct ring rings[PEA_EVENT_SOURCES];
+    int wake_fd;
+    atomic_int woken;
+};
+
+pea_events* pea_events_create(void) {
+    pea_events* q = calloc(1, sizeof(*q));
+    if (!q) return NULL;
+    for (int i = 0; i < PEA_EVENT_SOURCES; i++) {
+        atomic_init(&q->rings[i].head, 0);
+        atomic_init(&q->rings[i].tail, 0);
+        atomic_init(&q->rings[i].dropped, 0);
+    }
+    atomic_init(&q->woken, 0);
+    q->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (q->wake_fd < 0) {
+        free(q);
+        return NULL;
+    }
+    return q;
+}
+
+void pea_events_destroy(pea_events* q) {
+    if (!q) return;
+    for (int i = 0; i < PEA_EVENT_SOURCES; i++) {
+        struct ring* r = &q->rings[i];
+        for (size_t h = atomic_load(&r->head); h != atomic_load(&r->tail); h++) free(r->slots[h % RING_SLOTS].data);
+    }
+    close(q->wake_fd);
+    free(q);
+}
+
+static void signal_fd(pea_events* q) {
+    uint64_t one = 1;
+    while (write(q->wake_fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+}
+
+int pea_events_post(pea_events* q, int source, uint8_t type, const uint8_t* fixed, size_t fixed_len,
+    const uint8_t* data, size_t data_len) {
+    if (!q || source < 0 || source >= PEA_EVENT_SOURCES || fixed_len > FIXED_MAX || (fixed_len && !fixed)
+        || (data_len && !data) || data_len > UINT32_MAX - FIXED_MAX) {
+        return -1;
+    }
+    struct ring* r = &q->rings[source];
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint8_t* copy = NULL;
+    if (tail - atomic_load_explicit(&r->head, memory_order_acquire) == RING_SLOTS
+        || (data_len > 0 && !(copy = malloc(data_len)))) {
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+        signal_fd(q);
+        return -1;
+    }
+    struct slot* s = &r->slots[tail % RING_SLOTS];
+    s->type = type;
+    s->fixed_len = (uint8_t)fixed_len;
+    if (fixed_len) memcpy(s->fixed, fixed, fixed_len);
+    if (data_len) memcpy(copy, data, data_len);
+    s->data = copy;
+    s->data_len = data_len;
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    /* Every post signals: a check for "was empty" would race the consumer's drain, and events are infrequent. */
+    signal_fd(q);
+    return 0;
+}
+
+static void put_le32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+/* Copy records from every ring while they fit. Returns bytes written, or -needed if the very first does not fit. */
+static int drain(pea_events* q, uint8_t* out, size_t out_len) {
+    size_t off = 0;
+    for (int i = 0; i < PEA_EVENT_SOURCES; i++) {
+        struct ring* r = &q->rings[i];
+        unsigned dropped = atomic_exchange_explicit(&r->dropped, 0, memory_order_relaxed);
+        if (dropped > 0) {
+            if (out_len - off < RECORD_HEADER + 4) {
+                atomic_fetch_add_explicit(&r->dropped, dropped, memory_order_relaxed);
+                return off > 0 ? (int)off : -(RECORD_HEADER + 4);
+            }
+            put_le32(out + off, 4);
+            out[off + 4] = PEA_EVENT_DROPPED;
+            put_le32(out + off + RECORD_HEADER, dropped);
+            off += RECORD_HEADER + 4;
+        }
+        size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+        while (head != atomic_load_explicit(&r->tail, memory_order_acquire)) {
+            struct slot* s = &r->slots[head % RING_SLOTS];
+            size_t payload = s->fixed_len + s->data_len;
+            if (out_len - off < RECORD_HEADER + payload) {
+                if (off > 0) return (int)off;
+                size_t need = RECORD_HEADER + payload;
+                return need > INT32_MAX ? -1 : -(int)(need < 3 ? 3 : need);
+            }
+            put_le32(out + off, (uint32_t)payload);
+            out[off + 4] = s->type;
+            memcpy(out + off + RECORD_HEADER, s->fixed, s->fixed_len);
+            if (s->data_len) memcpy(out + off + RECORD_HEADER + s->fixed_len, s->data, s->data_len);
+            off += RECORD_HEADER + payload;
+            free(s->data);
+            s->data = NULL;
+            atomic_store_explicit(&r->head, ++head, memory_order_release);
+        }
+    }
+    return (int)off;
+}
+
+int pea_events_poll(pea_events* q, uint8_t* out, size_t out_len, int timeout_ms) {
+    if (!q || (!out && out_len > 0) || out_len > INT32_MAX) return -1;
+    for (;;) {
+        /* Clear the eventfd first so a post racing the drain below still leaves it readable. */
+        uint64_t n;
+        while (read(q->wake_fd, &n, sizeof(n)) < 0 && errno == EINTR) {}
+        int r = drain(q, out, out_len);
+        if (r != 0) return r;
+        if (atomic_exchange(&q->woken, 0) || timeout_ms == 0) return 0;
+        struct pollfd p = { q->wake_fd, POLLIN, 0 };
+        int ready = poll(&p, 1, timeout_ms);
+        if (ready < 0 && errno != EINTR) return -1;
+        /* One more drain after a timeout, then report it. */
+        if (ready == 0) timeout_ms = 0;
+    }
+}
+
+void pea_events_wake(pea_events* q) {
+    if (!q) return;
+    atomic_store(&q->woken, 1);
+    signal_fd(q);
+}
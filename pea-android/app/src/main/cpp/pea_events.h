@@ -0,0 +1,49 @@
+/* Native event queue: the engine threads (transport, discovery) post peer events and completed bodies here
+ * instead of calling into Java, so a slow consumer never stalls an epoll loop. Each source has its own
+ * single-producer/single-consumer ring of fixed slots; a full ring drops the event and counts it rather than block.
+ * One consumer thread drains every ring in batches with pea_events_poll, sleeping on an eventfd when all are empty. */
+#ifndef PEA_EVENTS_H
+#define PEA_EVENTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Producers: exactly one thread may post per source. */
+enum {
+    PEA_EVENT_SOURCE_TRANSPORT,
+    PEA_EVENT_SOURCE_DISCOVERY,
+    PEA_EVENT_SOURCES,
+};
+
+/* Record types in pea_events_poll output; payload layouts after each name. */
+enum {
+    PEA_EVENT_PEER_CONNECTED = 1, /* 16 peer_id */
+    PEA_EVENT_PEER_DISCONNECTED = 2, /* 16 peer_id */
+    PEA_EVENT_TRANSFER_COMPLETE = 3, /* body */
+    PEA_EVENT_PEER_JOINED = 4, /* 16 device_id, 32 public_key, 2 port LE, addr (4 or 16) */
+    PEA_EVENT_PEER_LEFT = 5, /* 16 device_id, re-request actions (pea_core_tick layout; empty if none) */
+    PEA_EVENT_DROPPED = 6, /* 4 count LE: events a full ring dropped since the last poll */
+};
+
+typedef struct pea_events pea_events;
+
+/* NULL on failure. */
+pea_events* pea_events_create(void);
+
+/* Free the queue and any events not yet polled. No thread may be posting or polling. */
+void pea_events_destroy(pea_events* q);
+
+/* Post an event; fixed is copied into the slot (at most 64 bytes), data (a body or actions) into its own buffer.
+ * Returns 0, or -1 when the ring is full or memory is short (the event is dropped and counted). */
+int pea_events_post(pea_events* q, int source, uint8_t type, const uint8_t* fixed, size_t fixed_len,
+    const uint8_t* data, size_t data_len);
+
+/* Drain events into out as records (4 payload length LE, 1 type, payload), oldest first per source. Waits up to
+ * timeout_ms (-1 forever) while every ring is empty. Returns bytes written, 0 on timeout or pea_events_wake,
+ * -needed (PEA_CORE_NEEDED) when out cannot hold even the next record (it stays queued), -1 on error. */
+int pea_events_poll(pea_events* q, uint8_t* out, size_t out_len, int timeout_ms);
+
+/* Make a waiting pea_events_poll return (e.g. to stop the consumer thread). */
+void pea_events_wake(pea_events* q);
+
+#endif
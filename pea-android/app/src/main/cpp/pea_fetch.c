@@ -0,0 +1,473 @@
+/* Native origin fetcher (see pea_fetch.h). Each call runs on the caller's thread (a LocalProxy handler);
+ * only the idle pool is shared, under a mutex. */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* clock_gettime and getaddrinfo under -std=c11 */
+#endif
+#include "pea_fetch.h"
+
+#include "pea_bufpool.h"
+#include "pea_core_ffi.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HOST_MAX 256
+/* Idle connections kept across all origins, and per origin. */
+#define IDLE_MAX 16
+#define IDLE_PER_ORIGIN 4
+/* Origins commonly close keep-alive connections after 5-60 s; a connection idle longer is not reused. */
+#define IDLE_TIMEOUT_MS 15000
+#define CONNECT_TIMEOUT_MS 10000
+#define IO_TIMEOUT_S 30
+/* Batches in a row the origin may fail outright before a fetch gives up, and the wait after the first failure
+ * (doubled after each further one). */
+#define ORIGIN_TRIES 4
+#define RETRY_BACKOFF_MS 200
+/* Response headers plus whatever body bytes arrive with them. */
+#define HEAD_MAX 16384
+#define REQUEST_MAX 4096
+/* Longest ETag / Last-Modified value reported to the core's chunk cache; longer ones are not reported. */
+#define VALIDATOR_MAX 256
+
+struct idle_conn {
+    char host[HOST_MAX];
+    uint16_t port;
+    int fd;
+    int64_t since_ms;
+};
+
+struct pea_fetch {
+    pthread_mutex_t lock;
+    struct idle_conn idle[IDLE_MAX];
+    size_t idle_len;
+};
+
+/* One connection for the duration of a batch; buf holds bytes read past the current position. */
+struct conn {
+    int fd;
+    int reused;
+    uint8_t buf[HEAD_MAX];
+    size_t off, len;
+};
+
+struct range {
+    uint64_t start, end;
+};
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Split "name[:port]" or "[v6][:port]" into name and port (default 80). Returns 0 on success. */
+static int split_host(const char* host, char* name, uint16_t* port) {
+    const char* colon;
+    const char* name_start = host;
+    size_t name_len;
+    if (host[0] == '[') {
+        const char* close_br = strchr(host, ']');
+        if (!close_br) return -1;
+        name_start = host + 1;
+        name_len = (size_t)(close_br - name_start);
+        colon = close_br[1] == ':' ? close_br + 1 : NULL;
+    } else {
+        colon = strchr(host, ':');
+        if (colon && strchr(colon + 1, ':')) colon = NULL;
+        name_len = colon ? (size_t)(colon - host) : strlen(host);
+    }
+    if (name_len == 0 || name_len >= HOST_MAX) return -1;
+    memcpy(name, name_start, name_len);
+    name[name_len] = '\0';
+    *port = 80;
+    if (colon) {
+        char* endp;
+        long p = strtol(colon + 1, &endp, 10);
+        if (*endp != '\0' || p <= 0 || p > 65535) return -1;
+        *port = (uint16_t)p;
+    }
+    return 0;
+}
+
+/* A pooled connection to name:port that has not idled out, else -1. Expired ones are closed on the way. */
+static int pool_take(pea_fetch* f, const char* name, uint16_t port) {
+    int fd = -1;
+    int64_t now = now_ms();
+    pthread_mutex_lock(&f->lock);
+    for (size_t i = f->idle_len; i-- > 0;) {
+        struct idle_conn* c = &f->idle[i];
+        int expired = now - c->since_ms > IDLE_TIMEOUT_MS;
+        if (!expired && (fd >= 0 || c->port != port || strcmp(c->host, name) != 0)) continue;
+        if (expired) close(c->fd);
+        else fd = c->fd;
+        f->idle[i] = f->idle[--f->idle_len];
+    }
+    pthread_mutex_unlock(&f->lock);
+    return fd;
+}
+
+/* Keep fd for reuse, or close it if the origin or the pool is full. */
+static void pool_put(pea_fetch* f, const char* name, uint16_t port, int fd) {
+    size_t same = 0;
+    pthread_mutex_lock(&f->lock);
+    for (size_t i = 0; i < f->idle_len; i++) {
+        if (f->idle[i].port == port && strcmp(f->idle[i].host, name) == 0) same++;
+    }
+    if (same < IDLE_PER_ORIGIN && f->idle_len < IDLE_MAX) {
+        struct idle_conn* c = &f->idle[f->idle_len++];
+        strcpy(c->host, name);
+        c->port = port;
+        c->fd = fd;
+        c->since_ms = now_ms();
+        fd = -1;
+    }
+    pthread_mutex_unlock(&f->lock);
+    if (fd >= 0) close(fd);
+}
+
+/* Non-blocking connect with a timeout, then blocking I/O with IO_TIMEOUT_S timeouts. */
+static int connect_one(const struct addrinfo* ai, pea_fetch_protect_fn protect, void* protect_ctx) {
+    int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+    if (fd < 0) return -1;
+    if (protect && protect(protect_ctx, fd) != 0) {
+        close(fd);
+        return -1;
+    }
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+        close(fd);
+        return -1;
+    }
+    int r = connect(fd, ai->ai_addr, ai->ai_addrlen);
+    if (r != 0 && errno == EINPROGRESS) {
+        struct pollfd p = { fd, POLLOUT, 0 };
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+        while ((r = poll(&p, 1, CONNECT_TIMEOUT_MS)) < 0 && errno == EINTR) {}
+        r = r == 1 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) == 0 && err == 0 ? 0 : -1;
+    }
+    struct timeval tv = { IO_TIMEOUT_S, 0 };
+    int one = 1;
+    if (r != 0 || fcntl(fd, F_SETFL, flags) != 0 || setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0
+        || setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0) {
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    return fd;
+}
+
+static int connect_origin(const char* name, uint16_t port, pea_fetch_protect_fn protect, void* protect_ctx) {
+    struct addrinfo hints, *res = NULL;
+    char service[8];
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%u", (unsigned)port);
+    if (getaddrinfo(name, service, &hints, &res) != 0) return -1;
+    int fd = -1;
+    for (const struct addrinfo* ai = res; ai && fd < 0; ai = ai->ai_next) fd = connect_one(ai, protect, protect_ctx);
+    freeaddrinfo(res);
+    return fd;
+}
+
+static int send_all(int fd, const char* p, size_t len) {
+    while (len > 0) {
+        ssize_t w = send(fd, p, len, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        p += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+/* Case-insensitive header match at the start of line; returns the value with leading spaces skipped, or NULL. */
+static const char* header_value(const char* line, const char* name) {
+    size_t n = strlen(name);
+    if (strncasecmp(line, name, n) != 0 || line[n] != ':') return NULL;
+    line += n + 1;
+    while (*line == ' ' || *line == '\t') line++;
+    return line;
+}
+
+/* Copy a header value (up to the line end) into out; "" if it does not fit. */
+static void copy_value(char* out, size_t cap, const char* v) {
+    size_t n = strcspn(v, "\r\n");
+    if (n >= cap) n = 0;
+    memcpy(out, v, n);
+    out[n] = '\0';
+}
+
+/* Read one response head. *out_length gets Content-Length, or UINT64_MAX when there is none or the body is chunked
+ * (not worth decoding here), *out_close whether the origin closes after this response, out_validator (VALIDATOR_MAX
+ * bytes, or NULL) its ETag, else Last-Modified, else "". Returns the status code, or -1 on I/O or parse failure. Leftover
+ * bytes stay in c. */
+static int read_head(struct conn* c, uint64_t* out_length, int* out_close, char* out_validator) {
+    char* head;
+    char* head_end;
+    for (;;) {
+        head = (char*)c->buf + c->off;
+        if (c->len > c->off) {
+            /* buf is never full when searched, so the terminator below stays in bounds. */
+            c->buf[c->len] = '\0';
+            head_end = strstr(head, "\r\n\r\n");
+            if (head_end) break;
+        }
+        if (c->off > 0) {
+            memmove(c->buf, c->buf + c->off, c->len - c->off);
+            c->len -= c->off;
+            c->off = 0;
+        }
+        if (c->len + 1 >= sizeof(c->buf)) return -1;
+        ssize_t r = recv(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        c->len += (size_t)r;
+    }
+    head_end[2] = '\0';
+    c->off = (size_t)(head_end + 4 - (char*)c->buf);
+    int minor, status;
+    if (sscanf(head, "HTTP/1.%d %d", &minor, &status) != 2) return -1;
+    int chunked = 0, etag = 0;
+    *out_length = UINT64_MAX;
+    *out_close = minor == 0;
+    if (out_validator) out_validator[0] = '\0';
+    for (char* line = strstr(head, "\r\n"); line && line[2] != '\0'; line = strstr(line + 2, "\r\n")) {
+        const char* v;
+        if ((v = header_value(line + 2, "Content-Length"))) {
+            char* endp;
+            unsigned long long n = strtoull(v, &endp, 10);
+            if (endp == v) return -1;
+            *out_length = n;
+        } else if ((v = header_value(line + 2, "Connection"))) {
+            *out_close = strncasecmp(v, "close", 5) == 0;
+        } else if (header_value(line + 2, "Transfer-Encoding")) {
+            chunked = 1;
+        } else if (out_validator && (v = header_value(line + 2, "ETag"))) {
+            copy_value(out_validator, VALIDATOR_MAX, v);
+            etag = 1;
+        } else if (out_validator && !etag && (v = header_value(line + 2, "Last-Modified"))) {
+            copy_value(out_validator, VALIDATOR_MAX, v);
+        }
+    }
+    if (chunked) *out_length = UINT64_MAX;
+    return status;
+}
+
+/* len body bytes into dst: what read_head buffered first, then straight from the socket. */
+static int read_body(struct conn* c, uint8_t* dst, size_t len) {
+    size_t have = c->len - c->off;
+    if (have > len) have = len;
+    memcpy(dst, c->buf + c->off, have);
+    c->off += have;
+    while (have < len) {
+        ssize_t r = recv(c->fd, dst + have, len - have, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        have += (size_t)r;
+    }
+    return 0;
+}
+
+/* Discard a response body so the connection can be reused; one larger than the head buffer is not worth reading. */
+static int skip_body(struct conn* c, uint64_t len) {
+    uint8_t discard[HEAD_MAX];
+    if (len > sizeof(discard)) return -1;
+    return read_body(c, discard, (size_t)len);
+}
+
+/* Fetch the claimed chunks (ascending, as the core hands them out) over one connection: contiguous ones form a run
+ * fetched with one Range request, and all runs' requests are sent before the first response is read.
+ * Returns 1 or -1 from the core as in pea_fetch_self_chunks, 0 otherwise; *out_delivered gets the chunks handed
+ * to the core, so an origin failure shows as fewer than n. */
+static int fetch_batch(pea_fetch* f, void* core, const uint8_t* tid, const char* host, const char* name,
+    uint16_t port, const char* path, uint64_t base, const struct range* chunks, size_t n,
+    pea_fetch_protect_fn protect, void* protect_ctx, size_t* out_delivered) {
+    struct range runs[PEA_FETCH_DEPTH];
+    size_t run_first[PEA_FETCH_DEPTH + 1];
+    size_t runs_len = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (runs_len > 0 && runs[runs_len - 1].end == chunks[i].start) {
+            runs[runs_len - 1].end = chunks[i].end;
+            continue;
+        }
+        run_first[runs_len] = i;
+        runs[runs_len++] = chunks[i];
+    }
+    run_first[runs_len] = n;
+    *out_delivered = 0;
+
+    char request[REQUEST_MAX * PEA_FETCH_DEPTH];
+    size_t request_len = 0;
+    for (size_t i = 0; i < runs_len; i++) {
+        int w = snprintf(request + request_len, sizeof(request) - request_len,
+            "GET %s HTTP/1.1\r\nHost: %s\r\nRange: bytes=%llu-%llu\r\nAccept-Encoding: identity\r\n\r\n", path, host,
+            (unsigned long long)(base + runs[i].start), (unsigned long long)(base + runs[i].end - 1));
+        if (w < 0 || (size_t)w >= sizeof(request) - request_len) return 0;
+        request_len += (size_t)w;
+    }
+
+    struct conn* c = malloc(sizeof(*c));
+    if (!c) return 0;
+    size_t delivered = 0;
+    int result = 0;
+    for (int attempt = 0; attempt < 2 && delivered == 0; attempt++) {
+        c->off = c->len = 0;
+        c->fd = attempt == 0 ? pool_take(f, name, port) : -1;
+        c->reused = c->fd >= 0;
+        if (c->fd < 0) c->fd = connect_origin(name, port, protect, protect_ctx);
+        if (c->fd < 0) break;
+        int ok = send_all(c->fd, request, request_len) == 0;
+        int responded = 0, closing = 0;
+        for (size_t r = 0; ok && r < runs_len && result == 0; r++) {
+            uint64_t length = 0;
+            char validator[VALIDATOR_MAX];
+            int status = read_head(c, &length, &closing, validator);
+            responded |= status >= 0;
+            if (status != 206 || length != runs[r].end - runs[r].start) {
+                ok = 0;
+                break;
+            }
+            /* Before the chunks go in: cached ranges from an older version of the resource are dropped. */
+            if (validator[0]) {
+                pea_core_set_transfer_validator(core, tid, (const uint8_t*)validator, strlen(validator));
+            }
+            for (size_t i = run_first[r]; i < run_first[r + 1]; i++) {
+                size_t len = (size_t)(chunks[i].end - chunks[i].start);
+                size_t cap;
+                uint8_t* slab = pea_bufpool_acquire(len, &cap);
+                if (!slab || read_body(c, slab, len) != 0) {
+                    pea_bufpool_release(slab);
+                    ok = 0;
+                    break;
+                }
+                int rc = pea_core_on_chunk_received(core, tid, chunks[i].start, chunks[i].end, NULL, slab, len, NULL, 0);
+                pea_bufpool_release(slab);
+                delivered++;
+                if (rc == 1 || rc == -1) {
+                    /* Later responses may still be in flight; only pool the connection once all were read. */
+                    result = rc;
+                    ok = rc == 1 && i + 1 == n;
+                    break;
+                }
+            }
+        }
+        if (ok && !closing) pool_put(f, name, port, c->fd);
+        else close(c->fd);
+        /* A pooled connection the origin closed in the meantime fails before any response; retry it fresh once. */
+        if (ok || responded || !c->reused) break;
+    }
+    free(c);
+    *out_delivered = delivered;
+    return result;
+}
+
+pea_fetch* pea_fetch_create(void) {
+    pea_fetch* f = calloc(1, sizeof(*f));
+    if (!f) return NULL;
+    if (pthread_mutex_init(&f->lock, NULL) != 0) {
+        free(f);
+        return NULL;
+    }
+    return f;
+}
+
+void pea_fetch_destroy(pea_fetch* f) {
+    if (!f) return;
+    for (size_t i = 0; i < f->idle_len; i++) close(f->idle[i].fd);
+    pthread_mutex_destroy(&f->lock);
+    free(f);
+}
+
+int pea_fetch_self_chunks(pea_fetch* f, void* core, const uint8_t* transfer_id_16, const char* host, const char* path,
+    uint64_t base, pea_fetch_protect_fn protect, void* protect_ctx) {
+    char name[HOST_MAX];
+    uint16_t port;
+    if (!f || !core || !transfer_id_16 || !host || !path || split_host(host, name, &port) != 0) return 0;
+    if (strlen(host) + strlen(path) > REQUEST_MAX - 128) return 0;
+    int failures = 0;
+    for (;;) {
+        /* Each pull releases what self still holds (including the assigned chunk) and claims it again first. */
+        uint64_t ranges[2 * PEA_FETCH_DEPTH];
+        struct range claimed[PEA_FETCH_DEPTH];
+        int n = pea_core_next_self_chunks(core, transfer_id_16, ranges, PEA_FETCH_DEPTH);
+        if (n <= 0) return 0;
+        size_t m = 0;
+        for (int i = 0; i < n; i++) {
+            /* Ranges fetched before (by this device or for a peer) come from the core's chunk cache. */
+            int c = pea_core_receive_cached_chunk(core, transfer_id_16, ranges[2 * i], ranges[2 * i + 1], NULL, 0);
+            if (c == 1 || c == -1) return c;
+            if (c == 2) claimed[m++] = (struct range){ ranges[2 * i], ranges[2 * i + 1] };
+        }
+        if (m == 0) continue;
+        size_t delivered;
+        int r = fetch_batch(f, core, transfer_id_16, host, name, port, path, base, claimed, m, protect,
+            protect_ctx, &delivered);
+        if (r != 0) return r;
+        if (delivered > 0) {
+            failures = 0;
+            continue;
+        }
+        /* Nothing came back: the next pull hands the same chunks out again, so wait first, and stop eventually. */
+        if (++failures >= ORIGIN_TRIES) return PEA_FETCH_ORIGIN_FAILED;
+        int64_t wait_ms = (int64_t)RETRY_BACKOFF_MS << (failures - 1);
+        struct timespec ts = { (time_t)(wait_ms / 1000), (long)(wait_ms % 1000) * 1000000 };
+        while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+    }
+}
+
+int pea_fetch_put_range(pea_fetch* f, const char* host, const char* path, uint64_t start, uint64_t end,
+    uint64_t total, const uint8_t* data, pea_fetch_protect_fn protect, void* protect_ctx) {
+    char name[HOST_MAX];
+    uint16_t port;
+    if (!f || !host || !path || !data || end <= start || end > total || split_host(host, name, &port) != 0) return -1;
+    if (strlen(host) + strlen(path) > REQUEST_MAX - 192) return -1;
+    char head[REQUEST_MAX];
+    int head_len = snprintf(head, sizeof(head),
+        "PUT %s HTTP/1.1\r\nHost: %s\r\nContent-Range: bytes %llu-%llu/%llu\r\nContent-Length: %llu\r\n\r\n", path, host,
+        (unsigned long long)start, (unsigned long long)(end - 1), (unsigned long long)total,
+        (unsigned long long)(end - start));
+    if (head_len < 0 || (size_t)head_len >= sizeof(head)) return -1;
+    struct conn* c = malloc(sizeof(*c));
+    if (!c) return -1;
+    int result = -1;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        c->off = c->len = 0;
+        c->fd = attempt == 0 ? pool_take(f, name, port) : -1;
+        c->reused = c->fd >= 0;
+        if (c->fd < 0) c->fd = connect_origin(name, port, protect, protect_ctx);
+        if (c->fd < 0) break;
+        uint64_t length = 0;
+        int closing = 0;
+        int status = send_all(c->fd, head, (size_t)head_len) == 0
+                && send_all(c->fd, (const char*)data, (size_t)(end - start)) == 0
+            ? read_head(c, &length, &closing, NULL)
+            : -1;
+        /* 308 is how resumable-upload origins accept a part short of the last one. */
+        if (status / 100 == 2 || status == 308) result = 0;
+        if (status == 204 || status == 304) length = 0;
+        if (status >= 0 && !closing && skip_body(c, length) == 0) pool_put(f, name, port, c->fd);
+        else close(c->fd);
+        /* A PUT is idempotent, so a pooled connection that failed before any response is retried fresh once. */
+        if (status >= 0 || !c->reused) break;
+    }
+    free(c);
+    return result;
+}
@@ -0,0 +1,43 @@
+/* Native origin fetcher: pulls this device's chunks of a transfer over HTTP/1.1 and feeds each one to
+ * pea_core_on_chunk_received without a Java round trip. Idle connections are pooled per origin (host, port), so
+ * a chunk costs a request rather than a TCP handshake. Up to PEA_FETCH_DEPTH self chunks are claimed at once:
+ * adjacent ones are coalesced into one Range request, separate runs are pipelined on the same connection, and
+ * every body is read straight into a pooled chunk buffer (pea_bufpool). Upload parts (pea_upload.c) go out over the
+ * same pool with pea_fetch_put_range. Plain HTTP only, like LocalProxy. */
+#ifndef PEA_FETCH_H
+#define PEA_FETCH_H
+
+#include <stdint.h>
+
+#define PEA_FETCH_DEPTH 4
+/* pea_fetch_self_chunks: the origin kept failing (see there). */
+#define PEA_FETCH_ORIGIN_FAILED (-2)
+
+typedef struct pea_fetch pea_fetch;
+
+/* Called with every new socket before connect (VpnService.protect, so origin traffic bypasses the tunnel).
+ * Returns 0 on success; the socket is closed otherwise. */
+typedef int (*pea_fetch_protect_fn)(void* ctx, int fd);
+
+/* Thread-safe; one fetcher can serve every transfer. NULL on failure. */
+pea_fetch* pea_fetch_create(void);
+
+/* Close pooled connections and free f. No fetch may be running. */
+void pea_fetch_destroy(pea_fetch* f);
+
+/* Fetch the host's chunks of transfer_id from origin host ("name[:port]", the Host header) and path, pulling up to
+ * PEA_FETCH_DEPTH at a time with pea_core_next_self_chunks until none is left. Chunk offsets are relative to base
+ * (the client's range start). A batch the origin fails to deliver (no connection, no 206, a wrong length) is
+ * claimed again after a back-off; after a few such batches in a row without a chunk delivered, the fetch gives up.
+ * Returns 1 when the transfer completed, 0 when no self chunk is left to claim (peers' chunks may still be in
+ * flight, and chunks they drop come back to the pool for another call), -1 when the core rejected a chunk or the
+ * sink failed, PEA_FETCH_ORIGIN_FAILED when the origin kept failing (the transfer cannot complete). */
+int pea_fetch_self_chunks(pea_fetch* f, void* core, const uint8_t* transfer_id_16, const char* host, const char* path,
+    uint64_t base, pea_fetch_protect_fn protect, void* protect_ctx);
+
+/* PUT data, bytes [start, end) of an upload of total bytes, to host/path with Content-Range over a pooled
+ * connection (the origin must accept ranged PUTs). Returns 0 once the origin accepted it (2xx or 308), -1 otherwise. */
+int pea_fetch_put_range(pea_fetch* f, const char* host, const char* path, uint64_t start, uint64_t end,
+    uint64_t total, const uint8_t* data, pea_fetch_protect_fn protect, void* protect_ctx);
+
+#endif
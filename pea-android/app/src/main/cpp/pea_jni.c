@@ -1,80 +1,217 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* O_CLOEXEC, mkostemp, ftruncate, mmap and sigtimedwait under -std=c11 */
+#endif
+#include <errno.h>
+#include <fcntl.h>
 #include <jni.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
 
-/* pea-core C API (from pea-core/src/ffi.rs); stubbed in pea_stub.c when not linked */
-extern uint8_t pea_core_version(void);
-extern void* pea_core_create(void);
-extern void pea_core_destroy(void* h);
-extern int pea_core_device_id(void* h, void* out_buf, size_t out_len);
-extern int pea_core_on_request(void* h, const uint8_t* url, size_t url_len,
-    uint64_t range_start, uint64_t range_end, uint8_t* out_buf, size_t out_buf_len);
-extern int pea_core_peer_joined(void* h, const uint8_t* device_id_16, const uint8_t* public_key_32);
-extern int pea_core_peer_left(void* h, const uint8_t* device_id_16, uint8_t* out_buf, size_t out_buf_len);
-extern int pea_core_on_message_received(void* h, const uint8_t* peer_id_16,
-    const uint8_t* msg, size_t msg_len, uint8_t* out_buf, size_t out_buf_len);
-extern int pea_core_on_chunk_received(void* h, const uint8_t* transfer_id_16,
-    uint64_t start, uint64_t end, const uint8_t* hash_32,
-    const uint8_t* payload, size_t payload_len, uint8_t* out_buf, size_t out_buf_len);
-extern int pea_core_tick(void* h, uint8_t* out_buf, size_t out_buf_len);
-extern int pea_core_beacon_frame(void* h, uint16_t listen_port, uint8_t* out_buf, size_t out_buf_len);
-extern int pea_core_discovery_response_frame(void* h, uint16_t listen_port, uint8_t* out_buf, size_t out_buf_len);
-extern int pea_core_decode_discovery_frame(const uint8_t* bytes, size_t len,
-    uint8_t* out_device_id_16, uint8_t* out_public_key_32, uint16_t* out_listen_port);
-extern int pea_core_handshake_bytes(void* h, uint8_t* out_buf, size_t out_buf_len);
-extern int pea_core_session_key(void* h, const uint8_t* peer_public_key_32, uint8_t* out_session_key_32);
-extern int pea_core_encrypt_wire(const uint8_t* session_key_32, uint64_t nonce,
-    const uint8_t* plain, size_t plain_len, uint8_t* out_buf, size_t out_buf_len);
-extern int pea_core_decrypt_wire(const uint8_t* session_key_32, uint64_t nonce,
-    const uint8_t* cipher, size_t cipher_len, uint8_t* out_buf, size_t out_buf_len);
+#include "pea_bufpool.h"
+#include "pea_core_ffi.h"
+#include "pea_discovery.h"
+#include "pea_events.h"
+#include "pea_fetch.h"
+#include "pea_transport.h"
+#include "pea_trace.h"
+#include "pea_tun.h"
+#include "pea_upload.h"
 
 #define PEA_CORE_JNI "dev/peapod/android/PeaCore"
+/* nativeOpenAndDispatch: frame failed to authenticate (connection should be dropped); -1 is a dispatch error. */
+#define PEA_JNI_OPEN_FAILED (-2)
+#define PEA_VPN_SERVICE_JNI "android/net/VpnService"
 
-JNIEXPORT jint JNI_OnLoad(JavaVM *vm, void *reserved) {
-    (void)reserved;
-    (void)vm;
-    (void)pea_core_version;
-    return JNI_VERSION_1_6;
+/* Peer events and completed bodies from the engine threads, drained by nativePollEvents; created in JNI_OnLoad. */
+static pea_events* g_events;
+
+/* Origin fetcher shared by every LocalProxy handler (its keep-alive pool lives for the process), and
+ * VpnService.protect(int) for its sockets; both set up in JNI_OnLoad. */
+static pea_fetch* g_fetch;
+static jmethodID g_vpn_protect;
+
+/* nativeDeviceId result for the last handle asked (one core per process): a global ref handed out as is. */
+static pthread_mutex_t g_device_id_lock = PTHREAD_MUTEX_INITIALIZER;
+static jlong g_device_id_handle;
+static jbyteArray g_device_id;
+
+/* nativeSetChunkCache's file mapping for the handle that holds it; unmapped only once the core has let go. */
+static pthread_mutex_t g_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static jlong g_cache_handle;
+static void* g_cache_map;
+static size_t g_cache_map_len;
+
+/* nativeSetSpill: streamed transfers longer than the window spill out-of-order chunks to a file in this directory
+ * (NULL: spill off). */
+static pthread_mutex_t g_spill_lock = PTHREAD_MUTEX_INITIALIZER;
+static char* g_spill_dir;
+static uint64_t g_spill_window;
+
+/* nativeStats: calls into these natives, bytes copied in or out of Java arrays (Get/SetByteArrayRegion), and
+ * arrays pinned with GetPrimitiveArrayCritical (which the VM may serve with a copy). Relaxed: counts only. */
+static atomic_uint_fast64_t g_jni_calls;
+static atomic_uint_fast64_t g_jni_copy_bytes;
+static atomic_uint_fast64_t g_jni_pins;
+
+/* First statement of every native: counts the call and, while tracing is on, opens an ATrace section named after
+ * the wrapper (jni_*) that lasts until it returns. */
+#define NATIVE_ENTRY(clazz) \
+    (void)(clazz); \
+    atomic_fetch_add_explicit(&g_jni_calls, 1, memory_order_relaxed); \
+    PEA_TRACE_SCOPE(__func__)
+
+static void get_region(JNIEnv *env, jbyteArray arr, jsize off, jsize n, jbyte* dst) {
+    (*env)->GetByteArrayRegion(env, arr, off, n, dst);
+    atomic_fetch_add_explicit(&g_jni_copy_bytes, (uint_fast64_t)n, memory_order_relaxed);
+}
+
+static void put_region(JNIEnv *env, jbyteArray arr, jsize off, jsize n, const jbyte* src) {
+    (*env)->SetByteArrayRegion(env, arr, off, n, src);
+    atomic_fetch_add_explicit(&g_jni_copy_bytes, (uint_fast64_t)n, memory_order_relaxed);
+}
+
+static void* pin(JNIEnv *env, jarray arr) {
+    atomic_fetch_add_explicit(&g_jni_pins, 1, memory_order_relaxed);
+    return (*env)->GetPrimitiveArrayCritical(env, arr, NULL);
 }
 
-JNIEXPORT jlong JNICALL
-Java_dev_peapod_android_PeaCore_nativeCreate(JNIEnv *env, jclass clazz) {
+/* Copy a fixed-size argument (device id, key, hash) into dst. -1 if arr is NULL or shorter than n. */
+static int get_fixed(JNIEnv *env, jbyteArray arr, void* dst, jsize n) {
+    if (!arr || (*env)->GetArrayLength(env, arr) < n) return -1;
+    get_region(env, arr, 0, n, (jbyte*)dst);
+    return 0;
+}
+
+static jlong JNICALL
+jni_create(JNIEnv *env, jclass clazz) {
     (void)env;
-    (void)clazz;
+    NATIVE_ENTRY(clazz);
     return (jlong)(uintptr_t)pea_core_create();
 }
 
-JNIEXPORT void JNICALL
-Java_dev_peapod_android_PeaCore_nativeDestroy(JNIEnv *env, jclass clazz, jlong handle) {
-    (void)env;
-    (void)clazz;
+static void JNICALL
+jni_destroy(JNIEnv *env, jclass clazz, jlong handle) {
+    NATIVE_ENTRY(clazz);
+    pthread_mutex_lock(&g_device_id_lock);
+    if (g_device_id && g_device_id_handle == handle) {
+        (*env)->DeleteGlobalRef(env, g_device_id);
+        g_device_id = NULL;
+    }
+    pthread_mutex_unlock(&g_device_id_lock);
     pea_core_destroy((void*)(uintptr_t)handle);
+    pthread_mutex_lock(&g_cache_lock);
+    if (g_cache_map && g_cache_handle == handle) {
+        munmap(g_cache_map, g_cache_map_len);
+        g_cache_map = NULL;
+    }
+    pthread_mutex_unlock(&g_cache_lock);
 }
 
-JNIEXPORT jbyteArray JNICALL
-Java_dev_peapod_android_PeaCore_nativeDeviceId(JNIEnv *env, jclass clazz, jlong handle) {
-    (void)clazz;
-    uint8_t buf[16];
-    if (pea_core_device_id((void*)(uintptr_t)handle, buf, 16) != 0)
-        return NULL;
-    jbyteArray out = (*env)->NewByteArray(env, 16);
-    if (out)
-        (*env)->SetByteArrayRegion(env, out, 0, 16, (jbyte*)buf);
-    return out;
+static jint JNICALL
+jni_set_config(JNIEnv *env, jclass clazz, jlong handle,
+    jlong minChunkSize, jlong maxChunkSize, jint chunksPerWorker, jint minChunkRtts) {
+    (void)env;
+    NATIVE_ENTRY(clazz);
+    if (minChunkSize < 0 || maxChunkSize < 0 || chunksPerWorker < 0 || minChunkRtts < 0) return -1;
+    pea_config cfg = {
+        .min_chunk_size = (uint64_t)minChunkSize,
+        .max_chunk_size = (uint64_t)maxChunkSize,
+        .chunks_per_worker = (uint32_t)chunksPerWorker,
+        .min_chunk_rtts = (uint32_t)minChunkRtts,
+    };
+    return (jint)pea_core_set_config((void*)(uintptr_t)handle, &cfg);
 }
 
-JNIEXPORT jint JNICALL
-Java_dev_peapod_android_PeaCore_nativeOnRequest(JNIEnv *env, jclass clazz, jlong handle,
+/* A len-byte file at path mapped shared for the chunk cache. Unlinked at once, so its blocks go with the mapping.
+ * NULL on failure. */
+static void* map_cache_file(const char* path, size_t len) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) return NULL;
+    unlink(path);
+    void* map = ftruncate(fd, (off_t)len) == 0 ? mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+static jint JNICALL
+jni_set_chunk_cache(JNIEnv *env, jclass clazz, jlong handle, jlong budgetBytes, jstring path) {
+    NATIVE_ENTRY(clazz);
+    if (!handle || budgetBytes < 0 || (uint64_t)budgetBytes > SIZE_MAX) return -1;
+    size_t len = (size_t)budgetBytes;
+    void* map = NULL;
+    if (path && len > 0) {
+        const char* chars = (*env)->GetStringUTFChars(env, path, NULL);
+        if (!chars) return -1;
+        map = map_cache_file(chars, len);
+        (*env)->ReleaseStringUTFChars(env, path, chars);
+        if (!map) return -1;
+    }
+    pthread_mutex_lock(&g_cache_lock);
+    int r = pea_core_set_chunk_cache((void*)(uintptr_t)handle, (uint64_t)len, map, map ? len : 0);
+    /* The core has dropped its previous cache by now, so that mapping can go (or this one, if the call failed).
+     * One core per process: another handle's mapping would only be leaked, never unmapped under it. */
+    void* unused = r == 0 ? NULL : map;
+    size_t unused_len = len;
+    if (r == 0) {
+        if (g_cache_handle == handle) {
+            unused = g_cache_map;
+            unused_len = g_cache_map_len;
+        }
+        g_cache_handle = handle;
+        g_cache_map = map;
+        g_cache_map_len = len;
+    }
+    pthread_mutex_unlock(&g_cache_lock);
+    if (unused) munmap(unused, unused_len);
+    return (jint)r;
+}
+
+static jbyteArray JNICALL
+jni_device_id(JNIEnv *env, jclass clazz, jlong handle) {
+    NATIVE_ENTRY(clazz);
+    pthread_mutex_lock(&g_device_id_lock);
+    if (!g_device_id || g_device_id_handle != handle) {
+        uint8_t buf[16];
+        jbyteArray out = pea_core_device_id((void*)(uintptr_t)handle, buf, 16) == 0
+            ? (*env)->NewByteArray(env, 16) : NULL;
+        if (g_device_id) (*env)->DeleteGlobalRef(env, g_device_id);
+        g_device_id = NULL;
+        if (out) {
+            put_region(env, out, 0, 16, (jbyte*)buf);
+            g_device_id = (*env)->NewGlobalRef(env, out);
+            g_device_id_handle = handle;
+            (*env)->DeleteLocalRef(env, out);
+        }
+    }
+    jbyteArray id = g_device_id ? (*env)->NewLocalRef(env, g_device_id) : NULL;
+    pthread_mutex_unlock(&g_device_id_lock);
+    return id;
+}
+
+static jint JNICALL
+jni_on_request(JNIEnv *env, jclass clazz, jlong handle,
     jstring url, jlong rangeStart, jlong rangeEnd, jbyteArray outBuf) {
-    (void)clazz;
-    if (!url || !outBuf) return -1;
+    NATIVE_ENTRY(clazz);
+    if (!url) return -1;
     const char* url_chars = (*env)->GetStringUTFChars(env, url, NULL);
     if (!url_chars) return -1;
     size_t url_len = strlen(url_chars);
-    jsize out_len = (*env)->GetArrayLength(env, outBuf);
-    jbyte* out = (*env)->GetByteArrayElements(env, outBuf, NULL);
-    if (!out) {
+    /* A null outBuf asks for the size only (the result is kept for nativeTakeOutput). */
+    jsize out_len = outBuf ? (*env)->GetArrayLength(env, outBuf) : 0;
+    jbyte* out = outBuf ? pin(env, outBuf) : NULL;
+    if (outBuf && !out) {
         (*env)->ReleaseStringUTFChars(env, url, url_chars);
         return -1;
     }
@@ -82,239 +219,976 @@ Java_dev_peapod_android_PeaCore_nativeOnRequest(JNIEnv *env, jclass clazz, jlong
         (const uint8_t*)url_chars, url_len,
         (uint64_t)rangeStart, (uint64_t)rangeEnd,
         (uint8_t*)out, (size_t)out_len);
-    (*env)->ReleaseByteArrayElements(env, outBuf, out, 0);
+    if (out) (*env)->ReleasePrimitiveArrayCritical(env, outBuf, out, r == 1 ? 0 : JNI_ABORT);
     (*env)->ReleaseStringUTFChars(env, url, url_chars);
     return (jint)r;
 }
 
-JNIEXPORT jint JNICALL
-Java_dev_peapod_android_PeaCore_nativePeerJoined(JNIEnv *env, jclass clazz, jlong handle,
+static jint JNICALL
+jni_peer_joined(JNIEnv *env, jclass clazz, jlong handle,
     jbyteArray deviceId, jbyteArray publicKey) {
-    (void)clazz;
-    if (!deviceId || (*env)->GetArrayLength(env, deviceId) < 16) return -1;
-    if (!publicKey || (*env)->GetArrayLength(env, publicKey) < 32) return -1;
-    jbyte* id = (*env)->GetByteArrayElements(env, deviceId, NULL);
-    jbyte* pk = (*env)->GetByteArrayElements(env, publicKey, NULL);
-    if (!id || !pk) return -1;
-    int r = pea_core_peer_joined((void*)(uintptr_t)handle, (uint8_t*)id, (uint8_t*)pk);
-    (*env)->ReleaseByteArrayElements(env, deviceId, id, JNI_ABORT);
-    (*env)->ReleaseByteArrayElements(env, publicKey, pk, JNI_ABORT);
-    return (jint)r;
+    NATIVE_ENTRY(clazz);
+    uint8_t id[16], pk[32];
+    if (get_fixed(env, deviceId, id, 16) != 0 || get_fixed(env, publicKey, pk, 32) != 0) return -1;
+    return (jint)pea_core_peer_joined((void*)(uintptr_t)handle, id, pk);
 }
 
-JNIEXPORT jint JNICALL
-Java_dev_peapod_android_PeaCore_nativePeerLeft(JNIEnv *env, jclass clazz, jlong handle,
+static jint JNICALL
+jni_peer_left(JNIEnv *env, jclass clazz, jlong handle,
     jbyteArray deviceId, jbyteArray outBuf) {
-    (void)clazz;
-    if (!deviceId || (*env)->GetArrayLength(env, deviceId) < 16) return -1;
-    jbyte* id = (*env)->GetByteArrayElements(env, deviceId, NULL);
-    if (!id) return -1;
-    uint8_t* out = outBuf && (*env)->GetArrayLength(env, outBuf) > 0
-        ? (uint8_t*)(*env)->GetByteArrayElements(env, outBuf, NULL) : NULL;
-    size_t out_len = out ? (size_t)(*env)->GetArrayLength(env, outBuf) : 0;
-    int r = pea_core_peer_left((void*)(uintptr_t)handle, (uint8_t*)id, out, out_len);
-    (*env)->ReleaseByteArrayElements(env, deviceId, id, JNI_ABORT);
-    if (out) (*env)->ReleaseByteArrayElements(env, outBuf, (jbyte*)out, 0);
+    NATIVE_ENTRY(clazz);
+    uint8_t id[16];
+    if (get_fixed(env, deviceId, id, 16) != 0) return -1;
+    jsize out_len = outBuf ? (*env)->GetArrayLength(env, outBuf) : 0;
+    uint8_t* out = out_len > 0 ? pin(env, outBuf) : NULL;
+    if (out_len > 0 && !out) return -1;
+    int r = pea_core_peer_left((void*)(uintptr_t)handle, id, out, (size_t)out_len);
+    if (out) (*env)->ReleasePrimitiveArrayCritical(env, outBuf, out, r > 0 ? 0 : JNI_ABORT);
     return (jint)r;
 }
 
-JNIEXPORT jint JNICALL
-Java_dev_peapod_android_PeaCore_nativeOnMessageReceived(JNIEnv *env, jclass clazz, jlong handle,
+static jint JNICALL
+jni_on_message_received(JNIEnv *env, jclass clazz, jlong handle,
     jbyteArray peerId, jbyteArray msg, jbyteArray outBuf) {
-    (void)clazz;
-    if (!peerId || !msg || !outBuf) return -1;
-    jbyte* pid = (*env)->GetByteArrayElements(env, peerId, NULL);
+    NATIVE_ENTRY(clazz);
+    uint8_t pid[16];
+    if (!msg || get_fixed(env, peerId, pid, 16) != 0) return -1;
+    /* Not a critical section: with a transfer sink this call may write queued runs to the client socket (after
+     * the core lock is released), which can block. */
     jbyte* m = (*env)->GetByteArrayElements(env, msg, NULL);
-    jbyte* out = (*env)->GetByteArrayElements(env, outBuf, NULL);
-    if (!pid || !m || !out) {
-        if (pid) (*env)->ReleaseByteArrayElements(env, peerId, pid, JNI_ABORT);
+    jbyte* out = outBuf ? (*env)->GetByteArrayElements(env, outBuf, NULL) : NULL;
+    if (!m || (outBuf && !out)) {
         if (m) (*env)->ReleaseByteArrayElements(env, msg, m, JNI_ABORT);
         if (out) (*env)->ReleaseByteArrayElements(env, outBuf, out, JNI_ABORT);
         return -1;
     }
     jsize msg_len = (*env)->GetArrayLength(env, msg);
-    jsize out_len = (*env)->GetArrayLength(env, outBuf);
+    jsize out_len = outBuf ? (*env)->GetArrayLength(env, outBuf) : 0;
     int r = pea_core_on_message_received((void*)(uintptr_t)handle,
-        (uint8_t*)pid, (uint8_t*)m, (size_t)msg_len, (uint8_t*)out, (size_t)out_len);
-    (*env)->ReleaseByteArrayElements(env, peerId, pid, JNI_ABORT);
+        pid, (uint8_t*)m, (size_t)msg_len, (uint8_t*)out, (size_t)out_len);
     (*env)->ReleaseByteArrayElements(env, msg, m, JNI_ABORT);
-    (*env)->ReleaseByteArrayElements(env, outBuf, out, 0);
+    if (out) (*env)->ReleaseByteArrayElements(env, outBuf, out, r > 0 ? 0 : JNI_ABORT);
     return (jint)r;
 }
 
-JNIEXPORT jint JNICALL
-Java_dev_peapod_android_PeaCore_nativeOnChunkReceived(JNIEnv *env, jclass clazz, jlong handle,
+static jint JNICALL
+jni_on_chunk_received(JNIEnv *env, jclass clazz, jlong handle,
     jbyteArray transferId, jlong start, jlong end, jbyteArray hash, jbyteArray payload,
     jbyteArray outBuf) {
-    (void)clazz;
-    if (!transferId || !hash || !payload || !outBuf) return -1;
-    jbyte* tid = (*env)->GetByteArrayElements(env, transferId, NULL);
-    jbyte* h = (*env)->GetByteArrayElements(env, hash, NULL);
+    NATIVE_ENTRY(clazz);
+    /* outBuf is optional: with a transfer sink the body never comes back to Java. A null hash means the
+     * payload was already checked, so the core does not hash it again. */
+    uint8_t tid[16], h[32];
+    if (!payload || get_fixed(env, transferId, tid, 16) != 0) return -1;
+    if (hash && get_fixed(env, hash, h, 32) != 0) return -1;
     jbyte* p = (*env)->GetByteArrayElements(env, payload, NULL);
-    jbyte* out = (*env)->GetByteArrayElements(env, outBuf, NULL);
-    if (!tid || !h || !p || !out) {
-        if (tid) (*env)->ReleaseByteArrayElements(env, transferId, tid, JNI_ABORT);
-        if (h) (*env)->ReleaseByteArrayElements(env, hash, h, JNI_ABORT);
+    jbyte* out = outBuf ? (*env)->GetByteArrayElements(env, outBuf, NULL) : NULL;
+    if (!p || (outBuf && !out)) {
         if (p) (*env)->ReleaseByteArrayElements(env, payload, p, JNI_ABORT);
         if (out) (*env)->ReleaseByteArrayElements(env, outBuf, out, JNI_ABORT);
         return -1;
     }
     jsize payload_len = (*env)->GetArrayLength(env, payload);
-    jsize out_len = (*env)->GetArrayLength(env, outBuf);
+    jsize out_len = outBuf ? (*env)->GetArrayLength(env, outBuf) : 0;
     int r = pea_core_on_chunk_received((void*)(uintptr_t)handle,
-        (uint8_t*)tid, (uint64_t)start, (uint64_t)end, (uint8_t*)h,
+        tid, (uint64_t)start, (uint64_t)end, hash ? h : NULL,
         (uint8_t*)p, (size_t)payload_len, (uint8_t*)out, (size_t)out_len);
-    (*env)->ReleaseByteArrayElements(env, transferId, tid, JNI_ABORT);
-    (*env)->ReleaseByteArrayElements(env, hash, h, JNI_ABORT);
     (*env)->ReleaseByteArrayElements(env, payload, p, JNI_ABORT);
-    (*env)->ReleaseByteArrayElements(env, outBuf, out, 0);
+    if (out) (*env)->ReleaseByteArrayElements(env, outBuf, out, r == 1 ? 0 : JNI_ABORT);
+    return (jint)r;
+}
+
+/* pea-core's PeaIoSlice is { const uint8_t* base; size_t len; }, passed straight through as iovec. */
+_Static_assert(sizeof(struct iovec) == sizeof(void*) + sizeof(size_t), "iovec layout");
+#define PEA_SINK_MAX_IOV 64
+
+/* Transfer sink: ctx is the client socket fd. Sends each batch of in-order chunks in one sendmsg
+ * (writev without SIGPIPE), resuming after partial writes; any error makes the core drop the transfer. */
+static int fd_sink_writev(void* ctx, const struct iovec* iov, size_t iov_count) {
+    int fd = (int)(intptr_t)ctx;
+    struct iovec v[PEA_SINK_MAX_IOV];
+    while (iov_count > 0) {
+        size_t n = iov_count < PEA_SINK_MAX_IOV ? iov_count : PEA_SINK_MAX_IOV;
+        memcpy(v, iov, n * sizeof(*v));
+        iov += n;
+        iov_count -= n;
+        struct iovec* cur = v;
+        while (n > 0) {
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = cur;
+            msg.msg_iovlen = n;
+            ssize_t w = sendmsg(fd, &msg, MSG_NOSIGNAL);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            size_t left = (size_t)w;
+            while (n > 0 && left >= cur->iov_len) {
+                left -= cur->iov_len;
+                cur++;
+                n--;
+            }
+            if (n > 0) {
+                cur->iov_base = (uint8_t*)cur->iov_base + left;
+                cur->iov_len -= left;
+            }
+        }
+    }
+    return 0;
+}
+
+/* A transfer's spill file: sparse, unlinked and mapped shared, so chunks the core parks in the mapping are in the
+ * file's page cache. It is also that transfer's sink ctx, and runs in the mapping go out with sendfile. Freed by
+ * spill_release when the core lets go of the transfer. */
+struct spill {
+    int sock;
+    int fd;
+    uint8_t* map;
+    size_t len;
+};
+
+static void spill_release(void* ctx) {
+    struct spill* s = ctx;
+    munmap(s->map, s->len);
+    close(s->fd);
+    free(s);
+}
+
+/* sendfile has no MSG_NOSIGNAL: SIGPIPE from a client that went away is blocked on this thread and swallowed. */
+static int sendfile_all(int sock, int fd, off_t off, size_t len) {
+    sigset_t pipe_set, old;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old);
+    int r = 0;
+    while (len > 0) {
+        ssize_t n = sendfile(sock, fd, &off, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n < 0 && errno == EPIPE) {
+                struct timespec zero = { 0, 0 };
+                sigtimedwait(&pipe_set, NULL, &zero);
+            }
+            r = -1;
+            break;
+        }
+        len -= (size_t)n;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return r;
+}
+
+/* Transfer sink for a spilling transfer: held chunks go out as in fd_sink_writev, spilled runs (iovecs into the
+ * mapping, which follow each other in the file) straight from the file's pages. */
+static int spill_sink_write(void* ctx, const struct iovec* iov, size_t iov_count) {
+    struct spill* s = ctx;
+    size_t i = 0;
+    while (i < iov_count) {
+        size_t j = i;
+        const uint8_t* p = iov[i].iov_base;
+        int in_file = p >= s->map && p < s->map + s->len;
+        size_t run = 0;
+        while (j < iov_count) {
+            const uint8_t* q = iov[j].iov_base;
+            if ((q >= s->map && q < s->map + s->len) != in_file) break;
+            run += iov[j].iov_len;
+            j++;
+        }
+        int r = in_file ? sendfile_all(s->sock, s->fd, (off_t)(p - s->map), run)
+                        : fd_sink_writev((void*)(intptr_t)s->sock, iov + i, j - i);
+        if (r != 0) return -1;
+        i = j;
+    }
+    return 0;
+}
+
+/* Spill file for transfer tid when spilling is on and the transfer is longer than the window; NULL otherwise. */
+static struct spill* spill_create(void* core, const uint8_t* tid, uint64_t* out_window) {
+    uint8_t st[24];
+    if (pea_core_transfer_status(core, tid, st, sizeof st) != 24) return NULL;
+    uint64_t total = 0;
+    for (int i = 7; i >= 0; i--) total = (total << 8) | st[i];
+    char path[4096];
+    pthread_mutex_lock(&g_spill_lock);
+    int on = g_spill_dir && total > g_spill_window && total <= SIZE_MAX
+        && snprintf(path, sizeof(path), "%s/peapod-spill-XXXXXX", g_spill_dir) < (int)sizeof(path);
+    *out_window = g_spill_window;
+    pthread_mutex_unlock(&g_spill_lock);
+    if (!on) return NULL;
+    int fd = mkostemp(path, O_CLOEXEC);
+    if (fd < 0) return NULL;
+    unlink(path);
+    struct spill* s = malloc(sizeof(*s));
+    void* map = s && ftruncate(fd, (off_t)total) == 0
+        ? mmap(NULL, (size_t)total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+        : MAP_FAILED;
+    if (map == MAP_FAILED) {
+        free(s);
+        close(fd);
+        return NULL;
+    }
+    s->fd = fd;
+    s->map = map;
+    s->len = (size_t)total;
+    return s;
+}
+
+static jint JNICALL
+jni_set_transfer_sink_fd(JNIEnv *env, jclass clazz, jlong handle,
+    jbyteArray transferId, jint fd) {
+    NATIVE_ENTRY(clazz);
+    uint8_t tid[16];
+    void* core = (void*)(uintptr_t)handle;
+    if (get_fixed(env, transferId, tid, 16) != 0) return -1;
+    if (fd < 0) return (jint)pea_core_set_transfer_sink(core, tid, NULL, NULL);
+    uint64_t window;
+    struct spill* s = spill_create(core, tid, &window);
+    if (s) {
+        s->sock = fd;
+        /* On failure the core has already released s; stream without spilling. */
+        if (pea_core_set_transfer_spill(core, tid, s->map, s->len, window, spill_release, s) == 0)
+            return (jint)pea_core_set_transfer_sink(core, tid, spill_sink_write, s);
+    }
+    return (jint)pea_core_set_transfer_sink(core, tid, fd_sink_writev, (void*)(intptr_t)fd);
+}
+
+static jint JNICALL
+jni_set_spill(JNIEnv *env, jclass clazz, jstring dir, jlong windowBytes) {
+    NATIVE_ENTRY(clazz);
+    if (windowBytes < 0) return -1;
+    char* copy = NULL;
+    if (dir) {
+        const char* chars = (*env)->GetStringUTFChars(env, dir, NULL);
+        if (!chars) return -1;
+        copy = strdup(chars);
+        (*env)->ReleaseStringUTFChars(env, dir, chars);
+        if (!copy) return -1;
+    }
+    pthread_mutex_lock(&g_spill_lock);
+    char* old = g_spill_dir;
+    g_spill_dir = copy;
+    g_spill_window = (uint64_t)windowBytes;
+    pthread_mutex_unlock(&g_spill_lock);
+    free(old);
+    return 0;
+}
+
+static jint JNICALL
+jni_next_self_chunk(JNIEnv *env, jclass clazz, jlong handle,
+    jbyteArray transferId, jlongArray outRange) {
+    NATIVE_ENTRY(clazz);
+    uint8_t tid[16];
+    if (!outRange || (*env)->GetArrayLength(env, outRange) < 2) return -1;
+    if (get_fixed(env, transferId, tid, 16) != 0) return -1;
+    uint64_t start = 0, end = 0;
+    int r = pea_core_next_self_chunk((void*)(uintptr_t)handle, tid, &start, &end);
+    if (r == 1) {
+        jlong range[2] = { (jlong)start, (jlong)end };
+        (*env)->SetLongArrayRegion(env, outRange, 0, 2, range);
+    }
     return (jint)r;
 }
 
-JNIEXPORT jint JNICALL
-Java_dev_peapod_android_PeaCore_nativeTick(JNIEnv *env, jclass clazz, jlong handle, jbyteArray outBuf) {
-    (void)clazz;
-    if (!outBuf) return 0;
-    jbyte* out = (*env)->GetByteArrayElements(env, outBuf, NULL);
-    if (!out) return 0;
-    jsize out_len = (*env)->GetArrayLength(env, outBuf);
+static jint JNICALL
+jni_cancel_transfer(JNIEnv *env, jclass clazz, jlong handle,
+    jbyteArray transferId) {
+    NATIVE_ENTRY(clazz);
+    uint8_t tid[16];
+    if (get_fixed(env, transferId, tid, 16) != 0) return -1;
+    return (jint)pea_core_cancel_transfer((void*)(uintptr_t)handle, tid);
+}
+
+static jint JNICALL
+jni_transfer_status(JNIEnv *env, jclass clazz, jlong handle,
+    jbyteArray transferId, jlongArray out) {
+    NATIVE_ENTRY(clazz);
+    uint8_t tid[16];
+    uint8_t st[24];
+    if (!out || (*env)->GetArrayLength(env, out) < 4) return -1;
+    if (get_fixed(env, transferId, tid, 16) != 0) return -1;
+    if (pea_core_transfer_status((void*)(uintptr_t)handle, tid, st, sizeof st) != 24) return -1;
+    /* [total_length, received_bytes, chunks_total, chunks_received] from 8, 8, 4, 4 LE bytes. */
+    static const int off[4] = { 0, 8, 16, 20 }, width[4] = { 8, 8, 4, 4 };
+    jlong v[4];
+    for (int f = 0; f < 4; f++) {
+        uint64_t x = 0;
+        for (int i = width[f] - 1; i >= 0; i--) x = (x << 8) | st[off[f] + i];
+        v[f] = (jlong)x;
+    }
+    (*env)->SetLongArrayRegion(env, out, 0, 4, v);
+    return 0;
+}
+
+static jint JNICALL
+jni_tick(JNIEnv *env, jclass clazz, jlong handle, jbyteArray outBuf) {
+    NATIVE_ENTRY(clazz);
+    jsize out_len = outBuf ? (*env)->GetArrayLength(env, outBuf) : 0;
+    jbyte* out = outBuf ? pin(env, outBuf) : NULL;
+    if (outBuf && !out) return -1;
     int r = pea_core_tick((void*)(uintptr_t)handle, (uint8_t*)out, (size_t)out_len);
-    (*env)->ReleaseByteArrayElements(env, outBuf, out, 0);
+    /* Copy back only when something was written (most ticks produce nothing). */
+    if (out) (*env)->ReleasePrimitiveArrayCritical(env, outBuf, out, r > 0 ? 0 : JNI_ABORT);
+    return (jint)r;
+}
+
+/* nativeStats: bytes this file appends to the core's counters (calls, copy bytes, pins). */
+#define PEA_JNI_STATS_LEN 24
+
+/* The core's counters (pea_core_stats layout) then this file's, at the start of a direct ByteBuffer. Every Android
+ * ABI is little-endian, so the JNI counters are copied as is. Returns the length or a need code. */
+static jint JNICALL
+jni_stats(JNIEnv *env, jclass clazz, jlong handle, jobject outBuf) {
+    NATIVE_ENTRY(clazz);
+    uint8_t* out = outBuf ? (uint8_t*)(*env)->GetDirectBufferAddress(env, outBuf) : NULL;
+    jlong cap = outBuf ? (*env)->GetDirectBufferCapacity(env, outBuf) : -1;
+    if (!handle || !out || cap < 0) return -1;
+    size_t room = (size_t)cap > PEA_JNI_STATS_LEN ? (size_t)cap - PEA_JNI_STATS_LEN : 0;
+    int r = pea_core_stats((void*)(uintptr_t)handle, out, room);
+    if (r == -1) return -1;
+    if (r < 0) return (jint)(r - PEA_JNI_STATS_LEN);
+    uint64_t jni[3] = {
+        atomic_load_explicit(&g_jni_calls, memory_order_relaxed),
+        atomic_load_explicit(&g_jni_copy_bytes, memory_order_relaxed),
+        atomic_load_explicit(&g_jni_pins, memory_order_relaxed),
+    };
+    memcpy(out + r, jni, sizeof(jni));
+    return (jint)(r + PEA_JNI_STATS_LEN);
+}
+
+static jint JNICALL
+jni_take_output(JNIEnv *env, jclass clazz, jlong handle, jbyteArray outBuf) {
+    NATIVE_ENTRY(clazz);
+    jsize out_len = outBuf ? (*env)->GetArrayLength(env, outBuf) : 0;
+    jbyte* out = outBuf ? pin(env, outBuf) : NULL;
+    if (outBuf && !out) return -1;
+    int r = pea_core_take_output((void*)(uintptr_t)handle, (uint8_t*)out, (size_t)out_len);
+    if (out) (*env)->ReleasePrimitiveArrayCritical(env, outBuf, out, r > 0 ? 0 : JNI_ABORT);
     return (jint)r;
 }
 
-JNIEXPORT jint JNICALL
-Java_dev_peapod_android_PeaCore_nativeBeaconFrame(JNIEnv *env, jclass clazz, jlong handle,
+static jint JNICALL
+jni_beacon_frame(JNIEnv *env, jclass clazz, jlong handle,
     jint listenPort, jbyteArray outBuf) {
-    (void)clazz;
-    if (!outBuf) return -1;
-    jbyte* out = (*env)->GetByteArrayElements(env, outBuf, NULL);
-    if (!out) return -1;
-    jsize out_len = (*env)->GetArrayLength(env, outBuf);
+    NATIVE_ENTRY(clazz);
+    jsize out_len = outBuf ? (*env)->GetArrayLength(env, outBuf) : 0;
+    jbyte* out = outBuf ? pin(env, outBuf) : NULL;
+    if (outBuf && !out) return -1;
     int r = pea_core_beacon_frame((void*)(uintptr_t)handle, (uint16_t)listenPort, (uint8_t*)out, (size_t)out_len);
-    (*env)->ReleaseByteArrayElements(env, outBuf, out, 0);
+    if (out) (*env)->ReleasePrimitiveArrayCritical(env, outBuf, out, r > 0 ? 0 : JNI_ABORT);
     return (jint)r;
 }
 
-JNIEXPORT jint JNICALL
-Java_dev_peapod_android_PeaCore_nativeDiscoveryResponseFrame(JNIEnv *env, jclass clazz, jlong handle,
+static jint JNICALL
+jni_discovery_response_frame(JNIEnv *env, jclass clazz, jlong handle,
     jint listenPort, jbyteArray outBuf) {
-    (void)clazz;
-    if (!outBuf) return -1;
-    jbyte* out = (*env)->GetByteArrayElements(env, outBuf, NULL);
-    if (!out) return -1;
-    jsize out_len = (*env)->GetArrayLength(env, outBuf);
+    NATIVE_ENTRY(clazz);
+    jsize out_len = outBuf ? (*env)->GetArrayLength(env, outBuf) : 0;
+    jbyte* out = outBuf ? pin(env, outBuf) : NULL;
+    if (outBuf && !out) return -1;
     int r = pea_core_discovery_response_frame((void*)(uintptr_t)handle, (uint16_t)listenPort, (uint8_t*)out, (size_t)out_len);
-    (*env)->ReleaseByteArrayElements(env, outBuf, out, 0);
+    if (out) (*env)->ReleasePrimitiveArrayCritical(env, outBuf, out, r > 0 ? 0 : JNI_ABORT);
     return (jint)r;
 }
 
-JNIEXPORT jint JNICALL
-Java_dev_peapod_android_PeaCore_nativeDecodeDiscoveryFrame(JNIEnv *env, jclass clazz,
-    jbyteArray frame, jbyteArray outDeviceId, jbyteArray outPublicKey, jintArray outListenPort) {
-    (void)clazz;
+static jint JNICALL
+jni_decode_discovery_frame(JNIEnv *env, jclass clazz,
+    jbyteArray frame, jint frameLen, jbyteArray outDeviceId, jbyteArray outPublicKey, jintArray outListenPort) {
+    NATIVE_ENTRY(clazz);
     if (!frame || !outDeviceId || !outPublicKey || !outListenPort) return -1;
+    if (frameLen < 0 || (*env)->GetArrayLength(env, frame) < frameLen) return -1;
     if ((*env)->GetArrayLength(env, outDeviceId) < 16) return -1;
     if ((*env)->GetArrayLength(env, outPublicKey) < 32) return -1;
     if ((*env)->GetArrayLength(env, outListenPort) < 1) return -1;
-    jbyte* f = (*env)->GetByteArrayElements(env, frame, NULL);
+    jbyte* f = pin(env, frame);
     if (!f) return -1;
-    jsize f_len = (*env)->GetArrayLength(env, frame);
-    jbyte* id = (*env)->GetByteArrayElements(env, outDeviceId, NULL);
-    jbyte* pk = (*env)->GetByteArrayElements(env, outPublicKey, NULL);
-    jint* port = (*env)->GetIntArrayElements(env, outListenPort, NULL);
-    if (!id || !pk || !port) {
-        (*env)->ReleaseByteArrayElements(env, frame, f, JNI_ABORT);
-        if (id) (*env)->ReleaseByteArrayElements(env, outDeviceId, id, JNI_ABORT);
-        if (pk) (*env)->ReleaseByteArrayElements(env, outPublicKey, pk, JNI_ABORT);
-        if (port) (*env)->ReleaseIntArrayElements(env, outListenPort, port, JNI_ABORT);
-        return -1;
-    }
+    uint8_t id[16], pk[32];
     uint16_t listen_port;
-    int r = pea_core_decode_discovery_frame((const uint8_t*)f, (size_t)f_len,
-        (uint8_t*)id, (uint8_t*)pk, &listen_port);
-    (*env)->ReleaseByteArrayElements(env, frame, f, JNI_ABORT);
-    (*env)->ReleaseByteArrayElements(env, outDeviceId, id, 0);
-    (*env)->ReleaseByteArrayElements(env, outPublicKey, pk, 0);
-    port[0] = (jint)listen_port;
-    (*env)->ReleaseIntArrayElements(env, outListenPort, port, 0);
+    int r = pea_core_decode_discovery_frame((const uint8_t*)f, (size_t)frameLen, id, pk, &listen_port);
+    (*env)->ReleasePrimitiveArrayCritical(env, frame, f, JNI_ABORT);
+    if (r == 0) {
+        jint port = (jint)listen_port;
+        put_region(env, outDeviceId, 0, 16, (const jbyte*)id);
+        put_region(env, outPublicKey, 0, 32, (const jbyte*)pk);
+        (*env)->SetIntArrayRegion(env, outListenPort, 0, 1, &port);
+    }
     return (jint)r;
 }
 
-JNIEXPORT jint JNICALL
-Java_dev_peapod_android_PeaCore_nativeHandshakeBytes(JNIEnv *env, jclass clazz, jlong handle, jbyteArray outBuf) {
-    (void)clazz;
+static jint JNICALL
+jni_handshake_bytes(JNIEnv *env, jclass clazz, jlong handle, jbyteArray outBuf) {
+    NATIVE_ENTRY(clazz);
     if (!outBuf || (*env)->GetArrayLength(env, outBuf) < 49) return -1;
-    jbyte* out = (*env)->GetByteArrayElements(env, outBuf, NULL);
-    if (!out) return -1;
-    int r = pea_core_handshake_bytes((void*)(uintptr_t)handle, (uint8_t*)out, 49);
-    (*env)->ReleaseByteArrayElements(env, outBuf, out, 0);
+    uint8_t hs[49];
+    int r = pea_core_handshake_bytes((void*)(uintptr_t)handle, hs, sizeof hs);
+    if (r >= 0) put_region(env, outBuf, 0, 49, (const jbyte*)hs);
     return (jint)r;
 }
 
-JNIEXPORT jint JNICALL
-Java_dev_peapod_android_PeaCore_nativeSessionKey(JNIEnv *env, jclass clazz, jlong handle,
+static jint JNICALL
+jni_session_key(JNIEnv *env, jclass clazz, jlong handle,
     jbyteArray peerPublicKey, jbyteArray outSessionKey) {
-    (void)clazz;
-    if (!peerPublicKey || (*env)->GetArrayLength(env, peerPublicKey) < 32) return -1;
+    NATIVE_ENTRY(clazz);
+    uint8_t pk[32], key[32];
+    if (get_fixed(env, peerPublicKey, pk, 32) != 0) return -1;
     if (!outSessionKey || (*env)->GetArrayLength(env, outSessionKey) < 32) return -1;
-    jbyte* pk = (*env)->GetByteArrayElements(env, peerPublicKey, NULL);
-    jbyte* out = (*env)->GetByteArrayElements(env, outSessionKey, NULL);
-    if (!pk || !out) {
-        if (pk) (*env)->ReleaseByteArrayElements(env, peerPublicKey, pk, JNI_ABORT);
-        if (out) (*env)->ReleaseByteArrayElements(env, outSessionKey, out, JNI_ABORT);
-        return -1;
-    }
-    int r = pea_core_session_key((void*)(uintptr_t)handle, (const uint8_t*)pk, (uint8_t*)out);
-    (*env)->ReleaseByteArrayElements(env, peerPublicKey, pk, JNI_ABORT);
-    (*env)->ReleaseByteArrayElements(env, outSessionKey, out, 0);
+    int r = pea_core_session_key((void*)(uintptr_t)handle, pk, key);
+    if (r == 0) put_region(env, outSessionKey, 0, 32, (const jbyte*)key);
+    memset(key, 0, sizeof(key));
     return (jint)r;
 }
 
-JNIEXPORT jint JNICALL
-Java_dev_peapod_android_PeaCore_nativeEncryptWire(JNIEnv *env, jclass clazz,
+static jint JNICALL
+jni_encrypt_wire(JNIEnv *env, jclass clazz,
     jbyteArray sessionKey, jlong nonce, jbyteArray plain, jbyteArray outBuf) {
-    (void)clazz;
-    if (!sessionKey || !plain || !outBuf) return -1;
-    jbyte* key = (*env)->GetByteArrayElements(env, sessionKey, NULL);
-    jbyte* p = (*env)->GetByteArrayElements(env, plain, NULL);
-    jbyte* out = (*env)->GetByteArrayElements(env, outBuf, NULL);
-    if (!key || !p || !out) {
-        if (key) (*env)->ReleaseByteArrayElements(env, sessionKey, key, JNI_ABORT);
-        if (p) (*env)->ReleaseByteArrayElements(env, plain, p, JNI_ABORT);
-        if (out) (*env)->ReleaseByteArrayElements(env, outBuf, out, JNI_ABORT);
-        return -1;
-    }
+    NATIVE_ENTRY(clazz);
+    uint8_t key[32];
+    if (!plain || get_fixed(env, sessionKey, key, 32) != 0) return -1;
     jsize plain_len = (*env)->GetArrayLength(env, plain);
-    jsize out_len = (*env)->GetArrayLength(env, outBuf);
-    int r = pea_core_encrypt_wire((const uint8_t*)key, (uint64_t)nonce,
-        (const uint8_t*)p, (size_t)plain_len, (uint8_t*)out, (size_t)out_len);
-    (*env)->ReleaseByteArrayElements(env, sessionKey, key, JNI_ABORT);
-    (*env)->ReleaseByteArrayElements(env, plain, p, JNI_ABORT);
-    (*env)->ReleaseByteArrayElements(env, outBuf, out, 0);
+    jsize out_len = outBuf ? (*env)->GetArrayLength(env, outBuf) : 0;
+    jbyte* p = pin(env, plain);
+    jbyte* out = p && outBuf ? pin(env, outBuf) : NULL;
+    int r = -1;
+    if (p && (!outBuf || out))
+        r = pea_core_encrypt_wire(key, (uint64_t)nonce,
+            (const uint8_t*)p, (size_t)plain_len, (uint8_t*)out, (size_t)out_len);
+    if (out) (*env)->ReleasePrimitiveArrayCritical(env, outBuf, out, r > 0 ? 0 : JNI_ABORT);
+    if (p) (*env)->ReleasePrimitiveArrayCritical(env, plain, p, JNI_ABORT);
+    memset(key, 0, sizeof(key));
     return (jint)r;
 }
 
-JNIEXPORT jint JNICALL
-Java_dev_peapod_android_PeaCore_nativeDecryptWire(JNIEnv *env, jclass clazz,
+static jint JNICALL
+jni_decrypt_wire(JNIEnv *env, jclass clazz,
     jbyteArray sessionKey, jlong nonce, jbyteArray cipher, jbyteArray outBuf) {
-    (void)clazz;
-    if (!sessionKey || !cipher || !outBuf) return -1;
-    jbyte* key = (*env)->GetByteArrayElements(env, sessionKey, NULL);
-    jbyte* c = (*env)->GetByteArrayElements(env, cipher, NULL);
-    jbyte* out = (*env)->GetByteArrayElements(env, outBuf, NULL);
-    if (!key || !c || !out) {
-        if (key) (*env)->ReleaseByteArrayElements(env, sessionKey, key, JNI_ABORT);
-        if (c) (*env)->ReleaseByteArrayElements(env, cipher, c, JNI_ABORT);
-        if (out) (*env)->ReleaseByteArrayElements(env, outBuf, out, JNI_ABORT);
+    NATIVE_ENTRY(clazz);
+    uint8_t key[32];
+    if (!cipher || get_fixed(env, sessionKey, key, 32) != 0) return -1;
+    jsize cipher_len = (*env)->GetArrayLength(env, cipher);
+    jsize out_len = outBuf ? (*env)->GetArrayLength(env, outBuf) : 0;
+    jbyte* c = pin(env, cipher);
+    jbyte* out = c && outBuf ? pin(env, outBuf) : NULL;
+    int r = -1;
+    if (c && (!outBuf || out))
+        r = pea_core_decrypt_wire(key, (uint64_t)nonce,
+            (const uint8_t*)c, (size_t)cipher_len, (uint8_t*)out, (size_t)out_len);
+    if (out) (*env)->ReleasePrimitiveArrayCritical(env, outBuf, out, r > 0 ? 0 : JNI_ABORT);
+    if (c) (*env)->ReleasePrimitiveArrayCritical(env, cipher, c, JNI_ABORT);
+    memset(key, 0, sizeof(key));
+    return (jint)r;
+}
+
+/* Resolve [off, off+len) of a direct ByteBuffer. NULL if buf is not direct or the range is out of bounds. */
+static uint8_t* direct_region(JNIEnv *env, jobject buf, jint off, jint len) {
+    if (!buf || off < 0 || len < 0) return NULL;
+    uint8_t* base = (uint8_t*)(*env)->GetDirectBufferAddress(env, buf);
+    jlong cap = (*env)->GetDirectBufferCapacity(env, buf);
+    if (!base || cap < 0 || (jlong)off + (jlong)len > cap) return NULL;
+    return base + off;
+}
+
+static jint JNICALL
+jni_encrypt_wire_direct(JNIEnv *env, jclass clazz,
+    jbyteArray sessionKey, jlong nonce, jobject plain, jint plainOff, jint plainLen,
+    jobject outBuf, jint outOff, jint outLen) {
+    NATIVE_ENTRY(clazz);
+    uint8_t* p = direct_region(env, plain, plainOff, plainLen);
+    uint8_t* out = direct_region(env, outBuf, outOff, outLen);
+    uint8_t key[32];
+    if (!p || !out || get_fixed(env, sessionKey, key, 32) != 0) return -1;
+    int r = pea_core_encrypt_wire(key, (uint64_t)nonce, p, (size_t)plainLen, out, (size_t)outLen);
+    memset(key, 0, sizeof(key));
+    return (jint)r;
+}
+
+static jint JNICALL
+jni_decrypt_wire_direct(JNIEnv *env, jclass clazz,
+    jbyteArray sessionKey, jlong nonce, jobject cipher, jint cipherOff, jint cipherLen,
+    jobject outBuf, jint outOff, jint outLen) {
+    NATIVE_ENTRY(clazz);
+    uint8_t* c = direct_region(env, cipher, cipherOff, cipherLen);
+    uint8_t* out = direct_region(env, outBuf, outOff, outLen);
+    uint8_t key[32];
+    if (!c || !out || get_fixed(env, sessionKey, key, 32) != 0) return -1;
+    int r = pea_core_decrypt_wire(key, (uint64_t)nonce, c, (size_t)cipherLen, out, (size_t)outLen);
+    memset(key, 0, sizeof(key));
+    return (jint)r;
+}
+
+static jint JNICALL
+jni_on_request_direct(JNIEnv *env, jclass clazz, jlong handle,
+    jstring url, jlong rangeStart, jlong rangeEnd, jobject outBuf, jint outOff, jint outLen) {
+    NATIVE_ENTRY(clazz);
+    uint8_t* out = direct_region(env, outBuf, outOff, outLen);
+    if (!url || !out) return -1;
+    const char* url_chars = (*env)->GetStringUTFChars(env, url, NULL);
+    if (!url_chars) return -1;
+    int r = pea_core_on_request((void*)(uintptr_t)handle,
+        (const uint8_t*)url_chars, strlen(url_chars),
+        (uint64_t)rangeStart, (uint64_t)rangeEnd, out, (size_t)outLen);
+    (*env)->ReleaseStringUTFChars(env, url, url_chars);
+    return (jint)r;
+}
+
+static jint JNICALL
+jni_take_output_direct(JNIEnv *env, jclass clazz, jlong handle,
+    jobject outBuf, jint outOff, jint outLen) {
+    NATIVE_ENTRY(clazz);
+    uint8_t* out = direct_region(env, outBuf, outOff, outLen);
+    if (!out) return -1;
+    return (jint)pea_core_take_output((void*)(uintptr_t)handle, out, (size_t)outLen);
+}
+
+static jobject JNICALL
+jni_buffer_acquire(JNIEnv *env, jclass clazz, jint size) {
+    NATIVE_ENTRY(clazz);
+    if (size < 0) return NULL;
+    size_t cap;
+    void* p = pea_bufpool_acquire((size_t)size, &cap);
+    if (!p) return NULL;
+    jobject buf = (*env)->NewDirectByteBuffer(env, p, (jlong)cap);
+    if (!buf) pea_bufpool_release(p);
+    return buf;
+}
+
+static void JNICALL
+jni_buffer_release(JNIEnv *env, jclass clazz, jobject buf) {
+    NATIVE_ENTRY(clazz);
+    if (buf) pea_bufpool_release((*env)->GetDirectBufferAddress(env, buf));
+}
+
+static jlong JNICALL
+jni_chunk_verify_begin(JNIEnv *env, jclass clazz) {
+    (void)env;
+    NATIVE_ENTRY(clazz);
+    return (jlong)(uintptr_t)pea_core_chunk_verify_begin();
+}
+
+static jint JNICALL
+jni_chunk_verify_update(JNIEnv *env, jclass clazz, jlong verifier,
+    jobject buf, jint off, jint len) {
+    NATIVE_ENTRY(clazz);
+    uint8_t* p = direct_region(env, buf, off, len);
+    if (!verifier || !p) return -1;
+    return (jint)pea_core_chunk_verify_update((void*)(uintptr_t)verifier, p, (size_t)len);
+}
+
+static jint JNICALL
+jni_chunk_verify_finish(JNIEnv *env, jclass clazz, jlong verifier,
+    jbyteArray expectedHash, jbyteArray outHash) {
+    NATIVE_ENTRY(clazz);
+    if (!verifier) return -1;
+    uint8_t expected[32], digest[32];
+    int have_expected = expectedHash && (*env)->GetArrayLength(env, expectedHash) >= 32;
+    if (have_expected) get_region(env, expectedHash, 0, 32, (jbyte*)expected);
+    int r = pea_core_chunk_verify_finish((void*)(uintptr_t)verifier, have_expected ? expected : NULL, digest);
+    if (r >= 0 && outHash && (*env)->GetArrayLength(env, outHash) >= 32)
+        put_region(env, outHash, 0, 32, (const jbyte*)digest);
+    return (jint)r;
+}
+
+static jlong JNICALL
+jni_cipher_create(JNIEnv *env, jclass clazz, jbyteArray sessionKey) {
+    NATIVE_ENTRY(clazz);
+    uint8_t key[32];
+    if (get_fixed(env, sessionKey, key, 32) != 0) return 0;
+    void* c = pea_core_cipher_create(key);
+    memset(key, 0, sizeof(key));
+    return (jlong)(uintptr_t)c;
+}
+
+static void JNICALL
+jni_cipher_destroy(JNIEnv *env, jclass clazz, jlong cipher) {
+    (void)env;
+    NATIVE_ENTRY(clazz);
+    pea_core_cipher_destroy((void*)(uintptr_t)cipher);
+}
+
+static jint JNICALL
+jni_cipher_seal(JNIEnv *env, jclass clazz, jlong cipher,
+    jobject plain, jint plainOff, jint plainLen, jobject outBuf, jint outOff, jint outLen) {
+    NATIVE_ENTRY(clazz);
+    uint8_t* p = direct_region(env, plain, plainOff, plainLen);
+    uint8_t* out = direct_region(env, outBuf, outOff, outLen);
+    if (!cipher || !p || !out) return -1;
+    return (jint)pea_core_cipher_seal((void*)(uintptr_t)cipher, p, (size_t)plainLen, out, (size_t)outLen);
+}
+
+static jint JNICALL
+jni_cipher_open(JNIEnv *env, jclass clazz, jlong cipher,
+    jobject cipherBuf, jint cipherOff, jint cipherLen, jobject outBuf, jint outOff, jint outLen) {
+    NATIVE_ENTRY(clazz);
+    uint8_t* c = direct_region(env, cipherBuf, cipherOff, cipherLen);
+    uint8_t* out = direct_region(env, outBuf, outOff, outLen);
+    if (!cipher || !c || !out) return -1;
+    return (jint)pea_core_cipher_open((void*)(uintptr_t)cipher, c, (size_t)cipherLen, out, (size_t)outLen);
+}
+
+static jint JNICALL
+jni_open_and_dispatch(JNIEnv *env, jclass clazz, jlong handle,
+    jlong cipher, jbyteArray peerId, jobject frame, jint frameOff, jint frameLen,
+    jobject outBuf, jint outOff, jint outLen) {
+    NATIVE_ENTRY(clazz);
+    uint8_t pid[16];
+    if (!handle || !cipher || get_fixed(env, peerId, pid, 16) != 0) return -1;
+    uint8_t* f = direct_region(env, frame, frameOff, frameLen);
+    uint8_t* out = direct_region(env, outBuf, outOff, outLen);
+    if (!f || !out) return -1;
+    /* Decrypt in place: the plaintext never leaves the frame buffer before dispatch. */
+    int plain_len = pea_core_cipher_open((void*)(uintptr_t)cipher, f, (size_t)frameLen, f, (size_t)frameLen);
+    if (plain_len < 0) return PEA_JNI_OPEN_FAILED;
+    return (jint)pea_core_on_message_received((void*)(uintptr_t)handle, pid, f, (size_t)plain_len,
+        out, (size_t)outLen);
+}
+
+static jint JNICALL
+jni_on_messages_received_batch(JNIEnv *env, jclass clazz, jlong handle,
+    jobject records, jint recordsOff, jint recordsLen, jint recordCount,
+    jobject outBuf, jint outOff, jint outLen) {
+    NATIVE_ENTRY(clazz);
+    if (!handle || recordCount < 0) return -1;
+    uint8_t* r = direct_region(env, records, recordsOff, recordsLen);
+    uint8_t* out = direct_region(env, outBuf, outOff, outLen);
+    if (!r || !out) return -1;
+    return (jint)pea_core_on_messages_received_batch((void*)(uintptr_t)handle, r, (size_t)recordsLen,
+        (uint32_t)recordCount, out, (size_t)outLen);
+}
+
+/* Transport callbacks: everything goes to g_events (the transport thread never calls into Java). */
+static void tj_peer_connected(void* ctx, const uint8_t* peer_id_16) {
+    (void)ctx;
+    pea_events_post(g_events, PEA_EVENT_SOURCE_TRANSPORT, PEA_EVENT_PEER_CONNECTED, peer_id_16, 16, NULL, 0);
+}
+
+static void tj_peer_disconnected(void* ctx, const uint8_t* peer_id_16) {
+    (void)ctx;
+    pea_events_post(g_events, PEA_EVENT_SOURCE_TRANSPORT, PEA_EVENT_PEER_DISCONNECTED, peer_id_16, 16, NULL, 0);
+}
+
+static void tj_transfer_complete(void* ctx, const uint8_t* body, size_t body_len) {
+    (void)ctx;
+    pea_events_post(g_events, PEA_EVENT_SOURCE_TRANSPORT, PEA_EVENT_TRANSFER_COMPLETE, NULL, 0, body, body_len);
+}
+
+static const pea_transport_callbacks tj_callbacks = {
+    NULL,
+    NULL,
+    tj_peer_connected,
+    tj_peer_disconnected,
+    tj_transfer_complete,
+};
+
+static jlong JNICALL
+jni_transport_start(JNIEnv *env, jclass clazz, jlong handle, jint port) {
+    (void)env;
+    NATIVE_ENTRY(clazz);
+    if (!handle || port <= 0 || port > 65535) return 0;
+    return (jlong)(uintptr_t)pea_transport_start((void*)(uintptr_t)handle, (uint16_t)port, &tj_callbacks, NULL);
+}
+
+static void JNICALL
+jni_transport_stop(JNIEnv *env, jclass clazz, jlong transport) {
+    (void)env;
+    NATIVE_ENTRY(clazz);
+    pea_transport_stop((pea_transport*)(uintptr_t)transport);
+}
+
+static jint JNICALL
+jni_transport_connect(JNIEnv *env, jclass clazz, jlong transport,
+    jbyteArray deviceId, jbyteArray addr, jint port) {
+    NATIVE_ENTRY(clazz);
+    pea_transport* t = (pea_transport*)(uintptr_t)transport;
+    uint8_t id[16];
+    uint8_t a[16];
+    if (!t || !addr || port <= 0 || port > 65535 || get_fixed(env, deviceId, id, 16) != 0) return -1;
+    jsize addr_len = (*env)->GetArrayLength(env, addr);
+    if (addr_len != 4 && addr_len != 16) return -1;
+    get_region(env, addr, 0, addr_len, (jbyte*)a);
+    return (jint)pea_transport_connect(t, id, a, (size_t)addr_len, (uint16_t)port);
+}
+
+static jint JNICALL
+jni_transport_send_actions(JNIEnv *env, jclass clazz, jlong transport,
+    jbyteArray actions, jint len) {
+    NATIVE_ENTRY(clazz);
+    pea_transport* t = (pea_transport*)(uintptr_t)transport;
+    if (!t || !actions || len < 4 || len > (*env)->GetArrayLength(env, actions)) return -1;
+    /* send_actions only copies the bytes into the transport's queue. */
+    jbyte* a = pin(env, actions);
+    if (!a) return -1;
+    int r = pea_transport_send_actions(t, (const uint8_t*)a, (size_t)len);
+    (*env)->ReleasePrimitiveArrayCritical(env, actions, a, JNI_ABORT);
+    return (jint)r;
+}
+
+/* Discovery callbacks, posted to g_events like the transport's. */
+static void dj_peer_joined(void* ctx, const uint8_t* device_id_16, const uint8_t* public_key_32,
+    const uint8_t* addr, size_t addr_len, uint16_t port) {
+    (void)ctx;
+    uint8_t fixed[16 + 32 + 2 + 16];
+    if (addr_len != 4 && addr_len != 16) return;
+    memcpy(fixed, device_id_16, 16);
+    memcpy(fixed + 16, public_key_32, 32);
+    fixed[48] = (uint8_t)port;
+    fixed[49] = (uint8_t)(port >> 8);
+    memcpy(fixed + 50, addr, addr_len);
+    pea_events_post(g_events, PEA_EVENT_SOURCE_DISCOVERY, PEA_EVENT_PEER_JOINED, fixed, 50 + addr_len, NULL, 0);
+}
+
+static void dj_peer_left(void* ctx, const uint8_t* device_id_16, const uint8_t* actions, size_t actions_len) {
+    (void)ctx;
+    pea_events_post(g_events, PEA_EVENT_SOURCE_DISCOVERY, PEA_EVENT_PEER_LEFT, device_id_16, 16, actions,
+        actions_len);
+}
+
+static const pea_discovery_callbacks dj_callbacks = {
+    NULL,
+    NULL,
+    dj_peer_joined,
+    dj_peer_left,
+};
+
+static jlong JNICALL
+jni_discovery_start(JNIEnv *env, jclass clazz, jlong handle, jint listenPort, jboolean throttle) {
+    (void)env;
+    NATIVE_ENTRY(clazz);
+    if (!handle || listenPort <= 0 || listenPort > 65535) return 0;
+    return (jlong)(uintptr_t)pea_discovery_start((void*)(uintptr_t)handle, (uint16_t)listenPort,
+        throttle == JNI_TRUE, &dj_callbacks, NULL);
+}
+
+static void JNICALL
+jni_discovery_stop(JNIEnv *env, jclass clazz, jlong discovery) {
+    (void)env;
+    NATIVE_ENTRY(clazz);
+    pea_discovery_stop((pea_discovery*)(uintptr_t)discovery);
+}
+
+static void JNICALL
+jni_discovery_set_throttle(JNIEnv *env, jclass clazz, jlong discovery, jboolean throttle) {
+    (void)env;
+    NATIVE_ENTRY(clazz);
+    pea_discovery* d = (pea_discovery*)(uintptr_t)discovery;
+    if (d) pea_discovery_set_throttle(d, throttle == JNI_TRUE);
+}
+
+static jint JNICALL
+jni_poll_events(JNIEnv *env, jclass clazz, jobject outBuf, jint outOff, jint outLen, jint timeoutMs) {
+    NATIVE_ENTRY(clazz);
+    uint8_t* out = direct_region(env, outBuf, outOff, outLen);
+    if (!out) return -1;
+    return (jint)pea_events_poll(g_events, out, (size_t)outLen, (int)timeoutMs);
+}
+
+static void JNICALL
+jni_wake_events(JNIEnv *env, jclass clazz) {
+    (void)env;
+    NATIVE_ENTRY(clazz);
+    pea_events_wake(g_events);
+}
+
+static jlong JNICALL
+jni_tun_start(JNIEnv *env, jclass clazz, jint fd, jbyteArray tunAddr, jint proxyPort) {
+    NATIVE_ENTRY(clazz);
+    uint8_t addr[4];
+    if (fd < 0 || proxyPort <= 0 || proxyPort > 65535 || get_fixed(env, tunAddr, addr, 4) != 0) return 0;
+    return (jlong)(uintptr_t)pea_tun_start((int)fd, addr, (uint16_t)proxyPort);
+}
+
+static void JNICALL
+jni_tun_stop(JNIEnv *env, jclass clazz, jlong tun) {
+    (void)env;
+    NATIVE_ENTRY(clazz);
+    pea_tun_stop((pea_tun*)(uintptr_t)tun);
+}
+
+struct fetch_jni {
+    JNIEnv* env;
+    jobject vpn;
+};
+
+/* Runs on the calling thread, so the caller's env is valid. */
+static int fj_protect(void* ctx, int fd) {
+    struct fetch_jni* j = ctx;
+    jboolean ok = (*j->env)->CallBooleanMethod(j->env, j->vpn, g_vpn_protect, (jint)fd);
+    if ((*j->env)->ExceptionCheck(j->env)) {
+        (*j->env)->ExceptionClear(j->env);
         return -1;
     }
-    jsize cipher_len = (*env)->GetArrayLength(env, cipher);
-    jsize out_len = (*env)->GetArrayLength(env, outBuf);
-    int r = pea_core_decrypt_wire((const uint8_t*)key, (uint64_t)nonce,
-        (const uint8_t*)c, (size_t)cipher_len, (uint8_t*)out, (size_t)out_len);
-    (*env)->ReleaseByteArrayElements(env, sessionKey, key, JNI_ABORT);
-    (*env)->ReleaseByteArrayElements(env, cipher, c, JNI_ABORT);
-    (*env)->ReleaseByteArrayElements(env, outBuf, out, 0);
+    return ok == JNI_TRUE ? 0 : -1;
+}
+
+static jint JNICALL
+jni_fetch_self_chunks(JNIEnv *env, jclass clazz, jlong handle, jobject vpnService, jbyteArray transferId,
+    jstring host, jstring path, jlong base) {
+    NATIVE_ENTRY(clazz);
+    uint8_t tid[16];
+    if (!host || !path || base < 0 || get_fixed(env, transferId, tid, 16) != 0) return -1;
+    const char* host_chars = (*env)->GetStringUTFChars(env, host, NULL);
+    const char* path_chars = host_chars ? (*env)->GetStringUTFChars(env, path, NULL) : NULL;
+    int r = -1;
+    if (path_chars) {
+        struct fetch_jni j = { env, vpnService };
+        r = pea_fetch_self_chunks(g_fetch, (void*)(uintptr_t)handle, tid, host_chars, path_chars, (uint64_t)base,
+            vpnService ? fj_protect : NULL, &j);
+        (*env)->ReleaseStringUTFChars(env, path, path_chars);
+    }
+    if (host_chars) (*env)->ReleaseStringUTFChars(env, host, host_chars);
+    return (jint)r;
+}
+
+static jlong JNICALL
+jni_upload_start(JNIEnv *env, jclass clazz, jlong handle, jlong transport) {
+    (void)env;
+    NATIVE_ENTRY(clazz);
+    return (jlong)(uintptr_t)pea_upload_create((void*)(uintptr_t)handle, (pea_transport*)(uintptr_t)transport,
+        g_fetch);
+}
+
+/* Blocks on the calling (relay) thread until nativeUploadStop, so fj_protect can use its env throughout. */
+static void JNICALL
+jni_upload_serve(JNIEnv *env, jclass clazz, jlong upload, jobject vpnService) {
+    NATIVE_ENTRY(clazz);
+    struct fetch_jni j = { env, vpnService };
+    pea_upload_serve((pea_upload*)(uintptr_t)upload, vpnService ? fj_protect : NULL, &j);
+}
+
+static void JNICALL
+jni_upload_stop(JNIEnv *env, jclass clazz, jlong upload) {
+    (void)env;
+    NATIVE_ENTRY(clazz);
+    pea_upload_stop((pea_upload*)(uintptr_t)upload);
+}
+
+static void JNICALL
+jni_upload_destroy(JNIEnv *env, jclass clazz, jlong upload) {
+    (void)env;
+    NATIVE_ENTRY(clazz);
+    pea_upload_destroy((pea_upload*)(uintptr_t)upload);
+}
+
+static jint JNICALL
+jni_upload(JNIEnv *env, jclass clazz, jlong upload, jobject vpnService, jint fd, jlong length, jstring host,
+    jstring path) {
+    NATIVE_ENTRY(clazz);
+    if (!upload || fd < 0 || length <= 0 || !host || !path) return -1;
+    const char* host_chars = (*env)->GetStringUTFChars(env, host, NULL);
+    const char* path_chars = host_chars ? (*env)->GetStringUTFChars(env, path, NULL) : NULL;
+    int r = -1;
+    if (path_chars) {
+        struct fetch_jni j = { env, vpnService };
+        r = pea_upload_run((pea_upload*)(uintptr_t)upload, (int)fd, (uint64_t)length, host_chars, path_chars,
+            vpnService ? fj_protect : NULL, &j);
+        (*env)->ReleaseStringUTFChars(env, path, path_chars);
+    }
+    if (host_chars) (*env)->ReleaseStringUTFChars(env, host, host_chars);
     return (jint)r;
 }
+
+static jint JNICALL
+jni_set_tracing(JNIEnv *env, jclass clazz, jboolean enabled) {
+    (void)env;
+    NATIVE_ENTRY(clazz);
+    return (jint)pea_trace_set_enabled(enabled == JNI_TRUE);
+}
+
+/* Every PeaCore external, bound in JNI_OnLoad (no Java_* symbol lookup). Signatures follow PeaCore.kt. */
+static const JNINativeMethod core_methods[] = {
+    { "nativeCreate", "()J", (void*)jni_create },
+    { "nativeDestroy", "(J)V", (void*)jni_destroy },
+    { "nativeSetConfig", "(JJJII)I", (void*)jni_set_config },
+    { "nativeSetChunkCache", "(JJLjava/lang/String;)I", (void*)jni_set_chunk_cache },
+    { "nativeDeviceId", "(J)[B", (void*)jni_device_id },
+    { "nativeOnRequest", "(JLjava/lang/String;JJ[B)I", (void*)jni_on_request },
+    { "nativeOnRequestDirect", "(JLjava/lang/String;JJLjava/nio/ByteBuffer;II)I", (void*)jni_on_request_direct },
+    { "nativePeerJoined", "(J[B[B)I", (void*)jni_peer_joined },
+    { "nativePeerLeft", "(J[B[B)I", (void*)jni_peer_left },
+    { "nativeOnMessageReceived", "(J[B[B[B)I", (void*)jni_on_message_received },
+    { "nativeOnMessagesReceivedBatch", "(JLjava/nio/ByteBuffer;IIILjava/nio/ByteBuffer;II)I", (void*)jni_on_messages_received_batch },
+    { "nativeOnChunkReceived", "(J[BJJ[B[B[B)I", (void*)jni_on_chunk_received },
+    { "nativeChunkVerifyBegin", "()J", (void*)jni_chunk_verify_begin },
+    { "nativeChunkVerifyUpdate", "(JLjava/nio/ByteBuffer;II)I", (void*)jni_chunk_verify_update },
+    { "nativeChunkVerifyFinish", "(J[B[B)I", (void*)jni_chunk_verify_finish },
+    { "nativeSetTransferSinkFd", "(J[BI)I", (void*)jni_set_transfer_sink_fd },
+    { "nativeSetSpill", "(Ljava/lang/String;J)I", (void*)jni_set_spill },
+    { "nativeNextSelfChunk", "(J[B[J)I", (void*)jni_next_self_chunk },
+    { "nativeCancelTransfer", "(J[B)I", (void*)jni_cancel_transfer },
+    { "nativeTransferStatus", "(J[B[J)I", (void*)jni_transfer_status },
+    { "nativeBufferAcquire", "(I)Ljava/nio/ByteBuffer;", (void*)jni_buffer_acquire },
+    { "nativeBufferRelease", "(Ljava/nio/ByteBuffer;)V", (void*)jni_buffer_release },
+    { "nativeTick", "(J[B)I", (void*)jni_tick },
+    { "nativeTakeOutput", "(J[B)I", (void*)jni_take_output },
+    { "nativeTakeOutputDirect", "(JLjava/nio/ByteBuffer;II)I", (void*)jni_take_output_direct },
+    { "nativeStats", "(JLjava/nio/ByteBuffer;)I", (void*)jni_stats },
+    { "nativeSetTracing", "(Z)I", (void*)jni_set_tracing },
+    { "nativeBeaconFrame", "(JI[B)I", (void*)jni_beacon_frame },
+    { "nativeDiscoveryResponseFrame", "(JI[B)I", (void*)jni_discovery_response_frame },
+    { "nativeDecodeDiscoveryFrame", "([BI[B[B[I)I", (void*)jni_decode_discovery_frame },
+    { "nativeHandshakeBytes", "(J[B)I", (void*)jni_handshake_bytes },
+    { "nativeSessionKey", "(J[B[B)I", (void*)jni_session_key },
+    { "nativeEncryptWire", "([BJ[B[B)I", (void*)jni_encrypt_wire },
+    { "nativeDecryptWire", "([BJ[B[B)I", (void*)jni_decrypt_wire },
+    { "nativeEncryptWireDirect", "([BJLjava/nio/ByteBuffer;IILjava/nio/ByteBuffer;II)I", (void*)jni_encrypt_wire_direct },
+    { "nativeDecryptWireDirect", "([BJLjava/nio/ByteBuffer;IILjava/nio/ByteBuffer;II)I", (void*)jni_decrypt_wire_direct },
+    { "nativeCipherCreate", "([B)J", (void*)jni_cipher_create },
+    { "nativeCipherDestroy", "(J)V", (void*)jni_cipher_destroy },
+    { "nativeCipherSeal", "(JLjava/nio/ByteBuffer;IILjava/nio/ByteBuffer;II)I", (void*)jni_cipher_seal },
+    { "nativeCipherOpen", "(JLjava/nio/ByteBuffer;IILjava/nio/ByteBuffer;II)I", (void*)jni_cipher_open },
+    { "nativeOpenAndDispatch", "(JJ[BLjava/nio/ByteBuffer;IILjava/nio/ByteBuffer;II)I", (void*)jni_open_and_dispatch },
+    { "nativeTransportStart", "(JI)J", (void*)jni_transport_start },
+    { "nativeTransportStop", "(J)V", (void*)jni_transport_stop },
+    { "nativeTransportConnect", "(J[B[BI)I", (void*)jni_transport_connect },
+    { "nativeTransportSendActions", "(J[BI)I", (void*)jni_transport_send_actions },
+    { "nativeDiscoveryStart", "(JIZ)J", (void*)jni_discovery_start },
+    { "nativeDiscoveryStop", "(J)V", (void*)jni_discovery_stop },
+    { "nativeDiscoverySetThrottle", "(JZ)V", (void*)jni_discovery_set_throttle },
+    { "nativeTunStart", "(I[BI)J", (void*)jni_tun_start },
+    { "nativeTunStop", "(J)V", (void*)jni_tun_stop },
+    { "nativePollEvents", "(Ljava/nio/ByteBuffer;III)I", (void*)jni_poll_events },
+    { "nativeWakeEvents", "()V", (void*)jni_wake_events },
+    { "nativeFetchSelfChunks", "(JLandroid/net/VpnService;[BLjava/lang/String;Ljava/lang/String;J)I",
+        (void*)jni_fetch_self_chunks },
+    { "nativeUploadStart", "(JJ)J", (void*)jni_upload_start },
+    { "nativeUploadServe", "(JLandroid/net/VpnService;)V", (void*)jni_upload_serve },
+    { "nativeUploadStop", "(J)V", (void*)jni_upload_stop },
+    { "nativeUploadDestroy", "(J)V", (void*)jni_upload_destroy },
+    { "nativeUpload", "(JLandroid/net/VpnService;IJLjava/lang/String;Ljava/lang/String;)I", (void*)jni_upload },
+};
+
+/* Whether the linked core speaks PeaCore.PROTOCOL_VERSION, the version the app advertises in its handshake. A
+ * mismatched core must not load: peers would reject every frame it builds. */
+static int core_version_matches(JNIEnv* env, jclass core) {
+    jfieldID version = (*env)->GetStaticFieldID(env, core, "PROTOCOL_VERSION", "I");
+    if (!version) {
+        (*env)->ExceptionClear(env);
+        return 0;
+    }
+    return (*env)->GetStaticIntField(env, core, version) == (jint)pea_core_version();
+}
+
+/* Check the protocol version, bind the natives, resolve VpnService.protect once, create the fetcher and event
+ * queue and honour debug.peapod.trace; a mismatch fails System.loadLibrary instead of a later call. */
+JNIEXPORT jint JNI_OnLoad(JavaVM *vm, void *reserved) {
+    (void)reserved;
+    JNIEnv* env;
+    if ((*vm)->GetEnv(vm, (void**)&env, JNI_VERSION_1_6) != JNI_OK) return JNI_ERR;
+    jclass core = (*env)->FindClass(env, PEA_CORE_JNI);
+    if (!core) return JNI_ERR;
+    if (!core_version_matches(env, core)) {
+        (*env)->DeleteLocalRef(env, core);
+        return JNI_ERR;
+    }
+    jint r = (*env)->RegisterNatives(env, core, core_methods,
+        (jint)(sizeof(core_methods) / sizeof(core_methods[0])));
+    (*env)->DeleteLocalRef(env, core);
+    if (r != JNI_OK) return JNI_ERR;
+    jclass cls = (*env)->FindClass(env, PEA_VPN_SERVICE_JNI);
+    if (!cls) return JNI_ERR;
+    g_vpn_protect = (*env)->GetMethodID(env, cls, "protect", "(I)Z");
+    (*env)->DeleteLocalRef(env, cls);
+    if (!g_vpn_protect) return JNI_ERR;
+    if (!g_fetch) g_fetch = pea_fetch_create();
+    if (!g_events) g_events = pea_events_create();
+    pea_trace_init_from_property();
+    return g_fetch && g_events ? JNI_VERSION_1_6 : JNI_ERR;
+}
@@ -0,0 +1,224 @@
+/* Shared-memory frame rings and the Unix socket plumbing that sets them up (see pea_shm.h). */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* F_ADD_SEALS, MFD_* and SCM_RIGHTS under -std=c11 */
+#endif
+#include "pea_shm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* memfd_create is a libc function only from API 30; minSdk is 24. */
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_GET_SEALS 1034
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+
+/* Mapping: a page of ring heads (one cache line each), then ring 0 (attacher -> creator), then ring 1. */
+#define HEADER_SIZE 4096
+#define HEAD_STRIDE 64
+#define MAP_SIZE ((size_t)HEADER_SIZE + 2 * (size_t)PEA_SHM_RING_SIZE)
+
+struct pea_shm {
+    uint8_t* map;
+    uint8_t* tx;
+    uint8_t* rx;
+    /* Advanced by the peer as it releases what this side wrote, and by this side for the peer. */
+    atomic_uint_least64_t* tx_head;
+    atomic_uint_least64_t* rx_head;
+    uint64_t tx_pos;
+    uint64_t rx_pos;
+};
+
+static pea_shm* map_rings(int fd, int creator) {
+    uint8_t* map = mmap(NULL, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) return NULL;
+    pea_shm* s = calloc(1, sizeof(*s));
+    if (!s) {
+        munmap(map, MAP_SIZE);
+        return NULL;
+    }
+    s->map = map;
+    uint8_t* ring0 = map + HEADER_SIZE;
+    uint8_t* ring1 = ring0 + PEA_SHM_RING_SIZE;
+    atomic_uint_least64_t* head0 = (atomic_uint_least64_t*)map;
+    atomic_uint_least64_t* head1 = (atomic_uint_least64_t*)(map + HEAD_STRIDE);
+    s->tx = creator ? ring1 : ring0;
+    s->rx = creator ? ring0 : ring1;
+    s->tx_head = creator ? head1 : head0;
+    s->rx_head = creator ? head0 : head1;
+    return s;
+}
+
+pea_shm* pea_shm_create(int* out_fd) {
+    if (!out_fd) return NULL;
+#ifdef SYS_memfd_create
+    int fd = (int)syscall(SYS_memfd_create, "peapod-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+    int fd = -1;
+#endif
+    if (fd < 0) return NULL;
+    /* Sealed before the peer sees it: neither side can resize the file under the other's mapping. */
+    if (ftruncate(fd, (off_t)MAP_SIZE) != 0
+        || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+        close(fd);
+        return NULL;
+    }
+    pea_shm* s = map_rings(fd, 1);
+    if (!s) {
+        close(fd);
+        return NULL;
+    }
+    *out_fd = fd;
+    return s;
+}
+
+pea_shm* pea_shm_attach(int fd) {
+    struct stat st;
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || !(seals & F_SEAL_SHRINK) || fstat(fd, &st) != 0 || (size_t)st.st_size != MAP_SIZE) return NULL;
+    return map_rings(fd, 0);
+}
+
+void pea_shm_destroy(pea_shm* s) {
+    if (!s) return;
+    munmap(s->map, MAP_SIZE);
+    free(s);
+}
+
+int pea_shm_write(pea_shm* s, const uint8_t* frame, size_t len, uint64_t* out_pos) {
+    if (!s || len == 0 || len > PEA_SHM_RING_SIZE) return -1;
+    uint64_t head = atomic_load_explicit(s->tx_head, memory_order_acquire);
+    /* The head is the peer's to write; one that is ahead of us or a lap behind is not trusted. */
+    if (head > s->tx_pos || s->tx_pos - head > PEA_SHM_RING_SIZE) return -1;
+    uint64_t pos = s->tx_pos;
+    size_t off = (size_t)(pos % PEA_SHM_RING_SIZE);
+    /* Frames never wrap: skip to the start of the ring when the tail end is too short. */
+    if (len > PEA_SHM_RING_SIZE - off) pos += PEA_SHM_RING_SIZE - off;
+    if (pos + len - head > PEA_SHM_RING_SIZE) return -1;
+    memcpy(s->tx + pos % PEA_SHM_RING_SIZE, frame, len);
+    atomic_thread_fence(memory_order_release);
+    s->tx_pos = pos + len;
+    *out_pos = pos;
+    return 0;
+}
+
+const uint8_t* pea_shm_read(pea_shm* s, uint64_t pos, size_t len) {
+    if (!s || len == 0 || len > PEA_SHM_RING_SIZE || pos < s->rx_pos || pos - s->rx_pos >= PEA_SHM_RING_SIZE)
+        return NULL;
+    size_t off = (size_t)(pos % PEA_SHM_RING_SIZE);
+    if (len > PEA_SHM_RING_SIZE - off) return NULL;
+    atomic_thread_fence(memory_order_acquire);
+    s->rx_pos = pos + len;
+    return s->rx + off;
+}
+
+void pea_shm_release(pea_shm* s) {
+    if (s) atomic_store_explicit(s->rx_head, s->rx_pos, memory_order_release);
+}
+
+/* "\0peapod-shm-" + hex device id: abstract, so nothing to clean up and gone with the process. */
+static socklen_t shm_addr(const uint8_t* device_id_16, struct sockaddr_un* a) {
+    static const char prefix[] = "peapod-shm-";
+    static const char hex[] = "0123456789abcdef";
+    memset(a, 0, sizeof(*a));
+    a->sun_family = AF_UNIX;
+    char* p = a->sun_path + 1;
+    memcpy(p, prefix, sizeof(prefix) - 1);
+    p += sizeof(prefix) - 1;
+    for (int i = 0; i < 16; i++) {
+        *p++ = hex[device_id_16[i] >> 4];
+        *p++ = hex[device_id_16[i] & 15];
+    }
+    return (socklen_t)(p - (char*)a);
+}
+
+int pea_shm_listen(const uint8_t* device_id_16) {
+    struct sockaddr_un a;
+    socklen_t a_len = shm_addr(device_id_16, &a);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (bind(fd, (struct sockaddr*)&a, a_len) != 0 || listen(fd, 8) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int pea_shm_connect(const uint8_t* device_id_16) {
+    struct sockaddr_un a;
+    socklen_t a_len = shm_addr(device_id_16, &a);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    /* A Unix connect completes at once or not at all (a full backlog is EAGAIN): no pending state to track. */
+    if (connect(fd, (struct sockaddr*)&a, a_len) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int pea_shm_send_fd(int sock, int fd) {
+    uint8_t byte = 0;
+    struct iovec iov = { &byte, 1 };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+    memset(&ctrl, 0, sizeof(ctrl));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+    ssize_t n;
+    while ((n = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {}
+    return n == 1 ? 0 : -1;
+}
+
+int pea_shm_recv_fd(int sock) {
+    uint8_t byte;
+    struct iovec iov = { &byte, 1 };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    ssize_t n;
+    while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {}
+    if (n != 1) return -1;
+    struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    if (!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS || cm->cmsg_len != CMSG_LEN(sizeof(int)))
+        return -1;
+    int fd;
+    memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+    return fd;
+}
@@ -0,0 +1,52 @@
+/* Same-host fast path for pea_transport: two peas on one kernel (work profile, second user, a container) swap
+ * frames through a shared memfd instead of sealing them and pushing them through loopback TCP. The memfd holds one
+ * ring per direction; each frame is copied into the sender's ring once and only a small sealed descriptor crosses
+ * the TCP connection, so the payload skips AEAD and both socket copies. The receiver copies a frame out before
+ * using it, since the peer can still write the ring. Co-location is found by connecting to the peer's abstract Unix
+ * socket, named after its device id; the memfd crosses that socket with SCM_RIGHTS once the TCP session
+ * (authenticated by the handshake) has vouched for a one-time token. */
+#ifndef PEA_SHM_H
+#define PEA_SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Per direction; frames larger than this always go over TCP. */
+#define PEA_SHM_RING_SIZE (8u * 1024 * 1024)
+
+typedef struct pea_shm pea_shm;
+
+/* Create a sealed memfd and map it (the responder's side). *out_fd is the memfd to pass to the peer; close it once
+ * sent. NULL on failure (e.g. no memfd_create on this kernel). */
+pea_shm* pea_shm_create(int* out_fd);
+
+/* Map a memfd received from the peer that created it. Only a memfd sealed against shrinking is accepted, so the
+ * peer cannot truncate it under this process. The caller keeps (and closes) fd. NULL on failure. */
+pea_shm* pea_shm_attach(int fd);
+
+void pea_shm_destroy(pea_shm* s);
+
+/* Copy frame into the send ring. Returns 0 with its position in *out_pos, or -1 when it does not fit now (too
+ * large, or the peer has not released enough yet): send it over TCP instead. Sender thread only. */
+int pea_shm_write(pea_shm* s, const uint8_t* frame, size_t len, uint64_t* out_pos);
+
+/* The frame the peer wrote at pos. Descriptors must arrive in write order; NULL when pos/len is out of order or
+ * outside the ring. Valid until pea_shm_release. Receiver thread only. */
+const uint8_t* pea_shm_read(pea_shm* s, uint64_t pos, size_t len);
+
+/* Hand everything read so far back to the peer's writer. */
+void pea_shm_release(pea_shm* s);
+
+/* Abstract Unix listener for device_id (nonblocking, CLOEXEC), or -1. */
+int pea_shm_listen(const uint8_t* device_id_16);
+
+/* Nonblocking connect to the listener of a pea with device_id on this host; -1 when there is none. */
+int pea_shm_connect(const uint8_t* device_id_16);
+
+/* Send fd (SCM_RIGHTS) over a Unix socket. Returns 0 or -1. */
+int pea_shm_send_fd(int sock, int fd);
+
+/* Receive an fd sent with pea_shm_send_fd; -1 if none is waiting. */
+int pea_shm_recv_fd(int sock);
+
+#endif
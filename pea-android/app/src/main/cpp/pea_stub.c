@@ -6,12 +6,41 @@ uint8_t pea_core_version(void) { return 1; }
 void* pea_core_create(void) { return NULL; }
 void pea_core_destroy(void* h) { (void)h; }
 int pea_core_device_id(void* h, void* out_buf, size_t out_len) { (void)h; (void)out_buf; (void)out_len; return -1; }
+int pea_core_set_config(void* h, const void* cfg) { (void)h; (void)cfg; return -1; }
+int pea_core_set_chunk_cache(void* h, uint64_t budget_bytes, void* arena, size_t arena_len) { (void)h; (void)budget_bytes; (void)arena; (void)arena_len; return -1; }
 int pea_core_on_request(void* h, const void* url, size_t url_len, uint64_t range_start, uint64_t range_end, void* out_buf, size_t out_buf_len) { (void)h; (void)url; (void)url_len; (void)range_start; (void)range_end; (void)out_buf; (void)out_buf_len; return -1; }
 int pea_core_peer_joined(void* h, const void* device_id_16, const void* public_key_32) { (void)h; (void)device_id_16; (void)public_key_32; return -1; }
 int pea_core_peer_left(void* h, const void* device_id_16, void* out_buf, size_t out_buf_len) { (void)h; (void)device_id_16; (void)out_buf; (void)out_buf_len; return 0; }
 int pea_core_on_message_received(void* h, const void* peer_id_16, const void* msg, size_t msg_len, void* out_buf, size_t out_buf_len) { (void)h; (void)peer_id_16; (void)msg; (void)msg_len; (void)out_buf; (void)out_buf_len; return -1; }
+int pea_core_on_messages_received_batch(void* h, const void* records, size_t records_len, uint32_t record_count, void* out_buf, size_t out_buf_len) { (void)h; (void)records; (void)records_len; (void)record_count; (void)out_buf; (void)out_buf_len; return -1; }
+int pea_core_on_messages_received_v(void* h, const void* msgs, size_t msg_count, void* out_buf, size_t out_buf_len) { (void)h; (void)msgs; (void)msg_count; (void)out_buf; (void)out_buf_len; return -1; }
 int pea_core_on_chunk_received(void* h, const void* transfer_id_16, uint64_t start, uint64_t end, const void* hash_32, const void* payload, size_t payload_len, void* out_buf, size_t out_buf_len) { (void)h; (void)transfer_id_16; (void)start; (void)end; (void)hash_32; (void)payload; (void)payload_len; (void)out_buf; (void)out_buf_len; return -1; }
+int pea_core_set_transfer_validator(void* h, const void* transfer_id_16, const void* validator, size_t validator_len) { (void)h; (void)transfer_id_16; (void)validator; (void)validator_len; return -1; }
+void* pea_core_chunk_verify_begin(void) { return NULL; }
+int pea_core_chunk_verify_update(void* v, const void* data, size_t len) { (void)v; (void)data; (void)len; return -1; }
+int pea_core_chunk_verify_finish(void* v, const void* expected_hash_32, void* out_hash_32) { (void)v; (void)expected_hash_32; (void)out_hash_32; return -1; }
+int pea_core_set_transfer_sink(void* h, const void* transfer_id_16, int (*sink)(void* ctx, const void* iov, size_t iov_count), void* ctx) { (void)h; (void)transfer_id_16; (void)sink; (void)ctx; return -1; }
+int pea_core_next_self_chunk(void* h, const void* transfer_id_16, uint64_t* out_start, uint64_t* out_end) { (void)h; (void)transfer_id_16; (void)out_start; (void)out_end; return -1; }
+int pea_core_receive_cached_chunk(void* h, const void* transfer_id_16, uint64_t start, uint64_t end, void* out_buf, size_t out_buf_len) { (void)h; (void)transfer_id_16; (void)start; (void)end; (void)out_buf; (void)out_buf_len; return 2; }
+int pea_core_set_transfer_spill(void* h, const void* transfer_id_16, void* area, size_t area_len, uint64_t window_bytes, void (*release)(void* ctx), void* ctx) { (void)h; (void)transfer_id_16; (void)area; (void)area_len; (void)window_bytes; if (release) release(ctx); return -1; }
+int pea_core_next_self_chunks(void* h, const void* transfer_id_16, uint64_t* out_ranges, size_t max) { (void)h; (void)transfer_id_16; (void)out_ranges; (void)max; return -1; }
+int pea_core_cancel_transfer(void* h, const void* transfer_id_16) { (void)h; (void)transfer_id_16; return -1; }
+int pea_core_transfer_status(void* h, const void* transfer_id_16, void* out_buf, size_t out_buf_len) { (void)h; (void)transfer_id_16; (void)out_buf; (void)out_buf_len; return -1; }
+int pea_core_on_upload_request(void* h, const void* url, size_t url_len, uint64_t total_length, void* out_buf, size_t out_buf_len) { (void)h; (void)url; (void)url_len; (void)total_length; (void)out_buf; (void)out_buf_len; return 0; }
+int pea_core_next_upload_parts(void* h, const void* transfer_id_16, void* out_buf, size_t out_buf_len) { (void)h; (void)transfer_id_16; (void)out_buf; (void)out_buf_len; return -1; }
+int pea_core_upload_part_frame(void* h, const void* transfer_id_16, uint64_t start, uint64_t end, const void* payload, size_t payload_len, void* out_buf, size_t out_buf_len) { (void)h; (void)transfer_id_16; (void)start; (void)end; (void)payload; (void)payload_len; (void)out_buf; (void)out_buf_len; return -1; }
+int pea_core_upload_part_done(void* h, const void* transfer_id_16, uint64_t start, uint64_t end, int ok) { (void)h; (void)transfer_id_16; (void)start; (void)end; (void)ok; return -1; }
+int pea_core_upload_status(void* h, const void* transfer_id_16, void* out_buf, size_t out_buf_len) { (void)h; (void)transfer_id_16; (void)out_buf; (void)out_buf_len; return -1; }
+int pea_core_finish_upload(void* h, const void* transfer_id_16) { (void)h; (void)transfer_id_16; return -1; }
+int pea_core_take_upload_job(void* h, void* out_buf, size_t out_buf_len) { (void)h; (void)out_buf; (void)out_buf_len; return 0; }
+int pea_core_upload_ack(const void* peer_id_16, const void* transfer_id_16, uint64_t start, uint64_t end, int ok, void* out_buf, size_t out_buf_len) { (void)peer_id_16; (void)transfer_id_16; (void)start; (void)end; (void)ok; (void)out_buf; (void)out_buf_len; return -1; }
+uint64_t pea_core_wait_upload_event(void* h, uint64_t seen, uint32_t timeout_ms) { (void)h; (void)timeout_ms; return seen; }
 int pea_core_tick(void* h, void* out_buf, size_t out_buf_len) { (void)h; (void)out_buf; (void)out_buf_len; return 0; }
+int pea_core_tick_at(void* h, uint64_t now_ms, void* out_buf, size_t out_buf_len) { (void)h; (void)now_ms; (void)out_buf; (void)out_buf_len; return 0; }
+int pea_core_take_output(void* h, void* out_buf, size_t out_buf_len) { (void)h; (void)out_buf; (void)out_buf_len; return -1; }
+uint32_t pea_core_tick_interval_ms(void* h) { (void)h; return 0; }
+int pea_core_stats(void* h, void* out_buf, size_t out_buf_len) { (void)h; (void)out_buf; (void)out_buf_len; return -1; }
+void pea_core_set_trace_hooks(const void* hooks) { (void)hooks; }
 int pea_core_beacon_frame(void* h, uint16_t listen_port, void* out_buf, size_t out_buf_len) { (void)h; (void)listen_port; (void)out_buf; (void)out_buf_len; return -1; }
 int pea_core_discovery_response_frame(void* h, uint16_t listen_port, void* out_buf, size_t out_buf_len) { (void)h; (void)listen_port; (void)out_buf; (void)out_buf_len; return -1; }
 int pea_core_decode_discovery_frame(const void* bytes, size_t len, void* out_device_id_16, void* out_public_key_32, uint16_t* out_listen_port) { (void)bytes; (void)len; (void)out_device_id_16; (void)out_public_key_32; (void)out_listen_port; return -1; }
@@ -19,3 +48,7 @@ int pea_core_handshake_bytes(void* h, void* out_buf, size_t out_buf_len) { (void
 int pea_core_session_key(void* h, const void* peer_public_key_32, void* out_session_key_32) { (void)h; (void)peer_public_key_32; (void)out_session_key_32; return -1; }
 int pea_core_encrypt_wire(const void* session_key_32, uint64_t nonce, const void* plain, size_t plain_len, void* out_buf, size_t out_buf_len) { (void)session_key_32; (void)nonce; (void)plain; (void)plain_len; (void)out_buf; (void)out_buf_len; return -1; }
 int pea_core_decrypt_wire(const void* session_key_32, uint64_t nonce, const void* cipher, size_t cipher_len, void* out_buf, size_t out_buf_len) { (void)session_key_32; (void)nonce; (void)cipher; (void)cipher_len; (void)out_buf; (void)out_buf_len; return -1; }
+void* pea_core_cipher_create(const void* session_key_32) { (void)session_key_32; return NULL; }
+void pea_core_cipher_destroy(void* c) { (void)c; }
+int pea_core_cipher_seal(void* c, const void* plain, size_t plain_len, void* out_buf, size_t out_buf_len) { (void)c; (void)plain; (void)plain_len; (void)out_buf; (void)out_buf_len; return -1; }
+int pea_core_cipher_open(void* c, const void* cipher, size_t cipher_len, void* out_buf, size_t out_buf_len) { (void)c; (void)cipher; (void)cipher_len; (void)out_buf; (void)out_buf_len; return -1; }
@@ -0,0 +1,60 @@
+/* ATrace glue (see pea_trace.h). The functions are resolved from libandroid once, on first use, and the library
+ * stays loaded for the process; the core is handed the same functions, so its sections cost no extra hop. */
+#include "pea_trace.h"
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#ifdef __ANDROID__
+#include <sys/system_properties.h>
+#endif
+
+#include "pea_core_ffi.h"
+
+atomic_int pea_trace_on;
+
+static pthread_once_t resolve_once = PTHREAD_ONCE_INIT;
+/* Static: the core may end a section through these after tracing is turned off. */
+static pea_trace_hooks atrace;
+
+static void resolve(void) {
+    void* lib = dlopen("libandroid.so", RTLD_NOW | RTLD_LOCAL);
+    if (!lib) return;
+    /* ATrace_beginSection and ATrace_endSection since API 23, the async pair since API 29. */
+    void (*begin)(const char*) = (void (*)(const char*))dlsym(lib, "ATrace_beginSection");
+    void (*end)(void) = (void (*)(void))dlsym(lib, "ATrace_endSection");
+    if (!begin || !end) return;
+    atrace.begin_async_section = (void (*)(const char*, int32_t))dlsym(lib, "ATrace_beginAsyncSection");
+    atrace.end_async_section = (void (*)(const char*, int32_t))dlsym(lib, "ATrace_endAsyncSection");
+    if (!atrace.begin_async_section || !atrace.end_async_section) {
+        atrace.begin_async_section = NULL;
+        atrace.end_async_section = NULL;
+    }
+    atrace.begin_section = begin;
+    atrace.end_section = end;
+}
+
+int pea_trace_set_enabled(int enabled) {
+    pthread_once(&resolve_once, resolve);
+    if (enabled && !atrace.begin_section) return -1;
+    atomic_store_explicit(&pea_trace_on, enabled != 0, memory_order_release);
+    pea_core_set_trace_hooks(enabled ? &atrace : NULL);
+    return 0;
+}
+
+void pea_trace_init_from_property(void) {
+#ifdef __ANDROID__
+    char value[PROP_VALUE_MAX];
+    if (__system_property_get("debug.peapod.trace", value) > 0 && value[0] == '1') (void)pea_trace_set_enabled(1);
+#endif
+}
+
+/* Only reached while pea_trace_on, which is only set once both are resolved. */
+void pea_trace_begin(const char* name) {
+    atrace.begin_section(name);
+}
+
+void pea_trace_end(void) {
+    atrace.end_section();
+}
@@ -0,0 +1,39 @@
+/* ATrace sections for systrace and Perfetto: one per PeaCore native (NATIVE_ENTRY in pea_jni.c) and, through
+ * pea_core_set_trace_hooks, the core's own phases and an async slice per transfer. Off until pea_trace_set_enabled
+ * (PeaCore.nativeSetTracing, or the debug.peapod.trace property when the library loads); while off a section costs
+ * one atomic load. libandroid's ATrace_* are looked up at run time, so devices before API 29 get the sections
+ * without the async slices. */
+#ifndef PEA_TRACE_H
+#define PEA_TRACE_H
+
+#include <stdatomic.h>
+
+/* Nonzero while tracing is on; read by PEA_TRACE_SCOPE. */
+extern atomic_int pea_trace_on;
+
+/* Turn tracing on or off. 0, or -1 when this device has no ATrace (tracing stays off). */
+int pea_trace_set_enabled(int enabled);
+
+/* Turn tracing on if the debug.peapod.trace system property is 1 (`adb shell setprop debug.peapod.trace 1`, then
+ * restart the app). No-op off Android. */
+void pea_trace_init_from_property(void);
+
+void pea_trace_begin(const char* name);
+void pea_trace_end(void);
+
+static inline int pea_trace_scope_begin(const char* name) {
+    if (!atomic_load_explicit(&pea_trace_on, memory_order_acquire)) return 0;
+    pea_trace_begin(name);
+    return 1;
+}
+
+static inline void pea_trace_scope_end(const int* open) {
+    if (*open) pea_trace_end();
+}
+
+/* Section name (a string that outlives the call) from here to the end of the enclosing block; one per block.
+ * Whether it opened is kept, so turning tracing off mid-call still ends it. Needs the cleanup attribute (clang, GCC). */
+#define PEA_TRACE_SCOPE(name) \
+    __attribute__((cleanup(pea_trace_scope_end))) int pea_trace_scope_ = pea_trace_scope_begin(name)
+
+#endif
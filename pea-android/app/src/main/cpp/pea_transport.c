@@ -0,0 +1,1034 @@
+/* Native peer transport (see pea_transport.h): epoll loop over the listen socket, a wake eventfd
+ * for commands from other threads, the core's tick timerfd, and every peer connection. All connection state is touched only
+ * by the transport thread, so per-connection ciphers seal in queue order without locking. A peer on the same host
+ * also gets a shared-memory ring (pea_shm.h) for large frames, set up with control frames on the sealed stream. */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* accept4, MSG_NOSIGNAL */
+#endif
+#include "pea_transport.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pea_bufpool.h"
+#include "pea_core_ffi.h"
+#include "pea_shm.h"
+
+#define HANDSHAKE_SIZE 49
+#define LEN_SIZE 4
+#define TAG_SIZE 16
+#define MAX_FRAME_LEN (16u * 1024 * 1024)
+/* Initial per-connection input buffer (one default chunk plus framing); grown on demand up to MAX_FRAME_LEN. */
+#define INITIAL_IN_BUF (256 * 1024 + 1024)
+/* A peer that lets this much sealed output pile up is dropped rather than buffered without bound. */
+#define MAX_OUT_PENDING (64u * 1024 * 1024)
+#define SCRATCH_SIZE 65536
+/* Same as the 30 s soTimeout the Kotlin transport used: handshake deadline and idle read limit. */
+#define IO_TIMEOUT_MS 30000
+#define MAX_EVENTS 64
+/* Transport control frames for the same-host path: sealed like any frame but never handed to the core. They open
+ * with u32::MAX, which is no Message variant tag, and only go to a peer that answered on its Unix socket. */
+#define SHM_MAGIC 0xffffffffu
+#define CTRL_HEADER 5
+/* Smaller frames are sealed as usual: a descriptor plus a copy would cost about as much. */
+#define SHM_MIN_FRAME (16 * 1024)
+/* Unix links accepted but not yet matched to an offer. */
+#define SHM_LINKS_MAX 8
+
+/* Control kinds, body after each: OFFER 16 token; READY, ACK none; DATA 8 ring position LE, 4 len LE. */
+enum { SHM_OFFER = 1, SHM_READY = 2, SHM_ACK = 3, SHM_DATA = 4 };
+/* OFFERED: outbound sent its token, waiting for READY; inbound got one, looking for the link. */
+enum shm_state { SHM_NONE, SHM_OFFERED, SHM_UP };
+
+enum conn_state { CONN_CONNECTING, CONN_HANDSHAKE, CONN_OPEN };
+
+struct conn {
+    int fd;
+    enum conn_state state;
+    int outbound;
+    /* Set when closing; freed after the current epoll batch so queued events never see freed memory. */
+    int dead;
+    /* Superseded by a newer connection to the same peer: close without peer_left. */
+    int replaced;
+    int want_out;
+    int64_t last_rx_ms;
+    /* Outbound: expected id until the handshake confirms it. */
+    uint8_t peer_id[16];
+    uint8_t hs[HANDSHAKE_SIZE];
+    size_t hs_len;
+    void* cipher;
+    uint8_t* in;
+    size_t in_len;
+    size_t in_cap;
+    /* in[0, in_consumed) holds frames opened this pass; the batch points into it until flush_batch. */
+    size_t in_consumed;
+    uint8_t* out;
+    size_t out_off;
+    size_t out_len;
+    size_t out_cap;
+    /* Same-host path: the outbound side's Unix link until READY, the ring once up, and whether DATA may be sent
+     * (outbound once it has mapped the ring, inbound once the peer has ACKed). */
+    enum shm_state shm_state;
+    uint8_t shm_token[16];
+    int shm_link;
+    pea_shm* shm;
+    int shm_tx;
+    struct conn* next;
+};
+
+struct shm_link {
+    int fd;
+    uint8_t token[16];
+    size_t token_len;
+    int64_t since;
+    struct shm_link* next;
+};
+
+enum cmd_kind { CMD_CONNECT, CMD_SEND_ACTIONS, CMD_SEND_FRAME };
+
+struct cmd {
+    enum cmd_kind kind;
+    uint8_t peer_id[16];
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    /* CMD_SEND_FRAME: a pooled buffer, the frame's len bytes after LEN_SIZE of headroom. Else malloc'd. */
+    uint8_t* data;
+    size_t len;
+    struct cmd* next;
+};
+
+struct pea_transport {
+    void* core;
+    pea_transport_callbacks cb;
+    void* cb_ctx;
+    int epfd;
+    int listen_fd;
+    int wake_fd;
+    /* Drives pea_core_tick_at; re-armed whenever pea_core_tick_interval_ms changes. */
+    int timer_fd;
+    uint32_t tick_interval_ms;
+    atomic_int running;
+    pthread_t thread;
+    pthread_mutex_t cmd_lock;
+    struct cmd* cmd_head;
+    struct cmd* cmd_tail;
+    struct conn* conns;
+    /* Frames opened during one epoll pass, dispatched together so the core checks their chunk hashes in one go. */
+    pea_message_ref* batch;
+    size_t batch_len;
+    size_t batch_cap;
+    /* Pooled private copies of ring frames the batch points into, released once it is dispatched. */
+    uint8_t** held;
+    size_t held_len;
+    size_t held_cap;
+    /* Output of pea_core_on_messages_received_v / pea_core_peer_left / pea_core_tick_at. SCRATCH_SIZE normally;
+     * grown to what the core reports it needs (e.g. a completed body) and shrunk back once delivered. */
+    uint8_t* scratch;
+    size_t scratch_cap;
+    /* Abstract Unix listener named after this device (-1 if unavailable) and links accepted from it. */
+    int shm_listen_fd;
+    struct shm_link* links;
+    size_t links_len;
+};
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint32_t get_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_le32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint64_t get_le64(const uint8_t* p) {
+    return (uint64_t)get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+static void put_le64(uint8_t* p, uint64_t v) {
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static void conn_kill(struct conn* c) {
+    c->dead = 1;
+}
+
+static void conn_set_events(pea_transport* t, struct conn* c) {
+    int want_out = c->state == CONN_CONNECTING || c->out_off < c->out_len;
+    if (want_out == c->want_out) return;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | (want_out ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    if (epoll_ctl(t->epfd, EPOLL_CTL_MOD, c->fd, &ev) == 0) c->want_out = want_out;
+}
+
+static struct conn* conn_add(pea_transport* t, int fd, enum conn_state state, int outbound) {
+    struct conn* c = calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    c->fd = fd;
+    c->state = state;
+    c->outbound = outbound;
+    c->last_rx_ms = now_ms();
+    c->want_out = state == CONN_CONNECTING;
+    c->shm_link = -1;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | (c->want_out ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    if (epoll_ctl(t->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        free(c);
+        return NULL;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c->next = t->conns;
+    t->conns = c;
+    return c;
+}
+
+static struct conn* find_open(pea_transport* t, const uint8_t* peer_id) {
+    for (struct conn* c = t->conns; c; c = c->next)
+        if (!c->dead && c->state == CONN_OPEN && memcmp(c->peer_id, peer_id, 16) == 0) return c;
+    return NULL;
+}
+
+/* Make room for need more output bytes (compacting first). 0 or -1 when the peer is too far behind. */
+static int out_reserve(struct conn* c, size_t need) {
+    if (c->out_cap - c->out_len >= need) return 0;
+    if (c->out_off > 0) {
+        memmove(c->out, c->out + c->out_off, c->out_len - c->out_off);
+        c->out_len -= c->out_off;
+        c->out_off = 0;
+        if (c->out_cap - c->out_len >= need) return 0;
+    }
+    if (c->out_len + need > MAX_OUT_PENDING) return -1;
+    size_t cap = c->out_cap ? c->out_cap : INITIAL_IN_BUF;
+    while (cap < c->out_len + need) cap *= 2;
+    uint8_t* p = realloc(c->out, cap);
+    if (!p) return -1;
+    c->out = p;
+    c->out_cap = cap;
+    return 0;
+}
+
+static void conn_flush(pea_transport* t, struct conn* c) {
+    while (c->out_off < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            conn_kill(c);
+            return;
+        }
+        c->out_off += (size_t)n;
+    }
+    if (c->out_off == c->out_len) c->out_off = c->out_len = 0;
+    conn_set_events(t, c);
+}
+
+static void queue_raw(pea_transport* t, struct conn* c, const uint8_t* bytes, size_t len) {
+    if (out_reserve(c, len) != 0) {
+        conn_kill(c);
+        return;
+    }
+    memcpy(c->out + c->out_len, bytes, len);
+    c->out_len += len;
+    conn_flush(t, c);
+}
+
+/* Seal plain straight into the output buffer behind its length prefix. */
+static void seal_frame(pea_transport* t, struct conn* c, const uint8_t* plain, size_t len) {
+    if (out_reserve(c, LEN_SIZE + len + TAG_SIZE) != 0) {
+        conn_kill(c);
+        return;
+    }
+    uint8_t* frame = c->out + c->out_len;
+    int n = pea_core_cipher_seal(c->cipher, plain, len, frame + LEN_SIZE, c->out_cap - c->out_len - LEN_SIZE);
+    if (n <= 0) {
+        /* The frame is lost and the nonce sequence may be off: the peer could only stall or fail to open. */
+        conn_kill(c);
+        return;
+    }
+    put_le32(frame, (uint32_t)n);
+    c->out_len += LEN_SIZE + (size_t)n;
+    conn_flush(t, c);
+}
+
+static void queue_ctrl(pea_transport* t, struct conn* c, uint8_t kind, const uint8_t* body, size_t body_len) {
+    uint8_t frame[CTRL_HEADER + 16];
+    put_le32(frame, SHM_MAGIC);
+    frame[4] = kind;
+    if (body_len) memcpy(frame + CTRL_HEADER, body, body_len);
+    seal_frame(t, c, frame, CTRL_HEADER + body_len);
+}
+
+/* A large frame to a same-host peer is copied into the ring if it has room and only its descriptor is sealed. */
+static void queue_frame(pea_transport* t, struct conn* c, const uint8_t* plain, size_t len) {
+    uint64_t pos;
+    if (c->shm_tx && len >= SHM_MIN_FRAME && pea_shm_write(c->shm, plain, len, &pos) == 0) {
+        uint8_t desc[12];
+        put_le64(desc, pos);
+        put_le32(desc + 8, (uint32_t)len);
+        queue_ctrl(t, c, SHM_DATA, desc, sizeof(desc));
+        return;
+    }
+    seal_frame(t, c, plain, len);
+}
+
+/* A frame from pea_transport_send_frame: sealed in its own buffer and sent from there when nothing is queued ahead
+ * of it. Frames that may go through the ring, or must wait behind queued output, take the usual path. */
+static void send_frame(pea_transport* t, const struct cmd* cmd) {
+    struct conn* c = find_open(t, cmd->peer_id);
+    if (!c) return;
+    uint8_t* plain = cmd->data + LEN_SIZE;
+    if (c->out_len > c->out_off || (c->shm_tx && cmd->len >= SHM_MIN_FRAME)) {
+        queue_frame(t, c, plain, cmd->len);
+        return;
+    }
+    int n = pea_core_cipher_seal(c->cipher, plain, cmd->len, plain, cmd->len + TAG_SIZE);
+    if (n <= 0) {
+        conn_kill(c);
+        return;
+    }
+    put_le32(cmd->data, (uint32_t)n);
+    size_t total = LEN_SIZE + (size_t)n, sent = 0;
+    while (sent < total) {
+        ssize_t w = send(c->fd, cmd->data + sent, total - sent, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            conn_kill(c);
+            return;
+        }
+        sent += (size_t)w;
+    }
+    if (sent < total) queue_raw(t, c, cmd->data + sent, total - sent);
+}
+
+static void cmd_free(struct cmd* cmd) {
+    if (cmd->kind == CMD_SEND_FRAME)
+        pea_bufpool_release(cmd->data);
+    else
+        free(cmd->data);
+    free(cmd);
+}
+
+/* Actions layout: 4 count LE, then each (16 peer_id, 4 len LE, payload). Unknown peers are skipped. */
+static void send_actions(pea_transport* t, const uint8_t* buf, size_t len) {
+    if (len < 4) return;
+    uint32_t count = get_le32(buf);
+    size_t off = 4;
+    for (uint32_t i = 0; i < count; i++) {
+        if (off + 20 > len) return;
+        const uint8_t* peer_id = buf + off;
+        uint32_t payload_len = get_le32(buf + off + 16);
+        off += 20;
+        if (payload_len > len - off) return;
+        struct conn* c = find_open(t, peer_id);
+        if (c) queue_frame(t, c, buf + off, payload_len);
+        off += payload_len;
+    }
+}
+
+static int batch_push(pea_transport* t, struct conn* c, const uint8_t* plain, size_t len) {
+    if (t->batch_len == t->batch_cap) {
+        size_t cap = t->batch_cap ? t->batch_cap * 2 : MAX_EVENTS;
+        pea_message_ref* p = realloc(t->batch, cap * sizeof(*p));
+        if (!p) return -1;
+        t->batch = p;
+        t->batch_cap = cap;
+    }
+    t->batch[t->batch_len++] = (pea_message_ref){ .peer_id = c->peer_id, .frame = plain, .len = len };
+    return 0;
+}
+
+/* A pooled buffer of len bytes that lives until the batch is dispatched (flush_batch). NULL on failure. */
+static uint8_t* batch_hold(pea_transport* t, size_t len) {
+    if (t->held_len == t->held_cap) {
+        size_t cap = t->held_cap ? t->held_cap * 2 : MAX_EVENTS;
+        uint8_t** p = realloc(t->held, cap * sizeof(*p));
+        if (!p) return NULL;
+        t->held = p;
+        t->held_cap = cap;
+    }
+    uint8_t* buf = pea_bufpool_acquire(len, NULL);
+    if (buf) t->held[t->held_len++] = buf;
+    return buf;
+}
+
+/* r is what a core call writing into scratch returned. When the output did not fit, grow scratch to the size the
+ * core reported and collect the output it kept (pea_core_take_output). Returns the output length, 0 if none. */
+static size_t core_output(pea_transport* t, int r) {
+    size_t need = PEA_CORE_NEEDED(r);
+    if (need > 0) {
+        if (need > t->scratch_cap) {
+            uint8_t* p = realloc(t->scratch, need);
+            if (!p) return 0;
+            t->scratch = p;
+            t->scratch_cap = need;
+        }
+        r = pea_core_take_output(t->core, t->scratch, t->scratch_cap);
+    }
+    return r > 0 ? (size_t)r : 0;
+}
+
+/* Give back memory from a one-off large output. */
+static void shrink_scratch(pea_transport* t) {
+    if (t->scratch_cap <= SCRATCH_SIZE) return;
+    uint8_t* p = realloc(t->scratch, SCRATCH_SIZE);
+    if (!p) return;
+    t->scratch = p;
+    t->scratch_cap = SCRATCH_SIZE;
+}
+
+/* Batch output: 4 completed count, each (16 transfer_id, 4 len LE, body), then the actions layout. */
+static void deliver_batch_output(pea_transport* t, size_t len) {
+    uint32_t completed = get_le32(t->scratch);
+    size_t off = 4;
+    for (uint32_t i = 0; i < completed; i++) {
+        if (len - off < 20) return;
+        uint32_t body_len = get_le32(t->scratch + off + 16);
+        off += 20;
+        if (body_len > len - off) return;
+        if (body_len > 0 && t->cb.on_transfer_complete)
+            t->cb.on_transfer_complete(t->cb_ctx, t->scratch + off, body_len);
+        off += body_len;
+    }
+    send_actions(t, t->scratch + off, len - off);
+}
+
+static int random_token(uint8_t* out) {
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    size_t have = 0;
+    while (have < 16) {
+        ssize_t n = read(fd, out + have, 16 - have);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        have += (size_t)n;
+    }
+    close(fd);
+    return have == 16 ? 0 : -1;
+}
+
+/* Outbound side, just after the handshake: a peer that answers on its Unix socket is on this host. Give it a fresh
+ * token over the link and the same token sealed over TCP; it only trusts a link the session vouched for. */
+static void shm_offer(pea_transport* t, struct conn* c) {
+    int link = pea_shm_connect(c->peer_id);
+    if (link < 0) return;
+    if (random_token(c->shm_token) != 0 || send(link, c->shm_token, 16, MSG_NOSIGNAL) != 16) {
+        close(link);
+        return;
+    }
+    c->shm_link = link;
+    c->shm_state = SHM_OFFERED;
+    queue_ctrl(t, c, SHM_OFFER, c->shm_token, 16);
+}
+
+static void link_close(pea_transport* t, struct shm_link** pp) {
+    struct shm_link* l = *pp;
+    *pp = l->next;
+    close(l->fd);
+    free(l);
+    t->links_len--;
+}
+
+/* Accept pending links and read the tokens they have sent. The listener is not in epoll: an offer only arrives
+ * after its link sent its token, so draining here when one does is enough. */
+static void shm_accept_links(pea_transport* t) {
+    for (;;) {
+        int fd = accept4(t->shm_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        struct shm_link* l = t->links_len < SHM_LINKS_MAX ? calloc(1, sizeof(*l)) : NULL;
+        if (!l) {
+            close(fd);
+            continue;
+        }
+        l->fd = fd;
+        l->since = now_ms();
+        l->next = t->links;
+        t->links = l;
+        t->links_len++;
+    }
+    struct shm_link** pp = &t->links;
+    while (*pp) {
+        struct shm_link* l = *pp;
+        if (l->token_len < 16) {
+            ssize_t n = recv(l->fd, l->token + l->token_len, 16 - l->token_len, 0);
+            if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                link_close(t, pp);
+                continue;
+            }
+            if (n > 0) l->token_len += (size_t)n;
+        }
+        pp = &l->next;
+    }
+}
+
+/* Inbound side, on OFFER: find the link that sent the same token, create the ring and pass it over that link. */
+static void shm_match(pea_transport* t, struct conn* c) {
+    if (t->shm_listen_fd < 0) return;
+    shm_accept_links(t);
+    for (struct shm_link** pp = &t->links; *pp; pp = &(*pp)->next) {
+        struct shm_link* l = *pp;
+        if (l->token_len != 16 || memcmp(l->token, c->shm_token, 16) != 0) continue;
+        int fd = -1;
+        pea_shm* s = pea_shm_create(&fd);
+        if (s && pea_shm_send_fd(l->fd, fd) == 0) {
+            c->shm = s;
+            c->shm_state = SHM_UP;
+            queue_ctrl(t, c, SHM_READY, NULL, 0);
+        } else {
+            pea_shm_destroy(s);
+        }
+        if (fd >= 0) close(fd);
+        link_close(t, pp);
+        return;
+    }
+}
+
+/* Handle a control frame; -1 kills the connection (a bad DATA descriptor). Out-of-turn setup frames are ignored. */
+static int shm_control(pea_transport* t, struct conn* c, const uint8_t* frame, size_t len) {
+    switch (frame[4]) {
+    case SHM_OFFER:
+        if (c->outbound || c->shm_state != SHM_NONE || len != CTRL_HEADER + 16) return 0;
+        memcpy(c->shm_token, frame + CTRL_HEADER, 16);
+        shm_match(t, c);
+        return 0;
+    case SHM_READY: {
+        if (!c->outbound || c->shm_state != SHM_OFFERED) return 0;
+        /* The peer passed the memfd before sealing READY, so it is already waiting on the link. */
+        int fd = pea_shm_recv_fd(c->shm_link);
+        close(c->shm_link);
+        c->shm_link = -1;
+        c->shm = fd >= 0 ? pea_shm_attach(fd) : NULL;
+        if (fd >= 0) close(fd);
+        c->shm_state = c->shm ? SHM_UP : SHM_NONE;
+        if (!c->shm) return 0;
+        c->shm_tx = 1;
+        queue_ctrl(t, c, SHM_ACK, NULL, 0);
+        return 0;
+    }
+    case SHM_ACK:
+        if (!c->outbound && c->shm_state == SHM_UP) c->shm_tx = 1;
+        return 0;
+    case SHM_DATA: {
+        if (!c->shm || len != CTRL_HEADER + 12) return -1;
+        uint32_t data_len = get_le32(frame + CTRL_HEADER + 8);
+        const uint8_t* data = pea_shm_read(c->shm, get_le64(frame + CTRL_HEADER), data_len);
+        /* The peer can still write its ring, so the core gets a private copy: bytes it has hashed cannot change
+         * under it. The ring space goes back at once. */
+        uint8_t* copy = data ? batch_hold(t, data_len) : NULL;
+        if (!copy) return -1;
+        memcpy(copy, data, data_len);
+        pea_shm_release(c->shm);
+        return batch_push(t, c, copy, data_len);
+    }
+    default:
+        return 0;
+    }
+}
+
+static void handshake_done(pea_transport* t, struct conn* c) {
+    const uint8_t* hs = c->hs;
+    if (hs[0] != pea_core_version()) {
+        conn_kill(c);
+        return;
+    }
+    if (c->outbound && memcmp(c->peer_id, hs + 1, 16) != 0) {
+        conn_kill(c);
+        return;
+    }
+    memcpy(c->peer_id, hs + 1, 16);
+    uint8_t key[32];
+    if (pea_core_session_key(t->core, hs + 17, key) != 0) {
+        conn_kill(c);
+        return;
+    }
+    c->cipher = pea_core_cipher_create(key);
+    memset(key, 0, sizeof(key));
+    c->in = malloc(INITIAL_IN_BUF);
+    if (!c->cipher || !c->in) {
+        conn_kill(c);
+        return;
+    }
+    c->in_cap = INITIAL_IN_BUF;
+    if (!c->outbound) {
+        uint8_t ours[HANDSHAKE_SIZE];
+        if (pea_core_handshake_bytes(t->core, ours, sizeof(ours)) != 0) {
+            conn_kill(c);
+            return;
+        }
+        queue_raw(t, c, ours, sizeof(ours));
+        if (c->dead) return;
+    }
+    struct conn* old = find_open(t, c->peer_id);
+    if (old) {
+        old->replaced = 1;
+        conn_kill(old);
+    }
+    c->state = CONN_OPEN;
+    if (c->outbound) shm_offer(t, c);
+    if (t->cb.on_peer_connected) t->cb.on_peer_connected(t->cb_ctx, c->peer_id);
+}
+
+/* Open every complete frame in c->in in place and queue it on the batch; flush_batch dispatches and compacts. */
+static void process_frames(pea_transport* t, struct conn* c) {
+    size_t off = c->in_consumed;
+    while (c->in_len - off >= LEN_SIZE) {
+        uint32_t len = get_le32(c->in + off);
+        if (len == 0 || len > MAX_FRAME_LEN) {
+            conn_kill(c);
+            return;
+        }
+        if (c->in_len - off < LEN_SIZE + (size_t)len) break;
+        uint8_t* frame = c->in + off + LEN_SIZE;
+        int plain_len = pea_core_cipher_open(c->cipher, frame, len, frame, len);
+        if (plain_len < 0) {
+            conn_kill(c);
+            return;
+        }
+        int r = plain_len >= CTRL_HEADER && get_le32(frame) == SHM_MAGIC
+            ? shm_control(t, c, frame, (size_t)plain_len)
+            : batch_push(t, c, frame, (size_t)plain_len);
+        if (r != 0) {
+            conn_kill(c);
+            return;
+        }
+        off += LEN_SIZE + len;
+    }
+    c->in_consumed = off;
+}
+
+/* Drop dispatched frames from c->in; grow it for a partial frame that won't fit. */
+static void compact_in(struct conn* c) {
+    size_t off = c->in_consumed;
+    c->in_consumed = 0;
+    if (off > 0) {
+        memmove(c->in, c->in + off, c->in_len - off);
+        c->in_len -= off;
+    }
+    if (c->in_len >= LEN_SIZE) {
+        size_t need = LEN_SIZE + (size_t)get_le32(c->in);
+        if (need > c->in_cap) {
+            uint8_t* p = realloc(c->in, need);
+            if (!p) {
+                conn_kill(c);
+                return;
+            }
+            c->in = p;
+            c->in_cap = need;
+        }
+    }
+}
+
+/* Hand every frame opened this pass to the core in one call, then compact (or grow) each open input buffer. */
+static void flush_batch(pea_transport* t) {
+    if (t->batch_len > 0) {
+        size_t n = core_output(t,
+            pea_core_on_messages_received_v(t->core, t->batch, t->batch_len, t->scratch, t->scratch_cap));
+        t->batch_len = 0;
+        if (n >= 4) deliver_batch_output(t, n);
+        shrink_scratch(t);
+    }
+    while (t->held_len > 0) pea_bufpool_release(t->held[--t->held_len]);
+    for (struct conn* c = t->conns; c; c = c->next) {
+        if (c->dead || c->state != CONN_OPEN) continue;
+        compact_in(c);
+    }
+}
+
+/* One recv per readiness event (level-triggered) so a busy peer can't starve the others. */
+static void conn_readable(pea_transport* t, struct conn* c) {
+    uint8_t* dst;
+    size_t room;
+    if (c->state == CONN_OPEN) {
+        dst = c->in + c->in_len;
+        room = c->in_cap - c->in_len;
+    } else {
+        /* Read exactly the handshake so frames that follow it stay in the socket for the frame path. */
+        dst = c->hs + c->hs_len;
+        room = HANDSHAKE_SIZE - c->hs_len;
+    }
+    ssize_t n = recv(c->fd, dst, room, 0);
+    if (n == 0) {
+        conn_kill(c);
+        return;
+    }
+    if (n < 0) {
+        if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) conn_kill(c);
+        return;
+    }
+    c->last_rx_ms = now_ms();
+    if (c->state == CONN_OPEN) {
+        c->in_len += (size_t)n;
+        process_frames(t, c);
+        return;
+    }
+    c->hs_len += (size_t)n;
+    if (c->hs_len == HANDSHAKE_SIZE) handshake_done(t, c);
+}
+
+/* Outbound connect finished: check the result and send our handshake first, as the connecting side does. */
+static void conn_connected(pea_transport* t, struct conn* c) {
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) != 0 || err != 0) {
+        conn_kill(c);
+        return;
+    }
+    c->state = CONN_HANDSHAKE;
+    uint8_t ours[HANDSHAKE_SIZE];
+    if (pea_core_handshake_bytes(t->core, ours, sizeof(ours)) != 0) {
+        conn_kill(c);
+        return;
+    }
+    queue_raw(t, c, ours, sizeof(ours));
+}
+
+static void accept_all(pea_transport* t) {
+    for (;;) {
+        int fd = accept4(t->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        if (!conn_add(t, fd, CONN_HANDSHAKE, 0)) close(fd);
+    }
+}
+
+static void start_connect(pea_transport* t, const struct cmd* cmd) {
+    for (struct conn* c = t->conns; c; c = c->next)
+        if (!c->dead && (c->outbound || c->state == CONN_OPEN) && memcmp(c->peer_id, cmd->peer_id, 16) == 0)
+            return;
+    int fd = socket(cmd->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return;
+    if (connect(fd, (const struct sockaddr*)&cmd->addr, cmd->addr_len) != 0 && errno != EINPROGRESS) {
+        close(fd);
+        return;
+    }
+    struct conn* c = conn_add(t, fd, CONN_CONNECTING, 1);
+    if (!c) {
+        close(fd);
+        return;
+    }
+    memcpy(c->peer_id, cmd->peer_id, 16);
+}
+
+static void run_commands(pea_transport* t) {
+    uint64_t v;
+    while (read(t->wake_fd, &v, sizeof(v)) < 0 && errno == EINTR) {}
+    pthread_mutex_lock(&t->cmd_lock);
+    struct cmd* cmd = t->cmd_head;
+    t->cmd_head = t->cmd_tail = NULL;
+    pthread_mutex_unlock(&t->cmd_lock);
+    while (cmd) {
+        struct cmd* next = cmd->next;
+        if (cmd->kind == CMD_CONNECT)
+            start_connect(t, cmd);
+        else if (cmd->kind == CMD_SEND_FRAME)
+            send_frame(t, cmd);
+        else
+            send_actions(t, cmd->data, cmd->len);
+        cmd_free(cmd);
+        cmd = next;
+    }
+}
+
+static void arm_tick(pea_transport* t, uint32_t interval_ms) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_interval.tv_sec = interval_ms / 1000;
+    its.it_interval.tv_nsec = (long)(interval_ms % 1000) * 1000000L;
+    its.it_value = its.it_interval;
+    if (timerfd_settime(t->timer_fd, 0, &its, NULL) == 0) t->tick_interval_ms = interval_ms;
+}
+
+/* Follow the core's suggested interval: tighten as soon as a transfer starts, back off when idle. */
+static void retune_tick(pea_transport* t) {
+    uint32_t interval = pea_core_tick_interval_ms(t->core);
+    if (interval != 0 && interval != t->tick_interval_ms) arm_tick(t, interval);
+}
+
+static void expire_idle(pea_transport* t);
+
+/* Heartbeats and timeout-driven reassignments go straight to the peer sockets. */
+static void run_tick(pea_transport* t) {
+    uint64_t expirations;
+    while (read(t->timer_fd, &expirations, sizeof(expirations)) < 0 && errno == EINTR) {}
+    int64_t now = now_ms();
+    size_t n = core_output(t, pea_core_tick_at(t->core, (uint64_t)now, t->scratch, t->scratch_cap));
+    if (n > 0) send_actions(t, t->scratch, n);
+    shrink_scratch(t);
+    expire_idle(t);
+}
+
+/* Close handshakes and open connections that have been silent longer than IO_TIMEOUT_MS. */
+static void expire_idle(pea_transport* t) {
+    int64_t now = now_ms();
+    for (struct conn* c = t->conns; c; c = c->next)
+        if (!c->dead && now - c->last_rx_ms > IO_TIMEOUT_MS) conn_kill(c);
+    struct shm_link** pp = &t->links;
+    while (*pp) {
+        if (now - (*pp)->since > IO_TIMEOUT_MS)
+            link_close(t, pp);
+        else
+            pp = &(*pp)->next;
+    }
+}
+
+/* Free dead connections. A lost open peer goes through pea_core_peer_left and its chunks are re-requested. */
+static void reap(pea_transport* t) {
+    struct conn** pp = &t->conns;
+    while (*pp) {
+        struct conn* c = *pp;
+        if (!c->dead) {
+            pp = &c->next;
+            continue;
+        }
+        *pp = c->next;
+        epoll_ctl(t->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+        if (c->state == CONN_OPEN && !c->replaced) {
+            size_t n = core_output(t, pea_core_peer_left(t->core, c->peer_id, t->scratch, t->scratch_cap));
+            if (n > 0) send_actions(t, t->scratch, n);
+            shrink_scratch(t);
+            if (t->cb.on_peer_disconnected) t->cb.on_peer_disconnected(t->cb_ctx, c->peer_id);
+        }
+        if (c->cipher) pea_core_cipher_destroy(c->cipher);
+        if (c->shm_link >= 0) close(c->shm_link);
+        pea_shm_destroy(c->shm);
+        free(c->in);
+        free(c->out);
+        free(c);
+        /* peer_left may have killed others (send failure); rescan from the head. */
+        pp = &t->conns;
+    }
+}
+
+static void* transport_main(void* arg) {
+    pea_transport* t = arg;
+    if (t->cb.on_thread_start) t->cb.on_thread_start(t->cb_ctx);
+    retune_tick(t);
+    struct epoll_event events[MAX_EVENTS];
+    while (atomic_load(&t->running)) {
+        /* No timeout: the tick timer is the only periodic wakeup. */
+        int n = epoll_wait(t->epfd, events, MAX_EVENTS, -1);
+        for (int i = 0; i < n; i++) {
+            void* p = events[i].data.ptr;
+            if (p == &t->listen_fd) {
+                accept_all(t);
+            } else if (p == &t->wake_fd) {
+                run_commands(t);
+            } else if (p == &t->timer_fd) {
+                run_tick(t);
+            } else {
+                struct conn* c = p;
+                if (c->dead) continue;
+                uint32_t ev = events[i].events;
+                if (c->state == CONN_CONNECTING) {
+                    if (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP)) conn_connected(t, c);
+                    continue;
+                }
+                if (ev & (EPOLLIN | EPOLLERR | EPOLLHUP)) conn_readable(t, c);
+                if (!c->dead && (ev & EPOLLOUT)) conn_flush(t, c);
+            }
+        }
+        flush_batch(t);
+        reap(t);
+        retune_tick(t);
+    }
+    for (struct conn* c = t->conns; c; c = c->next) conn_kill(c);
+    reap(t);
+    if (t->cb.on_thread_exit) t->cb.on_thread_exit(t->cb_ctx);
+    return NULL;
+}
+
+static int open_listener(uint16_t port) {
+    int one = 1, zero = 0;
+    int fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd >= 0) {
+        struct sockaddr_in6 a6;
+        memset(&a6, 0, sizeof(a6));
+        a6.sin6_family = AF_INET6;
+        a6.sin6_addr = in6addr_any;
+        a6.sin6_port = htons(port);
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+        if (bind(fd, (struct sockaddr*)&a6, sizeof(a6)) == 0 && listen(fd, SOMAXCONN) == 0) return fd;
+        close(fd);
+    }
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_in a4;
+    memset(&a4, 0, sizeof(a4));
+    a4.sin_family = AF_INET;
+    a4.sin_addr.s_addr = htonl(INADDR_ANY);
+    a4.sin_port = htons(port);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr*)&a4, sizeof(a4)) == 0 && listen(fd, SOMAXCONN) == 0) return fd;
+    close(fd);
+    return -1;
+}
+
+static int epoll_add_ptr(int epfd, int fd, void* ptr) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = ptr;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+pea_transport* pea_transport_start(void* core, uint16_t port, const pea_transport_callbacks* cb, void* ctx) {
+    if (!core) return NULL;
+    pea_transport* t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+    t->core = core;
+    if (cb) t->cb = *cb;
+    t->cb_ctx = ctx;
+    t->epfd = epoll_create1(EPOLL_CLOEXEC);
+    t->listen_fd = open_listener(port);
+    t->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    t->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    pthread_mutex_init(&t->cmd_lock, NULL);
+    atomic_init(&t->running, 1);
+    t->scratch = malloc(SCRATCH_SIZE);
+    t->scratch_cap = SCRATCH_SIZE;
+    uint8_t self_id[16];
+    t->shm_listen_fd = pea_core_device_id(core, self_id, 16) == 0 ? pea_shm_listen(self_id) : -1;
+    if (!t->scratch || t->epfd < 0 || t->listen_fd < 0 || t->wake_fd < 0 || t->timer_fd < 0
+        || epoll_add_ptr(t->epfd, t->listen_fd, &t->listen_fd) != 0
+        || epoll_add_ptr(t->epfd, t->wake_fd, &t->wake_fd) != 0
+        || epoll_add_ptr(t->epfd, t->timer_fd, &t->timer_fd) != 0
+        || pthread_create(&t->thread, NULL, transport_main, t) != 0) {
+        if (t->epfd >= 0) close(t->epfd);
+        if (t->listen_fd >= 0) close(t->listen_fd);
+        if (t->wake_fd >= 0) close(t->wake_fd);
+        if (t->timer_fd >= 0) close(t->timer_fd);
+        if (t->shm_listen_fd >= 0) close(t->shm_listen_fd);
+        pthread_mutex_destroy(&t->cmd_lock);
+        free(t->scratch);
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+static void wake(pea_transport* t) {
+    uint64_t one = 1;
+    while (write(t->wake_fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+}
+
+void pea_transport_stop(pea_transport* t) {
+    if (!t) return;
+    atomic_store(&t->running, 0);
+    wake(t);
+    pthread_join(t->thread, NULL);
+    close(t->listen_fd);
+    close(t->wake_fd);
+    close(t->timer_fd);
+    close(t->epfd);
+    if (t->shm_listen_fd >= 0) close(t->shm_listen_fd);
+    while (t->links) link_close(t, &t->links);
+    struct cmd* cmd = t->cmd_head;
+    while (cmd) {
+        struct cmd* next = cmd->next;
+        cmd_free(cmd);
+        cmd = next;
+    }
+    pthread_mutex_destroy(&t->cmd_lock);
+    while (t->held_len > 0) pea_bufpool_release(t->held[--t->held_len]);
+    free(t->held);
+    free(t->batch);
+    free(t->scratch);
+    free(t);
+}
+
+static void push_cmd(pea_transport* t, struct cmd* cmd) {
+    pthread_mutex_lock(&t->cmd_lock);
+    if (t->cmd_tail)
+        t->cmd_tail->next = cmd;
+    else
+        t->cmd_head = cmd;
+    t->cmd_tail = cmd;
+    pthread_mutex_unlock(&t->cmd_lock);
+    wake(t);
+}
+
+int pea_transport_connect(pea_transport* t, const uint8_t* peer_id_16, const uint8_t* addr, size_t addr_len,
+    uint16_t port) {
+    if (!t || !peer_id_16 || !addr || (addr_len != 4 && addr_len != 16)) return -1;
+    struct cmd* cmd = calloc(1, sizeof(*cmd));
+    if (!cmd) return -1;
+    cmd->kind = CMD_CONNECT;
+    memcpy(cmd->peer_id, peer_id_16, 16);
+    if (addr_len == 4) {
+        struct sockaddr_in* a4 = (struct sockaddr_in*)&cmd->addr;
+        a4->sin_family = AF_INET;
+        a4->sin_port = htons(port);
+        memcpy(&a4->sin_addr, addr, 4);
+        cmd->addr_len = sizeof(*a4);
+    } else {
+        struct sockaddr_in6* a6 = (struct sockaddr_in6*)&cmd->addr;
+        a6->sin6_family = AF_INET6;
+        a6->sin6_port = htons(port);
+        memcpy(&a6->sin6_addr, addr, 16);
+        cmd->addr_len = sizeof(*a6);
+    }
+    push_cmd(t, cmd);
+    return 0;
+}
+
+int pea_transport_send_actions(pea_transport* t, const uint8_t* actions, size_t len) {
+    if (!t || !actions || len < 4) return -1;
+    struct cmd* cmd = calloc(1, sizeof(*cmd));
+    if (!cmd) return -1;
+    cmd->data = malloc(len);
+    if (!cmd->data) {
+        free(cmd);
+        return -1;
+    }
+    cmd->kind = CMD_SEND_ACTIONS;
+    memcpy(cmd->data, actions, len);
+    cmd->len = len;
+    push_cmd(t, cmd);
+    return 0;
+}
+
+int pea_transport_send_frame(pea_transport* t, const uint8_t* peer_id_16, uint8_t* buf, size_t len) {
+    struct cmd* cmd = t && peer_id_16 && buf && len > 0 && len <= MAX_FRAME_LEN ? calloc(1, sizeof(*cmd)) : NULL;
+    if (!cmd) {
+        pea_bufpool_release(buf);
+        return -1;
+    }
+    cmd->kind = CMD_SEND_FRAME;
+    memcpy(cmd->peer_id, peer_id_16, 16);
+    cmd->data = buf;
+    cmd->len = len;
+    push_cmd(t, cmd);
+    return 0;
+}
@@ -0,0 +1,57 @@
+/* Native peer transport: one epoll thread owns every peer TCP socket.
+ * Handshake (49 bytes: version + device_id + public_key), then 4-byte LE length-prefixed sealed frames;
+ * same wire format as Transport.kt used and pea-windows/transport.rs. Frames are opened in place, each epoll
+ * pass is dispatched in one pea_core_on_messages_received_v call (chunk hashes checked together, on several
+ * threads for big bursts) and the resulting actions sealed and sent without leaving native code.
+ * A timerfd drives pea_core_tick_at at the core's suggested interval, so heartbeats also stay native.
+ * A peer on the same host gets a shared-memory ring for large frames after the handshake (pea_shm.h).
+ * The host only hears about peer connect/disconnect and completed bodies. */
+#ifndef PEA_TRANSPORT_H
+#define PEA_TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct pea_transport pea_transport;
+
+/* Called on the transport thread. Any may be NULL. */
+typedef struct pea_transport_callbacks {
+    /* First and last thing the transport thread does (e.g. attach to / detach from the JVM). */
+    void (*on_thread_start)(void* ctx);
+    void (*on_thread_exit)(void* ctx);
+    /* Handshake done for peer_id (a previous connection to the same peer is closed silently). */
+    void (*on_peer_connected)(void* ctx, const uint8_t* peer_id_16);
+    /* Connection closed; pea_core_peer_left has already run and its ChunkRequests were sent. */
+    void (*on_peer_disconnected)(void* ctx, const uint8_t* peer_id_16);
+    /* A peer message completed a transfer the core reassembled (no sink set). body is valid for the call only. */
+    void (*on_transfer_complete)(void* ctx, const uint8_t* body, size_t body_len);
+} pea_transport_callbacks;
+
+/* Listen on port (dual-stack) and start the transport thread. core is a pea_core handle. NULL on failure. */
+pea_transport* pea_transport_start(void* core, uint16_t port, const pea_transport_callbacks* cb, void* ctx);
+
+/* Stop the thread, close every connection and free t. */
+void pea_transport_stop(pea_transport* t);
+
+/* Connect to a discovered peer; addr is 4 (IPv4) or 16 (IPv6) bytes. No-op if already connected/connecting.
+ * Returns 0 if queued, -1 on bad arguments. */
+int pea_transport_connect(pea_transport* t, const uint8_t* peer_id_16, const uint8_t* addr, size_t addr_len,
+    uint16_t port);
+
+/* Send outbound actions in pea-core layout (4 count LE, then each 16 peer_id, 4 len LE, payload).
+ * Copied; sealed and written by the transport thread. Tick output needs no call: the transport sends it.
+ * Returns 0 if queued, -1 on error. */
+int pea_transport_send_actions(pea_transport* t, const uint8_t* actions, size_t len);
+
+/* Room a frame for pea_transport_send_frame needs around it: the sealed frame's length prefix before, the AEAD
+ * tag after. */
+#define PEA_TRANSPORT_FRAME_HEADROOM 4
+#define PEA_TRANSPORT_FRAME_TAILROOM 16
+
+/* Send one frame to peer_id without copying it: buf is from pea_bufpool_acquire, and the len-byte frame starts at
+ * buf + PEA_TRANSPORT_FRAME_HEADROOM with PEA_TRANSPORT_FRAME_TAILROOM spare bytes after it (e.g. encoded there by
+ * pea_core_upload_part_frame). The transport takes buf, even on error, seals the frame where it lies and sends it
+ * from there; only what the socket does not take at once is copied. Returns 0 if queued, -1 on error. */
+int pea_transport_send_frame(pea_transport* t, const uint8_t* peer_id_16, uint8_t* buf, size_t len);
+
+#endif
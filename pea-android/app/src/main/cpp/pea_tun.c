@@ -0,0 +1,203 @@
+/* Native tunnel reader (see pea_tun.h): poll loop over the TUN fd and a wake eventfd for stop.
+ * The NAT table is touched only by the tunnel thread. */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* clock_gettime under -std=c11 */
+#endif
+#include "pea_tun.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Packets read per wakeup before they are processed and written back. */
+#define TUN_BATCH 64
+/* Slot per packet; PeaPodVpnService sets MTU 1500, a longer read is truncated and dropped. */
+#define TUN_PACKET_MAX 4096
+#define HTTP_PORT 80
+/* Open addressing over (server address, client port); a flow idle this long may be overwritten. */
+#define NAT_SLOTS 4096
+#define NAT_PROBES 16
+#define NAT_IDLE_MS (5 * 60 * 1000)
+
+struct nat_entry {
+    uint32_t server;
+    uint16_t client_port;
+    uint16_t server_port;
+    int64_t last_ms;
+};
+
+struct pea_tun {
+    int fd;
+    int wake_fd;
+    uint32_t tun_addr;
+    uint16_t proxy_port;
+    atomic_int running;
+    pthread_t thread;
+    struct nat_entry nat[NAT_SLOTS];
+    uint8_t* arena;
+    size_t lens[TUN_BATCH];
+};
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint16_t get_be16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static void put_be16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+/* Patch the one's-complement checksum at sum after a 16-bit field changed from old to neu (RFC 1624). */
+static void csum_replace16(uint8_t* sum, uint16_t old, uint16_t neu) {
+    uint32_t s = (uint16_t)~get_be16(sum) + (uint32_t)(uint16_t)~old + neu;
+    s = (s & 0xffff) + (s >> 16);
+    s = (s & 0xffff) + (s >> 16);
+    put_be16(sum, (uint16_t)~s);
+}
+
+static size_t nat_hash(uint32_t server, uint16_t client_port) {
+    uint32_t h = server * 2654435761u ^ client_port * 40503u;
+    return (h ^ (h >> 16)) & (NAT_SLOTS - 1);
+}
+
+static struct nat_entry* nat_find(pea_tun* t, uint32_t server, uint16_t client_port) {
+    size_t i = nat_hash(server, client_port);
+    for (int n = 0; n < NAT_PROBES; n++, i = (i + 1) & (NAT_SLOTS - 1)) {
+        struct nat_entry* e = &t->nat[i];
+        if (e->last_ms == 0) return NULL;
+        if (e->server == server && e->client_port == client_port) return e;
+    }
+    return NULL;
+}
+
+/* Existing entry for the flow, else the first empty or idle slot on its probe run. NULL if the run is full. */
+static struct nat_entry* nat_put(pea_tun* t, uint32_t server, uint16_t client_port, int64_t now) {
+    struct nat_entry* e = nat_find(t, server, client_port);
+    if (e) return e;
+    size_t i = nat_hash(server, client_port);
+    for (int n = 0; n < NAT_PROBES; n++, i = (i + 1) & (NAT_SLOTS - 1)) {
+        e = &t->nat[i];
+        if (e->last_ms == 0 || now - e->last_ms > NAT_IDLE_MS) {
+            e->server = server;
+            e->client_port = client_port;
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/* Rewrite an IPv4/TCP packet in place. Returns 1 if it should be written back to the tunnel, 0 to drop it. */
+static int redirect(pea_tun* t, uint8_t* p, size_t len, int64_t now) {
+    if (len < 20 || (p[0] >> 4) != 4) return 0;
+    size_t ihl = (size_t)(p[0] & 0x0f) * 4;
+    size_t total = get_be16(p + 2);
+    /* TCP, not a fragment (ports are only in the first one). */
+    if (ihl < 20 || total < ihl + 20 || total > len || p[9] != 6 || (get_be16(p + 6) & 0x3fff) != 0) return 0;
+    uint8_t* tcp = p + ihl;
+    uint32_t src, dst;
+    memcpy(&src, p + 12, 4);
+    memcpy(&dst, p + 16, 4);
+    if (src != t->tun_addr || dst == t->tun_addr) return 0;
+    uint16_t sport = get_be16(tcp), dport = get_be16(tcp + 2);
+    uint8_t* port_field;
+    uint16_t new_port;
+    if (sport == t->proxy_port) {
+        /* Proxy -> S:p back to the app as S:80 -> tun_addr:p. */
+        struct nat_entry* e = nat_find(t, dst, dport);
+        if (!e) return 0;
+        e->last_ms = now;
+        port_field = tcp;
+        new_port = e->server_port;
+    } else if (dport == HTTP_PORT) {
+        /* App -> S:80 into the proxy as S:p -> tun_addr:proxy_port. */
+        struct nat_entry* e = nat_put(t, dst, sport, now);
+        if (!e) return 0;
+        e->server_port = dport;
+        e->last_ms = now;
+        port_field = tcp + 2;
+        new_port = t->proxy_port;
+    } else {
+        return 0;
+    }
+    /* Swapping source and destination leaves both checksums as they are; only the port needs patching. */
+    memcpy(p + 12, &dst, 4);
+    memcpy(p + 16, &src, 4);
+    csum_replace16(tcp + 16, get_be16(port_field), new_port);
+    put_be16(port_field, new_port);
+    return 1;
+}
+
+/* Read up to TUN_BATCH packets, rewrite them, write the redirected ones straight back from the arena. */
+static void run_batch(pea_tun* t) {
+    size_t n = 0;
+    while (n < TUN_BATCH) {
+        ssize_t r = read(t->fd, t->arena + n * TUN_PACKET_MAX, TUN_PACKET_MAX);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        t->lens[n++] = (size_t)r;
+    }
+    int64_t now = now_ms();
+    for (size_t i = 0; i < n; i++) {
+        uint8_t* p = t->arena + i * TUN_PACKET_MAX;
+        if (!redirect(t, p, t->lens[i], now)) continue;
+        while (write(t->fd, p, t->lens[i]) < 0 && errno == EINTR) {}
+    }
+}
+
+static void* tun_main(void* arg) {
+    pea_tun* t = arg;
+    struct pollfd fds[2] = { { t->fd, POLLIN, 0 }, { t->wake_fd, POLLIN, 0 } };
+    while (atomic_load(&t->running)) {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) break;
+        if (fds[1].revents) break;
+        if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) break;
+        if (fds[0].revents & POLLIN) run_batch(t);
+    }
+    return NULL;
+}
+
+pea_tun* pea_tun_start(int fd, const uint8_t* tun_addr_4, uint16_t proxy_port) {
+    if (fd < 0 || !tun_addr_4 || proxy_port == 0) return NULL;
+    pea_tun* t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+    t->fd = fd;
+    memcpy(&t->tun_addr, tun_addr_4, 4);
+    t->proxy_port = proxy_port;
+    atomic_init(&t->running, 1);
+    t->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    t->arena = malloc((size_t)TUN_BATCH * TUN_PACKET_MAX);
+    int flags = fcntl(fd, F_GETFL);
+    if (!t->arena || t->wake_fd < 0 || flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0
+        || pthread_create(&t->thread, NULL, tun_main, t) != 0) {
+        if (t->wake_fd >= 0) close(t->wake_fd);
+        free(t->arena);
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+void pea_tun_stop(pea_tun* t) {
+    if (!t) return;
+    atomic_store(&t->running, 0);
+    uint64_t one = 1;
+    while (write(t->wake_fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+    pthread_join(t->thread, NULL);
+    close(t->wake_fd);
+    free(t->arena);
+    free(t);
+}
@@ -0,0 +1,22 @@
+/* Native VPN tunnel reader: one thread owns the TUN fd from VpnService.Builder.establish().
+ * Packets are read in batches into one arena and their IPv4/TCP headers parsed in place. HTTP flows (TCP to port 80)
+ * are redirected to the local proxy by reflecting them back into the tunnel: a SYN from tun_addr:p to S:80 is
+ * rewritten to S:p -> tun_addr:proxy_port, and the proxy's replies to S:p are rewritten back to S:80 -> tun_addr:p.
+ * The addresses swap places, so only one port word changes and both checksums are patched incrementally.
+ * Rewritten packets are written back from the read buffer; anything else is dropped, as before.
+ * IPv6 is not routed into the tunnel (no v6 address or route), so v6 packets are dropped too. */
+#ifndef PEA_TUN_H
+#define PEA_TUN_H
+
+#include <stdint.h>
+
+typedef struct pea_tun pea_tun;
+
+/* Start reading fd (a TUN device; set non-blocking here, still owned by the caller). tun_addr_4 is the tunnel's
+ * IPv4 address; the proxy must accept on tun_addr:proxy_port. NULL on failure. */
+pea_tun* pea_tun_start(int fd, const uint8_t* tun_addr_4, uint16_t proxy_port);
+
+/* Stop the thread and free t. The caller closes the fd afterwards. */
+void pea_tun_stop(pea_tun* t);
+
+#endif
@@ -0,0 +1,272 @@
+/* Native upload pipeline (see pea_upload.h). pea_upload_run works on its caller's thread, one upload per call, and
+ * pea_upload_serve on the relay thread; they share only the core, transport and fetcher, which are thread-safe. */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* pread and clock_gettime under -std=c11 */
+#endif
+#include "pea_upload.h"
+
+#include "pea_bufpool.h"
+#include "pea_core_ffi.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SERVE_WAIT_MS 250
+#define RUN_WAIT_MS 1000
+/* An upload with no part acknowledged for this long is given up. */
+#define STALL_MS 60000
+/* Own PUTs refused in a row before the origin is taken not to accept ranged PUTs at all. */
+#define SELF_FAILURES_MAX 3
+#define URL_MAX 4096
+#define HOST_MAX 256
+/* Frame bytes beyond payload and url: UploadPart's fixed fields and the length prefix. */
+#define FRAME_OVERHEAD 128
+/* pea_core_on_request assignment record: 16 device_id, 8 start, 8 end. */
+#define PART_RECORD 32
+/* Relay job head: 16 from, 16 transfer_id, 8 start, 8 end, 8 total_length, 4 url_len. */
+#define JOB_HEADER 60
+/* take_kept: the kept output is larger than the biggest pool class (it stays kept). */
+#define KEPT_TOO_LARGE (-2)
+
+struct pea_upload {
+    void* core;
+    pea_transport* transport;
+    pea_fetch* fetch;
+    atomic_int stop;
+};
+
+static uint32_t get_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_le64(const uint8_t* p) {
+    return (uint64_t)get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* r from a core call that keeps its output when *buf is short: move that output into a pooled buffer big enough.
+ * Returns KEPT_TOO_LARGE, leaving *buf as it was, if no pool class fits it. */
+static int take_kept(void* core, uint8_t** buf, size_t* cap, int r) {
+    size_t need = PEA_CORE_NEEDED(r);
+    if (need == 0) return r;
+    if (need > PEA_BUF_FRAME) return KEPT_TOO_LARGE;
+    pea_bufpool_release(*buf);
+    *buf = pea_bufpool_acquire(need, cap);
+    if (!*buf) *cap = 0;
+    return *buf ? pea_core_take_output(core, *buf, *cap) : -1;
+}
+
+/* fd[start, end) into dst. */
+static int read_part(int fd, uint8_t* dst, uint64_t start, uint64_t end) {
+    size_t len = (size_t)(end - start), have = 0;
+    while (have < len) {
+        ssize_t r = pread(fd, dst + have, len - have, (off_t)(start + have));
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        have += (size_t)r;
+    }
+    return 0;
+}
+
+/* Split "http://host[:port]/path" into host (as a Host header) and path. Returns 0 on success. */
+static int split_url(const uint8_t* url, size_t len, char* host, char* path) {
+    static const char scheme[] = "http://";
+    size_t s = sizeof(scheme) - 1;
+    if (len <= s || len >= URL_MAX || memcmp(url, scheme, s) != 0) return -1;
+    const uint8_t* slash = memchr(url + s, '/', len - s);
+    size_t host_len = slash ? (size_t)(slash - url) - s : len - s;
+    if (host_len == 0 || host_len >= HOST_MAX) return -1;
+    memcpy(host, url + s, host_len);
+    host[host_len] = '\0';
+    size_t path_len = slash ? len - (size_t)(slash - url) : 0;
+    if (path_len) memcpy(path, slash, path_len);
+    else path[path_len++] = '/';
+    path[path_len] = '\0';
+    return 0;
+}
+
+/* Read a peer's part and queue it on the transport as an UploadPart. Returns -1 only if the body cannot be read;
+ * a part that cannot be framed or queued stays with the peer and is duplicated to another worker at the end. */
+static int send_part(pea_upload* u, const uint8_t* tid, int fd, const uint8_t* rec, size_t url_len) {
+    uint64_t start = get_le64(rec + 16), end = get_le64(rec + 24);
+    size_t len = (size_t)(end - start), cap, out_cap;
+    uint8_t* payload = pea_bufpool_acquire(len, &cap);
+    if (!payload || read_part(fd, payload, start, end) != 0) {
+        pea_bufpool_release(payload);
+        return -1;
+    }
+    /* The frame is encoded between the transport's headroom and tailroom, so it is sealed where it is written. */
+    size_t room = PEA_TRANSPORT_FRAME_HEADROOM + PEA_TRANSPORT_FRAME_TAILROOM;
+    uint8_t* out = pea_bufpool_acquire(room + len + url_len + FRAME_OVERHEAD, &out_cap);
+    int n = out ? pea_core_upload_part_frame(u->core, tid, start, end, payload, len,
+                      out + PEA_TRANSPORT_FRAME_HEADROOM, out_cap - room)
+                : -1;
+    if (PEA_CORE_NEEDED(n)) {
+        pea_bufpool_release(out);
+        out = pea_bufpool_acquire(room + PEA_CORE_NEEDED(n), &out_cap);
+        n = out ? pea_core_upload_part_frame(u->core, tid, start, end, payload, len,
+                      out + PEA_TRANSPORT_FRAME_HEADROOM, out_cap - room)
+                : -1;
+    }
+    if (n > 0)
+        pea_transport_send_frame(u->transport, rec, out, (size_t)n);
+    else
+        pea_bufpool_release(out);
+    pea_bufpool_release(payload);
+    return 0;
+}
+
+/* PUT one of this device's parts and report it to the core. Returns 0 if accepted, 1 if refused, -1 if the body
+ * cannot be read. */
+static int put_part(pea_upload* u, const uint8_t* tid, int fd, const uint8_t* rec, const char* host,
+    const char* path, uint64_t total, pea_fetch_protect_fn protect, void* protect_ctx) {
+    uint64_t start = get_le64(rec + 16), end = get_le64(rec + 24);
+    size_t cap;
+    uint8_t* payload = pea_bufpool_acquire((size_t)(end - start), &cap);
+    if (!payload || read_part(fd, payload, start, end) != 0) {
+        pea_bufpool_release(payload);
+        return -1;
+    }
+    int ok = pea_fetch_put_range(u->fetch, host, path, start, end, total, payload, protect, protect_ctx) == 0;
+    pea_bufpool_release(payload);
+    pea_core_upload_part_done(u->core, tid, start, end, ok);
+    return ok ? 0 : 1;
+}
+
+pea_upload* pea_upload_create(void* core, pea_transport* t, pea_fetch* f) {
+    if (!core || !t || !f) return NULL;
+    pea_upload* u = calloc(1, sizeof(*u));
+    if (!u) return NULL;
+    u->core = core;
+    u->transport = t;
+    u->fetch = f;
+    atomic_init(&u->stop, 0);
+    return u;
+}
+
+void pea_upload_destroy(pea_upload* u) {
+    free(u);
+}
+
+void pea_upload_stop(pea_upload* u) {
+    if (u) atomic_store(&u->stop, 1);
+}
+
+/* PUT one relay job (JOB_HEADER, url, payload) to its origin and ack the uploader either way. */
+static void relay_job(pea_upload* u, const uint8_t* job, size_t len, pea_fetch_protect_fn protect,
+    void* protect_ctx) {
+    if (len < JOB_HEADER) return;
+    uint64_t start = get_le64(job + 32), end = get_le64(job + 40), total = get_le64(job + 48);
+    size_t url_len = get_le32(job + 56);
+    if (url_len > len - JOB_HEADER || len - JOB_HEADER - url_len != end - start) return;
+    char host[HOST_MAX], path[URL_MAX];
+    int ok = split_url(job + JOB_HEADER, url_len, host, path) == 0
+        && pea_fetch_put_range(u->fetch, host, path, start, end, total, job + JOB_HEADER + url_len, protect,
+               protect_ctx) == 0;
+    uint8_t ack[256];
+    int n = pea_core_upload_ack(job, job + 16, start, end, ok, ack, sizeof(ack));
+    if (n > 0) pea_transport_send_actions(u->transport, ack, (size_t)n);
+}
+
+/* Refuse a kept job too large to pool: ack it as failed so the uploader gives the part to another worker at once
+ * instead of waiting for it to time out. Only the head is needed, but kept output is taken whole. */
+static void reject_job(pea_upload* u, size_t need) {
+    uint8_t* job = malloc(need);
+    if (!job) return;
+    if (pea_core_take_output(u->core, job, need) >= JOB_HEADER) {
+        uint8_t ack[256];
+        int n = pea_core_upload_ack(job, job + 16, get_le64(job + 32), get_le64(job + 40), 0, ack, sizeof(ack));
+        if (n > 0) pea_transport_send_actions(u->transport, ack, (size_t)n);
+    }
+    free(job);
+}
+
+void pea_upload_serve(pea_upload* u, pea_fetch_protect_fn protect, void* protect_ctx) {
+    if (!u) return;
+    size_t cap;
+    uint8_t* buf = pea_bufpool_acquire(PEA_BUF_CHUNK, &cap);
+    if (!buf) cap = 0;
+    uint64_t seen = 0;
+    while (!atomic_load(&u->stop)) {
+        int job = pea_core_take_upload_job(u->core, buf, cap);
+        int r = take_kept(u->core, &buf, &cap, job);
+        if (r > 0) relay_job(u, buf, (size_t)r, protect, protect_ctx);
+        else if (r == KEPT_TOO_LARGE) reject_job(u, PEA_CORE_NEEDED(job));
+        else seen = pea_core_wait_upload_event(u->core, seen, SERVE_WAIT_MS);
+    }
+    pea_bufpool_release(buf);
+}
+
+int pea_upload_run(pea_upload* u, int fd, uint64_t length, const char* host, const char* path,
+    pea_fetch_protect_fn protect, void* protect_ctx) {
+    if (!u || fd < 0 || length == 0 || !host || !path) return -1;
+    char url[URL_MAX];
+    int url_len = snprintf(url, sizeof(url), "http://%s%s", host, path);
+    uint8_t self_id[16];
+    if (url_len < 0 || (size_t)url_len >= sizeof(url) || pea_core_device_id(u->core, self_id, 16) != 0) return -1;
+    size_t cap;
+    uint8_t* buf = pea_bufpool_acquire(PEA_BUF_SMALL, &cap);
+    if (!buf) return -1;
+    uint64_t seen = pea_core_wait_upload_event(u->core, 0, 0);
+    int r = take_kept(u->core, &buf, &cap,
+        pea_core_on_upload_request(u->core, (const uint8_t*)url, (size_t)url_len, length, buf, cap));
+    if (r <= 0) {
+        pea_bufpool_release(buf);
+        return r == 0 ? 0 : -1;
+    }
+    uint8_t tid[16];
+    memcpy(tid, buf, 16);
+    size_t records = 24;
+    int result = -1, self_failures = 0;
+    uint32_t acked = 0;
+    int64_t last_progress = now_ms();
+    for (;;) {
+        uint32_t n = get_le32(buf + records);
+        int failed = 0;
+        /* Peers' parts first, so they are in flight while this device PUTs its own. */
+        for (int own = 0; own < 2 && !failed; own++) {
+            for (uint32_t i = 0; i < n && !failed; i++) {
+                const uint8_t* rec = buf + records + 4 + (size_t)i * PART_RECORD;
+                if ((memcmp(rec, self_id, 16) == 0) != own) continue;
+                if (!own) {
+                    failed = send_part(u, tid, fd, rec, (size_t)url_len) != 0;
+                    continue;
+                }
+                int put = put_part(u, tid, fd, rec, host, path, length, protect, protect_ctx);
+                failed = put < 0;
+                self_failures = put == 1 ? self_failures + 1 : 0;
+            }
+        }
+        uint8_t st[24];
+        if (failed || self_failures >= SELF_FAILURES_MAX || pea_core_upload_status(u->core, tid, st, 24) != 24) break;
+        uint32_t parts = get_le32(st + 16), done = get_le32(st + 20);
+        if (done == parts) {
+            result = 1;
+            break;
+        }
+        if (done != acked) {
+            acked = done;
+            last_progress = now_ms();
+        } else if (now_ms() - last_progress > STALL_MS) {
+            break;
+        }
+        r = take_kept(u->core, &buf, &cap, pea_core_next_upload_parts(u->core, tid, buf, cap));
+        if (r < 4) break;
+        records = 0;
+        /* seen only moves here, so an ack that landed since the last wait makes this one return at once. */
+        if (get_le32(buf) == 0) seen = pea_core_wait_upload_event(u->core, seen, RUN_WAIT_MS);
+    }
+    pea_core_finish_upload(u->core, tid);
+    pea_bufpool_release(buf);
+    return result;
+}
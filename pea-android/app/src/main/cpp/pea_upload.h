@@ -0,0 +1,38 @@
+/* Native upload pipeline: spreads one upload over the pod's uplinks. The core splits the body into parts and hands
+ * them to self and each peer by measured uplink rate; this device PUTs its own parts to origin through pea_fetch
+ * and sends every other part to its peer as an UploadPart over the encrypted transport. The peer PUTs it with
+ * Content-Range over its own uplink and acks, so the origin must accept ranged PUTs. Parts are read from the body
+ * fd with pread into pooled buffers, so the body is never held in memory as a whole. Both directions sleep on
+ * pea_core_wait_upload_event rather than poll. */
+#ifndef PEA_UPLOAD_H
+#define PEA_UPLOAD_H
+
+#include <stdint.h>
+
+#include "pea_fetch.h"
+#include "pea_transport.h"
+
+typedef struct pea_upload pea_upload;
+
+/* core is a pea_core handle; t sends parts and acks to peers, f carries this device's PUTs. NULL on failure. */
+pea_upload* pea_upload_create(void* core, pea_transport* t, pea_fetch* f);
+
+/* Free u. pea_upload_serve must have returned and no pea_upload_run may be running. */
+void pea_upload_destroy(pea_upload* u);
+
+/* Relay loop: PUT every part a peer sends this device to its origin and ack it. A part too large for the buffer
+ * pool (over PEA_BUF_FRAME with its head) is acked as failed without a PUT. Blocks until pea_upload_stop; run it
+ * on a thread of its own. protect is applied to every origin socket, as in pea_fetch. */
+void pea_upload_serve(pea_upload* u, pea_fetch_protect_fn protect, void* protect_ctx);
+
+/* Make pea_upload_serve return (within a quarter second). */
+void pea_upload_stop(pea_upload* u);
+
+/* Upload fd[0, length) to http://host/path (host as in pea_fetch_self_chunks) through the pod; blocks until done.
+ * fd must support pread. Returns 1 when every part reached origin, 0 when the core did not accelerate (no peers:
+ * upload it directly), -1 when the upload failed (origin refused this device's parts, the body could not be read,
+ * or no part landed for a minute). */
+int pea_upload_run(pea_upload* u, int fd, uint64_t length, const char* host, const char* path,
+    pea_fetch_protect_fn protect, void* protect_ctx);
+
+#endif
@@ -0,0 +1,29 @@
+package dev.peapod.android
+
+import java.nio.ByteBuffer
+
+/**
+ * Pooled direct buffers for JNI output (pea_bufpool.c): native memory in fixed size classes, reused across
+ * calls so request/beacon/chunk hot paths allocate nothing per call in steady state. Falls back to a fresh
+ * direct buffer when the pool cannot serve the size.
+ */
+object BufferPool {
+    /** Size classes (pea_bufpool.h): JNI output buffers, one default chunk plus AEAD tag, largest wire frame. */
+    const val SMALL: Int = 64 * 1024
+    const val CHUNK: Int = 256 * 1024 + 16
+    const val FRAME: Int = 16 * 1024 * 1024
+
+    /**
+     * Run block with a direct buffer of at least size bytes (position 0, limit = capacity) and release it after.
+     * The buffer must not be used once block returns.
+     */
+    inline fun <T> withBuffer(size: Int, block: (ByteBuffer) -> T): T {
+        val pooled = PeaCore.nativeBufferAcquire(size)
+        val buf = pooled ?: ByteBuffer.allocateDirect(size)
+        try {
+            return block(buf)
+        } finally {
+            if (pooled != null) PeaCore.nativeBufferRelease(pooled)
+        }
+    }
+}
@@ -1,46 +1,26 @@
 package dev.peapod.android
 
-import java.net.DatagramPacket
 import java.net.InetAddress
-import java.net.MulticastSocket
-import kotlin.concurrent.thread
+import java.util.concurrent.ConcurrentHashMap
 
 /**
  * LAN discovery per .tasks/03-android §3.1 and 07: UDP multicast 239.255.60.60:45678,
  * periodic beacon (device_id, public_key, listen_port), receive and parse beacons/responses,
  * maintain peer list, call core on_peer_joined / on_peer_left. Advertises listen_port for local transport (§4).
+ * The socket is owned by the native engine (pea_discovery.c): one thread reads datagrams in recvmmsg batches,
+ * decodes them and keeps the known-peer table, so repeat beacons never reach Kotlin. It calls the core itself
+ * and queues only join/leave transitions for Kotlin ([NativeEvents]).
  */
 object Discovery {
 
     const val DISCOVERY_PORT = 45678
     const val LOCAL_TRANSPORT_PORT = 45679
-    private const val MULTICAST_GROUP = "239.255.60.60"
-    private const val BEACON_INTERVAL_MS = 4000L
-    private const val BEACON_INTERVAL_THROTTLE_MS = 12000L
-    private const val PEER_TIMEOUT_MS = 16000L
-    private const val TIMEOUT_CHECK_MS = 4000L
-    private const val BEACON_FRAME_MAX = 256
 
-    @Volatile
-    private var socket: MulticastSocket? = null
-
-    @Volatile
-    private var running = false
-
-    private data class PeerEntry(
-        val deviceId: ByteArray,
-        val publicKey: ByteArray,
-        val addr: InetAddress,
-        val port: Int,
-        var lastSeen: Long
-    ) {
-        override fun equals(other: Any?) = other is PeerEntry && deviceId.contentEquals(other.deviceId)
-        override fun hashCode() = deviceId.contentHashCode()
-    }
+    /** Native discovery handle (PeaCore.nativeDiscoveryStart), 0 when stopped; guarded by lock. */
+    private var discovery: Long = 0L
+    private val lock = Object()
 
-    @Volatile
-    private var peers = mutableMapOf<String, PeerEntry>()
-    private val peersLock = Any()
+    private val peers = ConcurrentHashMap.newKeySet<String>()
 
     /** Optional: called when peer set changes (join or timeout). Use to update notification. */
     @Volatile
@@ -53,121 +33,47 @@ object Discovery {
     /** When true, use longer beacon interval to reduce battery use (§7.1). Set by service from battery state. */
     @Volatile
     var throttleBeacon = false
-
-    /** Start discovery: bind multicast, send beacon loop, receive loop, timeout loop. Call when VPN/core is up. */
-    fun start(coreHandle: Long, listenPort: Int) {
-        if (coreHandle == 0L) return
-        if (running) return
-        running = true
-        try {
-            val s = MulticastSocket(DISCOVERY_PORT)
-            s.reuseAddress = true
-            s.soTimeout = 2000
-            s.joinGroup(InetAddress.getByName(MULTICAST_GROUP))
-            socket = s
-            val group = InetAddress.getByName(MULTICAST_GROUP)
-            val beaconBuf = ByteArray(BEACON_FRAME_MAX)
-            thread(name = "DiscoveryBeacon") {
-                while (running && socket != null) {
-                    val n = PeaCore.nativeBeaconFrame(coreHandle, listenPort, beaconBuf)
-                    if (n > 0) {
-                        try {
-                            socket?.send(DatagramPacket(beaconBuf, n, group, DISCOVERY_PORT))
-                        } catch (_: Exception) {}
-                    }
-                    Thread.sleep(if (throttleBeacon) BEACON_INTERVAL_THROTTLE_MS else BEACON_INTERVAL_MS)
-                }
-            }
-            thread(name = "DiscoveryRecv") {
-                recvLoop(coreHandle, listenPort)
+        set(value) {
+            field = value
+            synchronized(lock) {
+                if (discovery != 0L) PeaCore.nativeDiscoverySetThrottle(discovery, value)
             }
-            thread(name = "DiscoveryTimeout") {
-                timeoutLoop(coreHandle)
-            }
-        } catch (e: Exception) {
-            e.printStackTrace()
-            running = false
         }
-    }
 
-    private fun recvLoop(coreHandle: Long, listenPort: Int) {
-        val s = socket ?: return
-        val buf = ByteArray(65536)
-        val packet = DatagramPacket(buf, buf.size)
-        val myId = PeaCore.nativeDeviceId(coreHandle) ?: return
-        val responseFrame = ByteArray(BEACON_FRAME_MAX)
-        val responseLen = buildDiscoveryResponseFrame(coreHandle, listenPort, responseFrame)
-        while (running && socket != null) {
-            try {
-                s.receive(packet)
-                val n = packet.length
-                if (n < 5) continue
-                val frame = packet.data.copyOfRange(0, n)
-                val outDeviceId = ByteArray(16)
-                val outPublicKey = ByteArray(32)
-                val outListenPort = IntArray(1)
-                val ok = PeaCore.nativeDecodeDiscoveryFrame(frame, outDeviceId, outPublicKey, outListenPort)
-                if (ok != 0) continue
-                if (outDeviceId.contentEquals(myId)) continue
-                val from = packet.address
-                val peerPort = outListenPort[0].and(0xFFFF)
-                val idKey = outDeviceId.joinToString("") { "%02x".format(it) }
-                val isNew = synchronized(peersLock) {
-                    val prev = peers[idKey]
-                    peers[idKey] = PeerEntry(outDeviceId, outPublicKey, from, peerPort, System.currentTimeMillis())
-                    prev == null
-                }
-                if (isNew) {
-                    PeaCore.nativePeerJoined(coreHandle, outDeviceId, outPublicKey)
-                    onPeerCountChanged?.invoke()
-                    onPeerDiscovered?.invoke(outDeviceId, outPublicKey, from, peerPort)
-                }
-                if (responseLen > 0) {
-                    try {
-                        s.send(DatagramPacket(responseFrame, responseLen, from, packet.port))
-                    } catch (_: Exception) {}
-                }
-            } catch (_: java.net.SocketTimeoutException) {
-            } catch (e: Exception) {
-                if (running) e.printStackTrace()
-            }
+    /** Start discovery: bind multicast, beacon, receive and time out peers natively. Call when VPN/core is up. */
+    fun start(coreHandle: Long, listenPort: Int) {
+        if (coreHandle == 0L) return
+        synchronized(lock) {
+            if (discovery != 0L) return
+            discovery = PeaCore.nativeDiscoveryStart(coreHandle, listenPort, throttleBeacon)
         }
     }
 
-    private fun buildDiscoveryResponseFrame(coreHandle: Long, listenPort: Int, outBuf: ByteArray): Int {
-        return PeaCore.nativeDiscoveryResponseFrame(coreHandle, listenPort, outBuf)
+    /** From [NativeEvents] for a peer not seen before (core already told via peer_joined). */
+    fun onNativePeerJoined(deviceId: ByteArray, publicKey: ByteArray, addr: ByteArray, port: Int) {
+        peers.add(hex(deviceId))
+        onPeerCountChanged?.invoke()
+        onPeerDiscovered?.invoke(deviceId, publicKey, InetAddress.getByAddress(addr), port)
     }
 
-    private fun timeoutLoop(coreHandle: Long) {
-        while (running) {
-            Thread.sleep(TIMEOUT_CHECK_MS)
-            val now = System.currentTimeMillis()
-            val timedOut = mutableListOf<ByteArray>()
-            synchronized(peersLock) {
-                peers.entries.removeIf { (_, entry) ->
-                    if (now - entry.lastSeen >= PEER_TIMEOUT_MS) {
-                        timedOut.add(entry.deviceId)
-                        true
-                    } else false
-                }
-            }
-            for (deviceId in timedOut) {
-                PeaCore.nativePeerLeft(coreHandle, deviceId, null)
-                onPeerCountChanged?.invoke()
-            }
-        }
+    /** From [NativeEvents] for a timed-out peer; actions re-request its chunks (null if none). */
+    fun onNativePeerLeft(deviceId: ByteArray, actions: ByteArray?) {
+        peers.remove(hex(deviceId))
+        if (actions != null) Transport.sendActions(actions, actions.size)
+        onPeerCountChanged?.invoke()
     }
 
     /** Stop discovery (call from service onDestroy). */
     fun stop() {
-        running = false
-        try {
-            socket?.close()
-        } catch (_: Exception) {}
-        socket = null
-        synchronized(peersLock) { peers.clear() }
+        synchronized(lock) {
+            if (discovery != 0L) PeaCore.nativeDiscoveryStop(discovery)
+            discovery = 0L
+        }
+        peers.clear()
     }
 
     /** Current peer count for notification. */
-    fun peerCount(): Int = synchronized(peersLock) { peers.size }
+    fun peerCount(): Int = peers.size
+
+    private fun hex(id: ByteArray) = id.joinToString("") { "%02x".format(it) }
 }
@@ -1,6 +1,8 @@
 package dev.peapod.android
 
 import android.net.VpnService
+import android.os.ParcelFileDescriptor
+import android.os.SystemClock
 import java.io.InputStream
 import java.io.OutputStream
 import java.net.InetSocketAddress
@@ -8,49 +10,60 @@ import java.net.ServerSocket
 import java.net.Socket
 import java.nio.ByteBuffer
 import java.nio.charset.StandardCharsets
-import java.security.MessageDigest
+import java.util.concurrent.CopyOnWriteArrayList
 import kotlin.concurrent.thread
 
 /**
  * Local HTTP proxy in app (.tasks/03-android §2.2.3, §2.2.4).
- * Listens on 127.0.0.1:PROXY_PORT; parses request (method, Host, Range); calls PeaCore.nativeOnRequest.
- * On Fallback: protect socket, connect to origin, forward request/response. On Accelerate: fetch self-assigned chunks via WAN, pass to core, send reassembled response (§2.3); peer chunks require §4 local transport.
+ * Listens on 127.0.0.1:PROXY_PORT, and on the tunnel address for HTTP flows the native tunnel reader reflects
+ * (pea_tun.c); parses request (method, Host, Range); calls PeaCore.nativeOnRequest.
+ * On Fallback: protect socket, connect to origin, forward request/response. On Accelerate: fetch self-assigned chunks via WAN natively (pea_fetch.c), pass to core, which streams the in-order body to the client socket (§2.3); peer chunks require §4 local transport.
  */
 object LocalProxy {
 
     const val PROXY_PORT = 3128
     private const val BUF_SIZE = 65536
     private const val MAX_HEADERS_LEN = 32768
+    /** A transfer whose received bytes do not grow for this long is given up (same as the 30 s I/O timeouts). */
+    private const val COMPLETION_STALL_MS = 30_000L
+    private const val COMPLETION_POLL_MS = 50L
 
-    @Volatile
-    private var serverSocket: ServerSocket? = null
+    private val serverSockets = CopyOnWriteArrayList<ServerSocket>()
 
-    /** Start proxy in a background thread. coreHandle from PeaCore.nativeCreate(); vpnService for protect(). */
+    /**
+     * Start proxy in a background thread per listen address. coreHandle from PeaCore.nativeCreate(); vpnService for
+     * protect(); tunAddress (e.g. "10.0.0.2") also accepts the flows the tunnel reader redirects.
+     */
     fun start(
         coreHandle: Long,
         vpnService: VpnService,
+        tunAddress: String? = null,
     ) {
         if (coreHandle == 0L) return
-        thread(name = "LocalProxy") {
-            runServer(coreHandle, vpnService)
+        for (addr in listOfNotNull("127.0.0.1", tunAddress)) {
+            thread(name = "LocalProxy") {
+                runServer(coreHandle, vpnService, addr)
+            }
         }
     }
 
     /** Stop accepting new connections (call from service onDestroy). */
     fun stop() {
-        try {
-            serverSocket?.close()
-        } catch (_: Exception) {}
-        serverSocket = null
+        for (server in serverSockets) {
+            try {
+                server.close()
+            } catch (_: Exception) {}
+        }
+        serverSockets.clear()
     }
 
-    private fun runServer(coreHandle: Long, vpnService: VpnService) {
+    private fun runServer(coreHandle: Long, vpnService: VpnService, bindAddress: String) {
+        val server = ServerSocket()
         try {
-            val server = ServerSocket()
             server.reuseAddress = true
-            server.bind(InetSocketAddress("127.0.0.1", PROXY_PORT))
-            serverSocket = server
-            while (serverSocket != null) {
+            server.bind(InetSocketAddress(bindAddress, PROXY_PORT))
+            serverSockets.add(server)
+            while (!server.isClosed) {
                 val client = try { server.accept() } catch (_: Exception) { break }
                 thread {
                     try {
@@ -65,7 +78,8 @@ object LocalProxy {
         } catch (e: Exception) {
             e.printStackTrace()
         } finally {
-            serverSocket = null
+            serverSockets.remove(server)
+            try { server.close() } catch (_: Exception) {}
         }
     }
 
@@ -81,8 +95,20 @@ object LocalProxy {
             return
         }
         val url = buildUrl(host, path)
-        val outBuf = ByteArray(65536)
-        val action = PeaCore.nativeOnRequest(coreHandle, url, rangeStart, rangeEnd, outBuf)
+        // Assignment goes into a pooled native buffer and is parsed out before the buffer is returned.
+        val (action, accelerate) = BufferPool.withBuffer(BufferPool.SMALL) { out ->
+            val a = PeaCore.nativeOnRequestDirect(coreHandle, url, rangeStart, rangeEnd, out, 0, out.capacity())
+            val need = PeaCore.needed(a)
+            when {
+                a == 1 -> a to parseAccelerateResult(out)
+                // A long assignment list: the core kept it, collect it into a buffer of the reported size.
+                need > 0 -> BufferPool.withBuffer(need) { big ->
+                    val n = PeaCore.nativeTakeOutputDirect(coreHandle, big, 0, big.capacity())
+                    if (n >= need) 1 to parseAccelerateResult(big) else -1 to null
+                }
+                else -> a to null
+            }
+        }
         when (action) {
             0 -> {
                 // Fallback: forward to origin (protect socket so it bypasses VPN)
@@ -103,43 +129,41 @@ object LocalProxy {
                 origin.close()
             }
             1 -> {
-                // Accelerate §2.3: parse assignment, fetch self chunks via WAN, pass to core, send reassembled response
-                val acc = parseAccelerateResult(outBuf) ?: run {
+                // Accelerate §2.3: parse assignment, fetch self chunks via WAN, pass to core, body streams to the client fd
+                val acc = accelerate ?: run {
                     clientOut.write("HTTP/1.1 502 Bad Gateway\r\nConnection: close\r\n\r\n".toByteArray(StandardCharsets.US_ASCII))
                     return
                 }
-                val selfId = PeaCore.nativeDeviceId(coreHandle) ?: run {
-                    clientOut.write("HTTP/1.1 502 Bad Gateway\r\nConnection: close\r\n\r\n".toByteArray(StandardCharsets.US_ASCII))
-                    return
-                }
-                val bodyBuf = ByteArray(acc.totalLength.coerceAtMost(Int.MAX_VALUE.toLong()).toInt())
-                var complete = false
-                for ((deviceId, start, end) in acc.assignments) {
-                    if (!deviceId.contentEquals(selfId)) continue // peer chunks need §4 local transport
-                    val payload = fetchChunkViaWan(vpnService, host, path, start, end) ?: continue
-                    val hash = sha256(payload)
-                    val result = PeaCore.nativeOnChunkReceived(coreHandle, acc.transferId, start, end, hash, payload, bodyBuf)
-                    when (result) {
-                        1 -> { complete = true; break }
-                        -1 -> {
-                            clientOut.write("HTTP/1.1 502 Bad Gateway\r\nConnection: close\r\n\r\n".toByteArray(StandardCharsets.US_ASCII))
-                            return
-                        }
-                    }
-                }
-                if (!complete) {
-                    clientOut.write("HTTP/1.1 504 Gateway Timeout\r\nConnection: close\r\nContent-Length: 0\r\n\r\n".toByteArray(StandardCharsets.US_ASCII))
-                    return
-                }
-                val (status, rangeHeader, bodySlice) = if (rangeEnd >= rangeStart && rangeStart >= 0) {
-                    Triple(206, "Content-Range: bytes $rangeStart-$rangeEnd/${acc.totalLength}\r\n", bodyBuf)
-                } else {
-                    Triple(200, "", bodyBuf)
-                }
-                val headers = "HTTP/1.1 $status ${if (status == 206) "Partial Content" else "OK"}\r\nConnection: close\r\nContent-Length: ${bodySlice.size}\r\n$rangeHeader\r\n"
+                // Headers go out first; the core then streams the body to the client fd as chunks become contiguous.
+                val status = if (rangeEnd >= rangeStart && rangeStart >= 0) 206 else 200
+                val rangeHeader = if (status == 206) "Content-Range: bytes $rangeStart-$rangeEnd/${acc.totalLength}\r\n" else ""
+                val headers = "HTTP/1.1 $status ${if (status == 206) "Partial Content" else "OK"}\r\nConnection: close\r\nContent-Length: ${acc.totalLength}\r\n$rangeHeader\r\n"
                 clientOut.write(headers.toByteArray(StandardCharsets.US_ASCII))
-                clientOut.write(bodySlice)
                 clientOut.flush()
+                val sinkFd = ParcelFileDescriptor.fromSocket(client)
+                try {
+                    if (PeaCore.nativeSetTransferSinkFd(coreHandle, acc.transferId, sinkFd.fd) != 0) return
+                    // This device pulls the chunks it can claim; pea_fetch.c fetches them over pooled keep-alive
+                    // connections and hands them to the core itself. The bytes came from origin, so there is no
+                    // reference hash to check. Peers deliver theirs over §4 local transport meanwhile.
+                    val base = if (status == 206) rangeStart else 0L
+                    var r = PeaCore.nativeFetchSelfChunks(coreHandle, vpnService, acc.transferId, host, path, base)
+                    // 0 only means this device has nothing left to claim: peer and endgame chunks may still be in
+                    // flight, so the body is not complete yet.
+                    if (r == 0) r = awaitCompletion(coreHandle, vpnService, acc.transferId, host, path, base)
+                    if (r != 1) {
+                        // The headers are out, so a 504 is too late: reset the connection so the client sees the
+                        // failure at once rather than a body that stops short. Shutting output down also ends a
+                        // sink write blocked on this socket, which the cancel below would wait for.
+                        client.setSoLinger(true, 0)
+                        try { client.shutdownOutput() } catch (_: Exception) {}
+                    }
+                } finally {
+                    // Done or failed: drop the transfer and its sink so other transfers keep running. After a
+                    // completion this waits for the last queued writes to reach the socket.
+                    PeaCore.nativeCancelTransfer(coreHandle, acc.transferId)
+                    sinkFd.close()
+                }
             }
             else -> {
                 clientOut.write("HTTP/1.1 502 Bad Gateway\r\nConnection: close\r\n\r\n".toByteArray(StandardCharsets.US_ASCII))
@@ -147,21 +171,51 @@ object LocalProxy {
         }
     }
 
+    /**
+     * Wait until a transfer whose self chunks are all fetched completes. Chunks a peer drops or times out on go back
+     * to the pool, so this device keeps claiming and fetching them. Returns 1 once complete (the core no longer
+     * knows the transfer), a failing [PeaCore.nativeFetchSelfChunks] result, or 0 when the received bytes stopped
+     * growing for [COMPLETION_STALL_MS].
+     */
+    private fun awaitCompletion(
+        coreHandle: Long,
+        vpnService: VpnService,
+        transferId: ByteArray,
+        host: String,
+        path: String,
+        base: Long,
+    ): Int {
+        val status = LongArray(4)
+        var received = -1L
+        var progressAt = SystemClock.elapsedRealtime()
+        while (true) {
+            if (PeaCore.nativeTransferStatus(coreHandle, transferId, status) != 0) return 1
+            val now = SystemClock.elapsedRealtime()
+            if (status[1] != received) {
+                received = status[1]
+                progressAt = now
+            } else if (now - progressAt > COMPLETION_STALL_MS) {
+                return 0
+            }
+            val r = PeaCore.nativeFetchSelfChunks(coreHandle, vpnService, transferId, host, path, base)
+            if (r != 0) return r
+            Thread.sleep(COMPLETION_POLL_MS)
+        }
+    }
+
     /** Layout: 16 transfer_id, 8 total_length LE, 4 num LE, then num*(16 device_id, 8 start LE, 8 end LE). */
-    private fun parseAccelerateResult(buf: ByteArray): AccelerateResult? {
-        if (buf.size < 28) return null
-        val bb = ByteBuffer.wrap(buf).order(java.nio.ByteOrder.LITTLE_ENDIAN)
+    private fun parseAccelerateResult(buf: ByteBuffer): AccelerateResult? {
+        val bb = buf.duplicate().order(java.nio.ByteOrder.LITTLE_ENDIAN)
+        if (bb.capacity() < 28) return null
         val totalLength = bb.getLong(16)
         val num = bb.getInt(24) and 0x7FFF_FFFF
-        if (28 + num * 32 > buf.size) return null
+        if (28L + num * 32L > bb.capacity()) return null
+        fun idAt(base: Int) = ByteArray(16).also { bb.position(base); bb.get(it) }
         val assignments = (0 until num).map { i ->
             val base = 28 + i * 32
-            val deviceId = buf.copyOfRange(base, base + 16)
-            val start = bb.getLong(base + 16)
-            val end = bb.getLong(base + 24)
-            Triple(deviceId, start, end)
+            Triple(idAt(base), bb.getLong(base + 16), bb.getLong(base + 24))
         }
-        return AccelerateResult(buf.copyOfRange(0, 16), totalLength, assignments)
+        return AccelerateResult(idAt(0), totalLength, assignments)
     }
 
     private data class AccelerateResult(
@@ -173,49 +227,6 @@ object LocalProxy {
         override fun hashCode() = transferId.contentHashCode() + 31 * totalLength.hashCode()
     }
 
-    private fun sha256(input: ByteArray): ByteArray =
-        MessageDigest.getInstance("SHA-256").digest(input)
-
-    /** Fetch one range from origin via HTTP; socket protected so it bypasses VPN. Returns body bytes or null. */
-    private fun fetchChunkViaWan(vpnService: VpnService, host: String, path: String, start: Long, end: Long): ByteArray? {
-        val (hostOnly, port) = parseHostPort(host)
-        return try {
-            val socket = Socket()
-            vpnService.protect(socket)
-            socket.soTimeout = 30_000
-            socket.connect(InetSocketAddress(hostOnly, port), 10_000)
-            val request = "GET $path HTTP/1.1\r\nHost: $host\r\nRange: bytes=$start-$end\r\nConnection: close\r\n\r\n"
-            socket.getOutputStream().write(request.toByteArray(StandardCharsets.US_ASCII))
-            socket.getOutputStream().flush()
-            val input = socket.getInputStream()
-            val buf = ByteArray(8192)
-            var n = 0
-            while (n < buf.size) {
-                val r = input.read(buf, n, buf.size - n)
-                if (r <= 0) break
-                n += r
-                val s = String(buf, 0, n, StandardCharsets.US_ASCII)
-                val headerEnd = s.indexOf("\r\n\r\n")
-                if (headerEnd != -1) {
-                    val bodyStart = headerEnd + 4
-                    val bodyBytes = java.io.ByteArrayOutputStream()
-                    bodyBytes.write(buf, bodyStart, n - bodyStart)
-                    while (true) {
-                        val more = input.read(buf)
-                        if (more <= 0) break
-                        bodyBytes.write(buf, 0, more)
-                    }
-                    socket.close()
-                    return bodyBytes.toByteArray()
-                }
-            }
-            socket.close()
-            null
-        } catch (_: Exception) {
-            null
-        }
-    }
-
     /** Parse first line and headers; return (full request bytes, method, host, path, rangeStart, rangeEnd). */
     private fun parseRequest(input: InputStream): RequestParse? {
         val buf = ByteArray(MAX_HEADERS_LEN)
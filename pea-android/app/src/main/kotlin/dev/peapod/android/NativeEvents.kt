@@ -0,0 +1,102 @@
+package dev.peapod.android
+
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import kotlin.concurrent.thread
+
+/**
+ * Consumer of the native event queue (pea_events.c). The transport and discovery engines never call into Java:
+ * they queue peer transitions and completed bodies, and one thread here drains them in batches with
+ * [PeaCore.nativePollEvents] and dispatches to [Transport] and [Discovery]. Start before the engines, stop after.
+ */
+object NativeEvents {
+    /** Record types (pea_events.h). */
+    const val PEER_CONNECTED = 1
+    const val PEER_DISCONNECTED = 2
+    const val TRANSFER_COMPLETE = 3
+    const val PEER_JOINED = 4
+    const val PEER_LEFT = 5
+    const val DROPPED = 6
+
+    private const val POLL_TIMEOUT_MS = 1000
+
+    @Volatile
+    private var running = false
+    private var worker: Thread? = null
+
+    fun start() {
+        if (worker != null) return
+        running = true
+        worker = thread(name = "PeaEvents") { loop() }
+    }
+
+    /** Stop the consumer and wait for it; events still queued are delivered on the next start. */
+    fun stop() {
+        val t = worker ?: return
+        running = false
+        PeaCore.nativeWakeEvents()
+        t.join()
+        worker = null
+    }
+
+    private fun loop() {
+        var pooled = PeaCore.nativeBufferAcquire(BufferPool.SMALL)
+        var buf = pooled ?: ByteBuffer.allocateDirect(BufferPool.SMALL)
+        try {
+            while (running) {
+                val n = PeaCore.nativePollEvents(buf, 0, buf.capacity(), POLL_TIMEOUT_MS)
+                val need = PeaCore.needed(n)
+                if (need > 0) {
+                    // A body larger than the buffer: grow to fit it, it stays queued until then.
+                    if (pooled != null) PeaCore.nativeBufferRelease(pooled)
+                    pooled = PeaCore.nativeBufferAcquire(need)
+                    buf = pooled ?: ByteBuffer.allocateDirect(need)
+                    continue
+                }
+                if (n < 0) break
+                dispatch(buf, n)
+            }
+        } finally {
+            if (pooled != null) PeaCore.nativeBufferRelease(pooled)
+        }
+    }
+
+    /** Dispatch records in buf[0, len). Bodies are slices of buf, valid only until the handler returns. */
+    private fun dispatch(buf: ByteBuffer, len: Int) {
+        val view = buf.duplicate().order(ByteOrder.LITTLE_ENDIAN)
+        var off = 0
+        while (off + 5 <= len) {
+            val payloadLen = view.getInt(off)
+            val type = view.get(off + 4).toInt()
+            val start = off + 5
+            off = start + payloadLen
+            when (type) {
+                PEER_CONNECTED -> Transport.onNativePeerConnected(bytes(view, start, 16))
+                PEER_DISCONNECTED -> Transport.onNativePeerDisconnected(bytes(view, start, 16))
+                TRANSFER_COMPLETE -> {
+                    view.limit(start + payloadLen).position(start)
+                    val body = view.slice()
+                    view.clear()
+                    Transport.onNativeTransferComplete(body)
+                }
+                PEER_JOINED -> Discovery.onNativePeerJoined(
+                    bytes(view, start, 16),
+                    bytes(view, start + 16, 32),
+                    bytes(view, start + 50, payloadLen - 50),
+                    view.getShort(start + 48).toInt() and 0xffff
+                )
+                PEER_LEFT -> Discovery.onNativePeerLeft(
+                    bytes(view, start, 16),
+                    if (payloadLen > 16) bytes(view, start + 16, payloadLen - 16) else null
+                )
+                // DROPPED: the engine rings only fill if this thread stalls; the core already saw every transition.
+            }
+        }
+    }
+
+    private fun bytes(view: ByteBuffer, off: Int, len: Int): ByteArray {
+        val out = ByteArray(len)
+        for (i in 0 until len) out[i] = view.get(off + i)
+        return out
+    }
+}
@@ -1,9 +1,13 @@
 package dev.peapod.android
 
+import java.nio.ByteBuffer
+
 /**
  * JNI bridge to pea-core (Rust). Init core, feed request/peers/messages/chunks, tick.
  * See .tasks/03-android.md §1.2.3 and §5.1. When libpea_core.a is not linked, native calls
  * use stubs (e.g. nativeCreate returns 0).
+ * A handle may be used from any thread at once (transport, discovery, tick and proxy threads): the core locks only
+ * around its own state changes, and identity calls such as [nativeDeviceId] take no lock.
  */
 object PeaCore {
     init {
@@ -13,6 +17,22 @@ object PeaCore {
     /** Protocol version for handshake (must match pea-core PROTOCOL_VERSION). */
     const val PROTOCOL_VERSION: Int = 1
 
+    /** [nativeOpenAndDispatch] result when the frame fails to decrypt/authenticate (drop the connection). */
+    const val OPEN_FAILED: Int = -2
+
+    /** [nativeFetchSelfChunks] result when the origin kept failing to deliver this device's chunks. */
+    const val FETCH_ORIGIN_FAILED: Int = -2
+
+    /** Largest [nativeStats] snapshot (every peer slot in use). */
+    const val STATS_MAX_BYTES: Int = 7272
+
+    /**
+     * Bytes a call needed when its outBuf was null or too small (it returned -n, n >= 3), else 0. Calls that change
+     * core state keep that output for the calling thread: size a buffer (e.g. from [BufferPool]) and collect it with
+     * [nativeTakeOutput] on the same thread.
+     */
+    fun needed(result: Int): Int = if (result < -2) -result else 0
+
     /** Create core instance. Returns 0 if stub or failure. */
     @JvmStatic
     external fun nativeCreate(): Long
@@ -21,13 +41,44 @@ object PeaCore {
     @JvmStatic
     external fun nativeDestroy(handle: Long)
 
-    /** This device's ID (16 bytes), or null on error. */
+    /**
+     * Chunk sizing for transfers started afterwards (pea-core Config). Chunks aim for chunksPerWorker per worker,
+     * at least minChunkRtts round trips of bytes, within [minChunkSize, maxChunkSize]; 0 keeps a field's default.
+     * Returns 0 or -1.
+     */
+    @JvmStatic
+    external fun nativeSetConfig(
+        handle: Long,
+        minChunkSize: Long,
+        maxChunkSize: Long,
+        chunksPerWorker: Int,
+        minChunkRtts: Int
+    ): Int
+
+    /**
+     * Keep verified chunks for repeat fetches and peers' ChunkRequests, up to budgetBytes (pea-core ChunkCache;
+     * least recently used go first). With path, payloads live in a file mapped there (created, and unlinked at once
+     * so it goes with the mapping); null keeps them on the heap. 0 turns the cache off. Returns 0 or -1.
+     */
+    @JvmStatic
+    external fun nativeSetChunkCache(handle: Long, budgetBytes: Long, path: String?): Int
+
+    /**
+     * Spill for streamed transfers longer than windowBytes: once more than windowBytes of out-of-order chunks are
+     * held, later ones go to a sparse file in dir (unlinked at once) and are sent from it with sendfile when their
+     * turn comes. Applies to sinks set after the call; null dir turns it off. Returns 0 or -1.
+     */
+    @JvmStatic
+    external fun nativeSetSpill(dir: String?, windowBytes: Long): Int
+
+    /** This device's ID (16 bytes), or null on error. Cached natively: every call returns the same array, so do not modify it. */
     @JvmStatic
     external fun nativeDeviceId(handle: Long): ByteArray?
 
     /**
-     * On incoming request. Returns 0 = Fallback, 1 = Accelerate (outBuf filled with assignment), -1 = error.
-     * outBuf must be large enough for accelerate result (see pea-core ffi layout).
+     * On incoming request. Returns 0 = Fallback, 1 = Accelerate (outBuf filled with the first chunks handed out;
+     * pull the rest with [nativeNextSelfChunk]), -1 = error, or a [needed] code for an Accelerate result that did
+     * not fit in outBuf (null or too small; see pea-core ffi layout).
      */
     @JvmStatic
     external fun nativeOnRequest(
@@ -35,54 +86,172 @@ object PeaCore {
         url: String,
         rangeStart: Long,
         rangeEnd: Long,
-        outBuf: ByteArray
+        outBuf: ByteArray?
+    ): Int
+
+    /** [nativeOnRequest] into a direct buffer (e.g. from [BufferPool]) at outBuf[outOff, outOff + outLen), without a per-call array. */
+    @JvmStatic
+    external fun nativeOnRequestDirect(
+        handle: Long,
+        url: String,
+        rangeStart: Long,
+        rangeEnd: Long,
+        outBuf: ByteBuffer,
+        outOff: Int,
+        outLen: Int
     ): Int
 
     /** Peer joined. deviceId 16 bytes, publicKey 32 bytes. Returns 0 on success, -1 on error. */
     @JvmStatic
     external fun nativePeerJoined(handle: Long, deviceId: ByteArray, publicKey: ByteArray): Int
 
-    /** Peer left. Optionally fills outBuf with outbound actions. Returns bytes written or 0. */
+    /** Peer left. Fills outBuf with outbound actions (ChunkRequests for its chunks). Returns bytes written, 0 if none, -1, or a [needed] code. */
     @JvmStatic
     external fun nativePeerLeft(handle: Long, deviceId: ByteArray, outBuf: ByteArray?): Int
 
-    /** Message received from peer. Fills outBuf with (body_len, body?, outbound_actions). Returns bytes written, -1 on error. */
+    /** Message received from peer. Fills outBuf with (body_len, body?, outbound_actions). Returns bytes written, -1 on error, or a [needed] code. */
     @JvmStatic
     external fun nativeOnMessageReceived(
         handle: Long,
         peerId: ByteArray,
         msg: ByteArray,
-        outBuf: ByteArray
+        outBuf: ByteArray?
+    ): Int
+
+    /**
+     * Process a burst of received (already decrypted) frames in one call. records is a direct buffer holding
+     * recordCount packed records (16 peer_id, 4 len LE, frame). outBuf (direct) gets 4 completed count, each
+     * (16 transfer_id, 4 len, body), then all outbound actions (4 count, each 16 peer_id, 4 len, payload).
+     * Returns bytes written, -1 on error (malformed records), or a [needed] code when outBuf is too small.
+     */
+    @JvmStatic
+    external fun nativeOnMessagesReceivedBatch(
+        handle: Long,
+        records: ByteBuffer,
+        recordsOff: Int,
+        recordsLen: Int,
+        recordCount: Int,
+        outBuf: ByteBuffer,
+        outOff: Int,
+        outLen: Int
     ): Int
 
-    /** Chunk received. Returns 0 = in progress, 1 = complete (reassembled body in outBuf), -1 = error. */
+    /**
+     * Chunk received. Returns 0 = in progress, 1 = complete (reassembled body in outBuf), -1 = error, or a [needed]
+     * code when complete but outBuf is too small. outBuf may be
+     * null when a sink fd is set; hash may be null when the payload was already checked (e.g. [nativeChunkVerifyFinish]
+     * returned 1, or it came straight from origin), so the core does not hash it again.
+     */
     @JvmStatic
     external fun nativeOnChunkReceived(
         handle: Long,
         transferId: ByteArray,
         start: Long,
         end: Long,
-        hash: ByteArray,
+        hash: ByteArray?,
         payload: ByteArray,
-        outBuf: ByteArray
+        outBuf: ByteArray?
     ): Int
 
-    /** Tick. Fills outBuf with serialized outbound actions. Returns bytes written or 0. */
+    /** Start hashing a chunk incrementally, fed by [nativeChunkVerifyUpdate] as reads arrive. Returns 0 on error. */
     @JvmStatic
-    external fun nativeTick(handle: Long, outBuf: ByteArray): Int
+    external fun nativeChunkVerifyBegin(): Long
 
-    /** Build discovery beacon frame. Returns bytes written to outBuf, or -1 on error. */
+    /** Hash buf[off, off + len) (direct buffer) into the verifier while the bytes are still in cache. 0 or -1. */
     @JvmStatic
-    external fun nativeBeaconFrame(handle: Long, listenPort: Int, outBuf: ByteArray): Int
+    external fun nativeChunkVerifyUpdate(verifier: Long, buf: ByteBuffer, off: Int, len: Int): Int
 
-    /** Build DiscoveryResponse frame (send to beacon sender). Returns bytes written, or -1 on error. */
+    /**
+     * Finish and free the verifier; outHash (32 bytes, nullable) gets the digest. Returns 1 if it equals
+     * expectedHash, 0 if not (or expectedHash is null), -1 on error.
+     */
     @JvmStatic
-    external fun nativeDiscoveryResponseFrame(handle: Long, listenPort: Int, outBuf: ByteArray): Int
+    external fun nativeChunkVerifyFinish(verifier: Long, expectedHash: ByteArray?, outHash: ByteArray?): Int
 
-    /** Decode Beacon or DiscoveryResponse frame. Fills outDeviceId (16), outPublicKey (32), outListenPort[0]. Returns 0 on success, -1 on error. */
+    /**
+     * Stream the transfer's body to fd (a connected socket): chunks are written as soon as they are in order
+     * and freed in the core, so no whole-body array is needed. fd < 0 clears the sink; do that before closing fd.
+     * Returns 0 or -1 (unknown transfer, or the write failed and the transfer was dropped).
+     */
+    @JvmStatic
+    external fun nativeSetTransferSinkFd(handle: Long, transferId: ByteArray, fd: Int): Int
+
+    /**
+     * Next chunk for this device to fetch via WAN; call whenever the fetch loop is idle (a chunk it still held is
+     * given up). Fills outRange[0..2) with start and end (exclusive). Returns 1, 0 when nothing is left, -1 on error.
+     */
+    @JvmStatic
+    external fun nativeNextSelfChunk(handle: Long, transferId: ByteArray, outRange: LongArray): Int
+
+    /**
+     * Drop a transfer in progress (several can run at once, each by its transfer id): frees its state and sink,
+     * later chunks for it are ignored. Returns 0, or -1 if unknown (already completed or cancelled).
+     */
+    @JvmStatic
+    external fun nativeCancelTransfer(handle: Long, transferId: ByteArray): Int
+
+    /** Progress of a transfer in progress: out (size >= 4) gets [totalLength, receivedBytes, chunksTotal, chunksReceived]. Returns 0, or -1 if unknown. */
+    @JvmStatic
+    external fun nativeTransferStatus(handle: Long, transferId: ByteArray, out: LongArray): Int
+
+    /**
+     * Direct buffer of at least size bytes from the native pool (capacity is the size class), or null if size is
+     * over 16 MiB or memory is short. Must be handed back with [nativeBufferRelease]; prefer [BufferPool.withBuffer].
+     */
+    @JvmStatic
+    external fun nativeBufferAcquire(size: Int): ByteBuffer?
+
+    /** Return a buffer from [nativeBufferAcquire] to the pool. It must not be used afterwards. */
+    @JvmStatic
+    external fun nativeBufferRelease(buf: ByteBuffer)
+
+    /** Tick. Fills outBuf with serialized outbound actions. Returns bytes written, 0 if none, -1, or a [needed] code. */
+    @JvmStatic
+    external fun nativeTick(handle: Long, outBuf: ByteArray?): Int
+
+    /**
+     * Hot-path counters, written little-endian at the start of a direct buffer without taking the core lock, so a UI
+     * or telemetry poll can call it from any thread. Layout (docs/API.md, Stats): header, wire seal/open and chunk
+     * hash bytes, failures and time histograms, this core's chunk and integrity counters, one record per peer with
+     * its chunk latency histogram, then JNI calls, bytes copied through Java arrays and arrays pinned. Returns bytes
+     * written (at most [STATS_MAX_BYTES]), -1, or a [needed] code.
+     */
+    @JvmStatic
+    external fun nativeStats(handle: Long, outBuf: ByteBuffer): Int
+
+    /**
+     * Turn ATrace sections on or off for the process: one per native call, the core's assign, verify, reassemble
+     * and encode phases, and an async `pea.transfer` slice per transfer (API 29+). They show up in systrace and
+     * Perfetto with the app's atrace category. Also on from load when `debug.peapod.trace` is 1. Returns 0, or -1
+     * when the device has no ATrace.
+     */
+    @JvmStatic
+    external fun nativeSetTracing(enabled: Boolean): Int
+
+    /**
+     * Collect the output a call kept when it returned a [needed] code. Returns bytes written, 0 if nothing is kept,
+     * -1, or the [needed] code again (still kept) if outBuf is still too small. Take it before the next such call.
+     */
+    @JvmStatic
+    external fun nativeTakeOutput(handle: Long, outBuf: ByteArray?): Int
+
+    /** [nativeTakeOutput] into a direct buffer at outBuf[outOff, outOff + outLen). */
+    @JvmStatic
+    external fun nativeTakeOutputDirect(handle: Long, outBuf: ByteBuffer, outOff: Int, outLen: Int): Int
+
+    /** Build discovery beacon frame. Returns bytes written to outBuf, -1 on error, or a [needed] code. */
+    @JvmStatic
+    external fun nativeBeaconFrame(handle: Long, listenPort: Int, outBuf: ByteArray?): Int
+
+    /** Build DiscoveryResponse frame (send to beacon sender). Returns bytes written, -1 on error, or a [needed] code. */
+    @JvmStatic
+    external fun nativeDiscoveryResponseFrame(handle: Long, listenPort: Int, outBuf: ByteArray?): Int
+
+    /** Decode the Beacon or DiscoveryResponse frame frame[0, frameLen). Fills outDeviceId (16), outPublicKey (32), outListenPort[0]. Returns 0 on success, -1 on error. */
     @JvmStatic
     external fun nativeDecodeDiscoveryFrame(
         frame: ByteArray,
+        frameLen: Int,
         outDeviceId: ByteArray,
         outPublicKey: ByteArray,
         outListenPort: IntArray
@@ -96,11 +265,204 @@ object PeaCore {
     @JvmStatic
     external fun nativeSessionKey(handle: Long, peerPublicKey: ByteArray, outSessionKey: ByteArray): Int
 
-    /** Encrypt for wire. Output length = plain.size + 16. Returns bytes written, or -1 on error. */
+    /** Encrypt for wire. Output length = plain.size + 16. Returns bytes written, -1 on error, or a [needed] code. */
     @JvmStatic
-    external fun nativeEncryptWire(sessionKey: ByteArray, nonce: Long, plain: ByteArray, outBuf: ByteArray): Int
+    external fun nativeEncryptWire(sessionKey: ByteArray, nonce: Long, plain: ByteArray, outBuf: ByteArray?): Int
 
-    /** Decrypt from wire. Output length = cipher.size - 16. Returns bytes written, or -1 on error. */
+    /** Decrypt from wire. Output length = cipher.size - 16. Returns bytes written, -1 on error, or a [needed] code. */
+    @JvmStatic
+    external fun nativeDecryptWire(sessionKey: ByteArray, nonce: Long, cipher: ByteArray, outBuf: ByteArray?): Int
+
+    /**
+     * Encrypt for wire without copying: plain and outBuf must be direct ByteBuffers (not overlapping).
+     * Reads plain[plainOff, plainOff + plainLen), writes ciphertext at outBuf[outOff]. Buffer positions are ignored.
+     * Returns bytes written (plainLen + 16), -1 on error (non-direct buffer, range out of bounds), or a [needed] code
+     * if outLen is too small.
+     */
+    @JvmStatic
+    external fun nativeEncryptWireDirect(
+        sessionKey: ByteArray,
+        nonce: Long,
+        plain: ByteBuffer,
+        plainOff: Int,
+        plainLen: Int,
+        outBuf: ByteBuffer,
+        outOff: Int,
+        outLen: Int
+    ): Int
+
+    /** Decrypt from wire without copying; same buffer rules as [nativeEncryptWireDirect]. Returns bytes written (cipherLen - 16), or -1 on error. */
+    @JvmStatic
+    external fun nativeDecryptWireDirect(
+        sessionKey: ByteArray,
+        nonce: Long,
+        cipher: ByteBuffer,
+        cipherOff: Int,
+        cipherLen: Int,
+        outBuf: ByteBuffer,
+        outOff: Int,
+        outLen: Int
+    ): Int
+
+    /**
+     * Create a per-connection wire cipher from a 32-byte session key (key schedule built once; seal and open
+     * nonces each start at 0 and are tracked natively). Returns 0 on error. Free with [nativeCipherDestroy].
+     */
+    @JvmStatic
+    external fun nativeCipherCreate(sessionKey: ByteArray): Long
+
+    /** Destroy a cipher from [nativeCipherCreate]. No-op for 0. */
+    @JvmStatic
+    external fun nativeCipherDestroy(cipher: Long)
+
+    /**
+     * Encrypt with the cipher's next seal nonce. Direct buffers as in [nativeEncryptWireDirect]; outBuf may be the
+     * same buffer and offset as plain (in place). Returns bytes written (plainLen + 16), or -1 on error.
+     */
+    @JvmStatic
+    external fun nativeCipherSeal(
+        cipher: Long,
+        plain: ByteBuffer,
+        plainOff: Int,
+        plainLen: Int,
+        outBuf: ByteBuffer,
+        outOff: Int,
+        outLen: Int
+    ): Int
+
+    /** Decrypt with the cipher's next open nonce (advanced only on success). Returns bytes written (cipherLen - 16), or -1 on error. */
+    @JvmStatic
+    external fun nativeCipherOpen(
+        cipher: Long,
+        cipherBuf: ByteBuffer,
+        cipherOff: Int,
+        cipherLen: Int,
+        outBuf: ByteBuffer,
+        outOff: Int,
+        outLen: Int
+    ): Int
+
+    /**
+     * Read-loop fast path: open frame[frameOff, frameOff + frameLen) in place with cipher, then pass the plaintext
+     * straight to on_message_received for peerId (one JNI crossing, no plaintext copy). frame and outBuf are direct
+     * buffers; outBuf gets the nativeOnMessageReceived layout (body_len, body?, outbound_actions).
+     * Returns bytes written to outBuf, [OPEN_FAILED] if the frame does not authenticate, or -1 on dispatch error.
+     */
+    @JvmStatic
+    external fun nativeOpenAndDispatch(
+        handle: Long,
+        cipher: Long,
+        peerId: ByteArray,
+        frame: ByteBuffer,
+        frameOff: Int,
+        frameLen: Int,
+        outBuf: ByteBuffer,
+        outOff: Int,
+        outLen: Int
+    ): Int
+
+    /**
+     * Start the native peer transport (pea_transport.c) on port: one epoll thread that owns every peer socket,
+     * does the handshake, framing, crypto and core dispatch, and only queues connect/disconnect and completed
+     * bodies for [NativeEvents]. Returns a transport handle or 0 on failure.
+     */
+    @JvmStatic
+    external fun nativeTransportStart(handle: Long, port: Int): Long
+
+    /** Stop the transport thread, close every peer connection and free the handle. */
+    @JvmStatic
+    external fun nativeTransportStop(transport: Long)
+
+    /** Connect to a discovered peer; addr is 4 or 16 bytes (InetAddress.address). No-op if already connected. 0 or -1. */
+    @JvmStatic
+    external fun nativeTransportConnect(transport: Long, deviceId: ByteArray, addr: ByteArray, port: Int): Int
+
+    /** Queue outbound actions buf[0, len) (nativeTick layout) to be sealed and sent by the transport thread. 0 or -1. */
+    @JvmStatic
+    external fun nativeTransportSendActions(transport: Long, buf: ByteArray, len: Int): Int
+
+    /**
+     * Start native LAN discovery (pea_discovery.c) advertising listenPort: one thread that beacons, reads
+     * datagrams in recvmmsg batches, keeps the known-peer table and calls core peer_joined / peer_left itself.
+     * Only join/leave transitions are queued for [NativeEvents]. Returns a discovery handle or 0 on failure.
+     */
+    @JvmStatic
+    external fun nativeDiscoveryStart(handle: Long, listenPort: Int, throttle: Boolean): Long
+
+    /** Stop the discovery thread, leave the multicast group and free the handle. */
+    @JvmStatic
+    external fun nativeDiscoveryStop(discovery: Long)
+
+    /** Use the long (battery saving) beacon interval from the next beacon on. */
+    @JvmStatic
+    external fun nativeDiscoverySetThrottle(discovery: Long, throttle: Boolean)
+
+    /**
+     * Start the native tunnel reader (pea_tun.c) on the VPN fd: packets are read in batches, HTTP flows are
+     * reflected to [LocalProxy] on tunAddr:proxyPort and everything else is dropped. The fd stays owned by the
+     * caller; stop before closing it. Returns a tunnel handle or 0 on failure.
+     */
+    @JvmStatic
+    external fun nativeTunStart(fd: Int, tunAddr: ByteArray, proxyPort: Int): Long
+
+    /** Stop the tunnel thread and free the handle. */
+    @JvmStatic
+    external fun nativeTunStop(tun: Long)
+
+    /**
+     * Fetch this device's chunks of transferId from origin natively (pea_fetch.c) until it has none left to claim:
+     * up to 4 are claimed at once, adjacent ones share one Range request over a pooled keep-alive connection, and
+     * each body goes to the core without passing through Java. host is the Host header ("name[:port]"), base the
+     * client's range start (chunk offsets are relative to it). Sockets are protected with vpnService.
+     * Blocks; call from the connection's thread with the transfer sink already set. Returns 1 when the transfer
+     * completed, 0 when no self chunk is left to claim (not the end of the transfer: peers' chunks may still be in
+     * flight, and ones they drop return to the pool for another call), -1 if the core rejected a chunk or the sink
+     * failed, or [FETCH_ORIGIN_FAILED] once several batches in a row (with back-off in between) got nothing from
+     * origin.
+     */
+    @JvmStatic
+    external fun nativeFetchSelfChunks(handle: Long, vpnService: android.net.VpnService, transferId: ByteArray, host: String, path: String, base: Long): Int
+
+    /**
+     * Drain queued engine events (pea_events.c) into outBuf[outOff, outOff + outLen), a direct buffer, as records:
+     * 4 payload length LE, 1 type, payload (see [NativeEvents] for the types). Waits up to timeoutMs (-1 forever)
+     * while the queue is empty. Returns bytes written, 0 on timeout or [nativeWakeEvents], [needed] when outBuf
+     * cannot hold the next record (it stays queued), -1 on error. One consumer thread only.
+     */
+    @JvmStatic
+    external fun nativePollEvents(outBuf: ByteBuffer, outOff: Int, outLen: Int, timeoutMs: Int): Int
+
+    /** Make a waiting [nativePollEvents] return 0 (to stop the consumer thread). */
+    @JvmStatic
+    external fun nativeWakeEvents()
+
+    /**
+     * Create the native upload engine (pea_upload.c) on core handle and a running transport; 0 on failure. Free with
+     * [nativeUploadDestroy] once [nativeUploadServe] has returned and no [nativeUpload] is running.
+     */
+    @JvmStatic
+    external fun nativeUploadStart(handle: Long, transport: Long): Long
+
+    /**
+     * Relay loop: PUT every upload part a peer sends this device to its origin (sockets protected with vpnService)
+     * and ack it. Blocks until [nativeUploadStop]; call from a thread of its own.
+     */
+    @JvmStatic
+    external fun nativeUploadServe(upload: Long, vpnService: android.net.VpnService)
+
+    /** Make [nativeUploadServe] return within a quarter second. */
+    @JvmStatic
+    external fun nativeUploadStop(upload: Long)
+
+    @JvmStatic
+    external fun nativeUploadDestroy(upload: Long)
+
+    /**
+     * Upload fd[0, length) to http://host/path through the pod: the core splits it into parts by each device's
+     * measured uplink rate, this device PUTs its own with Content-Range and peers PUT theirs from their uplinks, so
+     * the origin must accept ranged PUTs. fd must support pread (a file, not a pipe). Blocks. Returns 1 when every
+     * part reached origin, 0 when not accelerated (no peers: upload directly), -1 on failure.
+     */
     @JvmStatic
-    external fun nativeDecryptWire(sessionKey: ByteArray, nonce: Long, cipher: ByteArray, outBuf: ByteArray): Int
+    external fun nativeUpload(upload: Long, vpnService: android.net.VpnService, fd: Int, length: Long, host: String, path: String): Int
 }
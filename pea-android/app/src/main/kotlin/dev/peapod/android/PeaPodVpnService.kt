@@ -17,12 +17,15 @@ import android.os.ParcelFileDescriptor
 import androidx.core.content.ContextCompat
 import androidx.core.app.NotificationCompat
 import androidx.core.app.NotificationManagerCompat
+import java.io.File
+import java.net.InetAddress
 import kotlin.concurrent.thread
 
 /**
  * VPN service for PeaPod traffic interception (.tasks/03-android §2.1, §2.4, §2.2).
  * Establishes tunnel (10.0.0.2/32, default route); runs as foreground with notification.
- * Local proxy on 127.0.0.1:3128 parses HTTP and calls core (§2.2.3–2.2.4). Tunnel packet read loop runs but does not yet redirect to proxy.
+ * Local proxy on 127.0.0.1:3128 parses HTTP and calls core (§2.2.3–2.2.4). The native tunnel reader (pea_tun.c) reflects
+ * HTTP flows from the tunnel to the proxy on TUN_ADDRESS:3128; other packets are still dropped (relay §2.2.2 pending).
  */
 class PeaPodVpnService : VpnService() {
 
@@ -36,9 +39,17 @@ class PeaPodVpnService : VpnService() {
         @Volatile var peerCountForUi = 0
         /** When true, discovery uses longer beacon interval (§7.1). */
         @Volatile var throttleDueToBattery = false
+        const val TUN_ADDRESS = "10.0.0.2"
+        /** Matches the native reader's packet slots (pea_tun.c). */
+        const val TUN_MTU = 1500
+        /** Chunk cache budget; the payloads live in a file under cacheDir rather than on the heap. */
+        const val CHUNK_CACHE_BYTES = 64L * 1024 * 1024
+        const val SPILL_WINDOW_BYTES = 32L * 1024 * 1024
     }
 
     private var tunnelFd: ParcelFileDescriptor? = null
+    /** Native tunnel reader (PeaCore.nativeTunStart), 0 if not running. */
+    private var tun: Long = 0L
     private var coreHandle: Long = 0L
     private var batteryReceiver: BroadcastReceiver? = null
 
@@ -60,7 +71,8 @@ class PeaPodVpnService : VpnService() {
         }
         val builder = Builder()
             .setSession(getString(R.string.app_name))
-            .addAddress("10.0.0.2", 32)
+            .addAddress(TUN_ADDRESS, 32)
+            .setMtu(TUN_MTU)
             .addRoute("0.0.0.0", 0)
             .addDnsServer("8.8.8.8")
         tunnelFd = builder.establish()
@@ -69,7 +81,12 @@ class PeaPodVpnService : VpnService() {
             return START_NOT_STICKY
         }
         coreHandle = PeaCore.nativeCreate()
-        LocalProxy.start(coreHandle, this)
+        if (PeaCore.nativeSetChunkCache(coreHandle, CHUNK_CACHE_BYTES, File(cacheDir, "chunk-cache").path) != 0) {
+            // No file to map (e.g. storage full): a smaller cache on the heap instead.
+            PeaCore.nativeSetChunkCache(coreHandle, CHUNK_CACHE_BYTES / 4, null)
+        }
+        PeaCore.nativeSetSpill(cacheDir.path, SPILL_WINDOW_BYTES)
+        LocalProxy.start(coreHandle, this, TUN_ADDRESS)
         Discovery.onPeerCountChanged = {
             Handler(Looper.getMainLooper()).post {
                 peerCountForUi = Discovery.peerCount()
@@ -79,8 +96,9 @@ class PeaPodVpnService : VpnService() {
         Discovery.onPeerDiscovered = { deviceId, publicKey, addr, port ->
             Transport.connectTo(deviceId, publicKey, addr, port)
         }
+        NativeEvents.start()
         Discovery.start(coreHandle, Discovery.LOCAL_TRANSPORT_PORT)
-        Transport.start(coreHandle)
+        Transport.start(coreHandle, this)
         registerBatteryReceiver()
         startTunnelReadLoop()
         vpnActive = true
@@ -89,9 +107,11 @@ class PeaPodVpnService : VpnService() {
         return START_STICKY
     }
 
-    /** Read packets from tunnel (required so VPN doesn't stall). Full TCP redirect to proxy deferred. */
+    /** Read packets from tunnel (required so VPN doesn't stall): natively, or drained here if the reader fails to start. */
     private fun startTunnelReadLoop() {
         val fd = tunnelFd ?: return
+        tun = PeaCore.nativeTunStart(fd.fd, InetAddress.getByName(TUN_ADDRESS).address, LocalProxy.PROXY_PORT)
+        if (tun != 0L) return
         thread(name = "VpnTunnelRead") {
             val buf = ByteArray(32768)
             try {
@@ -114,6 +134,7 @@ class PeaPodVpnService : VpnService() {
     private fun stopVpn() {
         Transport.stop()
         Discovery.stop()
+        NativeEvents.stop()
         Discovery.onPeerCountChanged = null
         Discovery.onPeerDiscovered = null
         LocalProxy.stop()
@@ -122,6 +143,8 @@ class PeaPodVpnService : VpnService() {
             coreHandle = 0L
         }
         unregisterBatteryReceiver()
+        if (tun != 0L) PeaCore.nativeTunStop(tun)
+        tun = 0L
         tunnelFd?.close()
         tunnelFd = null
         vpnActive = false
@@ -0,0 +1,251 @@
+//! Criterion benches for the core's hot paths: chunk splitting, the pull scheduler, reassembly, frame encoding and a
+//! whole transfer against N synthetic peers. `cargo bench -p pea-core`; results land as JSON under
+//! target/criterion/<group>/<bench>/new/estimates.json, or one line per bench with `-- --output-format bencher`.
+
+use std::collections::{HashMap, VecDeque};
+
+use criterion::{
+    black_box, criterion_group, criterion_main, BatchSize, BenchmarkId, Criterion, Throughput,
+};
+use pea_core::chunk::{split_into_chunks, ChunkId, ChunkSink, TransferState, DEFAULT_CHUNK_SIZE};
+use pea_core::integrity::hash_chunk;
+use pea_core::scheduler::WorkQueue;
+use pea_core::{
+    decode_frame, encode_frame, encode_frame_into, Action, DeviceId, FrameRef, Keypair, Message,
+    OutboundAction, PeaPodCore,
+};
+
+const TID: [u8; 16] = [7; 16];
+const FRAME_SIZES: [usize; 3] = [1024, 64 * 1024, 256 * 1024];
+
+/// Bytes of the synthetic body at [start, end).
+fn pattern(start: u64, end: u64) -> Vec<u8> {
+    (start..end).map(|i| (i * 31 % 251) as u8).collect()
+}
+
+struct NullSink;
+
+impl ChunkSink for NullSink {
+    fn write(&mut self, bytes: &[u8]) -> bool {
+        black_box(bytes);
+        true
+    }
+}
+
+fn bench_split(c: &mut Criterion) {
+    let mut g = c.benchmark_group("split_into_chunks");
+    for total in [16u64 << 20, 1 << 30] {
+        g.bench_with_input(BenchmarkId::from_parameter(total), &total, |b, &total| {
+            b.iter(|| split_into_chunks(TID, black_box(total), DEFAULT_CHUNK_SIZE))
+        });
+    }
+    g.finish();
+}
+
+/// Hand out and complete every chunk of a 1 GiB transfer among `workers`, four in flight each.
+fn bench_scheduler(c: &mut Criterion) {
+    let chunks = split_into_chunks(TID, 1 << 30, DEFAULT_CHUNK_SIZE);
+    let mut g = c.benchmark_group("scheduler_work_queue");
+    g.throughput(Throughput::Elements(chunks.len() as u64));
+    for workers in [2usize, 8, 16] {
+        let ids: Vec<DeviceId> = (0..workers)
+            .map(|_| Keypair::generate().device_id())
+            .collect();
+        g.bench_with_input(BenchmarkId::from_parameter(workers), &ids, |b, ids| {
+            b.iter_batched(
+                || WorkQueue::new(chunks.clone()),
+                |mut q| {
+                    let mut in_flight: VecDeque<ChunkId> = VecDeque::new();
+                    let mut now = 0;
+                    loop {
+                        for &w in ids {
+                            while let Some(c) = q.next_for(w, 4, now) {
+                                in_flight.push_back(c);
+                            }
+                        }
+                        let Some(c) = in_flight.pop_front() else {
+                            break;
+                        };
+                        q.complete(c);
+                        now += 1;
+                    }
+                    q.done_count()
+                },
+                BatchSize::LargeInput,
+            )
+        });
+    }
+    g.finish();
+}
+
+/// Receive 64 chunks of 256 KiB in order and in reverse (everything held until the last), buffered and streamed.
+fn bench_transfer_state(c: &mut Criterion) {
+    let total = 64 * DEFAULT_CHUNK_SIZE;
+    let chunks = split_into_chunks(TID, total, DEFAULT_CHUNK_SIZE);
+    let payloads: Vec<Vec<u8>> = chunks.iter().map(|c| pattern(c.start, c.end)).collect();
+    let mut g = c.benchmark_group("transfer_state");
+    g.throughput(Throughput::Bytes(total));
+    for (name, reverse, streamed) in [
+        ("in_order", false, false),
+        ("reverse", true, false),
+        ("in_order_sink", false, true),
+        ("reverse_sink", true, true),
+    ] {
+        g.bench_function(name, |b| {
+            b.iter_batched(
+                || {
+                    let mut state = TransferState::new(TID, total, chunks.clone());
+                    let writer = streamed.then(|| state.set_sink(Box::new(NullSink)));
+                    (state, writer)
+                },
+                |(mut state, writer)| {
+                    let order: Box<dyn Iterator<Item = usize>> = if reverse {
+                        Box::new((0..chunks.len()).rev())
+                    } else {
+                        Box::new(0..chunks.len())
+                    };
+                    for i in order {
+                        state.mark_received(chunks[i], &payloads[i]);
+                        if let Some(w) = &writer {
+                            state.flush_contiguous();
+                            w.deliver();
+                        }
+                    }
+                    state.take_body().len()
+                },
+                BatchSize::LargeInput,
+            )
+        });
+    }
+    g.finish();
+}
+
+fn bench_wire(c: &mut Criterion) {
+    let mut g = c.benchmark_group("wire_chunk_data");
+    for size in FRAME_SIZES {
+        let payload = pattern(0, size as u64);
+        let msg = Message::ChunkData {
+            transfer_id: TID,
+            start: 0,
+            end: size as u64,
+            hash: hash_chunk(&payload),
+            payload: payload.clone(),
+        };
+        let frame = FrameRef::from(&msg);
+        let mut out = vec![0u8; size + 128];
+        g.throughput(Throughput::Bytes(size as u64));
+        g.bench_with_input(BenchmarkId::new("encode_frame", size), &msg, |b, msg| {
+            b.iter(|| encode_frame(black_box(msg)).map(|f| f.len()))
+        });
+        g.bench_with_input(
+            BenchmarkId::new("encode_frame_into", size),
+            &frame,
+            |b, frame| b.iter(|| encode_frame_into(black_box(frame), &mut out)),
+        );
+        let bytes = encode_frame(&msg).expect("encode");
+        g.bench_with_input(
+            BenchmarkId::new("decode_frame_ref", size),
+            &bytes,
+            |b, bytes| b.iter(|| pea_core::decode_frame_ref(black_box(bytes)).map(|(_, n)| n)),
+        );
+    }
+    g.finish();
+}
+
+/// One accelerated 32 MiB transfer: self fetches its chunks, every peer answers each ChunkRequest at once. Every
+/// chunk is verified by the core as in production; frames for the peers' chunks are built as they are answered.
+fn simulate(
+    core: &mut PeaPodCore,
+    hashes: &mut HashMap<(u64, u64), [u8; 32]>,
+    source: &[u8],
+) -> usize {
+    let total = source.len() as u64;
+    let self_id = core.device_id();
+    let Action::Accelerate {
+        transfer_id,
+        assignment,
+        ..
+    } = core.on_incoming_request("http://bench.invalid/blob", Some((0, total - 1)))
+    else {
+        panic!("expected Accelerate");
+    };
+    let mut queue: VecDeque<(DeviceId, u64, u64)> = assignment
+        .iter()
+        .map(|&(c, w)| (w, c.start, c.end))
+        .collect();
+    let mut frame = Vec::new();
+    while let Some((worker, start, end)) = queue.pop_front() {
+        let payload = &source[start as usize..end as usize];
+        let hash = *hashes
+            .entry((start, end))
+            .or_insert_with(|| hash_chunk(payload));
+        if worker == self_id {
+            match core.on_chunk_received(transfer_id, start, end, hash, payload) {
+                Ok(Some(body)) => return body.len(),
+                Ok(None) => {}
+                Err(e) => panic!("self chunk: {e}"),
+            }
+            for c in core.next_self_chunks(transfer_id, 1) {
+                queue.push_back((self_id, c.start, c.end));
+            }
+            continue;
+        }
+        let data = FrameRef::ChunkData {
+            transfer_id,
+            start,
+            end,
+            hash,
+            payload,
+        };
+        frame.resize(payload.len() + 128, 0);
+        let n = encode_frame_into(&data, &mut frame).expect("encode");
+        let (actions, completed) = core
+            .on_message_received(worker, &frame[..n])
+            .expect("decode");
+        if let Some((_, body)) = completed {
+            return body.len();
+        }
+        for OutboundAction::SendMessage(peer, bytes) in actions {
+            if let Ok((Message::ChunkRequest { start, end, .. }, _)) = decode_frame(&bytes) {
+                queue.push_back((peer, start, end));
+            }
+        }
+    }
+    panic!("transfer did not complete");
+}
+
+fn bench_full_transfer(c: &mut Criterion) {
+    let total = 32u64 << 20;
+    let source = pattern(0, total);
+    let mut g = c.benchmark_group("full_transfer");
+    g.throughput(Throughput::Bytes(total));
+    g.sample_size(10);
+    for peers in [1usize, 4, 8] {
+        let mut hashes = HashMap::new();
+        g.bench_with_input(BenchmarkId::from_parameter(peers), &peers, |b, &peers| {
+            b.iter_batched(
+                || {
+                    let mut core = PeaPodCore::with_keypair(Keypair::generate());
+                    for _ in 0..peers {
+                        let kp = Keypair::generate();
+                        core.on_peer_joined(kp.device_id(), kp.public_key());
+                    }
+                    core
+                },
+                |mut core| simulate(&mut core, &mut hashes, &source),
+                BatchSize::LargeInput,
+            )
+        });
+    }
+    g.finish();
+}
+
+criterion_group!(
+    benches,
+    bench_split,
+    bench_scheduler,
+    bench_transfer_state,
+    bench_wire,
+    bench_full_transfer
+);
+criterion_main!(benches);
@@ -0,0 +1,389 @@
+//! Chunk cache: verified chunk payloads kept for later requests, so a range fetched once (by this device or for a
+//! peer) is served again without WAN bytes. Bounded by a byte budget with least-recently-used eviction. Entries
+//! are found by (URL, range) in absolute origin offsets, and payloads are stored once by hash, so the same bytes
+//! under several URLs (mirrors, cache-busting queries) take the budget once.
+//!
+//! Origin content can change under the same URL, so entries expire after a max age on the core clock, and the
+//! host reports each origin response's validator (ETag or Last-Modified): when it changes, everything cached for
+//! that URL is dropped.
+//!
+//! Payloads live on the heap or in an arena the host provides (e.g. an mmap'd file, so the cache can exceed what
+//! the process should keep resident); the core still does no I/O itself.
+
+use std::collections::{BTreeMap, HashMap};
+
+use crate::chunk::HostArena;
+
+/// (URL, range) aliases kept per payload; the oldest is dropped beyond this.
+const MAX_KEYS_PER_BLOB: usize = 8;
+/// Payload budget hosts use unless configured otherwise.
+pub const DEFAULT_BUDGET_BYTES: u64 = 64 * 1024 * 1024;
+/// Age (core clock ms) after which an entry is dropped instead of served, unless set with `set_max_age`.
+pub const DEFAULT_MAX_AGE_MS: u64 = 10 * 60 * 1000;
+
+enum Data {
+    Heap(Box<[u8]>),
+    /// Offset of the payload in the arena.
+    Arena(usize),
+}
+
+struct Blob {
+    data: Data,
+    len: usize,
+    /// Tick of the last insert or hit; the blob's key in `lru`.
+    last_used: u64,
+    keys: Vec<(String, u64)>,
+}
+
+/// One cached range of a URL.
+#[derive(Clone, Copy)]
+struct Entry {
+    end: u64,
+    hash: [u8; 32],
+    /// Core clock when the range was stored.
+    stored_ms: u64,
+}
+
+/// Cached ranges of one URL and the validator of the origin response they came from.
+#[derive(Default)]
+struct UrlEntries {
+    /// Range start -> entry.
+    ranges: BTreeMap<u64, Entry>,
+    validator: Option<String>,
+}
+
+/// Hit and miss counts and bytes in use, from `ChunkCache::stats`.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct CacheStats {
+    pub hits: u64,
+    pub misses: u64,
+    pub bytes_used: u64,
+    pub entries: u64,
+}
+
+pub struct ChunkCache {
+    budget: usize,
+    used: usize,
+    arena: Option<Box<dyn HostArena>>,
+    /// Arena offset -> length of every payload stored there, for first-fit placement.
+    spans: BTreeMap<usize, usize>,
+    urls: HashMap<String, UrlEntries>,
+    max_age_ms: Option<u64>,
+    blobs: HashMap<[u8; 32], Blob>,
+    lru: BTreeMap<u64, [u8; 32]>,
+    tick: u64,
+    hits: u64,
+    misses: u64,
+}
+
+impl ChunkCache {
+    /// Heap-backed cache holding at most `budget_bytes` of payload.
+    pub fn new(budget_bytes: usize) -> Self {
+        Self {
+            budget: budget_bytes,
+            used: 0,
+            arena: None,
+            spans: BTreeMap::new(),
+            urls: HashMap::new(),
+            max_age_ms: Some(DEFAULT_MAX_AGE_MS),
+            blobs: HashMap::new(),
+            lru: BTreeMap::new(),
+            tick: 0,
+            hits: 0,
+            misses: 0,
+        }
+    }
+
+    /// Cache storing payloads in `arena`; the budget is capped at the arena's size.
+    pub fn with_arena(mut arena: Box<dyn HostArena>, budget_bytes: usize) -> Self {
+        let budget = budget_bytes.min(arena.bytes().len());
+        Self {
+            arena: Some(arena),
+            ..Self::new(budget)
+        }
+    }
+
+    /// Serve entries for at most `max_age_ms` after they were stored; None keeps them until evicted.
+    pub fn set_max_age(&mut self, max_age_ms: Option<u64>) {
+        self.max_age_ms = max_age_ms;
+    }
+
+    /// Record the validator (ETag, else Last-Modified) of an origin response for url. If it differs from the one
+    /// the cached ranges came with, the origin content changed: they are all dropped.
+    pub fn set_validator(&mut self, url: &str, validator: &str) {
+        let stale = match self.urls.get(url) {
+            Some(u) if u.validator.as_deref() == Some(validator) => return,
+            Some(u) if u.validator.is_some() => {
+                u.ranges.iter().map(|(&s, e)| (s, e.hash)).collect()
+            }
+            _ => Vec::new(),
+        };
+        for (start, hash) in stale {
+            self.unlink(url, start, hash);
+        }
+        self.urls.entry(url.to_string()).or_default().validator = Some(validator.to_string());
+    }
+
+    pub fn stats(&self) -> CacheStats {
+        CacheStats {
+            hits: self.hits,
+            misses: self.misses,
+            bytes_used: self.used as u64,
+            entries: self.blobs.len() as u64,
+        }
+    }
+
+    /// Payload cached for url [start, end) and its hash, at core clock `now_ms`. Counts a hit or miss and marks the
+    /// entry recently used; an entry past the max age is dropped and counts as a miss.
+    pub fn get(
+        &mut self,
+        url: &str,
+        start: u64,
+        end: u64,
+        now_ms: u64,
+    ) -> Option<([u8; 32], &[u8])> {
+        let entry = self
+            .urls
+            .get(url)
+            .and_then(|u| u.ranges.get(&start))
+            .filter(|e| e.end == end)
+            .copied();
+        let Some(entry) = entry else {
+            self.misses += 1;
+            return None;
+        };
+        if self
+            .max_age_ms
+            .is_some_and(|max| now_ms.saturating_sub(entry.stored_ms) > max)
+        {
+            self.unlink(url, start, entry.hash);
+            self.misses += 1;
+            return None;
+        }
+        let hash = entry.hash;
+        self.hits += 1;
+        self.touch(hash);
+        let blob = &self.blobs[&hash];
+        let bytes = match &blob.data {
+            Data::Heap(b) => &b[..],
+            Data::Arena(off) => {
+                let arena = self.arena.as_mut().expect("arena blob without arena");
+                &arena.bytes()[*off..*off + blob.len]
+            }
+        };
+        Some((hash, bytes))
+    }
+
+    /// Keep payload as url [start, end), stored at core clock `now_ms`. `hash` must be its verified digest.
+    /// Payloads that do not fill the range or exceed the budget are not kept; older entries are evicted to make
+    /// room.
+    pub fn insert(
+        &mut self,
+        url: &str,
+        start: u64,
+        end: u64,
+        hash: [u8; 32],
+        payload: &[u8],
+        now_ms: u64,
+    ) {
+        if payload.is_empty()
+            || end.checked_sub(start) != Some(payload.len() as u64)
+            || payload.len() > self.budget
+        {
+            return;
+        }
+        let current = self
+            .urls
+            .get(url)
+            .and_then(|u| u.ranges.get(&start))
+            .copied();
+        match current {
+            Some(e) if e.end == end && e.hash == hash => {
+                self.touch(hash);
+                self.set_stored(url, start, now_ms);
+                return;
+            }
+            Some(e) => self.unlink(url, start, e.hash),
+            None => {}
+        }
+        if !self.blobs.contains_key(&hash) {
+            let Some(data) = self.store(payload) else {
+                return;
+            };
+            self.tick += 1;
+            self.lru.insert(self.tick, hash);
+            self.blobs.insert(
+                hash,
+                Blob {
+                    data,
+                    len: payload.len(),
+                    last_used: self.tick,
+                    keys: Vec::new(),
+                },
+            );
+        } else {
+            self.touch(hash);
+        }
+        let blob = self.blobs.get_mut(&hash).expect("blob just stored");
+        blob.keys.push((url.to_string(), start));
+        if blob.keys.len() > MAX_KEYS_PER_BLOB {
+            let (old_url, old_start) = blob.keys.remove(0);
+            Self::remove_range(&mut self.urls, &old_url, old_start);
+        }
+        self.urls.entry(url.to_string()).or_default().ranges.insert(
+            start,
+            Entry {
+                end,
+                hash,
+                stored_ms: now_ms,
+            },
+        );
+    }
+
+    fn set_stored(&mut self, url: &str, start: u64, now_ms: u64) {
+        if let Some(e) = self
+            .urls
+            .get_mut(url)
+            .and_then(|u| u.ranges.get_mut(&start))
+        {
+            e.stored_ms = now_ms;
+        }
+    }
+
+    /// Copy payload into storage, evicting least recently used blobs until it fits.
+    fn store(&mut self, payload: &[u8]) -> Option<Data> {
+        loop {
+            if self.used + payload.len() <= self.budget {
+                if self.arena.is_none() {
+                    self.used += payload.len();
+                    return Some(Data::Heap(payload.into()));
+                }
+                // Free bytes can be scattered between payloads; evict on until a gap is big enough.
+                if let Some(off) = self.find_gap(payload.len()) {
+                    let arena = self.arena.as_mut().expect("checked above");
+                    arena.bytes()[off..off + payload.len()].copy_from_slice(payload);
+                    self.spans.insert(off, payload.len());
+                    self.used += payload.len();
+                    return Some(Data::Arena(off));
+                }
+            }
+            let (_, &oldest) = self.lru.iter().next()?;
+            self.evict(oldest);
+        }
+    }
+
+    /// First arena offset with len free bytes before the next payload (or the end of the budget).
+    fn find_gap(&self, len: usize) -> Option<usize> {
+        let mut free_from = 0;
+        for (&off, &l) in &self.spans {
+            if off - free_from >= len {
+                return Some(free_from);
+            }
+            free_from = off + l;
+        }
+        (self.budget - free_from >= len).then_some(free_from)
+    }
+
+    fn touch(&mut self, hash: [u8; 32]) {
+        let Some(blob) = self.blobs.get_mut(&hash) else {
+            return;
+        };
+        self.lru.remove(&blob.last_used);
+        self.tick += 1;
+        blob.last_used = self.tick;
+        self.lru.insert(self.tick, hash);
+    }
+
+    /// Drop the (url, start) alias of hash, and the payload with its last alias.
+    fn unlink(&mut self, url: &str, start: u64, hash: [u8; 32]) {
+        Self::remove_range(&mut self.urls, url, start);
+        if let Some(blob) = self.blobs.get_mut(&hash) {
+            blob.keys.retain(|(u, s)| !(u == url && *s == start));
+            if blob.keys.is_empty() {
+                self.evict(hash);
+            }
+        }
+    }
+
+    fn evict(&mut self, hash: [u8; 32]) {
+        let Some(blob) = self.blobs.remove(&hash) else {
+            return;
+        };
+        self.lru.remove(&blob.last_used);
+        for (url, start) in &blob.keys {
+            Self::remove_range(&mut self.urls, url, *start);
+        }
+        if let Data::Arena(off) = blob.data {
+            self.spans.remove(&off);
+        }
+        self.used -= blob.len;
+    }
+
+    /// Drop the (url, start) range; the URL (and its validator) goes with its last range.
+    fn remove_range(urls: &mut HashMap<String, UrlEntries>, url: &str, start: u64) {
+        if let Some(u) = urls.get_mut(url) {
+            u.ranges.remove(&start);
+            if u.ranges.is_empty() {
+                urls.remove(url);
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::integrity::hash_chunk;
+
+    struct VecArena(Vec<u8>);
+
+    impl HostArena for VecArena {
+        fn bytes(&mut self) -> &mut [u8] {
+            &mut self.0
+        }
+    }
+
+    #[test]
+    fn same_bytes_under_two_urls_are_stored_once_and_lru_evicts_oldest() {
+        let mut cache = ChunkCache::with_arena(Box::new(VecArena(vec![0; 300])), 1 << 20);
+        let a = vec![1u8; 100];
+        let b = vec![2u8; 100];
+        let c = vec![3u8; 150];
+        cache.insert("http://x/a", 0, 100, hash_chunk(&a), &a, 0);
+        cache.insert("http://mirror/a", 500, 600, hash_chunk(&a), &a, 0);
+        cache.insert("http://x/b", 0, 100, hash_chunk(&b), &b, 0);
+        assert_eq!(cache.stats().bytes_used, 200);
+        assert_eq!(cache.get("http://mirror/a", 500, 600, 0).unwrap().1, &a[..]);
+        assert!(cache.get("http://x/a", 0, 99, 0).is_none());
+        // 150 more bytes only fit once b (least recently used) goes; a was just hit and stays.
+        cache.insert("http://x/c", 0, 150, hash_chunk(&c), &c, 0);
+        assert!(cache.get("http://x/b", 0, 100, 0).is_none());
+        assert_eq!(cache.get("http://x/a", 0, 100, 0).unwrap().1, &a[..]);
+        assert_eq!(cache.get("http://x/c", 0, 150, 0).unwrap().1, &c[..]);
+        let stats = cache.stats();
+        assert_eq!((stats.hits, stats.misses, stats.entries), (3, 2, 2));
+        assert_eq!(stats.bytes_used, 250);
+    }
+
+    #[test]
+    fn entries_expire_and_a_new_origin_validator_drops_the_url() {
+        let mut cache = ChunkCache::new(1 << 20);
+        cache.set_max_age(Some(1000));
+        let a = vec![1u8; 100];
+        let b = vec![2u8; 100];
+        cache.set_validator("http://x/a", "\"v1\"");
+        cache.insert("http://x/a", 0, 100, hash_chunk(&a), &a, 0);
+        cache.insert("http://x/a", 100, 200, hash_chunk(&b), &b, 500);
+        cache.insert("http://x/b", 0, 100, hash_chunk(&b), &b, 500);
+        assert!(cache.get("http://x/a", 0, 100, 1000).is_some());
+        // Past the max age: dropped, not served.
+        assert!(cache.get("http://x/a", 0, 100, 1001).is_none());
+        assert_eq!(cache.stats().entries, 1);
+        // The same validator keeps the rest; a new one drops everything cached for that URL only.
+        cache.set_validator("http://x/a", "\"v1\"");
+        assert!(cache.get("http://x/a", 100, 200, 1001).is_some());
+        cache.set_validator("http://x/a", "\"v2\"");
+        assert!(cache.get("http://x/a", 100, 200, 1001).is_none());
+        assert_eq!(cache.get("http://x/b", 0, 100, 1001).unwrap().1, &b[..]);
+    }
+}
@@ -1,12 +1,16 @@
 //! Chunk manager: split transfer into chunks, track state, reassemble.
 
-use std::collections::HashMap;
+use std::collections::VecDeque;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::{Arc, Mutex, MutexGuard, PoisonError, TryLockError};
 
 use crate::integrity;
 use crate::protocol::Message;
 
-/// Default chunk size in bytes (constant for now).
+/// Default chunk size in bytes (for `split_into_chunks` with size 0; transfers size chunks adaptively).
 pub const DEFAULT_CHUNK_SIZE: u64 = 256 * 1024; // 256 KiB
+/// Adaptive chunk sizes at or above this are rounded down to a multiple of it (page-sized ranges).
+const CHUNK_ALIGN: u64 = 4096;
 
 /// Chunk identifier: transfer ID + range (start, end).
 #[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
@@ -37,55 +41,476 @@ pub fn split_into_chunks(transfer_id: [u8; 16], total_len: u64, chunk_size: u64)
     out
 }
 
+/// Chunk sizes for a transfer split with `split_into_chunks_tapered`: `(head, tail, tail_bytes)`.
+/// Head chunks aim for `chunks_per_worker` chunks per worker, so short ranges still spread over the pod, but are
+/// never smaller than `floor` (a few round trips' worth of bytes, so request overhead stays small), within
+/// [min_size, max_size]. The last `tail_bytes` (one head chunk per worker) use quarter-size chunks so the
+/// stragglers at the end of a transfer are short.
+pub fn adaptive_chunk_sizes(
+    total_len: u64,
+    workers: usize,
+    chunks_per_worker: u64,
+    floor: u64,
+    min_size: u64,
+    max_size: u64,
+) -> (u64, u64, u64) {
+    let align = |x: u64| {
+        if x >= CHUNK_ALIGN {
+            x / CHUNK_ALIGN * CHUNK_ALIGN
+        } else {
+            x
+        }
+    };
+    let min = min_size.max(1);
+    let max = max_size.max(min);
+    let workers = (workers as u64).max(1);
+    let by_count = total_len / workers.saturating_mul(chunks_per_worker.max(1));
+    let head = align(by_count.max(floor)).clamp(min, max);
+    let tail = align(head / 4).clamp(min, head);
+    let tail_bytes = if tail < head {
+        head.saturating_mul(workers).min(total_len)
+    } else {
+        0
+    };
+    (head, tail, tail_bytes)
+}
+
+/// Split into `head`-sized chunks, then the last `tail_bytes` into `tail`-sized ones (see `adaptive_chunk_sizes`).
+pub fn split_into_chunks_tapered(
+    transfer_id: [u8; 16],
+    total_len: u64,
+    head: u64,
+    tail: u64,
+    tail_bytes: u64,
+) -> Vec<ChunkId> {
+    let head_end = total_len.saturating_sub(tail_bytes);
+    let mut out = split_into_chunks(transfer_id, head_end, head);
+    let tail = tail.max(1);
+    let mut start = head_end;
+    while start < total_len {
+        let end = (start + tail).min(total_len);
+        out.push(ChunkId {
+            transfer_id,
+            start,
+            end,
+        });
+        start = end;
+    }
+    out
+}
+
+/// Host-provided destination for in-order transfer bytes (e.g. the client socket).
+/// The core never calls it itself: it queues in-order runs on the transfer's `SinkWriter`, and the host writes them
+/// with `SinkWriter::deliver` once it no longer holds the core, so the sink may block. Return false to abort the
+/// transfer.
+pub trait ChunkSink: Send {
+    fn write(&mut self, bytes: &[u8]) -> bool;
+
+    /// Write several in-order chunks at once (e.g. one writev). Default: one `write` per chunk.
+    fn write_vectored(&mut self, chunks: &[&[u8]]) -> bool {
+        chunks.iter().all(|c| self.write(c))
+    }
+}
+
+/// Memory the host lends the core (e.g. an mmap'd file): the chunk cache's payloads or a transfer's spill area.
+/// The bytes must stay valid, and not be used elsewhere, for as long as the core holds the arena.
+pub trait HostArena: Send {
+    fn bytes(&mut self) -> &mut [u8];
+}
+
+/// Most chunks in one queued run, i.e. one `ChunkSink::write_vectored` call (kept well under IOV_MAX).
+const MAX_FLUSH_CHUNKS: usize = 64;
+
+fn lock<T>(m: &Mutex<T>) -> MutexGuard<'_, T> {
+    m.lock().unwrap_or_else(PoisonError::into_inner)
+}
+
+/// A transfer's spill area, shared by the transfer and the runs queued from it. A chunk is written to the area
+/// before it is marked received and only read (by a writer) after, so the two sides never touch the same bytes.
+struct SpillArea {
+    base: *mut u8,
+    len: usize,
+    _arena: Box<dyn HostArena>,
+}
+
+// The arena is only reached through base, at disjoint ranges (see above).
+unsafe impl Send for SpillArea {}
+unsafe impl Sync for SpillArea {}
+
+impl SpillArea {
+    fn new(mut arena: Box<dyn HostArena>) -> Self {
+        let bytes = arena.bytes();
+        Self {
+            base: bytes.as_mut_ptr(),
+            len: bytes.len(),
+            _arena: arena,
+        }
+    }
+
+    fn write(&self, at: usize, bytes: &[u8]) {
+        assert!(at + bytes.len() <= self.len);
+        unsafe {
+            self.base
+                .add(at)
+                .copy_from_nonoverlapping(bytes.as_ptr(), bytes.len())
+        };
+    }
+
+    fn get(&self, start: usize, end: usize) -> &[u8] {
+        assert!(start <= end && end <= self.len);
+        unsafe { std::slice::from_raw_parts(self.base.add(start), end - start) }
+    }
+}
+
+/// One chunk of a queued run: a held payload, or a range of the spill area.
+enum RunPart {
+    Held(Vec<u8>),
+    Spilled(Arc<SpillArea>, usize, usize),
+}
+
+impl RunPart {
+    fn bytes(&self) -> &[u8] {
+        match self {
+            RunPart::Held(payload) => payload,
+            RunPart::Spilled(area, start, end) => area.get(*start, *end),
+        }
+    }
+
+    fn held_len(&self) -> u64 {
+        match self {
+            RunPart::Held(payload) => payload.len() as u64,
+            RunPart::Spilled(..) => 0,
+        }
+    }
+}
+
+/// The sink of a streamed transfer and the spill area it may point into, dropped together.
+struct SinkSlot {
+    sink: Box<dyn ChunkSink>,
+    _spill: Option<Arc<SpillArea>>,
+}
+
+/// A streamed transfer's sink behind its own lock, with the in-order runs the core queued for it. The core only
+/// queues, under whatever lock the host keeps it behind; `deliver` writes outside it, so a sink that blocks holds
+/// up its own transfer and nothing else. Runs go out in the order they were queued, one writer at a time.
+pub struct SinkWriter {
+    transfer_id: [u8; 16],
+    runs: Mutex<VecDeque<Vec<RunPart>>>,
+    /// Held by the thread writing; None once closed or failed.
+    sink: Mutex<Option<SinkSlot>>,
+    failed: AtomicBool,
+    /// Bytes of queued runs held in memory (spilled parts are not), counted against the spill window.
+    queued_bytes: AtomicU64,
+}
+
+impl SinkWriter {
+    fn new(transfer_id: [u8; 16], sink: Box<dyn ChunkSink>, spill: Option<Arc<SpillArea>>) -> Self {
+        Self {
+            transfer_id,
+            runs: Mutex::new(VecDeque::new()),
+            sink: Mutex::new(Some(SinkSlot {
+                sink,
+                _spill: spill,
+            })),
+            failed: AtomicBool::new(false),
+            queued_bytes: AtomicU64::new(0),
+        }
+    }
+
+    pub fn transfer_id(&self) -> [u8; 16] {
+        self.transfer_id
+    }
+
+    /// The sink refused a write; the transfer cannot be delivered.
+    pub fn failed(&self) -> bool {
+        self.failed.load(Ordering::Acquire)
+    }
+
+    fn queued_bytes(&self) -> u64 {
+        self.queued_bytes.load(Ordering::Relaxed)
+    }
+
+    fn push(&self, run: Vec<RunPart>) {
+        let held: u64 = run.iter().map(RunPart::held_len).sum();
+        self.queued_bytes.fetch_add(held, Ordering::Relaxed);
+        lock(&self.runs).push_back(run);
+    }
+
+    /// Write the queued runs to the sink. Call without holding the core. If another thread is writing this
+    /// transfer, it also writes what is queued now and this returns at once. False once the sink has failed.
+    pub fn deliver(&self) -> bool {
+        loop {
+            let mut slot = match self.sink.try_lock() {
+                Ok(slot) => slot,
+                Err(TryLockError::Poisoned(e)) => e.into_inner(),
+                Err(TryLockError::WouldBlock) => break,
+            };
+            self.drain(&mut slot, true);
+            drop(slot);
+            // A run queued after the drain found the queue empty, while the lock was still held, is ours to write.
+            if lock(&self.runs).is_empty() {
+                break;
+            }
+        }
+        !self.failed()
+    }
+
+    /// Let go of the sink, waiting for a write in progress; it is never called again once this returns. With
+    /// flush (the transfer completed) the queued runs are written first, otherwise (cancelled) they are dropped.
+    /// False if the sink failed.
+    pub fn close(&self, flush: bool) -> bool {
+        let mut slot = lock(&self.sink);
+        self.drain(&mut slot, flush);
+        *slot = None;
+        !self.failed()
+    }
+
+    /// Pop runs until the queue is empty, writing them while the sink is there and write is set.
+    fn drain(&self, slot: &mut Option<SinkSlot>, write: bool) {
+        loop {
+            // Popped in its own statement so the queue is not locked while the sink runs.
+            let run = lock(&self.runs).pop_front();
+            let Some(run) = run else {
+                return;
+            };
+            if let Some(s) = slot.as_mut().filter(|_| write) {
+                let slices: Vec<&[u8]> = run.iter().map(RunPart::bytes).collect();
+                if !s.sink.write_vectored(&slices) {
+                    self.failed.store(true, Ordering::Release);
+                    *slot = None;
+                }
+            }
+            let held: u64 = run.iter().map(RunPart::held_len).sum();
+            self.queued_bytes.fetch_sub(held, Ordering::Relaxed);
+        }
+    }
+}
+
 /// Per-transfer state: which chunks are assigned, received, in flight; reassembly.
+/// Chunks are addressed by index into `chunk_ids` (sorted by start); completion is a counter check.
 pub struct TransferState {
     pub transfer_id: [u8; 16],
     pub total_length: u64,
     chunk_ids: Vec<ChunkId>,
-    /// Chunk payloads received and verified (ChunkId -> payload).
-    received: HashMap<ChunkId, Vec<u8>>,
+    /// One bit per chunk index: received and verified (whether held, in the body, or already flushed).
+    received: Vec<u64>,
+    received_count: usize,
+    received_bytes: u64,
+    /// Without a sink: the whole body, allocated on the first chunk; each chunk is written at its `start`.
+    body: Vec<u8>,
+    /// With a sink: verified chunks waiting for the contiguous prefix to reach them, by chunk index.
+    pending: Vec<Option<Vec<u8>>>,
+    /// With a sink: chunk_ids[..flushed] were queued on the writer in order and freed here.
+    flushed: usize,
+    /// Payload bytes held in `pending`.
+    pending_bytes: u64,
+    sink: Option<Arc<SinkWriter>>,
+    /// With a sink and a spill area: chunks that would take the held bytes (pending, and queued but not yet
+    /// written) past `spill_window` are written to the area at their `start` instead, and queued from there.
+    spill: Option<Arc<SpillArea>>,
+    spill_window: u64,
+    /// One bit per chunk index: payload is in the spill area.
+    spilled: Vec<u64>,
 }
 
 impl TransferState {
     pub fn new(transfer_id: [u8; 16], total_length: u64, chunk_ids: Vec<ChunkId>) -> Self {
+        let words = chunk_ids.len().div_ceil(64);
         Self {
             transfer_id,
             total_length,
             chunk_ids,
-            received: HashMap::new(),
+            received: vec![0; words],
+            received_count: 0,
+            received_bytes: 0,
+            body: Vec::new(),
+            pending: Vec::new(),
+            flushed: 0,
+            pending_bytes: 0,
+            sink: None,
+            spill: None,
+            spill_window: 0,
+            spilled: Vec::new(),
+        }
+    }
+
+    /// Stream the transfer to `sink`: chunks are queued on the returned writer as soon as they are contiguous and
+    /// freed here, so memory is bounded by the reorder window and what the sink has yet to take. Anything already
+    /// contiguous is queued at once; the caller writes it with `SinkWriter::deliver`.
+    pub fn set_sink(&mut self, sink: Box<dyn ChunkSink>) -> Arc<SinkWriter> {
+        if self.pending.is_empty() {
+            self.pending.resize_with(self.chunk_ids.len(), || None);
         }
+        // Chunks already written into the body move to pending, then the body is dropped.
+        let body = std::mem::take(&mut self.body);
+        if !body.is_empty() {
+            for i in self.flushed..self.chunk_ids.len() {
+                if self.bit(i) && self.pending[i].is_none() {
+                    let c = self.chunk_ids[i];
+                    self.pending[i] = Some(body[c.start as usize..c.end as usize].to_vec());
+                    self.pending_bytes += c.end - c.start;
+                }
+            }
+        }
+        let writer = Arc::new(SinkWriter::new(self.transfer_id, sink, self.spill.clone()));
+        self.sink = Some(writer.clone());
+        self.flush_contiguous();
+        writer
+    }
+
+    /// Bound the memory of a streamed transfer: once window bytes are held, further chunks go to `area` (at least
+    /// `total_length` bytes, e.g. a sparse mmap'd file) until the sink reaches them. Call before `set_sink`, so the
+    /// sink holds on to the area; false if a sink is already set or the area is too small.
+    pub fn set_spill(&mut self, area: Box<dyn HostArena>, window: u64) -> bool {
+        let area = SpillArea::new(area);
+        if self.sink.is_some() || (area.len as u64) < self.total_length {
+            return false;
+        }
+        self.spilled = vec![0; self.chunk_ids.len().div_ceil(64)];
+        self.spill = Some(Arc::new(area));
+        self.spill_window = window;
+        true
+    }
+
+    /// Drop the sink (e.g. client went away). The body can no longer be reassembled once chunks were flushed.
+    /// Runs already queued stay with the writer, which the host closes.
+    pub fn clear_sink(&mut self) {
+        self.sink = None;
+    }
+
+    pub fn has_sink(&self) -> bool {
+        self.sink.is_some()
+    }
+
+    /// The writer chunks are queued on, with a sink set.
+    pub fn sink_writer(&self) -> Option<&Arc<SinkWriter>> {
+        self.sink.as_ref()
     }
 
     /// Record that a chunk was received and verified. Returns true if transfer is now complete.
-    pub fn mark_received(&mut self, chunk_id: ChunkId, payload: Vec<u8>) -> bool {
-        self.received.insert(chunk_id, payload);
+    /// The payload must be `end - start` bytes; unknown chunks and duplicates are ignored. With a sink it is
+    /// copied (or parked in the spill area) even when it is next in order: the sink is written later, outside the
+    /// core, when `payload` may be gone.
+    pub fn mark_received(&mut self, chunk_id: ChunkId, payload: &[u8]) -> bool {
+        let Some(i) = self.index_of(chunk_id) else {
+            return self.is_complete();
+        };
+        if self.bit(i)
+            || payload.len() as u64 != chunk_id.end - chunk_id.start
+            || chunk_id.end > self.total_length
+        {
+            return self.is_complete();
+        }
+        if let Some(writer) = self.sink.as_ref() {
+            let len = chunk_id.end - chunk_id.start;
+            let held = self.pending_bytes + writer.queued_bytes();
+            match self.spill.as_ref() {
+                Some(area) if held + len > self.spill_window => {
+                    area.write(chunk_id.start as usize, payload);
+                    self.spilled[i / 64] |= 1 << (i % 64);
+                }
+                _ => {
+                    self.pending[i] = Some(payload.to_vec());
+                    self.pending_bytes += len;
+                }
+            }
+        } else {
+            if self.body.is_empty() {
+                self.body = vec![0; self.total_length as usize];
+            }
+            self.body[chunk_id.start as usize..chunk_id.end as usize].copy_from_slice(payload);
+        }
+        self.received[i / 64] |= 1 << (i % 64);
+        self.received_count += 1;
+        self.received_bytes += chunk_id.end - chunk_id.start;
         self.is_complete()
     }
 
+    /// Queue the in-order prefix of received chunks on the sink's writer, in runs of at most MAX_FLUSH_CHUNKS,
+    /// and free them here. False if the sink has failed.
+    pub fn flush_contiguous(&mut self) -> bool {
+        let Some(writer) = self.sink.clone() else {
+            return true;
+        };
+        if writer.failed() {
+            return false;
+        }
+        loop {
+            let mut run = Vec::new();
+            while run.len() < MAX_FLUSH_CHUNKS {
+                let i = self.flushed + run.len();
+                if let Some(payload) = self.pending.get_mut(i).and_then(Option::take) {
+                    self.pending_bytes -= payload.len() as u64;
+                    run.push(RunPart::Held(payload));
+                } else if let Some(area) = self.spill.as_ref().filter(|_| {
+                    i < self.chunk_ids.len()
+                        && self
+                            .spilled
+                            .get(i / 64)
+                            .is_some_and(|w| w & (1 << (i % 64)) != 0)
+                }) {
+                    let c = self.chunk_ids[i];
+                    run.push(RunPart::Spilled(
+                        area.clone(),
+                        c.start as usize,
+                        c.end as usize,
+                    ));
+                } else {
+                    break;
+                }
+            }
+            if run.is_empty() {
+                return true;
+            }
+            self.flushed += run.len();
+            writer.push(run);
+        }
+    }
+
     pub fn is_complete(&self) -> bool {
+        self.received_count == self.chunk_ids.len()
+    }
+
+    /// Number of chunks received and verified so far.
+    pub fn received_count(&self) -> usize {
+        self.received_count
+    }
+
+    /// Bytes received and verified so far (sum of received chunk lengths).
+    pub fn received_bytes(&self) -> u64 {
+        self.received_bytes
+    }
+
+    /// Chunks are in start order, so a chunk's index is found by binary search on start.
+    fn index_of(&self, chunk_id: ChunkId) -> Option<usize> {
         self.chunk_ids
-            .iter()
-            .all(|id| self.received.contains_key(id))
+            .binary_search_by_key(&chunk_id.start, |c| c.start)
+            .ok()
+            .filter(|&i| self.chunk_ids[i] == chunk_id)
     }
 
-    /// Reassemble chunks in order into a single byte stream. Call only when `is_complete()`.
-    pub fn reassemble_into_bytes(&self) -> Vec<u8> {
-        let mut out = Vec::with_capacity(self.total_length as usize);
-        for id in &self.chunk_ids {
-            if let Some(payload) = self.received.get(id) {
-                out.extend_from_slice(payload);
-            }
-        }
-        out
+    fn bit(&self, i: usize) -> bool {
+        self.received[i / 64] & (1 << (i % 64)) != 0
+    }
+
+    /// Hand over the reassembled body (chunks were written in place, so no copy). Call only when
+    /// `is_complete()` and no sink is set.
+    pub fn take_body(&mut self) -> Vec<u8> {
+        std::mem::take(&mut self.body)
     }
 
     pub fn chunk_ids(&self) -> &[ChunkId] {
         &self.chunk_ids
     }
 
+    /// Whether the chunk belongs to this transfer and is still missing.
+    pub fn is_chunk_pending(&self, chunk_id: ChunkId) -> bool {
+        self.index_of(chunk_id).is_some_and(|i| !self.bit(i))
+    }
+
     /// Whether the chunk has been received and verified.
     pub fn is_chunk_received(&self, chunk_id: ChunkId) -> bool {
-        self.received.contains_key(&chunk_id)
+        self.index_of(chunk_id).is_some_and(|i| self.bit(i))
     }
 }
 
@@ -102,12 +527,14 @@ pub fn chunk_request_message(chunk_id: ChunkId, url: Option<String>) -> Message
 
 /// Result of processing received ChunkData: verified and stored, or error.
 pub enum ChunkReceiveResult {
-    /// Chunk stored; transfer is now complete and reassembled bytes are ready.
+    /// Chunk stored; transfer is now complete and reassembled bytes are ready (empty when streamed to a sink).
     Complete(Vec<u8>),
     /// Chunk stored; transfer not yet complete.
     InProgress,
     /// Integrity check failed.
     IntegrityFailed,
+    /// The sink refused bytes; the transfer cannot be delivered.
+    SinkFailed,
 }
 
 /// Process ChunkData message: verify hash, store in state. Returns result for the transfer.
@@ -117,7 +544,7 @@ pub fn on_chunk_data_received(
     start: u64,
     end: u64,
     hash: [u8; 32],
-    payload: Vec<u8>,
+    payload: &[u8],
 ) -> ChunkReceiveResult {
     if state.transfer_id != transfer_id {
         return ChunkReceiveResult::IntegrityFailed;
@@ -127,12 +554,32 @@ pub fn on_chunk_data_received(
         start,
         end,
     };
-    if !integrity::verify_chunk(&payload, &hash) {
+    if !integrity::verify_chunk(payload, &hash) {
+        return ChunkReceiveResult::IntegrityFailed;
+    }
+    on_verified_chunk_data(state, chunk_id, payload)
+}
+
+/// Store a ChunkData payload whose hash the caller already checked (e.g. with `integrity::verify_chunks`).
+pub fn on_verified_chunk_data(
+    state: &mut TransferState,
+    chunk_id: ChunkId,
+    payload: &[u8],
+) -> ChunkReceiveResult {
+    // A payload that doesn't fill its range is as bad as a hash mismatch.
+    if state.transfer_id != chunk_id.transfer_id
+        || chunk_id.end.checked_sub(chunk_id.start) != Some(payload.len() as u64)
+    {
         return ChunkReceiveResult::IntegrityFailed;
     }
     let complete = state.mark_received(chunk_id, payload);
-    if complete {
-        ChunkReceiveResult::Complete(state.reassemble_into_bytes())
+    if !state.flush_contiguous() {
+        return ChunkReceiveResult::SinkFailed;
+    }
+    if complete && state.has_sink() {
+        ChunkReceiveResult::Complete(Vec::new())
+    } else if complete {
+        ChunkReceiveResult::Complete(state.take_body())
     } else {
         ChunkReceiveResult::InProgress
     }
@@ -163,6 +610,32 @@ mod tests {
         assert_eq!(split_into_chunks(id, 1001, 100).len(), 11);
     }
 
+    #[test]
+    fn adaptive_sizes_spread_short_ranges_and_taper_the_tail() {
+        let (min, max) = (64 * 1024, 4 * 1024 * 1024);
+        // 1 MiB over 4 workers: 32 KiB would be too small, so the minimum applies and every worker gets chunks.
+        assert_eq!(
+            adaptive_chunk_sizes(1 << 20, 4, 8, 0, min, max),
+            (min, min, 0)
+        );
+        // 1 GiB: capped at the maximum; the last 4 head chunks' worth is cut into 1 MiB pieces.
+        let (head, tail, tail_bytes) = adaptive_chunk_sizes(1 << 30, 4, 8, 0, min, max);
+        assert_eq!((head, tail, tail_bytes), (max, max / 4, 4 * max));
+        let chunks = split_into_chunks_tapered([0; 16], 1 << 30, head, tail, tail_bytes);
+        assert_eq!(chunks.first().unwrap().end, max);
+        assert_eq!(chunks.last().unwrap().end, 1 << 30);
+        assert!(chunks.windows(2).all(|w| w[0].end == w[1].start));
+        assert_eq!(
+            chunks.iter().filter(|c| c.end - c.start <= tail).count(),
+            16
+        );
+        // A known bandwidth-delay product raises the size above what the range alone asks for.
+        assert_eq!(
+            adaptive_chunk_sizes(1 << 24, 4, 8, 2 << 20, min, max).0,
+            2 << 20
+        );
+    }
+
     #[test]
     fn transfer_state_reassemble() {
         let id = [2u8; 16];
@@ -173,7 +646,7 @@ mod tests {
             let payload: Vec<u8> = (c.start..c.end).map(|i| i as u8).collect();
             let hash = integrity::hash_chunk(&payload);
             let r =
-                on_chunk_data_received(&mut state, c.transfer_id, c.start, c.end, hash, payload);
+                on_chunk_data_received(&mut state, c.transfer_id, c.start, c.end, hash, &payload);
             match r {
                 ChunkReceiveResult::InProgress => {}
                 ChunkReceiveResult::Complete(bytes) => {
@@ -182,7 +655,9 @@ mod tests {
                         assert_eq!(b, i as u8);
                     }
                 }
-                ChunkReceiveResult::IntegrityFailed => panic!("integrity failed"),
+                ChunkReceiveResult::IntegrityFailed | ChunkReceiveResult::SinkFailed => {
+                    panic!("unexpected failure")
+                }
             }
         }
         assert!(state.is_complete());
@@ -196,15 +671,181 @@ mod tests {
         let c = &chunks[0];
         let payload: Vec<u8> = (c.start..c.end).map(|i| i as u8).collect();
         let hash = integrity::hash_chunk(&payload);
-        let _ = on_chunk_data_received(
+        let _ = on_chunk_data_received(&mut state, c.transfer_id, c.start, c.end, hash, &payload);
+        let r2 = on_chunk_data_received(&mut state, c.transfer_id, c.start, c.end, hash, &payload);
+        assert!(matches!(r2, ChunkReceiveResult::InProgress));
+    }
+
+    struct VecSink(std::sync::Arc<std::sync::Mutex<Vec<u8>>>);
+
+    impl ChunkSink for VecSink {
+        fn write(&mut self, bytes: &[u8]) -> bool {
+            self.0.lock().unwrap().extend_from_slice(bytes);
+            true
+        }
+    }
+
+    /// Records how many chunks each vectored write carried.
+    struct CountingSink(std::sync::Arc<std::sync::Mutex<Vec<usize>>>);
+
+    impl ChunkSink for CountingSink {
+        fn write(&mut self, _bytes: &[u8]) -> bool {
+            unreachable!("flush should use write_vectored")
+        }
+
+        fn write_vectored(&mut self, chunks: &[&[u8]]) -> bool {
+            self.0.lock().unwrap().push(chunks.len());
+            true
+        }
+    }
+
+    #[test]
+    fn sink_flushes_contiguous_run_in_one_vectored_write() {
+        let id = [5u8; 16];
+        let chunks = split_into_chunks(id, 100, 10);
+        let mut state = TransferState::new(id, 100, chunks.clone());
+        let calls = std::sync::Arc::new(std::sync::Mutex::new(Vec::new()));
+        let writer = state.set_sink(Box::new(CountingSink(calls.clone())));
+        for c in chunks.iter().skip(1).chain(chunks.iter().take(1)) {
+            let payload = vec![0u8; (c.end - c.start) as usize];
+            let hash = integrity::hash_chunk(&payload);
+            let _ = on_chunk_data_received(&mut state, id, c.start, c.end, hash, &payload);
+            assert!(writer.deliver());
+        }
+        assert_eq!(*calls.lock().unwrap(), vec![10]);
+    }
+
+    struct VecArena(Vec<u8>);
+
+    impl HostArena for VecArena {
+        fn bytes(&mut self) -> &mut [u8] {
+            &mut self.0
+        }
+    }
+
+    #[test]
+    fn chunks_past_the_reorder_window_spill_and_flush_from_the_area() {
+        let id = [6u8; 16];
+        let chunks = split_into_chunks(id, 100, 20);
+        let mut state = TransferState::new(id, 100, chunks.clone());
+        let out = std::sync::Arc::new(std::sync::Mutex::new(Vec::new()));
+        assert!(!state.set_spill(Box::new(VecArena(vec![0; 99])), 20));
+        assert!(state.set_spill(Box::new(VecArena(vec![0; 100])), 20));
+        let writer = state.set_sink(Box::new(VecSink(out.clone())));
+        assert!(!state.set_spill(Box::new(VecArena(vec![0; 100])), 20));
+        // 4 is held (the window has room), 3, 1 and 0 are spilled; 0 goes out with 1 from the area.
+        for &i in &[4usize, 3, 1, 0, 2] {
+            let c = chunks[i];
+            let payload: Vec<u8> = (c.start..c.end).map(|b| b as u8).collect();
+            on_verified_chunk_data(&mut state, c, &payload);
+            assert!(writer.deliver());
+            match i {
+                4 | 3 | 1 => assert_eq!(state.pending_bytes, 20),
+                0 => assert_eq!(out.lock().unwrap().len(), 40),
+                _ => assert!(state.is_complete()),
+            }
+        }
+        assert_eq!(state.pending_bytes, 0);
+        let bytes = out.lock().unwrap();
+        assert_eq!(bytes.len(), 100);
+        assert!(bytes.iter().enumerate().all(|(i, &b)| b == i as u8));
+    }
+
+    #[test]
+    fn sink_receives_contiguous_prefix_and_frees_chunks() {
+        let id = [4u8; 16];
+        let chunks = split_into_chunks(id, 100, 30);
+        let mut state = TransferState::new(id, 100, chunks.clone());
+        let out = std::sync::Arc::new(std::sync::Mutex::new(Vec::new()));
+        let writer = state.set_sink(Box::new(VecSink(out.clone())));
+        // Deliver out of order: 1, 0, 3, 2.
+        for &i in &[1usize, 0, 3, 2] {
+            let c = chunks[i];
+            let payload: Vec<u8> = (c.start..c.end).map(|b| b as u8).collect();
+            let hash = integrity::hash_chunk(&payload);
+            let r = on_chunk_data_received(&mut state, id, c.start, c.end, hash, &payload);
+            assert!(writer.deliver());
+            match i {
+                1 => assert!(out.lock().unwrap().is_empty()),
+                0 => assert_eq!(out.lock().unwrap().len(), 60),
+                3 => assert_eq!(out.lock().unwrap().len(), 60),
+                _ => assert!(matches!(r, ChunkReceiveResult::Complete(ref b) if b.is_empty())),
+            }
+        }
+        assert!(state.pending.iter().all(Option::is_none));
+        assert!(state.body.is_empty());
+        assert!(state.is_chunk_received(chunks[0]));
+        let bytes = out.lock().unwrap();
+        assert!(bytes.iter().enumerate().all(|(i, &b)| b == i as u8));
+    }
+
+    /// Refuses every write (the client went away).
+    struct FailingSink;
+
+    impl ChunkSink for FailingSink {
+        fn write(&mut self, _bytes: &[u8]) -> bool {
+            false
+        }
+    }
+
+    #[test]
+    fn sink_is_written_only_by_deliver_and_close() {
+        let id = [7u8; 16];
+        let chunks = split_into_chunks(id, 90, 30);
+        let mut state = TransferState::new(id, 90, chunks.clone());
+        let out = std::sync::Arc::new(std::sync::Mutex::new(Vec::new()));
+        let writer = state.set_sink(Box::new(VecSink(out.clone())));
+        for c in &chunks[..2] {
+            on_verified_chunk_data(&mut state, *c, &[1u8; 30]);
+        }
+        // Queued, not written: the core never calls the sink itself.
+        assert!(out.lock().unwrap().is_empty());
+        assert_eq!(writer.queued_bytes(), 60);
+        assert!(writer.deliver());
+        assert_eq!(out.lock().unwrap().len(), 60);
+        assert_eq!(writer.queued_bytes(), 0);
+        // Closing a completed transfer writes what is left; a closed writer drops later runs.
+        on_verified_chunk_data(&mut state, chunks[2], &[1u8; 30]);
+        assert!(writer.close(true));
+        assert_eq!(out.lock().unwrap().len(), 90);
+        writer.push(vec![RunPart::Held(vec![0; 10])]);
+        assert!(writer.deliver());
+        assert_eq!(out.lock().unwrap().len(), 90);
+
+        // A failed write is reported by deliver and by the transfer's next flush.
+        let mut state = TransferState::new(id, 90, chunks.clone());
+        let writer = state.set_sink(Box::new(FailingSink));
+        on_verified_chunk_data(&mut state, chunks[0], &[1u8; 30]);
+        assert!(!writer.deliver());
+        assert!(matches!(
+            on_verified_chunk_data(&mut state, chunks[1], &[1u8; 30]),
+            ChunkReceiveResult::SinkFailed
+        ));
+    }
+
+    #[test]
+    fn wrong_length_payload_rejected_and_duplicates_not_double_counted() {
+        let id = [6u8; 16];
+        let chunks = split_into_chunks(id, 60, 30);
+        let mut state = TransferState::new(id, 60, chunks.clone());
+        let c = chunks[0];
+        let short = vec![1u8; 10];
+        let r = on_chunk_data_received(
             &mut state,
-            c.transfer_id,
+            id,
             c.start,
             c.end,
-            hash,
-            payload.clone(),
+            integrity::hash_chunk(&short),
+            &short,
         );
-        let r2 = on_chunk_data_received(&mut state, c.transfer_id, c.start, c.end, hash, payload);
-        assert!(matches!(r2, ChunkReceiveResult::InProgress));
+        assert!(matches!(r, ChunkReceiveResult::IntegrityFailed));
+        let payload = vec![1u8; 30];
+        let hash = integrity::hash_chunk(&payload);
+        for _ in 0..2 {
+            let _ = on_chunk_data_received(&mut state, id, c.start, c.end, hash, &payload);
+        }
+        assert_eq!(state.received_count, 1);
+        assert!(state.is_chunk_received(c));
+        assert!(!state.is_chunk_received(chunks[1]));
     }
 }
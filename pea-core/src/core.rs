@@ -1,39 +1,120 @@
 //! Host-driven API: PeaPodCore receives events from host, returns actions.
 
-use std::collections::HashMap;
+use std::collections::{HashMap, VecDeque};
 use std::sync::Arc;
+use std::time::Instant;
 
-use crate::chunk::{self, ChunkId, TransferState, DEFAULT_CHUNK_SIZE};
+use crate::cache::ChunkCache;
+use crate::chunk::{self, ChunkId, ChunkSink, HostArena, SinkWriter, TransferState};
 use crate::identity::{derive_session_key, DeviceId, Keypair, PublicKey};
+use crate::integrity;
 use crate::protocol::{Message, PROTOCOL_VERSION};
 use crate::scheduler;
+use crate::stats::{self, CoreStats};
+use crate::trace;
 use crate::wire;
-use crate::wire::FrameDecodeError;
+use crate::wire::{FrameDecodeError, FrameRef};
 
 const HEARTBEAT_TIMEOUT_TICKS: u64 = 5;
+/// Time one `tick()` stands for; hosts with a clock call `tick_at` instead.
+const TICK_MS: u64 = 1000;
+const HEARTBEAT_TIMEOUT_MS: u64 = HEARTBEAT_TIMEOUT_TICKS * TICK_MS;
+/// Heartbeats go out at most this often, however fast the host ticks.
+const HEARTBEAT_INTERVAL_MS: u64 = TICK_MS;
+/// Suggested tick intervals from `tick_interval_ms`: transfer running, peers but idle, no peers.
+/// Idle stays well under HEARTBEAT_TIMEOUT_MS so peers keep seeing our heartbeats.
+const TICK_ACTIVE_MS: u64 = 250;
+const TICK_IDLE_MS: u64 = 2000;
+const TICK_ALONE_MS: u64 = 5000;
+/// Transfers tracked at once; further requests fall back until one completes or is cancelled.
+pub const MAX_ACTIVE_TRANSFERS: usize = 64;
+/// Parts received for relaying that the host has not taken yet; further UploadParts are refused.
+pub const MAX_UPLOAD_JOBS: usize = 8;
 
-/// Configuration for timeouts and peer trust (optional; use defaults when not set).
-#[derive(Clone, Debug, Default)]
-pub struct Config {}
+/// Configuration for chunk sizing (optional; use defaults when not set). See `chunk::adaptive_chunk_sizes`.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Config {
+    /// Smallest chunk handed out; also the floor for tail chunks.
+    pub min_chunk_size: u64,
+    /// Largest chunk handed out, however long the range.
+    pub max_chunk_size: u64,
+    /// Chunks to aim for per worker (self and each peer), so short ranges still spread over the pod.
+    pub chunks_per_worker: u32,
+    /// Chunks carry at least this many round trips' worth of bytes at the workers' rate and latency.
+    pub min_chunk_rtts: u32,
+}
+
+impl Default for Config {
+    fn default() -> Self {
+        Self {
+            min_chunk_size: 64 * 1024,
+            max_chunk_size: 4 * 1024 * 1024,
+            chunks_per_worker: 8,
+            min_chunk_rtts: 4,
+        }
+    }
+}
 
 /// Optional per-peer metrics for scheduler weighting.
 #[derive(Clone, Debug, Default)]
 pub struct PeerMetrics {
     /// Estimated bandwidth in bytes per second; higher gives more chunks.
     pub bandwidth_bytes_per_sec: Option<u64>,
-    /// Latency in milliseconds (for future use).
+    /// Round-trip latency in milliseconds; with bandwidth, sets the smallest worthwhile chunk.
     pub latency_ms: Option<u32>,
 }
 
-/// Stub for upload path (split outbound into chunks; full impl later).
+/// Fixed-size split of an upload body; `on_upload_request` sizes its parts like a download instead.
 pub fn split_upload_chunks(transfer_id: [u8; 16], data_len: u64, chunk_size: u64) -> Vec<ChunkId> {
     chunk::split_into_chunks(transfer_id, data_len, chunk_size)
 }
 
-/// Active transfer: state and assignment.
+/// Active transfer: reassembly state, the pull scheduler handing out its chunks, and the URL peers fetch from.
 struct ActiveTransfer {
     state: TransferState,
-    assignment: Vec<(ChunkId, DeviceId)>,
+    /// Head chunk size chosen for this transfer (windows are counted in chunks of this size).
+    chunk_size: u64,
+    work: scheduler::WorkQueue,
+    url: String,
+    /// Origin offset of the requested range. Chunks count from it; wire messages and the cache use
+    /// absolute offsets.
+    base: u64,
+    /// When each (chunk start, worker) was handed out, for the per-peer chunk latency in `stats`.
+    requested_at: HashMap<(u64, DeviceId), Instant>,
+    /// The transfer's async trace slice, ended when the transfer is dropped.
+    _track: trace::TransferTrack,
+}
+
+/// Upload this device started: the pull scheduler handing its parts out by uplink rate. The host keeps the body.
+struct ActiveUpload {
+    url: String,
+    total_length: u64,
+    chunk_size: u64,
+    parts_total: u32,
+    done_bytes: u64,
+    work: scheduler::WorkQueue,
+}
+
+/// A part a peer asked this device to send to origin (UploadPart), from `take_upload_job`. The host PUTs it and
+/// answers with `upload_ack`.
+#[derive(Clone, Debug)]
+pub struct UploadJob {
+    pub from: DeviceId,
+    pub transfer_id: [u8; 16],
+    pub start: u64,
+    pub end: u64,
+    pub total_length: u64,
+    pub url: String,
+    pub payload: Vec<u8>,
+}
+
+/// Progress of one transfer, from `transfer_status`.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct TransferStatus {
+    pub total_length: u64,
+    pub received_bytes: u64,
+    pub chunks_total: u32,
+    pub chunks_received: u32,
 }
 
 /// Main coordinator. The host passes events (request metadata, peer join/leave, messages, chunk data);
@@ -41,11 +122,171 @@ struct ActiveTransfer {
 pub struct PeaPodCore {
     keypair: Arc<Keypair>,
     peers: Vec<DeviceId>,
-    peer_last_tick: HashMap<DeviceId, u64>,
-    tick_count: u64,
-    active_transfer: Option<ActiveTransfer>,
+    /// Core clock (ms) when each peer was last heard from.
+    peer_last_seen: HashMap<DeviceId, u64>,
+    /// Core clock in ms: advanced by `tick()` in TICK_MS steps or set from the host clock by `tick_at`.
+    clock_ms: u64,
+    /// Host time that corresponds to clock 0; fixed by the first `tick_at`.
+    clock_origin_ms: Option<u64>,
+    last_heartbeat_ms: Option<u64>,
+    /// Transfers in progress, by transfer id; each completes, fails or is cancelled independently.
+    transfers: HashMap<[u8; 16], ActiveTransfer>,
     /// Optional metrics per peer (and self) for weighted chunk assignment.
     peer_metrics: HashMap<DeviceId, PeerMetrics>,
+    /// Throughput measured from delivered chunks, per worker (self included); kept across transfers.
+    throughput: HashMap<DeviceId, scheduler::ThroughputEstimate>,
+    /// Uploads this device started, by transfer id.
+    uploads: HashMap<[u8; 16], ActiveUpload>,
+    /// Uplink throughput measured from acknowledged parts, per worker (self included).
+    upload_throughput: HashMap<DeviceId, scheduler::ThroughputEstimate>,
+    /// Parts peers sent for this device to relay, oldest first.
+    upload_jobs: VecDeque<UploadJob>,
+    /// Bumped whenever upload work appears (see `upload_events`).
+    upload_events: u64,
+    /// Verified chunks kept for repeat requests, if the host set one up.
+    cache: Option<ChunkCache>,
+    /// Writers of streamed transfers that had runs queued since `take_sink_deliveries`.
+    deliveries: Vec<Arc<SinkWriter>>,
+    config: Config,
+    stats: Arc<CoreStats>,
+}
+
+/// `PeaPodCore::beacon_frame` for a keypair alone: identity frames need no core state, so a host sharing the
+/// core between threads can build them without taking its lock.
+pub fn beacon_frame(
+    keypair: &Keypair,
+    listen_port: u16,
+) -> Result<Vec<u8>, wire::FrameEncodeError> {
+    wire::encode_frame(&Message::Beacon {
+        protocol_version: PROTOCOL_VERSION,
+        device_id: keypair.device_id(),
+        public_key: keypair.public_key().clone(),
+        listen_port,
+    })
+}
+
+/// `PeaPodCore::discovery_response_frame` for a keypair alone (see `beacon_frame`).
+pub fn discovery_response_frame(
+    keypair: &Keypair,
+    listen_port: u16,
+) -> Result<Vec<u8>, wire::FrameEncodeError> {
+    wire::encode_frame(&Message::DiscoveryResponse {
+        protocol_version: PROTOCOL_VERSION,
+        device_id: keypair.device_id(),
+        public_key: keypair.public_key().clone(),
+        listen_port,
+    })
+}
+
+/// `PeaPodCore::handshake_bytes` for a keypair alone (see `beacon_frame`).
+pub fn handshake_bytes(keypair: &Keypair) -> [u8; 49] {
+    let mut out = [0u8; 49];
+    out[0] = PROTOCOL_VERSION;
+    out[1..17].copy_from_slice(keypair.device_id().as_bytes());
+    out[17..49].copy_from_slice(keypair.public_key().as_bytes());
+    out
+}
+
+/// UploadPart frame carrying `payload`, bytes [start, end) of an upload of `total_length` bytes to `url`. Free so a
+/// host that locks the core can hash and copy the part outside the lock (see `PeaPodCore::upload_target`).
+pub fn upload_part_frame(
+    transfer_id: [u8; 16],
+    start: u64,
+    end: u64,
+    total_length: u64,
+    url: &str,
+    payload: &[u8],
+) -> Result<Vec<u8>, wire::FrameEncodeError> {
+    wire::encode_frame_ref(&upload_part(
+        transfer_id,
+        start,
+        end,
+        total_length,
+        url,
+        payload,
+    ))
+}
+
+/// The UploadPart of `upload_part_frame`, hashed but not yet encoded, for `wire::encode_frame_into` a host buffer.
+pub fn upload_part<'a>(
+    transfer_id: [u8; 16],
+    start: u64,
+    end: u64,
+    total_length: u64,
+    url: &'a str,
+    payload: &'a [u8],
+) -> FrameRef<'a> {
+    FrameRef::UploadPart {
+        transfer_id,
+        start,
+        end,
+        total_length,
+        url,
+        hash: integrity::hash_chunk(payload),
+        payload,
+    }
+}
+
+/// UploadAck for a relayed part, to send back to the uploader `to` once the host has sent the part to origin (ok)
+/// or given up on it.
+pub fn upload_ack(
+    to: DeviceId,
+    transfer_id: [u8; 16],
+    start: u64,
+    end: u64,
+    ok: bool,
+) -> Vec<OutboundAction> {
+    let msg = Message::UploadAck {
+        transfer_id,
+        start,
+        end,
+        ok,
+    };
+    wire::encode_frame(&msg)
+        .map(|bytes| OutboundAction::SendMessage(to, bytes))
+        .into_iter()
+        .collect()
+}
+
+/// A received frame decoded and, for ChunkData and UploadPart, hash-checked by `check_messages`; applied with
+/// `PeaPodCore::on_checked_messages`. Payloads still point into the frame.
+pub struct CheckedMessage<'a> {
+    peer_id: DeviceId,
+    msg: FrameRef<'a>,
+    verified: Option<bool>,
+}
+
+/// Decode frames and check every ChunkData and UploadPart hash (on several threads for a large burst) without touching core
+/// state, so a host that locks the core can do the expensive part before taking the lock. Frames that fail to
+/// decode are skipped. Unlike `on_messages_received`, chunks for transfers that are no longer active are hashed too.
+pub fn check_messages<'a>(frames: &[(DeviceId, &'a [u8])]) -> Vec<CheckedMessage<'a>> {
+    let mut checked: Vec<CheckedMessage> = frames
+        .iter()
+        .filter_map(|&(peer_id, f)| {
+            wire::decode_frame_ref(f)
+                .ok()
+                .map(|(msg, _)| CheckedMessage {
+                    peer_id,
+                    msg,
+                    verified: None,
+                })
+        })
+        .collect();
+    let mut wanted = Vec::new();
+    let mut items: Vec<(&[u8], &[u8; 32])> = Vec::new();
+    for (i, c) in checked.iter().enumerate() {
+        if let FrameRef::ChunkData { hash, payload, .. }
+        | FrameRef::UploadPart { hash, payload, .. } = &c.msg
+        {
+            wanted.push(i);
+            items.push((payload, hash));
+        }
+    }
+    let results = integrity::verify_chunks(&items);
+    for (i, ok) in wanted.into_iter().zip(results) {
+        checked[i].verified = Some(ok);
+    }
+    checked
 }
 
 impl PeaPodCore {
@@ -53,10 +294,21 @@ impl PeaPodCore {
         Self {
             keypair: Arc::new(Keypair::generate()),
             peers: Vec::new(),
-            peer_last_tick: HashMap::new(),
-            tick_count: 0,
-            active_transfer: None,
+            peer_last_seen: HashMap::new(),
+            clock_ms: 0,
+            clock_origin_ms: None,
+            last_heartbeat_ms: None,
+            transfers: HashMap::new(),
             peer_metrics: HashMap::new(),
+            throughput: HashMap::new(),
+            uploads: HashMap::new(),
+            upload_throughput: HashMap::new(),
+            upload_jobs: VecDeque::new(),
+            upload_events: 0,
+            cache: None,
+            deliveries: Vec::new(),
+            config: Config::default(),
+            stats: Arc::new(CoreStats::new()),
         }
     }
 
@@ -64,10 +316,21 @@ impl PeaPodCore {
         Self {
             keypair: Arc::new(keypair),
             peers: Vec::new(),
-            peer_last_tick: HashMap::new(),
-            tick_count: 0,
-            active_transfer: None,
+            peer_last_seen: HashMap::new(),
+            clock_ms: 0,
+            clock_origin_ms: None,
+            last_heartbeat_ms: None,
+            transfers: HashMap::new(),
             peer_metrics: HashMap::new(),
+            throughput: HashMap::new(),
+            uploads: HashMap::new(),
+            upload_throughput: HashMap::new(),
+            upload_jobs: VecDeque::new(),
+            upload_events: 0,
+            cache: None,
+            deliveries: Vec::new(),
+            config: Config::default(),
+            stats: Arc::new(CoreStats::new()),
         }
     }
 
@@ -76,10 +339,21 @@ impl PeaPodCore {
         Self {
             keypair,
             peers: Vec::new(),
-            peer_last_tick: HashMap::new(),
-            tick_count: 0,
-            active_transfer: None,
+            peer_last_seen: HashMap::new(),
+            clock_ms: 0,
+            clock_origin_ms: None,
+            last_heartbeat_ms: None,
+            transfers: HashMap::new(),
             peer_metrics: HashMap::new(),
+            throughput: HashMap::new(),
+            uploads: HashMap::new(),
+            upload_throughput: HashMap::new(),
+            upload_jobs: VecDeque::new(),
+            upload_events: 0,
+            cache: None,
+            deliveries: Vec::new(),
+            config: Config::default(),
+            stats: Arc::new(CoreStats::new()),
         }
     }
 
@@ -88,23 +362,79 @@ impl PeaPodCore {
         self.peer_metrics.insert(peer_id, metrics);
     }
 
-    /// Build weights for the given workers (self first, then peers). Returns None only when
-    /// every participant has default weight 1, so that weighted scheduling is used whenever
-    /// any participant (including self) has a non-default bandwidth.
-    fn worker_weights(&self, workers: &[DeviceId]) -> Option<Vec<u64>> {
-        let weights: Vec<u64> = workers
+    /// Replace the configuration; applies to transfers started afterwards.
+    pub fn set_config(&mut self, config: Config) {
+        self.config = config;
+    }
+
+    pub fn config(&self) -> &Config {
+        &self.config
+    }
+
+    /// Mean bandwidth-delay product (bytes in flight per round trip) over workers with a known rate and latency.
+    fn bytes_per_rtt(&self, workers: &[DeviceId]) -> u64 {
+        let bdps: Vec<u64> = workers
             .iter()
-            .map(|id| {
-                self.peer_metrics
-                    .get(id)
-                    .and_then(|m| m.bandwidth_bytes_per_sec)
-                    .unwrap_or(1)
+            .filter_map(|&w| {
+                let rate = self.worker_rate(w)?;
+                let rtt = self.peer_metrics.get(&w)?.latency_ms?;
+                Some(rate.saturating_mul(rtt as u64) / 1000)
             })
             .collect();
-        if weights.iter().all(|&w| w == 1) {
-            return None;
+        if bdps.is_empty() {
+            return 0;
         }
-        Some(weights)
+        bdps.iter().sum::<u64>() / bdps.len() as u64
+    }
+
+    /// A worker's rate for sizing its window: host-provided bandwidth if set, else the measured one.
+    fn worker_rate(&self, id: DeviceId) -> Option<u64> {
+        self.peer_metrics
+            .get(&id)
+            .and_then(|m| m.bandwidth_bytes_per_sec)
+            .or_else(|| self.throughput.get(&id).and_then(|t| t.bytes_per_sec()))
+    }
+
+    /// Fill each of `workers`' windows in transfer `transfer_id`; returns the ChunkRequests. Self is skipped
+    /// (the host pulls its own work with `next_self_chunk`), as are workers that are no longer peers.
+    fn dispatch(&mut self, transfer_id: [u8; 16], workers: &[DeviceId]) -> Vec<OutboundAction> {
+        let self_id = self.keypair.device_id();
+        let rates: Vec<(DeviceId, Option<u64>)> = workers
+            .iter()
+            .filter(|&&w| w != self_id && self.peers.contains(&w))
+            .map(|&w| (w, self.worker_rate(w)))
+            .collect();
+        let mut actions = Vec::new();
+        let Some(active) = self.transfers.get_mut(&transfer_id) else {
+            return actions;
+        };
+        for (peer, rate) in rates {
+            let window = scheduler::window_for(rate, active.chunk_size);
+            while let Some(c) = active.work.next_for(peer, window, self.clock_ms) {
+                let msg = chunk::chunk_request_message(
+                    ChunkId {
+                        start: active.base + c.start,
+                        end: active.base + c.end,
+                        ..c
+                    },
+                    Some(active.url.clone()),
+                );
+                if let Ok(bytes) = wire::encode_frame(&msg) {
+                    actions.push(OutboundAction::SendMessage(peer, bytes));
+                }
+                active.requested_at.insert((c.start, peer), Instant::now());
+            }
+        }
+        actions
+    }
+
+    /// Fill every peer's window in every transfer (after chunks went back to the pool).
+    fn dispatch_all(&mut self) -> Vec<OutboundAction> {
+        let peers = self.peers.clone();
+        let ids: Vec<[u8; 16]> = self.transfers.keys().copied().collect();
+        ids.into_iter()
+            .flat_map(|tid| self.dispatch(tid, &peers))
+            .collect()
     }
 
     /// This device's 16-byte ID (used in discovery and as "self" in assignments).
@@ -114,13 +444,7 @@ impl PeaPodCore {
 
     /// Build discovery beacon frame (length-prefix + bincode Beacon) for the host to send via UDP. Same format as 07.
     pub fn beacon_frame(&self, listen_port: u16) -> Result<Vec<u8>, wire::FrameEncodeError> {
-        let beacon = Message::Beacon {
-            protocol_version: PROTOCOL_VERSION,
-            device_id: self.keypair.device_id(),
-            public_key: self.keypair.public_key().clone(),
-            listen_port,
-        };
-        wire::encode_frame(&beacon)
+        beacon_frame(&self.keypair, listen_port)
     }
 
     /// Build DiscoveryResponse frame (sent to beacon sender). Same wire shape, different variant.
@@ -128,22 +452,12 @@ impl PeaPodCore {
         &self,
         listen_port: u16,
     ) -> Result<Vec<u8>, wire::FrameEncodeError> {
-        let resp = Message::DiscoveryResponse {
-            protocol_version: PROTOCOL_VERSION,
-            device_id: self.keypair.device_id(),
-            public_key: self.keypair.public_key().clone(),
-            listen_port,
-        };
-        wire::encode_frame(&resp)
+        discovery_response_frame(&self.keypair, listen_port)
     }
 
     /// Handshake bytes for local transport: 1 version + 16 device_id + 32 public_key.
     pub fn handshake_bytes(&self) -> [u8; 49] {
-        let mut out = [0u8; 49];
-        out[0] = PROTOCOL_VERSION;
-        out[1..17].copy_from_slice(self.keypair.device_id().as_bytes());
-        out[17..49].copy_from_slice(self.keypair.public_key().as_bytes());
-        out
+        handshake_bytes(&self.keypair)
     }
 
     /// Session key for a peer (from shared secret with peer's public key).
@@ -151,31 +465,73 @@ impl PeaPodCore {
         derive_session_key(&self.keypair.shared_secret(peer_public))
     }
 
-    /// Called when the host has an eligible request. Returns [`Action::Accelerate`] with chunk assignment
-    /// (host then fetches self chunks and sends ChunkRequest to peers) or [`Action::Fallback`].
-    pub fn on_incoming_request(&mut self, _url: &str, range: Option<(u64, u64)>) -> Action {
+    /// Called when the host has an eligible request. Returns [`Action::Accelerate`] with the first chunks
+    /// handed out (one for self, a window per peer: host fetches its chunk and sends ChunkRequest to peers)
+    /// or [`Action::Fallback`]. The rest are pulled as chunks land: peers get ChunkRequests in the actions of
+    /// `on_message_received`, the host asks `next_self_chunk` whenever it is idle.
+    pub fn on_incoming_request(&mut self, url: &str, range: Option<(u64, u64)>) -> Action {
         let total_length = range
             .map(|(s, e)| e.saturating_sub(s).saturating_add(1))
             .unwrap_or(0);
         if total_length == 0 {
             return Action::Fallback;
         }
-        if self.peers.is_empty() {
+        if self.peers.is_empty() || self.transfers.len() >= MAX_ACTIVE_TRANSFERS {
             return Action::Fallback;
         }
+        let _trace = trace::section(trace::ASSIGN);
         let transfer_id: [u8; 16] = uuid::Uuid::new_v4().into_bytes();
-        let chunk_ids = chunk::split_into_chunks(transfer_id, total_length, DEFAULT_CHUNK_SIZE);
-        let workers: Vec<DeviceId> = std::iter::once(self.keypair.device_id())
+        let self_id = self.keypair.device_id();
+        let workers: Vec<DeviceId> = std::iter::once(self_id)
             .chain(self.peers.iter().copied())
             .collect();
-        let weights = self.worker_weights(&workers);
-        let assignment =
-            scheduler::assign_chunks_to_peers_weighted(&chunk_ids, &workers, weights.as_deref());
-        let state = TransferState::new(transfer_id, total_length, chunk_ids.clone());
-        self.active_transfer = Some(ActiveTransfer {
-            state,
-            assignment: assignment.clone(),
-        });
+        let floor = self
+            .bytes_per_rtt(&workers)
+            .saturating_mul(self.config.min_chunk_rtts as u64);
+        let (chunk_size, tail, tail_bytes) = chunk::adaptive_chunk_sizes(
+            total_length,
+            workers.len(),
+            self.config.chunks_per_worker as u64,
+            floor,
+            self.config.min_chunk_size,
+            self.config.max_chunk_size,
+        );
+        let chunk_ids = chunk::split_into_chunks_tapered(
+            transfer_id,
+            total_length,
+            chunk_size,
+            tail,
+            tail_bytes,
+        );
+        let mut work = scheduler::WorkQueue::new(chunk_ids.clone());
+        let mut assignment: Vec<(ChunkId, DeviceId)> = work
+            .next_for(self_id, 1, self.clock_ms)
+            .map(|c| (c, self_id))
+            .into_iter()
+            .collect();
+        for &peer in &self.peers {
+            let window = scheduler::window_for(self.worker_rate(peer), chunk_size);
+            while let Some(c) = work.next_for(peer, window, self.clock_ms) {
+                assignment.push((c, peer));
+            }
+        }
+        let state = TransferState::new(transfer_id, total_length, chunk_ids);
+        let now = Instant::now();
+        self.transfers.insert(
+            transfer_id,
+            ActiveTransfer {
+                state,
+                chunk_size,
+                work,
+                url: url.to_string(),
+                base: range.map_or(0, |(s, _)| s),
+                requested_at: assignment
+                    .iter()
+                    .map(|&(c, w)| ((c.start, w), now))
+                    .collect(),
+                _track: trace::TransferTrack::begin(&transfer_id),
+            },
+        );
         Action::Accelerate {
             transfer_id,
             total_length,
@@ -183,35 +539,299 @@ impl PeaPodCore {
         }
     }
 
-    /// Process received chunk. Returns `Ok(Some(body))` when the transfer is complete and reassembled,
-    /// `Ok(None)` when still in progress, or `Err(ChunkError)` on integrity failure or unknown transfer.
+    /// Stream the transfer's body to `sink` instead of reassembling it: in-order chunks are queued on the returned
+    /// writer as soon as they are contiguous and freed. The core never writes the sink itself: after each call
+    /// that receives chunks, the host takes `take_sink_deliveries` and calls `SinkWriter::deliver` on them once it
+    /// no longer holds the core, so a slow sink stalls only its own transfer. Completion then returns
+    /// `Ok(Some(empty))`; the host closes the writer when done with the destination. Sink failure drops the transfer.
+    pub fn set_transfer_sink(
+        &mut self,
+        transfer_id: [u8; 16],
+        sink: Box<dyn ChunkSink>,
+    ) -> Result<Arc<SinkWriter>, ChunkError> {
+        let active = self
+            .transfers
+            .get_mut(&transfer_id)
+            .ok_or(ChunkError::UnknownTransfer)?;
+        let writer = active.state.set_sink(sink);
+        self.queue_delivery(&writer);
+        Ok(writer)
+    }
+
+    /// Writers with runs queued since the last call, for the host to `deliver` outside its lock on the core.
+    pub fn take_sink_deliveries(&mut self) -> Vec<Arc<SinkWriter>> {
+        std::mem::take(&mut self.deliveries)
+    }
+
+    fn queue_delivery(&mut self, writer: &Arc<SinkWriter>) {
+        if !self.deliveries.iter().any(|w| Arc::ptr_eq(w, writer)) {
+            self.deliveries.push(writer.clone());
+        }
+    }
+
+    /// Bound a streamed transfer's memory: beyond `window_bytes` of held chunks, further ones are parked in `area`
+    /// (at least the transfer's length, e.g. a sparse mmap'd file) until the sink reaches them. Set it before the
+    /// sink. False for an unknown transfer, a sink already set or a short area (which is then dropped).
+    pub fn set_transfer_spill(
+        &mut self,
+        transfer_id: [u8; 16],
+        area: Box<dyn HostArena>,
+        window_bytes: u64,
+    ) -> bool {
+        self.transfers
+            .get_mut(&transfer_id)
+            .is_some_and(|a| a.state.set_spill(area, window_bytes))
+    }
+
+    /// Remove the transfer's sink (host is closing the destination; it closes the writer too). No-op for an unknown
+    /// transfer.
+    pub fn clear_transfer_sink(&mut self, transfer_id: [u8; 16]) {
+        if let Some(a) = self.transfers.get_mut(&transfer_id) {
+            a.state.clear_sink();
+        }
+    }
+
+    /// Drop a transfer (e.g. the client went away): its state is freed and later chunks for it are ignored as
+    /// unknown. A sink stays with its writer until the host closes that. Returns false if no such transfer was in
+    /// progress.
+    pub fn cancel_transfer(&mut self, transfer_id: [u8; 16]) -> bool {
+        self.transfers.remove(&transfer_id).is_some()
+    }
+
+    /// Progress of a transfer in progress, or None if unknown (never started, completed, failed or cancelled).
+    pub fn transfer_status(&self, transfer_id: [u8; 16]) -> Option<TransferStatus> {
+        self.transfers.get(&transfer_id).map(|a| TransferStatus {
+            total_length: a.state.total_length,
+            received_bytes: a.state.received_bytes(),
+            chunks_total: a.state.chunk_ids().len() as u32,
+            chunks_received: a.state.received_count() as u32,
+        })
+    }
+
+    /// Next chunk for the host to fetch itself, called whenever its fetch loop is idle. Anything self still
+    /// held is released first (the host gave up on it). None when nothing is left to fetch or duplicate.
+    pub fn next_self_chunk(&mut self, transfer_id: [u8; 16]) -> Option<ChunkId> {
+        self.next_self_chunks(transfer_id, 1).pop()
+    }
+
+    /// Like `next_self_chunk` for a host that keeps up to `max` chunks of its own in flight (e.g. pipelined
+    /// range requests): releases what self still holds, then claims up to `max` chunks in order.
+    pub fn next_self_chunks(&mut self, transfer_id: [u8; 16], max: usize) -> Vec<ChunkId> {
+        let self_id = self.keypair.device_id();
+        let Some(active) = self.transfers.get_mut(&transfer_id) else {
+            return Vec::new();
+        };
+        active.work.remove_worker(self_id);
+        let mut out = Vec::new();
+        while out.len() < max {
+            match active.work.next_for(self_id, max, self.clock_ms) {
+                Some(c) => out.push(c),
+                None => break,
+            }
+        }
+        let now = Instant::now();
+        for c in &out {
+            active.requested_at.insert((c.start, self_id), now);
+        }
+        out
+    }
+
+    /// Process a chunk the host fetched itself. Returns `Ok(Some(body))` when the transfer is complete and
+    /// reassembled, `Ok(None)` when still in progress, or `Err(ChunkError)` on integrity failure or unknown transfer.
     pub fn on_chunk_received(
         &mut self,
         transfer_id: [u8; 16],
         start: u64,
         end: u64,
         hash: [u8; 32],
-        payload: Vec<u8>,
+        payload: &[u8],
+    ) -> Result<Option<Vec<u8>>, ChunkError> {
+        let self_id = self.keypair.device_id();
+        self.receive_chunk(self_id, transfer_id, start, end, Some(hash), false, payload)
+            .result
+    }
+
+    /// Like `on_chunk_received` for a payload the host already checked (e.g. hashed with an
+    /// `integrity::ChunkVerifier` as it arrived, or fetched from origin itself), so it is not hashed again.
+    pub fn on_verified_chunk_received(
+        &mut self,
+        transfer_id: [u8; 16],
+        start: u64,
+        end: u64,
+        payload: &[u8],
     ) -> Result<Option<Vec<u8>>, ChunkError> {
-        let active = match &mut self.active_transfer {
-            Some(a) if a.state.transfer_id == transfer_id => a,
-            _ => return Err(ChunkError::UnknownTransfer),
+        let self_id = self.keypair.device_id();
+        self.receive_chunk(self_id, transfer_id, start, end, None, true, payload)
+            .result
+    }
+
+    /// Keep verified chunks in `cache` for repeat requests; None turns caching off and frees it. Chunks this
+    /// device receives are added, and peers' ChunkRequests for a cached range are answered from it.
+    pub fn set_chunk_cache(&mut self, cache: Option<ChunkCache>) {
+        self.cache = cache;
+    }
+
+    pub fn chunk_cache(&self) -> Option<&ChunkCache> {
+        self.cache.as_ref()
+    }
+
+    /// This core's hot-path counters; a host keeps a clone to snapshot them without the core (see `stats`).
+    pub fn stats(&self) -> &Arc<CoreStats> {
+        &self.stats
+    }
+
+    /// Keep bytes [start, end) of url that the host fetched from origin to answer a peer's ChunkRequest (offsets
+    /// as in the request). No-op without a cache.
+    pub fn cache_chunk(&mut self, url: &str, start: u64, end: u64, hash: [u8; 32], payload: &[u8]) {
+        if let Some(cache) = self.cache.as_mut() {
+            cache.insert(url, start, end, hash, payload, self.clock_ms);
+        }
+    }
+
+    /// Report the validator (ETag, else Last-Modified) of an origin response for url; cached ranges of url from a
+    /// response with another validator are dropped (see `ChunkCache::set_validator`). No-op without a cache.
+    pub fn set_origin_validator(&mut self, url: &str, validator: &str) {
+        if let Some(cache) = self.cache.as_mut() {
+            cache.set_validator(url, validator);
+        }
+    }
+
+    /// `set_origin_validator` for the URL of an active transfer. Returns false if the transfer is unknown.
+    pub fn set_transfer_validator(&mut self, transfer_id: [u8; 16], validator: &str) -> bool {
+        let Some(active) = self.transfers.get(&transfer_id) else {
+            return false;
         };
-        match chunk::on_chunk_data_received(
-            &mut active.state,
+        if let Some(cache) = self.cache.as_mut() {
+            cache.set_validator(&active.url, validator);
+        }
+        true
+    }
+
+    /// Encoded ChunkData answering a ChunkRequest from the cache; None on a miss or without a cache.
+    pub fn cached_chunk_frame(
+        &mut self,
+        transfer_id: [u8; 16],
+        start: u64,
+        end: u64,
+        url: &str,
+    ) -> Option<Vec<u8>> {
+        let (hash, payload) = self.cache.as_mut()?.get(url, start, end, self.clock_ms)?;
+        wire::encode_frame_ref(&FrameRef::ChunkData {
             transfer_id,
             start,
             end,
             hash,
             payload,
-        ) {
+        })
+        .ok()
+    }
+
+    /// Take one of self's chunks from the cache instead of fetching it. None when it is not cached (fetch it),
+    /// otherwise the result as from `on_chunk_received`.
+    pub fn receive_cached_chunk(
+        &mut self,
+        transfer_id: [u8; 16],
+        start: u64,
+        end: u64,
+    ) -> Option<Result<Option<Vec<u8>>, ChunkError>> {
+        let active = self.transfers.get(&transfer_id)?;
+        let (s, e) = (active.base + start, active.base + end);
+        // Out of self while the payload is borrowed from it; receive_chunk then has no cache to put it back in.
+        let mut cache = self.cache.take()?;
+        let result = cache
+            .get(&active.url, s, e, self.clock_ms)
+            .map(|(hash, payload)| {
+                let self_id = self.keypair.device_id();
+                self.receive_chunk(self_id, transfer_id, start, end, Some(hash), true, payload)
+                    .result
+            });
+        self.cache = Some(cache);
+        result
+    }
+
+    /// Store a chunk delivered by `from`, credit its throughput and refill the windows it freed.
+    /// `hash` is checked against the payload unless `verified` (the caller checked it, or has no hash).
+    #[allow(clippy::too_many_arguments)]
+    fn receive_chunk(
+        &mut self,
+        from: DeviceId,
+        transfer_id: [u8; 16],
+        start: u64,
+        end: u64,
+        hash: Option<[u8; 32]>,
+        verified: bool,
+        payload: &[u8],
+    ) -> ChunkReceiveOutcome {
+        let Some(active) = self.transfers.get_mut(&transfer_id) else {
+            return ChunkReceiveOutcome {
+                result: Err(ChunkError::UnknownTransfer),
+                actions: vec![],
+            };
+        };
+        let chunk_id = ChunkId {
+            transfer_id,
+            start,
+            end,
+        };
+        let mut requested_at = None;
+        // A chunk is hashed once at most: to check it, or (with no hash to hand) to key it in the cache.
+        let digest = match hash {
+            Some(h) if !verified && !integrity::verify_chunk(payload, &h) => None,
+            Some(h) => Some(Some(h)),
+            None if self.cache.is_some() => Some(Some(integrity::hash_chunk(payload))),
+            None => Some(None),
+        };
+        let received = match digest {
+            None => chunk::ChunkReceiveResult::IntegrityFailed,
+            Some(digest) => {
+                requested_at = active.requested_at.remove(&(start, from));
+                if let (Some(cache), Some(digest)) = (self.cache.as_mut(), digest) {
+                    if active.state.is_chunk_pending(chunk_id) {
+                        let (s, e) = (active.base + start, active.base + end);
+                        cache.insert(&active.url, s, e, digest, payload, self.clock_ms);
+                    }
+                }
+                let _trace = trace::section(trace::REASSEMBLE);
+                chunk::on_verified_chunk_data(&mut active.state, chunk_id, payload)
+            }
+        };
+        if let Some(writer) = active.state.sink_writer().cloned() {
+            self.queue_delivery(&writer);
+        }
+        let result = match received {
             chunk::ChunkReceiveResult::Complete(bytes) => {
-                self.active_transfer = None;
+                self.transfers.remove(&transfer_id);
                 Ok(Some(bytes))
             }
             chunk::ChunkReceiveResult::InProgress => Ok(None),
-            chunk::ChunkReceiveResult::IntegrityFailed => Err(ChunkError::IntegrityFailed),
+            chunk::ChunkReceiveResult::IntegrityFailed => {
+                self.stats.integrity_failure(from);
+                return ChunkReceiveOutcome {
+                    result: Err(ChunkError::IntegrityFailed),
+                    actions: vec![],
+                };
+            }
+            chunk::ChunkReceiveResult::SinkFailed => {
+                self.transfers.remove(&transfer_id);
+                Err(ChunkError::SinkFailed)
+            }
+        };
+        self.throughput
+            .entry(from)
+            .or_default()
+            .record(end.saturating_sub(start));
+        self.stats.chunk_received(
+            from,
+            payload.len() as u64,
+            requested_at.map(stats::elapsed_ns),
+        );
+        let mut actions = Vec::new();
+        if let Some(active) = self.transfers.get_mut(&transfer_id) {
+            let mut freed = active.work.complete(chunk_id);
+            freed.push(from);
+            actions = self.dispatch(transfer_id, &freed);
         }
+        ChunkReceiveOutcome { result, actions }
     }
 
     /// Notify that a peer joined (from discovery). Updates peer list for chunk assignment.
@@ -219,37 +839,88 @@ impl PeaPodCore {
         if !self.peers.contains(&peer_id) {
             self.peers.push(peer_id);
         }
-        self.peer_last_tick.insert(peer_id, self.tick_count);
+        self.peer_last_seen.insert(peer_id, self.clock_ms);
     }
 
     /// Notify that a peer left. Redistributes its chunks to remaining peers; returns actions to send ChunkRequests.
     pub fn on_peer_left(&mut self, peer_id: DeviceId) -> Vec<OutboundAction> {
         self.peers.retain(|p| *p != peer_id);
-        self.peer_last_tick.remove(&peer_id);
+        self.peer_last_seen.remove(&peer_id);
         self.redistribute_peer_chunks(peer_id)
     }
 
     /// Call when host receives a heartbeat from peer (so we don't mark peer as left).
     pub fn on_heartbeat_received(&mut self, peer_id: DeviceId) {
-        self.peer_last_tick.insert(peer_id, self.tick_count);
+        self.peer_last_seen.insert(peer_id, self.clock_ms);
     }
 
     /// Periodic tick: check heartbeat timeouts (treat overdue peers as left), produce heartbeat messages.
     /// Periodic tick (e.g. every 1 s). Returns outbound actions (e.g. heartbeats); host sends them to peers.
     pub fn tick(&mut self) -> Vec<OutboundAction> {
-        self.tick_count = self.tick_count.saturating_add(1);
+        let now = self.clock_ms.saturating_add(TICK_MS);
+        self.advance_clock(now)
+    }
+
+    /// Same as `tick` for hosts that tick at a variable rate (see `tick_interval_ms`): `now_ms` is any
+    /// monotonic host clock. Timeouts are measured in time, not ticks, and heartbeats are rate-limited.
+    pub fn tick_at(&mut self, now_ms: u64) -> Vec<OutboundAction> {
+        let clock = self.clock_ms;
+        let origin = *self
+            .clock_origin_ms
+            .get_or_insert(now_ms.saturating_sub(clock));
+        self.advance_clock(now_ms.saturating_sub(origin))
+    }
+
+    /// Suggested delay before the next `tick_at`: short while a transfer runs (faster peer-loss
+    /// detection), longer when idle, longest with no peers.
+    pub fn tick_interval_ms(&self) -> u64 {
+        if !self.transfers.is_empty() || !self.uploads.is_empty() {
+            TICK_ACTIVE_MS
+        } else if !self.peers.is_empty() {
+            TICK_IDLE_MS
+        } else {
+            TICK_ALONE_MS
+        }
+    }
+
+    fn advance_clock(&mut self, now_ms: u64) -> Vec<OutboundAction> {
+        self.clock_ms = self.clock_ms.max(now_ms);
         let mut actions = Vec::new();
         let overdue: Vec<DeviceId> = self
-            .peer_last_tick
+            .peer_last_seen
             .iter()
-            .filter(|(_, &t)| self.tick_count.saturating_sub(t) > HEARTBEAT_TIMEOUT_TICKS)
+            .filter(|(_, &t)| self.clock_ms.saturating_sub(t) > HEARTBEAT_TIMEOUT_MS)
             .map(|(&p, _)| p)
             .collect();
         for peer_id in overdue {
             self.peers.retain(|p| *p != peer_id);
-            self.peer_last_tick.remove(&peer_id);
+            self.peer_last_seen.remove(&peer_id);
             actions.extend(self.redistribute_peer_chunks(peer_id));
         }
+        let workers: Vec<DeviceId> = std::iter::once(self.keypair.device_id())
+            .chain(self.peers.iter().copied())
+            .collect();
+        for w in workers {
+            let busy = self.transfers.values().any(|a| a.work.in_flight(w) > 0);
+            self.throughput
+                .entry(w)
+                .or_default()
+                .sample(self.clock_ms, busy);
+            let uploading = self.uploads.values().any(|u| u.work.in_flight(w) > 0);
+            self.upload_throughput
+                .entry(w)
+                .or_default()
+                .sample(self.clock_ms, uploading);
+        }
+        // Peers with room pick up released chunks, or stragglers to duplicate in the endgame.
+        actions.extend(self.dispatch_all());
+        let heartbeat_due = self
+            .last_heartbeat_ms
+            .is_none_or(|t| self.clock_ms.saturating_sub(t) >= HEARTBEAT_INTERVAL_MS);
+        if !heartbeat_due {
+            return actions;
+        }
+        self.last_heartbeat_ms = Some(self.clock_ms);
         let self_id = self.keypair.device_id();
         for &peer in &self.peers {
             let msg = Message::Heartbeat { device_id: self_id };
@@ -260,31 +931,199 @@ impl PeaPodCore {
         actions
     }
 
+    /// Put every chunk `peer_left` held back in the pool and hand them to the remaining peers. Its upload parts go
+    /// back too (the host picks them up with `next_upload_parts`), and parts it asked us to relay are dropped.
     fn redistribute_peer_chunks(&mut self, peer_left: DeviceId) -> Vec<OutboundAction> {
-        let active = match &mut self.active_transfer {
-            Some(a) => a,
-            None => return vec![],
-        };
-        let remaining: Vec<DeviceId> = std::iter::once(self.keypair.device_id())
+        for active in self.transfers.values_mut() {
+            active.work.remove_worker(peer_left);
+        }
+        for upload in self.uploads.values_mut() {
+            upload.work.remove_worker(peer_left);
+        }
+        self.upload_jobs.retain(|j| j.from != peer_left);
+        self.upload_events = self.upload_events.wrapping_add(1);
+        self.dispatch_all()
+    }
+
+    /// Start accelerating an upload of `total_length` bytes to `url`; the host keeps the body. Returns
+    /// [`Action::Accelerate`] with the first parts handed out, a window per worker sized by its uplink rate: the
+    /// host PUTs its own parts to origin and reports each with `on_upload_part_done`, and sends every peer its
+    /// parts with `upload_part_frame`. Later parts come from `next_upload_parts` as parts are acknowledged.
+    /// [`Action::Fallback`] when there are no peers or too many transfers are running.
+    pub fn on_upload_request(&mut self, url: &str, total_length: u64) -> Action {
+        if total_length == 0
+            || self.peers.is_empty()
+            || self.transfers.len() + self.uploads.len() >= MAX_ACTIVE_TRANSFERS
+        {
+            return Action::Fallback;
+        }
+        let transfer_id: [u8; 16] = uuid::Uuid::new_v4().into_bytes();
+        let (chunk_size, tail, tail_bytes) = chunk::adaptive_chunk_sizes(
+            total_length,
+            self.peers.len() + 1,
+            self.config.chunks_per_worker as u64,
+            0,
+            self.config.min_chunk_size,
+            self.config.max_chunk_size,
+        );
+        let parts = chunk::split_into_chunks_tapered(
+            transfer_id,
+            total_length,
+            chunk_size,
+            tail,
+            tail_bytes,
+        );
+        self.uploads.insert(
+            transfer_id,
+            ActiveUpload {
+                url: url.to_string(),
+                total_length,
+                chunk_size,
+                parts_total: parts.len() as u32,
+                done_bytes: 0,
+                work: scheduler::WorkQueue::new(parts),
+            },
+        );
+        let assignment = self.next_upload_parts(transfer_id);
+        Action::Accelerate {
+            transfer_id,
+            total_length,
+            assignment,
+        }
+    }
+
+    /// Hand out parts to every worker (self included) with room in its window; returns the new (part, worker)
+    /// pairs. In the endgame an idle worker gets a duplicate of a straggler. Call whenever `upload_events` moves.
+    pub fn next_upload_parts(&mut self, transfer_id: [u8; 16]) -> Vec<(ChunkId, DeviceId)> {
+        let rates: Vec<(DeviceId, Option<u64>)> = std::iter::once(self.keypair.device_id())
             .chain(self.peers.iter().copied())
+            .map(|w| {
+                let rate = self
+                    .upload_throughput
+                    .get(&w)
+                    .and_then(|t| t.bytes_per_sec());
+                (w, rate)
+            })
             .collect();
-        let new_assignments =
-            scheduler::reassign_after_peer_left(&active.assignment, peer_left, &remaining);
-        active.assignment.retain(|(_, p)| *p != peer_left);
-        let mut actions = Vec::new();
-        for (chunk_id, new_peer) in new_assignments {
-            active.assignment.push((chunk_id, new_peer));
-            let msg = chunk::chunk_request_message(chunk_id, None);
-            if let Ok(bytes) = wire::encode_frame(&msg) {
-                actions.push(OutboundAction::SendMessage(new_peer, bytes));
+        let Some(upload) = self.uploads.get_mut(&transfer_id) else {
+            return Vec::new();
+        };
+        let mut out = Vec::new();
+        for (worker, rate) in rates {
+            let window = scheduler::window_for(rate, upload.chunk_size);
+            while let Some(c) = upload.work.next_for(worker, window, self.clock_ms) {
+                out.push((c, worker));
             }
         }
-        actions
+        out
+    }
+
+    /// The host sent one of its own parts to origin (ok) or gave up on it. Returns false for an unknown upload.
+    pub fn on_upload_part_done(
+        &mut self,
+        transfer_id: [u8; 16],
+        start: u64,
+        end: u64,
+        ok: bool,
+    ) -> bool {
+        let self_id = self.keypair.device_id();
+        self.upload_part_result(self_id, transfer_id, start, end, ok)
+    }
+
+    /// Record `worker`'s result for a part: done (credited to its uplink) or back in the pool.
+    fn upload_part_result(
+        &mut self,
+        worker: DeviceId,
+        transfer_id: [u8; 16],
+        start: u64,
+        end: u64,
+        ok: bool,
+    ) -> bool {
+        let Some(upload) = self.uploads.get_mut(&transfer_id) else {
+            return false;
+        };
+        let part = ChunkId {
+            transfer_id,
+            start,
+            end,
+        };
+        if ok {
+            let before = upload.work.done_count();
+            upload.work.complete(part);
+            if upload.work.done_count() > before {
+                upload.done_bytes = upload.done_bytes.saturating_add(end.saturating_sub(start));
+            }
+            self.upload_throughput
+                .entry(worker)
+                .or_default()
+                .record(end.saturating_sub(start));
+        } else {
+            upload.work.release(part, worker);
+        }
+        self.upload_events = self.upload_events.wrapping_add(1);
+        true
+    }
+
+    /// Progress of an upload this device started: chunks_received and received_bytes count acknowledged parts.
+    /// Complete when every part is; the upload stays known until `finish_upload`. None if unknown.
+    pub fn upload_status(&self, transfer_id: [u8; 16]) -> Option<TransferStatus> {
+        self.uploads.get(&transfer_id).map(|u| TransferStatus {
+            total_length: u.total_length,
+            received_bytes: u.done_bytes,
+            chunks_total: u.parts_total,
+            chunks_received: u.work.done_count() as u32,
+        })
+    }
+
+    /// Url and total length of an upload in progress, for the free `upload_part_frame`.
+    pub fn upload_target(&self, transfer_id: [u8; 16]) -> Option<(String, u64)> {
+        self.uploads
+            .get(&transfer_id)
+            .map(|u| (u.url.clone(), u.total_length))
+    }
+
+    /// UploadPart frame for a part of an upload in progress (see `next_upload_parts`); None if unknown.
+    pub fn upload_part_frame(
+        &self,
+        transfer_id: [u8; 16],
+        start: u64,
+        end: u64,
+        payload: &[u8],
+    ) -> Option<Vec<u8>> {
+        let upload = self.uploads.get(&transfer_id)?;
+        upload_part_frame(
+            transfer_id,
+            start,
+            end,
+            upload.total_length,
+            &upload.url,
+            payload,
+        )
+        .ok()
+    }
+
+    /// Forget an upload (finished or abandoned); later acks for it are ignored. Returns false if unknown.
+    pub fn finish_upload(&mut self, transfer_id: [u8; 16]) -> bool {
+        self.uploads.remove(&transfer_id).is_some()
+    }
+
+    /// Oldest part a peer asked this device to relay, if any.
+    pub fn take_upload_job(&mut self) -> Option<UploadJob> {
+        self.upload_jobs.pop_front()
+    }
+
+    /// Counter bumped whenever upload work appears: a part acknowledged or refused, a relay job queued, a worker
+    /// lost. A host driving uploads waits for it to change rather than polling.
+    pub fn upload_events(&self) -> u64 {
+        self.upload_events
     }
 
-    /// Get current assignment for the active transfer (for host to issue ChunkRequests). Returns (chunk_id, peer_id) list.
-    pub fn current_assignment(&self) -> Option<Vec<(ChunkId, DeviceId)>> {
-        self.active_transfer.as_ref().map(|a| a.assignment.clone())
+    /// Chunks currently requested for a transfer and who holds them (a duplicated straggler appears once per
+    /// holder). Returns (chunk_id, peer_id) list.
+    pub fn current_assignment(&self, transfer_id: [u8; 16]) -> Option<Vec<(ChunkId, DeviceId)>> {
+        self.transfers
+            .get(&transfer_id)
+            .map(|a| a.work.assignment())
     }
 
     /// Process a received message (host decrypts and passes frame bytes).
@@ -295,90 +1134,227 @@ impl PeaPodCore {
         peer_id: DeviceId,
         frame_bytes: &[u8],
     ) -> Result<(Vec<OutboundAction>, Option<([u8; 16], Vec<u8>)>), OnMessageError> {
-        let (msg, _) = wire::decode_frame(frame_bytes).map_err(OnMessageError::Decode)?;
+        let (msg, _) = wire::decode_frame_ref(frame_bytes).map_err(OnMessageError::Decode)?;
+        Ok(self.handle_message(peer_id, msg, None))
+    }
+
+    /// Process a burst of received messages (e.g. everything one pass of the receive loop produced), in order.
+    /// Chunk payloads for known transfers are hashed together up front, on several threads when the burst is
+    /// large (`integrity::verify_chunks`). Frames that fail to decode are skipped.
+    /// Returns the merged outbound actions and every transfer the burst completed.
+    #[allow(clippy::type_complexity)]
+    pub fn on_messages_received(
+        &mut self,
+        frames: &[(DeviceId, &[u8])],
+    ) -> (Vec<OutboundAction>, Vec<([u8; 16], Vec<u8>)>) {
+        let msgs: Vec<(DeviceId, FrameRef)> = frames
+            .iter()
+            .filter_map(|&(peer, f)| wire::decode_frame_ref(f).ok().map(|(m, _)| (peer, m)))
+            .collect();
+        let mut verified = vec![None; msgs.len()];
+        {
+            let mut wanted = Vec::new();
+            let mut items: Vec<(&[u8], &[u8; 32])> = Vec::new();
+            for (i, (_, m)) in msgs.iter().enumerate() {
+                if let FrameRef::ChunkData {
+                    transfer_id,
+                    hash,
+                    payload,
+                    ..
+                } = m
+                {
+                    if self.transfers.contains_key(transfer_id) {
+                        wanted.push(i);
+                        items.push((payload, hash));
+                    }
+                }
+            }
+            for (i, ok) in wanted.into_iter().zip(integrity::verify_chunks(&items)) {
+                verified[i] = Some(ok);
+            }
+        }
+        let mut actions = Vec::new();
+        let mut completed = Vec::new();
+        for ((peer_id, msg), verified) in msgs.into_iter().zip(verified) {
+            let (a, c) = self.handle_message(peer_id, msg, verified);
+            actions.extend(a);
+            completed.extend(c);
+        }
+        (actions, completed)
+    }
+
+    /// Apply messages from `check_messages`, in order. Same result as `on_messages_received` on the raw frames.
+    #[allow(clippy::type_complexity)]
+    pub fn on_checked_messages(
+        &mut self,
+        msgs: Vec<CheckedMessage<'_>>,
+    ) -> (Vec<OutboundAction>, Vec<([u8; 16], Vec<u8>)>) {
+        let mut actions = Vec::new();
+        let mut completed = Vec::new();
+        for c in msgs {
+            let (a, done) = self.handle_message(c.peer_id, c.msg, c.verified);
+            actions.extend(a);
+            completed.extend(done);
+        }
+        (actions, completed)
+    }
+
+    /// Act on one decoded message. `verified` is the ChunkData hash check if the caller already ran it.
+    #[allow(clippy::type_complexity)]
+    fn handle_message(
+        &mut self,
+        peer_id: DeviceId,
+        msg: FrameRef<'_>,
+        verified: Option<bool>,
+    ) -> (Vec<OutboundAction>, Option<([u8; 16], Vec<u8>)>) {
         let mut actions = Vec::new();
         let mut completed = None;
         match msg {
-            Message::Heartbeat { .. } => {
+            FrameRef::Other(Message::Heartbeat { .. }) => {
                 self.on_heartbeat_received(peer_id);
             }
-            Message::Leave { device_id } => {
+            FrameRef::Other(Message::Leave { device_id }) => {
                 if device_id == peer_id {
                     actions.extend(self.on_peer_left(peer_id));
                 }
             }
-            Message::ChunkData {
+            FrameRef::ChunkData {
                 transfer_id,
                 start,
                 end,
                 hash,
                 payload,
-            } => match self.on_chunk_received(transfer_id, start, end, hash, payload) {
-                Ok(Some(body)) => completed = Some((transfer_id, body)),
-                Ok(None) => {}
-                Err(ChunkError::IntegrityFailed) => {
-                    let chunk_id = ChunkId {
+            } => {
+                let Some((start, end)) = self.transfer_range(transfer_id, start, end) else {
+                    return (actions, completed);
+                };
+                let outcome = match verified {
+                    Some(false) => {
+                        self.stats.integrity_failure(peer_id);
+                        ChunkReceiveOutcome {
+                            result: Err(ChunkError::IntegrityFailed),
+                            actions: vec![],
+                        }
+                    }
+                    _ => self.receive_chunk(
+                        peer_id,
                         transfer_id,
                         start,
                         end,
-                    };
-                    actions.extend(self.reassign_single_chunk(chunk_id));
+                        Some(hash),
+                        verified.is_some(),
+                        payload,
+                    ),
+                };
+                actions.extend(outcome.actions);
+                match outcome.result {
+                    Ok(Some(body)) => completed = Some((transfer_id, body)),
+                    Ok(None) => {}
+                    Err(ChunkError::IntegrityFailed) => {
+                        let chunk_id = ChunkId {
+                            transfer_id,
+                            start,
+                            end,
+                        };
+                        actions.extend(self.reassign_single_chunk(peer_id, chunk_id));
+                    }
+                    Err(ChunkError::UnknownTransfer) | Err(ChunkError::SinkFailed) => {}
                 }
-                Err(ChunkError::UnknownTransfer) => {}
-            },
-            Message::Nack {
+            }
+            FrameRef::Other(Message::Nack {
                 transfer_id,
                 start,
                 end,
-            } => {
+            }) => {
+                let Some((start, end)) = self.transfer_range(transfer_id, start, end) else {
+                    return (actions, completed);
+                };
                 let chunk_id = ChunkId {
                     transfer_id,
                     start,
                     end,
                 };
-                actions.extend(self.reassign_single_chunk(chunk_id));
+                actions.extend(self.reassign_single_chunk(peer_id, chunk_id));
+            }
+            FrameRef::UploadPart {
+                transfer_id,
+                start,
+                end,
+                total_length,
+                url,
+                hash,
+                payload,
+            } => {
+                let accepted = self.upload_jobs.len() < MAX_UPLOAD_JOBS
+                    && end > start
+                    && payload.len() as u64 == end - start
+                    && verified.unwrap_or_else(|| integrity::verify_chunk(payload, &hash));
+                if accepted {
+                    self.upload_jobs.push_back(UploadJob {
+                        from: peer_id,
+                        transfer_id,
+                        start,
+                        end,
+                        total_length,
+                        url: url.to_string(),
+                        payload: payload.to_vec(),
+                    });
+                    self.upload_events = self.upload_events.wrapping_add(1);
+                } else {
+                    actions.extend(upload_ack(peer_id, transfer_id, start, end, false));
+                }
+            }
+            FrameRef::Other(Message::UploadAck {
+                transfer_id,
+                start,
+                end,
+                ok,
+            }) => {
+                self.upload_part_result(peer_id, transfer_id, start, end, ok);
             }
-            Message::Beacon { .. }
-            | Message::DiscoveryResponse { .. }
-            | Message::Join { .. }
-            | Message::ChunkRequest { .. } => {}
+            FrameRef::Other(Message::ChunkRequest {
+                transfer_id,
+                start,
+                end,
+                url: Some(url),
+            }) => {
+                // Served here only from the cache; on a miss the host fetches it (see `cache_chunk`).
+                if let Some(frame) = self.cached_chunk_frame(transfer_id, start, end, &url) {
+                    actions.push(OutboundAction::SendMessage(peer_id, frame));
+                }
+            }
+            // Payload messages are only ever Other when built by hand; decoding gives them their own variants.
+            FrameRef::Other(
+                Message::Beacon { .. }
+                | Message::DiscoveryResponse { .. }
+                | Message::Join { .. }
+                | Message::ChunkRequest { url: None, .. }
+                | Message::ChunkData { .. }
+                | Message::UploadPart { .. },
+            ) => {}
         }
-        Ok((actions, completed))
+        (actions, completed)
     }
 
-    /// Reassign one chunk (e.g. after Nack or integrity failure). Returns ChunkRequest(s) to new peer(s).
-    fn reassign_single_chunk(&mut self, chunk_id: ChunkId) -> Vec<OutboundAction> {
-        let mut actions = Vec::new();
-        let active = match &mut self.active_transfer {
-            Some(a) => a,
-            None => return actions,
-        };
-        let old_peer = active
-            .assignment
-            .iter()
-            .find(|(c, _)| *c == chunk_id)
-            .map(|(_, p)| *p);
-        let Some(peer_left) = old_peer else {
-            return actions;
+    /// Absolute wire offsets as offsets within the transfer; None for an unknown transfer or a range before it.
+    fn transfer_range(&self, transfer_id: [u8; 16], start: u64, end: u64) -> Option<(u64, u64)> {
+        let base = self.transfers.get(&transfer_id)?.base;
+        Some((start.checked_sub(base)?, end.checked_sub(base)?))
+    }
+
+    /// Take one chunk back from `from` (Nack or integrity failure) and hand it to another peer with room;
+    /// `from` is refilled only after that, so it does not get the same chunk straight back.
+    fn reassign_single_chunk(&mut self, from: DeviceId, chunk_id: ChunkId) -> Vec<OutboundAction> {
+        let transfer_id = chunk_id.transfer_id;
+        let Some(active) = self.transfers.get_mut(&transfer_id) else {
+            return vec![];
         };
-        let remaining: Vec<DeviceId> = std::iter::once(self.keypair.device_id())
-            .chain(self.peers.iter().copied())
-            .filter(|&p| p != peer_left)
-            .collect();
-        if remaining.is_empty() {
-            return actions;
-        }
-        let to_reassign = [chunk_id];
-        let new_assignments = scheduler::assign_chunks_to_peers(&to_reassign, &remaining);
-        active.assignment.retain(|(c, _)| *c != chunk_id);
-        for (c, new_peer) in new_assignments {
-            active.assignment.push((c, new_peer));
-            let msg = chunk::chunk_request_message(c, None);
-            if let Ok(bytes) = wire::encode_frame(&msg) {
-                actions.push(OutboundAction::SendMessage(new_peer, bytes));
-            }
-        }
-        actions
+        active.work.release(chunk_id, from);
+        active.requested_at.remove(&(chunk_id.start, from));
+        self.stats.reassigned(from);
+        let mut order: Vec<DeviceId> = self.peers.iter().copied().filter(|&p| p != from).collect();
+        order.push(from);
+        self.dispatch(transfer_id, &order)
     }
 }
 
@@ -395,13 +1371,15 @@ impl Default for PeaPodCore {
     }
 }
 
-/// Error from `on_chunk_received`: unknown transfer or integrity check failed.
+/// Error from `on_chunk_received`: unknown transfer, integrity check failed, or the streaming sink failed.
 #[derive(Debug, thiserror::Error)]
 pub enum ChunkError {
     #[error("unknown transfer")]
     UnknownTransfer,
     #[error("integrity check failed")]
     IntegrityFailed,
+    #[error("transfer sink failed")]
+    SinkFailed,
 }
 
 /// Outcome of processing a received chunk: result and any outbound actions (e.g. reassign on failure).
@@ -463,7 +1441,7 @@ mod tests {
             let payload: Vec<u8> = (chunk_id.start..chunk_id.end).map(|j| j as u8).collect();
             let hash = integrity::hash_chunk(&payload);
             let r =
-                core.on_chunk_received(transfer_id, chunk_id.start, chunk_id.end, hash, payload);
+                core.on_chunk_received(transfer_id, chunk_id.start, chunk_id.end, hash, &payload);
             if let Ok(Some(bytes)) = r {
                 assert_eq!(bytes.len(), 100);
                 for (j, &b) in bytes.iter().enumerate() {
@@ -474,4 +1452,414 @@ mod tests {
         }
         panic!("transfer should complete after receiving all chunks");
     }
+
+    #[test]
+    fn stats_count_chunks_failures_and_reassignments_per_peer() {
+        let mut core = PeaPodCore::with_keypair(Keypair::generate());
+        let self_id = core.device_id();
+        let peer_id = Keypair::generate().device_id();
+        core.on_peer_joined(peer_id, &Keypair::generate().public_key().clone());
+        let Action::Accelerate { transfer_id, .. } =
+            core.on_incoming_request("http://example.com/file", Some((0, 99)))
+        else {
+            panic!("expected Accelerate");
+        };
+        let payload: Vec<u8> = (0..100u8).collect();
+        let hash = integrity::hash_chunk(&payload);
+        let nack = wire::encode_frame(&Message::Nack {
+            transfer_id,
+            start: 0,
+            end: 100,
+        })
+        .unwrap();
+        core.on_message_received(peer_id, &nack).unwrap();
+        assert!(core
+            .on_chunk_received(transfer_id, 0, 100, [0; 32], &payload)
+            .is_err());
+        assert!(core
+            .on_chunk_received(transfer_id, 0, 100, hash, &payload)
+            .is_ok());
+
+        let snap = core.stats().snapshot();
+        let word = |off: usize| u64::from_le_bytes(snap[off..off + 8].try_into().unwrap());
+        let peers = u32::from_le_bytes(snap[12..16].try_into().unwrap()) as usize;
+        assert_eq!(
+            u32::from_le_bytes(snap[4..8].try_into().unwrap()) as usize,
+            snap.len()
+        );
+        let core_at = 16 + 3 * (16 + 8 * (2 + stats::HIST_BUCKETS));
+        // chunks, bytes, integrity failures, reassignments
+        assert_eq!(
+            (
+                word(core_at),
+                word(core_at + 8),
+                word(core_at + 16),
+                word(core_at + 24)
+            ),
+            (1, 100, 1, 1)
+        );
+        let peer_len = 48 + 8 * (2 + stats::HIST_BUCKETS);
+        let record = |id: DeviceId| {
+            (0..peers)
+                .map(|i| core_at + 32 + i * peer_len)
+                .find(|&at| snap[at..at + 16] == id.as_bytes()[..])
+                .expect("peer record")
+        };
+        let (me, peer) = (record(self_id), record(peer_id));
+        assert_eq!((word(me + 16), word(me + 24), word(me + 32)), (1, 100, 1));
+        // The latency histogram counts self's chunk, handed out with the Accelerate plan.
+        assert_eq!(word(me + 48), 1);
+        assert_eq!((word(peer + 16), word(peer + 40)), (0, 1));
+    }
+
+    #[test]
+    fn concurrent_transfers_complete_and_cancel_independently() {
+        let mut core = PeaPodCore::with_keypair(Keypair::generate());
+        let peer_id = Keypair::generate().device_id();
+        core.on_peer_joined(peer_id, &Keypair::generate().public_key().clone());
+        let start = |core: &mut PeaPodCore| match core
+            .on_incoming_request("http://example.com/file", Some((0, 99)))
+        {
+            Action::Accelerate { transfer_id, .. } => transfer_id,
+            Action::Fallback => panic!("expected Accelerate"),
+        };
+        let a = start(&mut core);
+        let b = start(&mut core);
+        assert_ne!(a, b);
+
+        let payload: Vec<u8> = (0..100u8).collect();
+        let hash = integrity::hash_chunk(&payload);
+        let status = core.transfer_status(b).unwrap();
+        assert_eq!((status.total_length, status.received_bytes), (100, 0));
+        let body = core.on_chunk_received(b, 0, 100, hash, &payload);
+        assert_eq!(body.unwrap(), Some(payload.clone()));
+        assert!(core.transfer_status(b).is_none());
+        assert_eq!(core.transfer_status(a).unwrap().chunks_received, 0);
+
+        assert!(core.cancel_transfer(a));
+        assert!(!core.cancel_transfer(a));
+        assert!(matches!(
+            core.on_chunk_received(a, 0, 100, hash, &payload),
+            Err(ChunkError::UnknownTransfer)
+        ));
+        assert_eq!(core.tick_interval_ms(), TICK_IDLE_MS);
+    }
+
+    #[test]
+    fn peers_pull_chunks_as_they_deliver_and_duplicate_stragglers() {
+        let mut core = PeaPodCore::with_keypair(Keypair::generate());
+        let cs = crate::chunk::DEFAULT_CHUNK_SIZE;
+        core.set_config(Config {
+            min_chunk_size: cs,
+            max_chunk_size: cs,
+            ..Config::default()
+        });
+        let self_id = core.device_id();
+        let slow = Keypair::generate().device_id();
+        let fast = Keypair::generate().device_id();
+        core.on_peer_joined(slow, &Keypair::generate().public_key().clone());
+        core.on_peer_joined(fast, &Keypair::generate().public_key().clone());
+        let (transfer_id, assignment) =
+            match core.on_incoming_request("http://example.com/f", Some((0, 8 * cs - 1))) {
+                Action::Accelerate {
+                    transfer_id,
+                    assignment,
+                    ..
+                } => (transfer_id, assignment),
+                Action::Fallback => panic!("expected Accelerate"),
+            };
+        // Only the first window is handed out: one chunk for self, DEFAULT_WINDOW per peer.
+        assert_eq!(assignment.len(), 1 + 2 * scheduler::DEFAULT_WINDOW);
+        assert_eq!(assignment[0].1, self_id);
+        let chunk_frame = |c: ChunkId| {
+            let payload = vec![7u8; (c.end - c.start) as usize];
+            let hash = integrity::hash_chunk(&payload);
+            wire::encode_frame(&Message::ChunkData {
+                transfer_id,
+                start: c.start,
+                end: c.end,
+                hash,
+                payload,
+            })
+            .unwrap()
+        };
+        let requested = |actions: &[OutboundAction]| -> Vec<(DeviceId, u64, Option<String>)> {
+            actions
+                .iter()
+                .filter_map(|OutboundAction::SendMessage(p, bytes)| {
+                    match wire::decode_frame(bytes).unwrap().0 {
+                        Message::ChunkRequest { start, url, .. } => Some((*p, start, url)),
+                        _ => None,
+                    }
+                })
+                .collect()
+        };
+        // The fast peer drains the pool one delivery at a time while the slow peer sits on its window.
+        let mut fast_chunks: Vec<ChunkId> = assignment
+            .iter()
+            .filter(|(_, p)| *p == fast)
+            .map(|(c, _)| *c)
+            .collect();
+        let mut pulled = Vec::new();
+        let mut completed = None;
+        while let Some(c) = fast_chunks.pop() {
+            let (actions, done) = core.on_message_received(fast, &chunk_frame(c)).unwrap();
+            if done.is_some() {
+                completed = done;
+                break;
+            }
+            for (p, start, url) in requested(&actions) {
+                assert_eq!(p, fast);
+                assert_eq!(url.as_deref(), Some("http://example.com/f"));
+                fast_chunks.push(ChunkId {
+                    transfer_id,
+                    start,
+                    end: start + cs,
+                });
+                pulled.push(start / cs);
+            }
+        }
+        // The 3 unstarted chunks, then (endgame) duplicates of the stragglers held by self and the slow peer.
+        assert_eq!(pulled, vec![5, 6, 7, 0, 1, 2]);
+        let (tid, body) = completed.expect("fast peer should finish the transfer");
+        assert_eq!((tid, body.len() as u64), (transfer_id, 8 * cs));
+        assert!(core.next_self_chunk(transfer_id).is_none());
+    }
+
+    #[test]
+    fn next_self_chunks_claims_a_window_and_releases_it_on_the_next_call() {
+        let mut core = PeaPodCore::with_keypair(Keypair::generate());
+        let cs = crate::chunk::DEFAULT_CHUNK_SIZE;
+        core.set_config(Config {
+            min_chunk_size: cs,
+            max_chunk_size: cs,
+            ..Config::default()
+        });
+        core.on_peer_joined(
+            Keypair::generate().device_id(),
+            &Keypair::generate().public_key().clone(),
+        );
+        let transfer_id =
+            match core.on_incoming_request("http://example.com/f", Some((0, 8 * cs - 1))) {
+                Action::Accelerate { transfer_id, .. } => transfer_id,
+                Action::Fallback => panic!("expected Accelerate"),
+            };
+        let starts = |chunks: Vec<ChunkId>| chunks.iter().map(|c| c.start / cs).collect::<Vec<_>>();
+        // The assigned self chunk is released and handed out again, first, with the next unstarted ones.
+        let first = starts(core.next_self_chunks(transfer_id, 3));
+        assert_eq!(first.len(), 3);
+        assert!(first.windows(2).all(|w| w[0] < w[1]));
+        assert_eq!(starts(core.next_self_chunks(transfer_id, 3)), first);
+        assert!(core.next_self_chunks([9u8; 16], 3).is_empty());
+    }
+
+    #[test]
+    fn cached_chunks_answer_peer_requests_and_repeat_fetches_at_absolute_offsets() {
+        let mut core = PeaPodCore::with_keypair(Keypair::generate());
+        let cs = crate::chunk::DEFAULT_CHUNK_SIZE;
+        core.set_config(Config {
+            min_chunk_size: cs,
+            max_chunk_size: cs,
+            ..Config::default()
+        });
+        core.set_chunk_cache(Some(ChunkCache::new(16 * cs as usize)));
+        let peer = Keypair::generate().device_id();
+        core.on_peer_joined(peer, &Keypair::generate().public_key().clone());
+        let url = "http://example.com/f";
+        let base = 10 * cs;
+        let body: Vec<u8> = (0..4 * cs).map(|i| (i % 251) as u8).collect();
+        let chunk = |i: u64| body[(i * cs) as usize..((i + 1) * cs) as usize].to_vec();
+        let request = |core: &mut PeaPodCore| match core
+            .on_incoming_request(url, Some((base, base + 4 * cs - 1)))
+        {
+            Action::Accelerate { transfer_id, .. } => transfer_id,
+            Action::Fallback => panic!("expected Accelerate"),
+        };
+        // The peer answers with absolute offsets; self's chunks count from the range start.
+        let tid = request(&mut core);
+        for i in 0..2 {
+            let data = Message::ChunkData {
+                transfer_id: tid,
+                start: base + i * cs,
+                end: base + (i + 1) * cs,
+                hash: integrity::hash_chunk(&chunk(i)),
+                payload: chunk(i),
+            };
+            let frame = wire::encode_frame(&data).unwrap();
+            assert!(core.on_message_received(peer, &frame).unwrap().1.is_none());
+        }
+        assert!(core
+            .on_verified_chunk_received(tid, 2 * cs, 3 * cs, &chunk(2))
+            .unwrap()
+            .is_none());
+        let done = core.on_verified_chunk_received(tid, 3 * cs, 4 * cs, &chunk(3));
+        assert_eq!(done.unwrap().unwrap(), body);
+        assert_eq!(core.chunk_cache().unwrap().stats().entries, 4);
+
+        // Another device's request for a cached range is answered without the host.
+        let req = chunk::chunk_request_message(
+            ChunkId {
+                transfer_id: [7u8; 16],
+                start: base + cs,
+                end: base + 2 * cs,
+            },
+            Some(url.to_string()),
+        );
+        let (actions, _) = core
+            .on_message_received(peer, &wire::encode_frame(&req).unwrap())
+            .unwrap();
+        let OutboundAction::SendMessage(to, frame) = &actions[0];
+        assert_eq!(*to, peer);
+        match wire::decode_frame(frame).unwrap().0 {
+            Message::ChunkData { start, payload, .. } => {
+                assert_eq!((start, payload), (base + cs, chunk(1)))
+            }
+            other => panic!("expected ChunkData, got {:?}", other),
+        }
+
+        // A repeat of the same range completes from the cache alone.
+        let again = request(&mut core);
+        let results: Vec<_> = (0..4)
+            .map(|i| core.receive_cached_chunk(again, i * cs, (i + 1) * cs))
+            .collect();
+        assert!(results[..3].iter().all(|r| matches!(r, Some(Ok(None)))));
+        assert!(matches!(&results[3], Some(Ok(Some(b))) if *b == body));
+        assert!(core.receive_cached_chunk(again, 0, cs).is_none());
+    }
+
+    #[test]
+    fn upload_parts_are_relayed_by_a_peer_and_refused_parts_reassigned() {
+        let mut up = PeaPodCore::with_keypair(Keypair::generate());
+        let mut relay = PeaPodCore::with_keypair(Keypair::generate());
+        let cs = crate::chunk::DEFAULT_CHUNK_SIZE;
+        up.set_config(Config {
+            min_chunk_size: cs,
+            max_chunk_size: cs,
+            ..Config::default()
+        });
+        let (self_id, relay_id) = (up.device_id(), relay.device_id());
+        up.on_peer_joined(relay_id, &Keypair::generate().public_key().clone());
+        let body: Vec<u8> = (0..6 * cs).map(|i| i as u8).collect();
+        let (tid, mut parts) = match up.on_upload_request("http://example.com/put", 6 * cs) {
+            Action::Accelerate {
+                transfer_id,
+                assignment,
+                ..
+            } => (transfer_id, assignment),
+            Action::Fallback => panic!("expected Accelerate"),
+        };
+        assert!(
+            parts.iter().any(|(_, w)| *w == self_id) && parts.iter().any(|(_, w)| *w == relay_id)
+        );
+        let mut relayed = 0;
+        let mut refused_once = false;
+        while let Some((c, worker)) = parts.pop() {
+            let payload = &body[c.start as usize..c.end as usize];
+            if worker == self_id {
+                assert!(up.on_upload_part_done(tid, c.start, c.end, true));
+            } else {
+                let mut frame = up.upload_part_frame(tid, c.start, c.end, payload).unwrap();
+                if !refused_once {
+                    // A part that fails its hash: the relay refuses it and the part goes back in the pool.
+                    refused_once = true;
+                    frame = wire::encode_frame(&Message::UploadPart {
+                        transfer_id: tid,
+                        start: c.start,
+                        end: c.end,
+                        total_length: 6 * cs,
+                        url: "http://example.com/put".into(),
+                        hash: [0; 32],
+                        payload: payload.to_vec(),
+                    })
+                    .unwrap();
+                }
+                let before = up.upload_events();
+                let (acks, _) = relay.on_message_received(self_id, &frame).unwrap();
+                let acks = match relay.take_upload_job() {
+                    Some(job) => {
+                        assert_eq!(
+                            (job.from, job.url.as_str()),
+                            (self_id, "http://example.com/put")
+                        );
+                        assert_eq!(
+                            (job.total_length, job.payload.as_slice()),
+                            (6 * cs, payload)
+                        );
+                        relayed += 1;
+                        upload_ack(job.from, job.transfer_id, job.start, job.end, true)
+                    }
+                    None => acks,
+                };
+                for OutboundAction::SendMessage(to, ack) in acks {
+                    assert_eq!(to, self_id);
+                    up.on_message_received(relay_id, &ack).unwrap();
+                }
+                assert_ne!(up.upload_events(), before);
+            }
+            parts.extend(up.next_upload_parts(tid));
+        }
+        let st = up.upload_status(tid).unwrap();
+        assert_eq!(
+            (st.chunks_received, st.chunks_total, st.received_bytes),
+            (6, 6, 6 * cs)
+        );
+        assert!(refused_once && relayed > 0);
+        assert!(up.finish_upload(tid));
+        assert!(up.upload_status(tid).is_none());
+    }
+
+    #[test]
+    fn upload_parts_of_a_lost_peer_go_back_to_the_pool() {
+        let mut core = PeaPodCore::with_keypair(Keypair::generate());
+        let cs = crate::chunk::DEFAULT_CHUNK_SIZE;
+        core.set_config(Config {
+            min_chunk_size: cs,
+            max_chunk_size: cs,
+            ..Config::default()
+        });
+        let (self_id, peer_id) = (core.device_id(), Keypair::generate().device_id());
+        assert!(matches!(
+            core.on_upload_request("http://example.com/put", 6 * cs),
+            Action::Fallback
+        ));
+        core.on_peer_joined(peer_id, &Keypair::generate().public_key().clone());
+        let (tid, assignment) = match core.on_upload_request("http://example.com/put", 6 * cs) {
+            Action::Accelerate {
+                transfer_id,
+                assignment,
+                ..
+            } => (transfer_id, assignment),
+            Action::Fallback => panic!("expected Accelerate"),
+        };
+        assert_eq!(core.tick_interval_ms(), TICK_ACTIVE_MS);
+        let (mine, held): (Vec<_>, Vec<_>) =
+            assignment.into_iter().partition(|(_, w)| *w == self_id);
+        core.on_peer_left(peer_id);
+        for (c, _) in mine {
+            core.on_upload_part_done(tid, c.start, c.end, true);
+        }
+        // Self now has room again and the pool starts with the lost peer's parts.
+        let next = core.next_upload_parts(tid);
+        assert!(next.iter().all(|(_, w)| *w == self_id));
+        assert!(held.iter().all(|h| next.iter().any(|n| n.0 == h.0)));
+    }
+
+    #[test]
+    fn tick_at_times_out_by_clock_and_rate_limits_heartbeats() {
+        let mut core = PeaPodCore::with_keypair(Keypair::generate());
+        let peer_id = Keypair::generate().device_id();
+        core.on_peer_joined(peer_id, &Keypair::generate().public_key().clone());
+        assert_eq!(core.tick_interval_ms(), TICK_IDLE_MS);
+        // Host clock starts far from zero; the peer joined at core clock 0.
+        let base = 1_000_000u64;
+        assert_eq!(core.tick_at(base).len(), 1);
+        assert!(core.tick_at(base + 250).is_empty());
+        assert_eq!(core.tick_at(base + 1000).len(), 1);
+        core.on_heartbeat_received(peer_id);
+        let _ = core.tick_at(base + 1000 + HEARTBEAT_TIMEOUT_MS);
+        assert_eq!(core.peers, vec![peer_id]);
+        let _ = core.tick_at(base + 1001 + HEARTBEAT_TIMEOUT_MS);
+        assert!(core.peers.is_empty());
+        assert_eq!(core.tick_interval_ms(), TICK_ALONE_MS);
+    }
 }
@@ -1,14 +1,142 @@
 //! C ABI for linking pea-core as a static library from Android (NDK) or other C/C++ hosts.
 //! JNI in pea-android calls these from C (pea_jni.c).
 
+use std::cell::RefCell;
+use std::collections::HashMap;
 use std::ffi::c_void;
 use std::os::raw::c_int;
 use std::slice;
+use std::sync::{Arc, Condvar, Mutex, MutexGuard, PoisonError};
+use std::time::Duration;
 
-use crate::identity::{decrypt_wire, encrypt_wire, DeviceId, PublicKey};
+use crate::identity::{
+    decrypt_wire, derive_session_key, encrypt_wire, DeviceId, Keypair, PublicKey, WireCipher,
+    WIRE_TAG_SIZE,
+};
+use crate::integrity::{self, ChunkVerifier};
 use crate::protocol::{Message, PROTOCOL_VERSION};
-use crate::wire::decode_frame;
-use crate::{Action, PeaPodCore};
+use crate::stats::{self, CoreStats};
+use crate::trace::{self, TraceHooks};
+use crate::wire::{self, decode_frame};
+use crate::{
+    check_messages, core, Action, ChunkCache, ChunkId, ChunkSink, Config, HostArena, PeaPodCore,
+    SinkWriter,
+};
+
+/// Every function that writes out_buf returns -n when out_buf is NULL or shorter than the n bytes its output
+/// needs (n is at least NEED_MIN, so -1 stays "error" and -2 is free for host codes). Output that comes from a state
+/// change (actions, a completed body, a new transfer) is kept for the calling thread: fetch it with
+/// pea_core_take_output on the same thread before its next such call. Pure functions (frames, crypto) just need calling again with a big enough buffer.
+pub const NEED_MIN: usize = 3;
+
+/// Return code for "out_buf too small, `need` bytes required".
+fn need_code(need: usize) -> c_int {
+    -(need.clamp(NEED_MIN, c_int::MAX as usize) as c_int)
+}
+
+/// What a pea_core handle points to. The handle may be used from several threads at once (transport, discovery,
+/// tick and proxy threads): the core is behind a mutex held only for the state change itself (frames are decoded,
+/// chunks hashed, sinks written and output copied outside it), and the identity is immutable, so its calls take no
+/// lock.
+struct FfiCore {
+    keypair: Arc<Keypair>,
+    core: Mutex<PeaPodCore>,
+    /// Writers of the transfers given a sink, until the host cancels the transfer or clears the sink; a completed
+    /// transfer's writer may still be writing its last runs.
+    sinks: Mutex<HashMap<[u8; 16], Arc<SinkWriter>>>,
+    /// Signalled after every call that can move the core's upload_events (pea_core_wait_upload_event).
+    upload_cv: Condvar,
+    /// The core's counters, read by pea_core_stats without the lock.
+    stats: Arc<CoreStats>,
+}
+
+thread_local! {
+    /// Output this thread's last call kept back for pea_core_take_output, with the handle it came from. Per thread,
+    /// so concurrent callers never collect each other's output.
+    static PENDING: RefCell<(usize, Vec<u8>)> = const { RefCell::new((0, Vec::new())) };
+}
+
+fn ffi_core<'a>(h: *mut c_void) -> &'a FfiCore {
+    unsafe { &*(h as *const FfiCore) }
+}
+
+/// Lock the handle's core. A panic cannot unwind out of an extern "C" fn, so a poisoned lock is never observed
+/// by a caller that continues; recover the guard rather than fail every later call.
+fn lock_core<'a>(h: *mut c_void) -> MutexGuard<'a, PeaPodCore> {
+    ffi_core(h)
+        .core
+        .lock()
+        .unwrap_or_else(PoisonError::into_inner)
+}
+
+/// Write what a call queued for streamed transfers, after the core lock is released, so a client that reads
+/// slowly holds up only its own transfer. A transfer whose sink failed is dropped; returns their ids.
+fn deliver(h: *mut c_void, writers: Vec<Arc<SinkWriter>>) -> Vec<[u8; 16]> {
+    let mut failed = Vec::new();
+    for w in writers {
+        if !w.deliver() {
+            lock_core(h).cancel_transfer(w.transfer_id());
+            failed.push(w.transfer_id());
+        }
+    }
+    failed
+}
+
+/// Take the handle's writer for a transfer, if it was given a sink.
+fn take_sink(h: *mut c_void, tid: [u8; 16]) -> Option<Arc<SinkWriter>> {
+    ffi_core(h)
+        .sinks
+        .lock()
+        .unwrap_or_else(PoisonError::into_inner)
+        .remove(&tid)
+}
+
+/// Wake threads waiting in pea_core_wait_upload_event so they recheck the counter.
+fn notify_upload(h: *mut c_void) {
+    ffi_core(h).upload_cv.notify_all();
+}
+
+/// Run f on this thread's kept output for h (dropping any left over from another handle).
+fn with_pending<R>(h: *mut c_void, f: impl FnOnce(&mut Vec<u8>) -> R) -> R {
+    PENDING.with(|p| {
+        let mut p = p.borrow_mut();
+        if p.0 != h as usize {
+            *p = (h as usize, Vec::new());
+        }
+        f(&mut p.1)
+    })
+}
+
+/// Write `need` bytes via `fill` to out_buf and return need; when out_buf is NULL or short, fill the handle's
+/// pending output instead; either way output not yet taken is dropped and return need_code(need).
+fn emit(
+    pending: &mut Vec<u8>,
+    need: usize,
+    out_buf: *mut u8,
+    out_buf_len: usize,
+    fill: impl FnOnce(&mut [u8]),
+) -> c_int {
+    if !out_buf.is_null() && out_buf_len >= need {
+        if !pending.is_empty() {
+            *pending = Vec::new();
+        }
+        fill(unsafe { slice::from_raw_parts_mut(out_buf, need) });
+        return need as c_int;
+    }
+    pending.clear();
+    pending.resize(need, 0);
+    fill(pending);
+    need_code(need)
+}
+
+/// Copy `bytes` to out_buf for a pure function: bytes written, or need_code when out_buf is NULL or short.
+fn copy_out(bytes: &[u8], out_buf: *mut u8, out_buf_len: usize) -> c_int {
+    if out_buf.is_null() || out_buf_len < bytes.len() {
+        return need_code(bytes.len());
+    }
+    unsafe { out_buf.copy_from_nonoverlapping(bytes.as_ptr(), bytes.len()) };
+    bytes.len() as c_int
+}
 
 /// Returns the current protocol version. Used so the staticlib exports a C symbol and is linkable.
 #[no_mangle]
@@ -19,8 +147,16 @@ pub extern "C" fn pea_core_version() -> u8 {
 /// Create a new core instance. Returns opaque handle or null on failure.
 #[no_mangle]
 pub extern "C" fn pea_core_create() -> *mut c_void {
-    let core = PeaPodCore::new();
-    Box::into_raw(Box::new(core)) as *mut c_void
+    let keypair = Arc::new(Keypair::generate());
+    let core = PeaPodCore::with_keypair_arc(keypair.clone());
+    let handle = FfiCore {
+        keypair,
+        stats: core.stats().clone(),
+        core: Mutex::new(core),
+        sinks: Mutex::new(HashMap::new()),
+        upload_cv: Condvar::new(),
+    };
+    Box::into_raw(Box::new(handle)) as *mut c_void
 }
 
 /// Destroy core instance. No-op if h is null.
@@ -29,24 +165,135 @@ pub extern "C" fn pea_core_destroy(h: *mut c_void) {
     if h.is_null() {
         return;
     }
-    let _ = unsafe { Box::from_raw(h as *mut PeaPodCore) };
+    with_pending(h, |pending| *pending = Vec::new());
+    let _ = unsafe { Box::from_raw(h as *mut FfiCore) };
+}
+
+/// Snapshot of the hot-path counters (layout in the `stats` module: wire seal/open and chunk hashing for the
+/// process, chunk, integrity and per-peer counters for this core). Takes no lock, so any thread may poll it.
+/// Returns bytes written (at most `stats::MAX_SNAPSHOT_LEN`), need_code when out_buf is short, -1 if h is NULL.
+#[no_mangle]
+pub extern "C" fn pea_core_stats(h: *mut c_void, out_buf: *mut u8, out_buf_len: usize) -> c_int {
+    if h.is_null() {
+        return -1;
+    }
+    copy_out(&ffi_core(h).stats.snapshot(), out_buf, out_buf_len)
+}
+
+/// Send the core's trace sections (see the `trace` module) to hooks, or stop with NULL. Process-wide, for every
+/// handle. hooks must stay valid for the rest of the process (e.g. a static struct): sections opened through it
+/// may still end through it after it is replaced.
+#[no_mangle]
+pub extern "C" fn pea_core_set_trace_hooks(hooks: *const TraceHooks) {
+    trace::set_hooks(unsafe { hooks.as_ref() });
+}
+
+/// Chunk sizing configuration for `pea_core_set_config`; a 0 field keeps its default.
+#[repr(C)]
+pub struct PeaConfig {
+    pub min_chunk_size: u64,
+    pub max_chunk_size: u64,
+    pub chunks_per_worker: u32,
+    pub min_chunk_rtts: u32,
+}
+
+/// Set the core's configuration (applies to transfers started afterwards). Returns 0, or -1 if h or cfg is null.
+#[no_mangle]
+pub extern "C" fn pea_core_set_config(h: *mut c_void, cfg: *const PeaConfig) -> c_int {
+    if h.is_null() || cfg.is_null() {
+        return -1;
+    }
+    let cfg = unsafe { &*cfg };
+    let d = Config::default();
+    let or = |v: u64, default: u64| if v == 0 { default } else { v };
+    lock_core(h).set_config(Config {
+        min_chunk_size: or(cfg.min_chunk_size, d.min_chunk_size),
+        max_chunk_size: or(cfg.max_chunk_size, d.max_chunk_size),
+        chunks_per_worker: or(cfg.chunks_per_worker as u64, d.chunks_per_worker as u64) as u32,
+        min_chunk_rtts: or(cfg.min_chunk_rtts as u64, d.min_chunk_rtts as u64) as u32,
+    });
+    0
+}
+
+/// Called with ctx once nothing uses a spill area any more (the host may then unmap it): the transfer ended and its
+/// sink was let go. May run on whichever thread let go of it last.
+pub type PeaReleaseFn = extern "C" fn(ctx: *mut c_void);
+
+/// Host memory (e.g. an mmap'd file) lent to the core: chunk cache payloads or a transfer's spill area.
+struct FfiArena {
+    base: *mut u8,
+    len: usize,
+    release: Option<(PeaReleaseFn, *mut c_void)>,
+}
+
+// The host keeps the memory mapped until it is released (or, for the cache, replaced); access is under the core's
+// lock, or for a spill area by the transfer's writer at ranges the core is done with.
+unsafe impl Send for FfiArena {}
+
+impl HostArena for FfiArena {
+    fn bytes(&mut self) -> &mut [u8] {
+        unsafe { slice::from_raw_parts_mut(self.base, self.len) }
+    }
+}
+
+impl Drop for FfiArena {
+    fn drop(&mut self) {
+        if let Some((release, ctx)) = self.release {
+            release(ctx);
+        }
+    }
+}
+
+/// Keep verified chunks for repeat requests (this device's and peers' ChunkRequests), up to budget_bytes. With
+/// arena set, payloads are stored in arena[0, arena_len) (e.g. an mmap'd file): it must stay valid until the cache
+/// is replaced by another call or the core is destroyed. arena NULL keeps them on the heap; budget_bytes 0 turns
+/// the cache off. Replaces (and empties) any previous cache. Returns 0, or -1 if h is null.
+#[no_mangle]
+pub extern "C" fn pea_core_set_chunk_cache(
+    h: *mut c_void,
+    budget_bytes: u64,
+    arena: *mut u8,
+    arena_len: usize,
+) -> c_int {
+    if h.is_null() {
+        return -1;
+    }
+    let budget = budget_bytes.min(usize::MAX as u64) as usize;
+    let cache = match (budget, arena.is_null()) {
+        (0, _) => None,
+        (_, true) => Some(ChunkCache::new(budget)),
+        (_, false) => Some(ChunkCache::with_arena(
+            Box::new(FfiArena {
+                base: arena,
+                len: arena_len,
+                release: None,
+            }),
+            budget,
+        )),
+    };
+    // The old cache (and its hold on the old arena) is dropped under the lock, so the host may unmap after return.
+    lock_core(h).set_chunk_cache(cache);
+    0
 }
 
-/// Get this device's ID (16 bytes). Returns 0 on success, -1 if h null or out_buf too small.
+/// Get this device's ID (16 bytes). Returns 0 on success, -1 if h null, -16 if out_buf is NULL or too small.
 #[no_mangle]
 pub extern "C" fn pea_core_device_id(h: *mut c_void, out_buf: *mut u8, out_len: usize) -> c_int {
-    if h.is_null() || out_buf.is_null() || out_len < 16 {
+    if h.is_null() {
         return -1;
     }
-    let core = unsafe { &*(h as *const PeaPodCore) };
-    let id = core.device_id();
+    if out_buf.is_null() || out_len < 16 {
+        return need_code(16);
+    }
+    let id = ffi_core(h).keypair.device_id();
     unsafe {
         out_buf.copy_from_nonoverlapping(id.as_bytes().as_ptr(), 16);
     }
     0
 }
 
-/// Build discovery beacon frame for host to send (UDP). Fills out_buf with length-prefix + bincode Beacon. Returns bytes written, or -1 on error.
+/// Build discovery beacon frame for host to send (UDP). Fills out_buf with length-prefix + bincode Beacon. Returns bytes written,
+/// -1 on error, or -needed when out_buf is NULL or too small.
 #[no_mangle]
 pub extern "C" fn pea_core_beacon_frame(
     h: *mut c_void,
@@ -54,24 +301,16 @@ pub extern "C" fn pea_core_beacon_frame(
     out_buf: *mut u8,
     out_buf_len: usize,
 ) -> c_int {
-    if h.is_null() || out_buf.is_null() {
-        return -1;
-    }
-    let core = unsafe { &*(h as *const PeaPodCore) };
-    let frame = match core.beacon_frame(listen_port) {
-        Ok(f) => f,
-        Err(_) => return -1,
-    };
-    if frame.len() > out_buf_len {
+    if h.is_null() {
         return -1;
     }
-    unsafe {
-        out_buf.copy_from_nonoverlapping(frame.as_ptr(), frame.len());
+    match core::beacon_frame(&ffi_core(h).keypair, listen_port) {
+        Ok(frame) => copy_out(&frame, out_buf, out_buf_len),
+        Err(_) => -1,
     }
-    frame.len() as c_int
 }
 
-/// Build DiscoveryResponse frame (send to beacon sender). Returns bytes written, or -1 on error.
+/// Build DiscoveryResponse frame (send to beacon sender). Returns bytes written, -1 on error, or -needed as for pea_core_beacon_frame.
 #[no_mangle]
 pub extern "C" fn pea_core_discovery_response_frame(
     h: *mut c_void,
@@ -79,21 +318,13 @@ pub extern "C" fn pea_core_discovery_response_frame(
     out_buf: *mut u8,
     out_buf_len: usize,
 ) -> c_int {
-    if h.is_null() || out_buf.is_null() {
-        return -1;
-    }
-    let core = unsafe { &*(h as *const PeaPodCore) };
-    let frame = match core.discovery_response_frame(listen_port) {
-        Ok(f) => f,
-        Err(_) => return -1,
-    };
-    if frame.len() > out_buf_len {
+    if h.is_null() {
         return -1;
     }
-    unsafe {
-        out_buf.copy_from_nonoverlapping(frame.as_ptr(), frame.len());
+    match core::discovery_response_frame(&ffi_core(h).keypair, listen_port) {
+        Ok(frame) => copy_out(&frame, out_buf, out_buf_len),
+        Err(_) => -1,
     }
-    frame.len() as c_int
 }
 
 /// Decode a discovery frame (Beacon or DiscoveryResponse). Fills device_id (16), public_key (32), listen_port. Returns 0 on success, -1 on error.
@@ -146,18 +377,21 @@ pub extern "C" fn pea_core_decode_discovery_frame(
 
 const HANDSHAKE_SIZE: usize = 1 + 16 + 32;
 
-/// Fill out_buf with handshake bytes (49: version + device_id + public_key). Returns 0 on success, -1 on error.
+/// Fill out_buf with handshake bytes (49: version + device_id + public_key). Returns 0 on success, -1 on error,
+/// -49 if out_buf is NULL or too small.
 #[no_mangle]
 pub extern "C" fn pea_core_handshake_bytes(
     h: *mut c_void,
     out_buf: *mut u8,
     out_buf_len: usize,
 ) -> c_int {
-    if h.is_null() || out_buf.is_null() || out_buf_len < HANDSHAKE_SIZE {
+    if h.is_null() {
         return -1;
     }
-    let core = unsafe { &*(h as *const PeaPodCore) };
-    let bytes = core.handshake_bytes();
+    if out_buf.is_null() || out_buf_len < HANDSHAKE_SIZE {
+        return need_code(HANDSHAKE_SIZE);
+    }
+    let bytes = core::handshake_bytes(&ffi_core(h).keypair);
     unsafe {
         out_buf.copy_from_nonoverlapping(bytes.as_ptr(), HANDSHAKE_SIZE);
     }
@@ -174,19 +408,19 @@ pub extern "C" fn pea_core_session_key(
     if h.is_null() || peer_public_key_32.is_null() || out_session_key_32.is_null() {
         return -1;
     }
-    let core = unsafe { &*(h as *const PeaPodCore) };
     let pk = unsafe { slice::from_raw_parts(peer_public_key_32, 32) };
     let mut arr = [0u8; 32];
     arr.copy_from_slice(pk);
     let peer_public = PublicKey::from_bytes(arr);
-    let key = core.session_key(&peer_public);
+    let key = derive_session_key(&ffi_core(h).keypair.shared_secret(&peer_public));
     unsafe {
         out_session_key_32.copy_from_nonoverlapping(key.as_ptr(), 32);
     }
     0
 }
 
-/// Encrypt plaintext for wire. Output is ciphertext (plain_len + 16 for tag). Returns bytes written, or -1 on error.
+/// Encrypt plaintext for wire. Output is ciphertext (plain_len + 16 for tag). Returns bytes written, -1 on error, or
+/// -(plain_len + 16) when out_buf is NULL or too small.
 #[no_mangle]
 pub extern "C" fn pea_core_encrypt_wire(
     session_key_32: *const u8,
@@ -196,9 +430,12 @@ pub extern "C" fn pea_core_encrypt_wire(
     out_buf: *mut u8,
     out_buf_len: usize,
 ) -> c_int {
-    if session_key_32.is_null() || plain.is_null() || out_buf.is_null() {
+    if session_key_32.is_null() || plain.is_null() {
         return -1;
     }
+    if out_buf.is_null() || out_buf_len < plain_len + WIRE_TAG_SIZE {
+        return need_code(plain_len + WIRE_TAG_SIZE);
+    }
     let key = unsafe { slice::from_raw_parts(session_key_32, 32) };
     if key.len() != 32 {
         return -1;
@@ -206,20 +443,14 @@ pub extern "C" fn pea_core_encrypt_wire(
     let mut key_arr = [0u8; 32];
     key_arr.copy_from_slice(key);
     let plain_slice = unsafe { slice::from_raw_parts(plain, plain_len) };
-    let cipher = match encrypt_wire(&key_arr, nonce, plain_slice) {
-        Ok(c) => c,
-        Err(_) => return -1,
-    };
-    if cipher.len() > out_buf_len {
-        return -1;
-    }
-    unsafe {
-        out_buf.copy_from_nonoverlapping(cipher.as_ptr(), cipher.len());
+    match encrypt_wire(&key_arr, nonce, plain_slice) {
+        Ok(cipher) => copy_out(&cipher, out_buf, out_buf_len),
+        Err(_) => -1,
     }
-    cipher.len() as c_int
 }
 
-/// Decrypt ciphertext from wire. Output is plaintext (cipher_len - 16). Returns bytes written, or -1 on error.
+/// Decrypt ciphertext from wire. Output is plaintext (cipher_len - 16). Returns bytes written, -1 on error, or
+/// -(cipher_len - 16) when out_buf is NULL or too small (checked before decrypting).
 #[no_mangle]
 pub extern "C" fn pea_core_decrypt_wire(
     session_key_32: *const u8,
@@ -229,9 +460,12 @@ pub extern "C" fn pea_core_decrypt_wire(
     out_buf: *mut u8,
     out_buf_len: usize,
 ) -> c_int {
-    if session_key_32.is_null() || cipher.is_null() || out_buf.is_null() {
+    if session_key_32.is_null() || cipher.is_null() || cipher_len < WIRE_TAG_SIZE {
         return -1;
     }
+    if out_buf.is_null() || out_buf_len < cipher_len - WIRE_TAG_SIZE {
+        return need_code(cipher_len - WIRE_TAG_SIZE);
+    }
     let key = unsafe { slice::from_raw_parts(session_key_32, 32) };
     if key.len() != 32 {
         return -1;
@@ -239,22 +473,109 @@ pub extern "C" fn pea_core_decrypt_wire(
     let mut key_arr = [0u8; 32];
     key_arr.copy_from_slice(key);
     let cipher_slice = unsafe { slice::from_raw_parts(cipher, cipher_len) };
-    let plain = match decrypt_wire(&key_arr, nonce, cipher_slice) {
-        Ok(p) => p,
-        Err(_) => return -1,
+    match decrypt_wire(&key_arr, nonce, cipher_slice) {
+        Ok(plain) => copy_out(&plain, out_buf, out_buf_len),
+        Err(_) => -1,
+    }
+}
+
+/// Create a per-connection wire cipher from a 32-byte session key. Seal/open nonces start at 0.
+/// Returns opaque handle (free with pea_core_cipher_destroy) or null on error.
+#[no_mangle]
+pub extern "C" fn pea_core_cipher_create(session_key_32: *const u8) -> *mut c_void {
+    if session_key_32.is_null() {
+        return std::ptr::null_mut();
+    }
+    let mut key = [0u8; 32];
+    key.copy_from_slice(unsafe { slice::from_raw_parts(session_key_32, 32) });
+    let cipher = WireCipher::new(&key);
+    key.fill(0);
+    match cipher {
+        Ok(c) => Box::into_raw(Box::new(c)) as *mut c_void,
+        Err(_) => std::ptr::null_mut(),
+    }
+}
+
+/// Destroy a wire cipher. No-op if c is null.
+#[no_mangle]
+pub extern "C" fn pea_core_cipher_destroy(c: *mut c_void) {
+    if c.is_null() {
+        return;
+    }
+    let _ = unsafe { Box::from_raw(c as *mut WireCipher) };
+}
+
+/// Encrypt with the cipher's next seal nonce. out_buf needs plain_len + 16 bytes and may equal plain (in place).
+/// Returns bytes written, -1 on error, or -(plain_len + 16) when out_buf is NULL or too small (no nonce consumed).
+#[no_mangle]
+pub extern "C" fn pea_core_cipher_seal(
+    c: *mut c_void,
+    plain: *const u8,
+    plain_len: usize,
+    out_buf: *mut u8,
+    out_buf_len: usize,
+) -> c_int {
+    if c.is_null() || plain.is_null() {
+        return -1;
+    }
+    if out_buf.is_null() || out_buf_len < plain_len + WIRE_TAG_SIZE {
+        return need_code(plain_len + WIRE_TAG_SIZE);
+    }
+    let cipher = unsafe { &*(c as *const WireCipher) };
+    let buf = unsafe {
+        std::ptr::copy(plain, out_buf, plain_len);
+        slice::from_raw_parts_mut(out_buf, plain_len + WIRE_TAG_SIZE)
     };
-    if plain.len() > out_buf_len {
+    match cipher.seal_in_place(buf, plain_len) {
+        Ok(n) => n as c_int,
+        Err(_) => -1,
+    }
+}
+
+/// Decrypt with the cipher's next open nonce (advanced only on success). out_buf needs cipher_len - 16 bytes
+/// and may equal cipher (in place). Returns plaintext bytes written, -1 on error (bad tag, short input), or
+/// -(cipher_len - 16) when out_buf is NULL or too small.
+#[no_mangle]
+pub extern "C" fn pea_core_cipher_open(
+    c: *mut c_void,
+    cipher: *const u8,
+    cipher_len: usize,
+    out_buf: *mut u8,
+    out_buf_len: usize,
+) -> c_int {
+    if c.is_null() || cipher.is_null() || cipher_len < WIRE_TAG_SIZE {
         return -1;
     }
-    unsafe {
-        out_buf.copy_from_nonoverlapping(plain.as_ptr(), plain.len());
+    let plain_len = cipher_len - WIRE_TAG_SIZE;
+    if out_buf.is_null() || out_buf_len < plain_len {
+        return need_code(plain_len);
+    }
+    let wc = unsafe { &*(c as *const WireCipher) };
+    // Verify and decrypt in a scratch copy when out_buf is a distinct, tag-less buffer; in place otherwise.
+    if std::ptr::eq(cipher, out_buf) || out_buf_len >= cipher_len {
+        let buf = unsafe {
+            std::ptr::copy(cipher, out_buf, cipher_len);
+            slice::from_raw_parts_mut(out_buf, cipher_len)
+        };
+        return match wc.open_in_place(buf) {
+            Ok(n) => n as c_int,
+            Err(_) => -1,
+        };
+    }
+    let mut scratch = unsafe { slice::from_raw_parts(cipher, cipher_len) }.to_vec();
+    match wc.open_in_place(&mut scratch) {
+        Ok(n) => {
+            unsafe { out_buf.copy_from_nonoverlapping(scratch.as_ptr(), n) };
+            n as c_int
+        }
+        Err(_) => -1,
     }
-    plain.len() as c_int
 }
 
 /// On incoming request. url_len is byte length of url (UTF-8). range_end > range_start for a valid range; else treated as no range.
 /// out_buf when Accelerate: 16 transfer_id, 8 total_length (LE), 4 num (LE), then num*(16 device_id, 8 start LE, 8 end LE).
-/// Returns: 0 = Fallback, 1 = Accelerate (out_buf filled), -1 = error (e.g. out_buf too small).
+/// Returns: 0 = Fallback, 1 = Accelerate (out_buf filled), -1 = error, -needed = Accelerate but out_buf is NULL or
+/// too small (the result is kept for pea_core_take_output; the transfer has started either way).
 #[no_mangle]
 pub extern "C" fn pea_core_on_request(
     h: *mut c_void,
@@ -268,7 +589,6 @@ pub extern "C" fn pea_core_on_request(
     if h.is_null() || url.is_null() {
         return -1;
     }
-    let core = unsafe { &mut *(h as *mut PeaPodCore) };
     let url_slice = unsafe { slice::from_raw_parts(url, url_len) };
     let url_str = match std::str::from_utf8(url_slice) {
         Ok(s) => s,
@@ -279,7 +599,12 @@ pub extern "C" fn pea_core_on_request(
     } else {
         None
     };
-    let action = core.on_incoming_request(url_str, range);
+    let action = lock_core(h).on_incoming_request(url_str, range);
+    write_action(h, action, out_buf, out_buf_len)
+}
+
+/// Write an Action in the pea_core_on_request layout; returns 0 (Fallback), 1 or -needed.
+fn write_action(h: *mut c_void, action: Action, out_buf: *mut u8, out_buf_len: usize) -> c_int {
     match action {
         Action::Fallback => 0,
         Action::Accelerate {
@@ -287,26 +612,37 @@ pub extern "C" fn pea_core_on_request(
             total_length,
             assignment,
         } => {
-            let need = 16 + 8 + 4 + assignment.len() * (16 + 8 + 8);
-            if out_buf.is_null() || out_buf_len < need {
-                return -1;
+            let need = 16 + 8 + 4 + assignment.len() * ASSIGNMENT_RECORD;
+            let r = with_pending(h, |pending| {
+                emit(pending, need, out_buf, out_buf_len, |buf| {
+                    buf[0..16].copy_from_slice(&transfer_id);
+                    buf[16..24].copy_from_slice(&total_length.to_le_bytes());
+                    put_assignment(&assignment, &mut buf[24..]);
+                })
+            });
+            if r < 0 {
+                r
+            } else {
+                1
             }
-            let buf = unsafe { slice::from_raw_parts_mut(out_buf, out_buf_len) };
-            buf[0..16].copy_from_slice(&transfer_id);
-            buf[16..24].copy_from_slice(&total_length.to_le_bytes());
-            let n = assignment.len() as u32;
-            buf[24..28].copy_from_slice(&n.to_le_bytes());
-            for (i, (chunk_id, device_id)) in assignment.iter().enumerate() {
-                let base = 28 + i * 32;
-                buf[base..base + 16].copy_from_slice(device_id.as_bytes());
-                buf[base + 16..base + 24].copy_from_slice(&chunk_id.start.to_le_bytes());
-                buf[base + 24..base + 32].copy_from_slice(&chunk_id.end.to_le_bytes());
-            }
-            1
         }
     }
 }
 
+/// One (16 device_id, 8 start LE, 8 end LE) assignment record.
+const ASSIGNMENT_RECORD: usize = 16 + 8 + 8;
+
+/// Write 4 count (LE) then the assignment records to the front of buf.
+fn put_assignment(assignment: &[(ChunkId, DeviceId)], buf: &mut [u8]) {
+    buf[0..4].copy_from_slice(&(assignment.len() as u32).to_le_bytes());
+    for (i, (chunk_id, device_id)) in assignment.iter().enumerate() {
+        let base = 4 + i * ASSIGNMENT_RECORD;
+        buf[base..base + 16].copy_from_slice(device_id.as_bytes());
+        buf[base + 16..base + 24].copy_from_slice(&chunk_id.start.to_le_bytes());
+        buf[base + 24..base + 32].copy_from_slice(&chunk_id.end.to_le_bytes());
+    }
+}
+
 /// Peer joined. device_id_16 and public_key_32 must be non-null and at least 16 and 32 bytes.
 #[no_mangle]
 pub extern "C" fn pea_core_peer_joined(
@@ -317,7 +653,6 @@ pub extern "C" fn pea_core_peer_joined(
     if h.is_null() || device_id_16.is_null() || public_key_32.is_null() {
         return -1;
     }
-    let core = unsafe { &mut *(h as *mut PeaPodCore) };
     let mut id = [0u8; 16];
     let mut pk = [0u8; 32];
     unsafe {
@@ -326,11 +661,12 @@ pub extern "C" fn pea_core_peer_joined(
     }
     let peer_id = DeviceId::from_bytes(id);
     let public_key = PublicKey::from_bytes(pk);
-    core.on_peer_joined(peer_id, &public_key);
+    lock_core(h).on_peer_joined(peer_id, &public_key);
     0
 }
 
-/// Peer left. Optionally writes outbound actions (e.g. ChunkRequests) to out_buf. Returns bytes written to out_buf, or 0 if none/null.
+/// Peer left. Writes outbound actions (e.g. ChunkRequests for its chunks) to out_buf. Returns bytes written, 0 if
+/// none, -1 on error, or -needed when out_buf is NULL or too small (actions kept for pea_core_take_output).
 #[no_mangle]
 pub extern "C" fn pea_core_peer_left(
     h: *mut c_void,
@@ -341,37 +677,50 @@ pub extern "C" fn pea_core_peer_left(
     if h.is_null() || device_id_16.is_null() {
         return -1;
     }
-    let core = unsafe { &mut *(h as *mut PeaPodCore) };
     let mut id = [0u8; 16];
     unsafe {
         id.copy_from_slice(slice::from_raw_parts(device_id_16, 16));
     }
-    let actions = core.on_peer_left(DeviceId::from_bytes(id));
-    if actions.is_empty() || out_buf.is_null() {
+    let actions = lock_core(h).on_peer_left(DeviceId::from_bytes(id));
+    notify_upload(h);
+    if actions.is_empty() {
         return 0;
     }
-    write_outbound_actions(&actions, out_buf, out_buf_len)
+    write_outbound_actions(h, &actions, out_buf, out_buf_len)
 }
 
 /// Serialize outbound actions to out_buf: 4 bytes count (LE), then each (16 peer_id, 4 len LE, payload).
-/// Returns number of bytes written, or -1 on error.
+/// Returns number of bytes written, or -needed (actions kept in pending) when out_buf is NULL or too small.
 fn write_outbound_actions(
+    h: *mut c_void,
     actions: &[crate::OutboundAction],
     out_buf: *mut u8,
     out_buf_len: usize,
 ) -> c_int {
-    if out_buf.is_null() {
-        return -1;
-    }
+    with_pending(h, |pending| {
+        emit(
+            pending,
+            outbound_actions_len(actions),
+            out_buf,
+            out_buf_len,
+            |buf| {
+                put_outbound_actions(actions, buf);
+            },
+        )
+    })
+}
+
+fn outbound_actions_len(actions: &[crate::OutboundAction]) -> usize {
     let mut need = 4;
     for a in actions {
         let crate::OutboundAction::SendMessage(_, ref bytes) = a;
         need += 16 + 4 + bytes.len();
     }
-    if out_buf_len < need {
-        return -1;
-    }
-    let buf = unsafe { slice::from_raw_parts_mut(out_buf, out_buf_len) };
+    need
+}
+
+/// Write the actions layout to the front of buf (at least outbound_actions_len bytes); returns bytes written.
+fn put_outbound_actions(actions: &[crate::OutboundAction], buf: &mut [u8]) -> usize {
     buf[0..4].copy_from_slice(&(actions.len() as u32).to_le_bytes());
     let mut off = 4;
     for a in actions {
@@ -384,12 +733,13 @@ fn write_outbound_actions(
         buf[off..off + bytes.len()].copy_from_slice(bytes);
         off += bytes.len();
     }
-    off as c_int
+    off
 }
 
 /// On message received from peer. Serializes outbound actions (and optional completed body) to out_buf.
 /// Layout: 4 bytes completed_body_len (LE), 0 or body_len bytes of body, then same as write_outbound_actions.
-/// If completed_body_len > 0, the transfer is complete and body follows. Returns total bytes written, -1 on error.
+/// If completed_body_len > 0, the transfer is complete and body follows. Returns total bytes written, -1 on error, or
+/// -needed when out_buf is NULL or too small (output kept for pea_core_take_output).
 #[no_mangle]
 pub extern "C" fn pea_core_on_message_received(
     h: *mut c_void,
@@ -402,41 +752,175 @@ pub extern "C" fn pea_core_on_message_received(
     if h.is_null() || peer_id_16.is_null() || msg.is_null() {
         return -1;
     }
-    let core = unsafe { &mut *(h as *mut PeaPodCore) };
     let mut id = [0u8; 16];
     unsafe {
         id.copy_from_slice(slice::from_raw_parts(peer_id_16, 16));
     }
     let peer_id = DeviceId::from_bytes(id);
     let frame = unsafe { slice::from_raw_parts(msg, msg_len) };
-    let (actions, completed) = match core.on_message_received(peer_id, frame) {
-        Ok(x) => x,
-        Err(_) => return -1,
-    };
-    let body_len = completed.as_ref().map(|(_, b)| b.len()).unwrap_or(0);
-    let mut need = 4 + body_len;
-    for a in &actions {
-        let crate::OutboundAction::SendMessage(_, ref bytes) = a;
-        need += 16 + 4 + bytes.len();
+    let checked = check_messages(&[(peer_id, frame)]);
+    if checked.is_empty() {
+        return -1;
     }
-    if out_buf.is_null() || out_buf_len < need {
+    let (actions, completed, writers) = {
+        let mut core = lock_core(h);
+        let (actions, completed) = core.on_checked_messages(checked);
+        (actions, completed, core.take_sink_deliveries())
+    };
+    notify_upload(h);
+    deliver(h, writers);
+    let body = completed
+        .into_iter()
+        .next()
+        .map(|(_, b)| b)
+        .unwrap_or_default();
+    let need = 4 + body.len() + outbound_actions_len(&actions);
+    with_pending(h, |pending| {
+        emit(pending, need, out_buf, out_buf_len, |buf| {
+            buf[0..4].copy_from_slice(&(body.len() as u32).to_le_bytes());
+            buf[4..4 + body.len()].copy_from_slice(&body);
+            put_outbound_actions(&actions, &mut buf[4 + body.len()..]);
+        })
+    })
+}
+
+/// Process a burst of received messages in one call. records holds record_count packed records, each
+/// (16 peer_id, 4 len LE, len frame bytes); frames are handled in order and frames that fail to decode are skipped.
+/// Output: 4 completed count (LE), each (16 transfer_id, 4 len LE, body), then all outbound actions merged in the
+/// write_outbound_actions layout. Returns total bytes written, -1 on malformed records (checked before any state
+/// changes), or -needed when out_buf is NULL or too small (output kept for pea_core_take_output).
+#[no_mangle]
+pub extern "C" fn pea_core_on_messages_received_batch(
+    h: *mut c_void,
+    records: *const u8,
+    records_len: usize,
+    record_count: u32,
+    out_buf: *mut u8,
+    out_buf_len: usize,
+) -> c_int {
+    if h.is_null() || records.is_null() {
         return -1;
     }
-    let buf = unsafe { slice::from_raw_parts_mut(out_buf, out_buf_len) };
-    buf[0..4].copy_from_slice(&(body_len as u32).to_le_bytes());
-    let mut off = 4;
-    if let Some((_, body)) = completed {
-        buf[off..off + body.len()].copy_from_slice(&body);
-        off += body.len();
+    let input = unsafe { slice::from_raw_parts(records, records_len) };
+    // Validate the packing before touching core state so a bad buffer has no side effects.
+    let mut frames = Vec::with_capacity(record_count as usize);
+    let mut off = 0usize;
+    for _ in 0..record_count {
+        if input.len() - off < 16 + 4 {
+            return -1;
+        }
+        let mut id = [0u8; 16];
+        id.copy_from_slice(&input[off..off + 16]);
+        let mut len_bytes = [0u8; 4];
+        len_bytes.copy_from_slice(&input[off + 16..off + 20]);
+        let len = u32::from_le_bytes(len_bytes) as usize;
+        off += 20;
+        if input.len() - off < len {
+            return -1;
+        }
+        frames.push((DeviceId::from_bytes(id), &input[off..off + len]));
+        off += len;
     }
-    let n = write_outbound_actions(&actions, buf[off..].as_mut_ptr(), out_buf_len - off);
-    if n < 0 {
+    let checked = check_messages(&frames);
+    on_checked_batch(h, checked, out_buf, out_buf_len)
+}
+
+/// One received frame for pea_core_on_messages_received_v.
+#[repr(C)]
+pub struct PeaMessageRef {
+    pub peer_id: *const u8,
+    pub frame: *const u8,
+    pub len: usize,
+}
+
+/// Same as pea_core_on_messages_received_batch, but the frames stay where the host decrypted them: msgs points to
+/// msg_count `PeaMessageRef`s (peer_id 16 bytes, frame, len). Lets a receive loop hand over a whole pass without
+/// repacking.
+#[no_mangle]
+pub extern "C" fn pea_core_on_messages_received_v(
+    h: *mut c_void,
+    msgs: *const PeaMessageRef,
+    msg_count: usize,
+    out_buf: *mut u8,
+    out_buf_len: usize,
+) -> c_int {
+    if h.is_null() || (msgs.is_null() && msg_count > 0) {
         return -1;
     }
-    (off as c_int) + n
+    let refs: &[PeaMessageRef] = if msg_count == 0 {
+        &[]
+    } else {
+        unsafe { slice::from_raw_parts(msgs, msg_count) }
+    };
+    let mut frames = Vec::with_capacity(refs.len());
+    for m in refs {
+        if m.peer_id.is_null() || (m.frame.is_null() && m.len > 0) {
+            return -1;
+        }
+        let mut id = [0u8; 16];
+        id.copy_from_slice(unsafe { slice::from_raw_parts(m.peer_id, 16) });
+        let frame: &[u8] = if m.len == 0 {
+            &[]
+        } else {
+            unsafe { slice::from_raw_parts(m.frame, m.len) }
+        };
+        frames.push((DeviceId::from_bytes(id), frame));
+    }
+    let checked = check_messages(&frames);
+    on_checked_batch(h, checked, out_buf, out_buf_len)
+}
+
+/// Apply a checked batch, deliver what it queued for sinks, and write the batch output. A transfer whose sink
+/// failed on its last runs is not reported as completed.
+fn on_checked_batch(
+    h: *mut c_void,
+    checked: Vec<crate::CheckedMessage<'_>>,
+    out_buf: *mut u8,
+    out_buf_len: usize,
+) -> c_int {
+    let (actions, mut completed, writers) = {
+        let mut core = lock_core(h);
+        let (actions, completed) = core.on_checked_messages(checked);
+        (actions, completed, core.take_sink_deliveries())
+    };
+    notify_upload(h);
+    let failed = deliver(h, writers);
+    completed.retain(|(tid, _)| !failed.contains(tid));
+    write_batch_output(h, &actions, &completed, out_buf, out_buf_len)
+}
+
+/// Batch output: 4 completed count, each (16 transfer_id, 4 len, body), then the outbound actions.
+fn write_batch_output(
+    h: *mut c_void,
+    actions: &[crate::OutboundAction],
+    completed: &[([u8; 16], Vec<u8>)],
+    out_buf: *mut u8,
+    out_buf_len: usize,
+) -> c_int {
+    let mut need = 4 + outbound_actions_len(actions);
+    for (_, body) in completed {
+        need += 16 + 4 + body.len();
+    }
+    with_pending(h, |pending| {
+        emit(pending, need, out_buf, out_buf_len, |buf| {
+            buf[0..4].copy_from_slice(&(completed.len() as u32).to_le_bytes());
+            let mut off = 4;
+            for (transfer_id, body) in completed {
+                buf[off..off + 16].copy_from_slice(transfer_id);
+                buf[off + 16..off + 20].copy_from_slice(&(body.len() as u32).to_le_bytes());
+                off += 20;
+                buf[off..off + body.len()].copy_from_slice(body);
+                off += body.len();
+            }
+            put_outbound_actions(actions, &mut buf[off..]);
+        })
+    })
 }
 
-/// On chunk received. Returns 0 = in progress, 1 = complete (reassembled body in out_buf), -1 = error.
+/// On chunk received. Returns 0 = in progress, 1 = complete (reassembled body in out_buf; nothing written when a sink is set), -1 = error,
+/// -needed = complete but out_buf is NULL or too small for the body (kept for pea_core_take_output).
+/// out_buf may be NULL when a sink is set (pea_core_set_transfer_sink). hash_32 may be NULL when the host already
+/// checked the payload (pea_core_chunk_verify_finish returned 1, or it fetched the bytes from origin itself).
 #[no_mangle]
 pub extern "C" fn pea_core_on_chunk_received(
     h: *mut c_void,
@@ -449,22 +933,40 @@ pub extern "C" fn pea_core_on_chunk_received(
     out_buf: *mut u8,
     out_buf_len: usize,
 ) -> c_int {
-    if h.is_null() || transfer_id_16.is_null() || hash_32.is_null() || payload.is_null() {
+    if h.is_null() || transfer_id_16.is_null() || payload.is_null() {
         return -1;
     }
-    let core = unsafe { &mut *(h as *mut PeaPodCore) };
     let mut tid = [0u8; 16];
-    let mut hash = [0u8; 32];
-    unsafe {
-        tid.copy_from_slice(slice::from_raw_parts(transfer_id_16, 16));
-        hash.copy_from_slice(slice::from_raw_parts(hash_32, 32));
+    unsafe { tid.copy_from_slice(slice::from_raw_parts(transfer_id_16, 16)) };
+    let payload = unsafe { slice::from_raw_parts(payload, payload_len) };
+    // Hash before locking; the core then only stores the verified payload.
+    if !hash_32.is_null() {
+        let mut hash = [0u8; 32];
+        hash.copy_from_slice(unsafe { slice::from_raw_parts(hash_32, 32) });
+        if !integrity::verify_chunk(payload, &hash) {
+            // Counted against self as receive_chunk would; under the lock, which claims the stats slots.
+            let _core = lock_core(h);
+            let ffi = ffi_core(h);
+            ffi.stats.integrity_failure(ffi.keypair.device_id());
+            return -1;
+        }
+    }
+    let (received, writers) = {
+        let mut core = lock_core(h);
+        let received = core.on_verified_chunk_received(tid, start, end, payload);
+        (received, core.take_sink_deliveries())
+    };
+    if deliver(h, writers).contains(&tid) {
+        return -1;
     }
-    let payload_vec = unsafe { slice::from_raw_parts(payload, payload_len).to_vec() };
-    match core.on_chunk_received(tid, start, end, hash, payload_vec) {
+    match received {
         Ok(None) => 0,
+        Ok(Some(body)) if body.is_empty() => 1,
         Ok(Some(body)) => {
             if out_buf.is_null() || out_buf_len < body.len() {
-                return -1;
+                let need = body.len();
+                with_pending(h, |pending| *pending = body);
+                return need_code(need);
             }
             unsafe {
                 out_buf.copy_from_nonoverlapping(body.as_ptr(), body.len());
@@ -475,16 +977,889 @@ pub extern "C" fn pea_core_on_chunk_received(
     }
 }
 
-/// Tick. Writes serialized outbound actions to out_buf. Returns bytes written, 0 if none, -1 on error.
+/// Deliver self's chunk [start, end) from the chunk cache instead of fetching it. Returns 2 when it is not cached
+/// (fetch it as usual); otherwise as pea_core_on_chunk_received: 0 = in progress, 1 = complete, -1 = error, or
+/// -needed.
 #[no_mangle]
-pub extern "C" fn pea_core_tick(h: *mut c_void, out_buf: *mut u8, out_buf_len: usize) -> c_int {
-    if h.is_null() {
+pub extern "C" fn pea_core_receive_cached_chunk(
+    h: *mut c_void,
+    transfer_id_16: *const u8,
+    start: u64,
+    end: u64,
+    out_buf: *mut u8,
+    out_buf_len: usize,
+) -> c_int {
+    if h.is_null() || transfer_id_16.is_null() {
         return -1;
     }
-    let core = unsafe { &mut *(h as *mut PeaPodCore) };
-    let actions = core.tick();
-    if actions.is_empty() {
-        return 0;
+    let mut tid = [0u8; 16];
+    tid.copy_from_slice(unsafe { slice::from_raw_parts(transfer_id_16, 16) });
+    let (received, writers) = {
+        let mut core = lock_core(h);
+        let received = core.receive_cached_chunk(tid, start, end);
+        (received, core.take_sink_deliveries())
+    };
+    if deliver(h, writers).contains(&tid) {
+        return -1;
+    }
+    match received {
+        None => 2,
+        Some(Ok(None)) => 0,
+        Some(Ok(Some(body))) if body.is_empty() => 1,
+        Some(Ok(Some(body))) => {
+            if out_buf.is_null() || out_buf_len < body.len() {
+                let need = body.len();
+                with_pending(h, |pending| *pending = body);
+                return need_code(need);
+            }
+            unsafe {
+                out_buf.copy_from_nonoverlapping(body.as_ptr(), body.len());
+            }
+            1
+        }
+        Some(Err(_)) => -1,
+    }
+}
+
+/// Report the validator (ETag, else Last-Modified value) of an origin response for the transfer's URL. Cached
+/// ranges of that URL from a response with another validator are dropped. Returns 0, or -1 on unknown transfer or
+/// a validator that is not UTF-8.
+#[no_mangle]
+pub extern "C" fn pea_core_set_transfer_validator(
+    h: *mut c_void,
+    transfer_id_16: *const u8,
+    validator: *const u8,
+    validator_len: usize,
+) -> c_int {
+    if h.is_null() || transfer_id_16.is_null() || validator.is_null() {
+        return -1;
+    }
+    let mut tid = [0u8; 16];
+    tid.copy_from_slice(unsafe { slice::from_raw_parts(transfer_id_16, 16) });
+    let Ok(validator) =
+        std::str::from_utf8(unsafe { slice::from_raw_parts(validator, validator_len) })
+    else {
+        return -1;
+    };
+    if lock_core(h).set_transfer_validator(tid, validator) {
+        0
+    } else {
+        -1
+    }
+}
+
+/// Start hashing one chunk incrementally (feed it as the bytes arrive). Returns an opaque verifier, freed by
+/// pea_core_chunk_verify_finish.
+#[no_mangle]
+pub extern "C" fn pea_core_chunk_verify_begin() -> *mut c_void {
+    Box::into_raw(Box::new(ChunkVerifier::new())) as *mut c_void
+}
+
+/// Hash the next len bytes of the chunk. Returns 0, or -1 on null arguments.
+#[no_mangle]
+pub extern "C" fn pea_core_chunk_verify_update(
+    v: *mut c_void,
+    data: *const u8,
+    len: usize,
+) -> c_int {
+    if v.is_null() || (data.is_null() && len > 0) {
+        return -1;
+    }
+    if len > 0 {
+        let verifier = unsafe { &mut *(v as *mut ChunkVerifier) };
+        verifier.update(unsafe { slice::from_raw_parts(data, len) });
+    }
+    0
+}
+
+/// Finish and free the verifier. Writes the 32-byte digest to out_hash_32 if not NULL. Returns 1 if it equals
+/// expected_hash_32, 0 if not (or expected_hash_32 is NULL), -1 if v is NULL.
+#[no_mangle]
+pub extern "C" fn pea_core_chunk_verify_finish(
+    v: *mut c_void,
+    expected_hash_32: *const u8,
+    out_hash_32: *mut u8,
+) -> c_int {
+    if v.is_null() {
+        return -1;
+    }
+    let verifier = unsafe { Box::from_raw(v as *mut ChunkVerifier) };
+    let digest = verifier.finish();
+    if !out_hash_32.is_null() {
+        unsafe { out_hash_32.copy_from_nonoverlapping(digest.as_ptr(), 32) };
+    }
+    if expected_hash_32.is_null() {
+        return 0;
+    }
+    let ok = unsafe { slice::from_raw_parts(expected_hash_32, 32) } == digest;
+    if !ok {
+        stats::HASH.fail();
+    }
+    ok as c_int
+}
+
+/// One run of bytes for a vectored sink call; same layout as POSIX `struct iovec`.
+#[repr(C)]
+pub struct PeaIoSlice {
+    pub base: *const u8,
+    pub len: usize,
+}
+
+/// Streaming sink: called with in-order body runs (write them as one writev). Return 0 on success, nonzero to abort.
+/// Called without the core lock, on whichever thread's call queued the run (or pea_core_cancel_transfer), one call
+/// at a time per transfer and in order; it may block, which holds up only its own transfer.
+pub type PeaChunkSinkFn =
+    extern "C" fn(ctx: *mut c_void, iov: *const PeaIoSlice, iov_count: usize) -> c_int;
+
+struct FfiChunkSink {
+    write: PeaChunkSinkFn,
+    ctx: *mut c_void,
+}
+
+// The host owns ctx and keeps it valid until it cancels the transfer or clears the sink; calls are serialized by
+// the transfer's writer.
+unsafe impl Send for FfiChunkSink {}
+
+impl ChunkSink for FfiChunkSink {
+    fn write(&mut self, bytes: &[u8]) -> bool {
+        self.write_vectored(&[bytes])
+    }
+
+    fn write_vectored(&mut self, chunks: &[&[u8]]) -> bool {
+        let iov: Vec<PeaIoSlice> = chunks
+            .iter()
+            .map(|c| PeaIoSlice {
+                base: c.as_ptr(),
+                len: c.len(),
+            })
+            .collect();
+        (self.write)(self.ctx, iov.as_ptr(), iov.len()) == 0
+    }
+}
+
+/// Stream the active transfer to sink(ctx, iov, iov_count) instead of reassembling into out_buf. NULL sink clears it.
+/// ctx must stay valid until the sink is cleared or pea_core_cancel_transfer returns for the transfer (call it also
+/// once the transfer completed: it waits for the last writes). Returns 0 on success, -1 on unknown transfer or sink
+/// failure.
+#[no_mangle]
+pub extern "C" fn pea_core_set_transfer_sink(
+    h: *mut c_void,
+    transfer_id_16: *const u8,
+    sink: Option<PeaChunkSinkFn>,
+    ctx: *mut c_void,
+) -> c_int {
+    if h.is_null() || transfer_id_16.is_null() {
+        return -1;
+    }
+    let mut tid = [0u8; 16];
+    tid.copy_from_slice(unsafe { slice::from_raw_parts(transfer_id_16, 16) });
+    let Some(write) = sink else {
+        lock_core(h).clear_transfer_sink(tid);
+        if let Some(old) = take_sink(h, tid) {
+            old.close(false);
+        }
+        return 0;
+    };
+    let set = {
+        let mut core = lock_core(h);
+        core.set_transfer_sink(tid, Box::new(FfiChunkSink { write, ctx }))
+            .map(|w| (w, core.take_sink_deliveries()))
+    };
+    let Ok((writer, writers)) = set else {
+        return -1;
+    };
+    let old = ffi_core(h)
+        .sinks
+        .lock()
+        .unwrap_or_else(PoisonError::into_inner)
+        .insert(tid, writer);
+    // A replaced sink still gets what was queued for it.
+    if let Some(old) = old {
+        old.close(true);
+    }
+    if deliver(h, writers).contains(&tid) {
+        -1
+    } else {
+        0
+    }
+}
+
+/// Spill a streamed transfer's out-of-order chunks to area[0, area_len) (at least total_length bytes, e.g. a sparse
+/// mmap'd file) once window_bytes of them are held in memory; the sink is then handed iovecs that point into the
+/// area for those chunks. release(ctx), if set, is called when the transfer no longer needs the area (it ended, or
+/// this call failed). Returns 0, or -1 on unknown transfer or an area shorter than the transfer.
+#[no_mangle]
+pub extern "C" fn pea_core_set_transfer_spill(
+    h: *mut c_void,
+    transfer_id_16: *const u8,
+    area: *mut u8,
+    area_len: usize,
+    window_bytes: u64,
+    release: Option<PeaReleaseFn>,
+    ctx: *mut c_void,
+) -> c_int {
+    let arena = FfiArena {
+        base: area,
+        len: area_len,
+        release: release.map(|r| (r, ctx)),
+    };
+    if h.is_null() || transfer_id_16.is_null() || area.is_null() {
+        return -1;
+    }
+    let mut tid = [0u8; 16];
+    tid.copy_from_slice(unsafe { slice::from_raw_parts(transfer_id_16, 16) });
+    let set = lock_core(h).set_transfer_spill(tid, Box::new(arena), window_bytes);
+    if set {
+        0
+    } else {
+        -1
+    }
+}
+
+/// Next chunk for the host to fetch itself (call whenever its fetch loop is idle). Writes the chunk's start and
+/// end to out_start/out_end and returns 1, or returns 0 when nothing is left, -1 on error or unknown transfer.
+#[no_mangle]
+pub extern "C" fn pea_core_next_self_chunk(
+    h: *mut c_void,
+    transfer_id_16: *const u8,
+    out_start: *mut u64,
+    out_end: *mut u64,
+) -> c_int {
+    if h.is_null() || transfer_id_16.is_null() || out_start.is_null() || out_end.is_null() {
+        return -1;
+    }
+    let mut tid = [0u8; 16];
+    tid.copy_from_slice(unsafe { slice::from_raw_parts(transfer_id_16, 16) });
+    let mut core = lock_core(h);
+    if core.transfer_status(tid).is_none() {
+        return -1;
+    }
+    match core.next_self_chunk(tid) {
+        Some(c) => {
+            unsafe {
+                *out_start = c.start;
+                *out_end = c.end;
+            }
+            1
+        }
+        None => 0,
+    }
+}
+
+/// Up to max chunks for the host to fetch itself at once (pipelined fetches); releases what it still holds first,
+/// like pea_core_next_self_chunk. Writes start, end pairs to out_ranges (2 * max u64) and returns how many, 0 when
+/// nothing is left, -1 on error or unknown transfer.
+#[no_mangle]
+pub extern "C" fn pea_core_next_self_chunks(
+    h: *mut c_void,
+    transfer_id_16: *const u8,
+    out_ranges: *mut u64,
+    max: usize,
+) -> c_int {
+    if h.is_null() || transfer_id_16.is_null() || out_ranges.is_null() || max == 0 {
+        return -1;
+    }
+    let mut tid = [0u8; 16];
+    tid.copy_from_slice(unsafe { slice::from_raw_parts(transfer_id_16, 16) });
+    let mut core = lock_core(h);
+    if core.transfer_status(tid).is_none() {
+        return -1;
+    }
+    let chunks = core.next_self_chunks(tid, max.min(c_int::MAX as usize));
+    drop(core);
+    let out = unsafe { slice::from_raw_parts_mut(out_ranges, 2 * chunks.len()) };
+    for (pair, c) in out.chunks_exact_mut(2).zip(&chunks) {
+        pair[0] = c.start;
+        pair[1] = c.end;
+    }
+    chunks.len() as c_int
+}
+
+/// Cancel a transfer in progress (frees its state) and let go of its sink: once this returns the sink is never
+/// called again, so the host may close its destination. A write in progress is waited for; a transfer that already
+/// completed first gets its last queued runs written. Returns 0, or -1 if the transfer was not in progress.
+#[no_mangle]
+pub extern "C" fn pea_core_cancel_transfer(h: *mut c_void, transfer_id_16: *const u8) -> c_int {
+    if h.is_null() || transfer_id_16.is_null() {
+        return -1;
+    }
+    let mut tid = [0u8; 16];
+    tid.copy_from_slice(unsafe { slice::from_raw_parts(transfer_id_16, 16) });
+    let cancelled = lock_core(h).cancel_transfer(tid);
+    if let Some(writer) = take_sink(h, tid) {
+        writer.close(!cancelled);
+    }
+    if cancelled {
+        0
+    } else {
+        -1
+    }
+}
+
+/// Transfer progress. Writes 8 total_length, 8 received_bytes, 4 chunks_total, 4 chunks_received (all LE).
+/// Returns 24, -1 if the transfer is unknown (also once completed or cancelled), or -24 if out_buf is NULL or too small.
+#[no_mangle]
+pub extern "C" fn pea_core_transfer_status(
+    h: *mut c_void,
+    transfer_id_16: *const u8,
+    out_buf: *mut u8,
+    out_buf_len: usize,
+) -> c_int {
+    if h.is_null() || transfer_id_16.is_null() {
+        return -1;
+    }
+    if out_buf.is_null() || out_buf_len < 24 {
+        return need_code(24);
+    }
+    let mut tid = [0u8; 16];
+    tid.copy_from_slice(unsafe { slice::from_raw_parts(transfer_id_16, 16) });
+    let Some(st) = lock_core(h).transfer_status(tid) else {
+        return -1;
+    };
+    let out = unsafe { slice::from_raw_parts_mut(out_buf, 24) };
+    out[0..8].copy_from_slice(&st.total_length.to_le_bytes());
+    out[8..16].copy_from_slice(&st.received_bytes.to_le_bytes());
+    out[16..20].copy_from_slice(&st.chunks_total.to_le_bytes());
+    out[20..24].copy_from_slice(&st.chunks_received.to_le_bytes());
+    24
+}
+
+/// Read a 16-byte transfer id.
+fn transfer_id(transfer_id_16: *const u8) -> [u8; 16] {
+    let mut tid = [0u8; 16];
+    tid.copy_from_slice(unsafe { slice::from_raw_parts(transfer_id_16, 16) });
+    tid
+}
+
+/// Start accelerating an upload of total_length bytes to url (url_len bytes, UTF-8); the host keeps the body.
+/// out_buf when Accelerate has the pea_core_on_request layout, each record a part and the worker it went to: self
+/// PUTs its parts to origin and reports them with pea_core_upload_part_done, a peer is sent its part as
+/// pea_core_upload_part_frame. Returns 0 = Fallback, 1 = Accelerate, -1 = error, -needed as in pea_core_on_request.
+#[no_mangle]
+pub extern "C" fn pea_core_on_upload_request(
+    h: *mut c_void,
+    url: *const u8,
+    url_len: usize,
+    total_length: u64,
+    out_buf: *mut u8,
+    out_buf_len: usize,
+) -> c_int {
+    if h.is_null() || url.is_null() {
+        return -1;
+    }
+    let Ok(url_str) = std::str::from_utf8(unsafe { slice::from_raw_parts(url, url_len) }) else {
+        return -1;
+    };
+    let action = lock_core(h).on_upload_request(url_str, total_length);
+    write_action(h, action, out_buf, out_buf_len)
+}
+
+/// Parts newly handed out for an upload, to call whenever pea_core_wait_upload_event moves: 4 count (LE), then
+/// count records as in pea_core_on_request. Returns bytes written, -1 on error or unknown upload, or -needed
+/// (the parts are kept for pea_core_take_output).
+#[no_mangle]
+pub extern "C" fn pea_core_next_upload_parts(
+    h: *mut c_void,
+    transfer_id_16: *const u8,
+    out_buf: *mut u8,
+    out_buf_len: usize,
+) -> c_int {
+    if h.is_null() || transfer_id_16.is_null() {
+        return -1;
+    }
+    let tid = transfer_id(transfer_id_16);
+    let mut core = lock_core(h);
+    if core.upload_status(tid).is_none() {
+        return -1;
+    }
+    let parts = core.next_upload_parts(tid);
+    drop(core);
+    with_pending(h, |pending| {
+        emit(
+            pending,
+            4 + parts.len() * ASSIGNMENT_RECORD,
+            out_buf,
+            out_buf_len,
+            |buf| put_assignment(&parts, buf),
+        )
+    })
+}
+
+/// UploadPart frame for part [start, end) of an upload in progress, to send to the peer it was handed to; payload
+/// is the part's end - start bytes. Hashed and encoded outside the core lock. Returns frame bytes written, -1 on
+/// error or unknown upload, or -needed if out_buf is NULL or too small (call again).
+#[no_mangle]
+pub extern "C" fn pea_core_upload_part_frame(
+    h: *mut c_void,
+    transfer_id_16: *const u8,
+    start: u64,
+    end: u64,
+    payload: *const u8,
+    payload_len: usize,
+    out_buf: *mut u8,
+    out_buf_len: usize,
+) -> c_int {
+    if h.is_null() || transfer_id_16.is_null() || (payload.is_null() && payload_len > 0) {
+        return -1;
+    }
+    if end.checked_sub(start) != Some(payload_len as u64) {
+        return -1;
+    }
+    let tid = transfer_id(transfer_id_16);
+    let Some((url, total_length)) = lock_core(h).upload_target(tid) else {
+        return -1;
+    };
+    let payload = if payload_len == 0 {
+        &[][..]
+    } else {
+        unsafe { slice::from_raw_parts(payload, payload_len) }
+    };
+    // Encoded straight into out_buf: the payload is copied once, by the encoder.
+    let frame = core::upload_part(tid, start, end, total_length, &url, payload);
+    let need = match wire::frame_len(&frame) {
+        Ok(n) => n,
+        Err(_) => return -1,
+    };
+    if out_buf.is_null() || out_buf_len < need {
+        return need_code(need);
+    }
+    let out = unsafe { slice::from_raw_parts_mut(out_buf, need) };
+    match wire::encode_frame_into(&frame, out) {
+        Ok(n) => n as c_int,
+        Err(_) => -1,
+    }
+}
+
+/// Report one of the host's own upload parts: ok != 0 once origin accepted it, 0 to put it back in the pool.
+/// Returns 0, or -1 if the upload is unknown.
+#[no_mangle]
+pub extern "C" fn pea_core_upload_part_done(
+    h: *mut c_void,
+    transfer_id_16: *const u8,
+    start: u64,
+    end: u64,
+    ok: c_int,
+) -> c_int {
+    if h.is_null() || transfer_id_16.is_null() {
+        return -1;
+    }
+    let known = lock_core(h).on_upload_part_done(transfer_id(transfer_id_16), start, end, ok != 0);
+    notify_upload(h);
+    if known {
+        0
+    } else {
+        -1
+    }
+}
+
+/// Upload progress in the pea_core_transfer_status layout, counting acknowledged parts; the upload is done when
+/// chunks_received == chunks_total. Returns 24, -1 if unknown (also after pea_core_finish_upload), or -24.
+#[no_mangle]
+pub extern "C" fn pea_core_upload_status(
+    h: *mut c_void,
+    transfer_id_16: *const u8,
+    out_buf: *mut u8,
+    out_buf_len: usize,
+) -> c_int {
+    if h.is_null() || transfer_id_16.is_null() {
+        return -1;
+    }
+    if out_buf.is_null() || out_buf_len < 24 {
+        return need_code(24);
+    }
+    let Some(st) = lock_core(h).upload_status(transfer_id(transfer_id_16)) else {
+        return -1;
+    };
+    let out = unsafe { slice::from_raw_parts_mut(out_buf, 24) };
+    out[0..8].copy_from_slice(&st.total_length.to_le_bytes());
+    out[8..16].copy_from_slice(&st.received_bytes.to_le_bytes());
+    out[16..20].copy_from_slice(&st.chunks_total.to_le_bytes());
+    out[20..24].copy_from_slice(&st.chunks_received.to_le_bytes());
+    24
+}
+
+/// Forget an upload (done or abandoned); later acks for it are ignored. Returns 0, or -1 if unknown.
+#[no_mangle]
+pub extern "C" fn pea_core_finish_upload(h: *mut c_void, transfer_id_16: *const u8) -> c_int {
+    if h.is_null() || transfer_id_16.is_null() {
+        return -1;
+    }
+    if lock_core(h).finish_upload(transfer_id(transfer_id_16)) {
+        0
+    } else {
+        -1
+    }
+}
+
+/// Take the oldest part a peer asked this device to relay. Writes 16 from, 16 transfer_id, 8 start, 8 end,
+/// 8 total_length, 4 url_len (all LE), url, then the end - start payload bytes. PUT it to url and answer with
+/// pea_core_upload_ack. Returns bytes written, 0 if none is queued, -1 on error, or -needed (the job is kept for
+/// pea_core_take_output).
+#[no_mangle]
+pub extern "C" fn pea_core_take_upload_job(
+    h: *mut c_void,
+    out_buf: *mut u8,
+    out_buf_len: usize,
+) -> c_int {
+    if h.is_null() {
+        return -1;
+    }
+    let Some(job) = lock_core(h).take_upload_job() else {
+        return 0;
+    };
+    let need = 16 + 16 + 8 + 8 + 8 + 4 + job.url.len() + job.payload.len();
+    with_pending(h, |pending| {
+        emit(pending, need, out_buf, out_buf_len, |buf| {
+            buf[0..16].copy_from_slice(job.from.as_bytes());
+            buf[16..32].copy_from_slice(&job.transfer_id);
+            buf[32..40].copy_from_slice(&job.start.to_le_bytes());
+            buf[40..48].copy_from_slice(&job.end.to_le_bytes());
+            buf[48..56].copy_from_slice(&job.total_length.to_le_bytes());
+            buf[56..60].copy_from_slice(&(job.url.len() as u32).to_le_bytes());
+            let url_end = 60 + job.url.len();
+            buf[60..url_end].copy_from_slice(job.url.as_bytes());
+            buf[url_end..].copy_from_slice(&job.payload);
+        })
+    })
+}
+
+/// UploadAck telling peer_id whether its part [start, end) reached origin (ok != 0), as outbound actions
+/// (pea_core_tick layout) for the transport. Returns bytes written, -1 on error, or -needed (call again).
+#[no_mangle]
+pub extern "C" fn pea_core_upload_ack(
+    peer_id_16: *const u8,
+    transfer_id_16: *const u8,
+    start: u64,
+    end: u64,
+    ok: c_int,
+    out_buf: *mut u8,
+    out_buf_len: usize,
+) -> c_int {
+    if peer_id_16.is_null() || transfer_id_16.is_null() {
+        return -1;
+    }
+    let to = DeviceId::from_bytes(transfer_id(peer_id_16));
+    let actions = core::upload_ack(to, transfer_id(transfer_id_16), start, end, ok != 0);
+    let mut out = vec![0u8; outbound_actions_len(&actions)];
+    put_outbound_actions(&actions, &mut out);
+    copy_out(&out, out_buf, out_buf_len)
+}
+
+/// Block up to timeout_ms until the core's upload event count differs from seen (a part acknowledged or refused,
+/// a relay job queued, a peer lost) and return the current count, so an upload or relay loop sleeps instead of
+/// polling. Returns at once if it already differs; pass timeout_ms 0 to read it. 0 if h is NULL.
+#[no_mangle]
+pub extern "C" fn pea_core_wait_upload_event(h: *mut c_void, seen: u64, timeout_ms: u32) -> u64 {
+    if h.is_null() {
+        return 0;
+    }
+    let (core, _) = ffi_core(h)
+        .upload_cv
+        .wait_timeout_while(
+            lock_core(h),
+            Duration::from_millis(timeout_ms as u64),
+            |c| c.upload_events() == seen,
+        )
+        .unwrap_or_else(PoisonError::into_inner);
+    core.upload_events()
+}
+
+/// Tick. Writes serialized outbound actions to out_buf. Returns bytes written, 0 if none, -1 on error, or -needed
+/// when out_buf is NULL or too small (actions kept for pea_core_take_output).
+#[no_mangle]
+pub extern "C" fn pea_core_tick(h: *mut c_void, out_buf: *mut u8, out_buf_len: usize) -> c_int {
+    if h.is_null() {
+        return -1;
+    }
+    let actions = lock_core(h).tick();
+    notify_upload(h);
+    if actions.is_empty() {
+        return 0;
+    }
+    write_outbound_actions(h, &actions, out_buf, out_buf_len)
+}
+
+/// Tick with the host's monotonic clock in ms (variable-rate ticking). Same output and return as pea_core_tick.
+#[no_mangle]
+pub extern "C" fn pea_core_tick_at(
+    h: *mut c_void,
+    now_ms: u64,
+    out_buf: *mut u8,
+    out_buf_len: usize,
+) -> c_int {
+    if h.is_null() {
+        return -1;
+    }
+    let actions = lock_core(h).tick_at(now_ms);
+    notify_upload(h);
+    if actions.is_empty() {
+        return 0;
+    }
+    write_outbound_actions(h, &actions, out_buf, out_buf_len)
+}
+
+/// Output a previous call kept back because its out_buf was NULL or too small (returned -needed). Copies it to out_buf
+/// and clears it. Returns bytes written, 0 if nothing is kept, -1 if h is NULL, or -needed (still kept) if out_buf is
+/// NULL or too small.
+#[no_mangle]
+pub extern "C" fn pea_core_take_output(
+    h: *mut c_void,
+    out_buf: *mut u8,
+    out_buf_len: usize,
+) -> c_int {
+    if h.is_null() {
+        return -1;
+    }
+    with_pending(h, |pending| {
+        if pending.is_empty() {
+            return 0;
+        }
+        let r = copy_out(pending, out_buf, out_buf_len);
+        if r >= 0 {
+            *pending = Vec::new();
+        }
+        r
+    })
+}
+
+/// Suggested ms until the next pea_core_tick_at (short during a transfer, long when idle). 0 if h is NULL.
+#[no_mangle]
+pub extern "C" fn pea_core_tick_interval_ms(h: *mut c_void) -> u32 {
+    if h.is_null() {
+        return 0;
+    }
+    lock_core(h).tick_interval_ms() as u32
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::identity::Keypair;
+    use crate::wire::encode_frame;
+
+    fn record(peer: DeviceId, frame: &[u8]) -> Vec<u8> {
+        let mut r = peer.as_bytes().to_vec();
+        r.extend_from_slice(&(frame.len() as u32).to_le_bytes());
+        r.extend_from_slice(frame);
+        r
+    }
+
+    #[test]
+    fn batch_skips_bad_frames_and_rejects_truncated_records() {
+        let h = pea_core_create();
+        let peer = Keypair::generate();
+        let peer_id = peer.device_id();
+        assert_eq!(
+            pea_core_peer_joined(
+                h,
+                peer_id.as_bytes().as_ptr(),
+                peer.public_key().as_bytes().as_ptr()
+            ),
+            0
+        );
+        let heartbeat = encode_frame(&Message::Heartbeat { device_id: peer_id }).unwrap();
+        let mut records = record(peer_id, &heartbeat);
+        records.extend(record(peer_id, b"not a frame"));
+        let mut out = [0xffu8; 64];
+        let n = pea_core_on_messages_received_batch(
+            h,
+            records.as_ptr(),
+            records.len(),
+            2,
+            out.as_mut_ptr(),
+            out.len(),
+        );
+        // No completions, no actions: two zero counts.
+        assert_eq!(n, 8);
+        assert_eq!(out[..8], [0u8; 8]);
+        let n = pea_core_on_messages_received_batch(
+            h,
+            records.as_ptr(),
+            records.len() - 1,
+            2,
+            out.as_mut_ptr(),
+            out.len(),
+        );
+        assert_eq!(n, -1);
+        pea_core_destroy(h);
+    }
+
+    #[test]
+    fn short_out_buf_reports_size_and_keeps_output() {
+        let h = pea_core_create();
+        let peer = Keypair::generate();
+        pea_core_peer_joined(
+            h,
+            peer.device_id().as_bytes().as_ptr(),
+            peer.public_key().as_bytes().as_ptr(),
+        );
+        // Size query on a stateful call: the heartbeat is kept, not lost.
+        let r = pea_core_tick_at(h, 60_000, std::ptr::null_mut(), 0);
+        assert!(r < -2);
+        let need = (-r) as usize;
+        let mut out = vec![0u8; need];
+        assert_eq!(pea_core_take_output(h, out.as_mut_ptr(), need - 1), r);
+        assert_eq!(
+            pea_core_take_output(h, out.as_mut_ptr(), need),
+            need as c_int
+        );
+        assert_eq!(out[..4], 1u32.to_le_bytes());
+        assert_eq!(pea_core_take_output(h, out.as_mut_ptr(), need), 0);
+        // Pure functions just report the size.
+        let mut id = [0u8; 16];
+        assert_eq!(pea_core_device_id(h, id.as_mut_ptr(), 8), -16);
+        assert_eq!(pea_core_device_id(h, id.as_mut_ptr(), 16), 0);
+        pea_core_destroy(h);
+    }
+
+    #[test]
+    fn threads_share_a_handle_and_keep_their_own_output() {
+        let h = pea_core_create();
+        let peer = Keypair::generate();
+        let peer_id = peer.device_id();
+        pea_core_peer_joined(
+            h,
+            peer_id.as_bytes().as_ptr(),
+            peer.public_key().as_bytes().as_ptr(),
+        );
+        // Kept on this thread; the other threads' calls must neither see nor clear it.
+        let r = pea_core_tick_at(h, 60_000, std::ptr::null_mut(), 0);
+        assert!(r < -2);
+        let addr = h as usize;
+        let heartbeat = encode_frame(&Message::Heartbeat { device_id: peer_id }).unwrap();
+        std::thread::scope(|s| {
+            for _ in 0..4 {
+                s.spawn(|| {
+                    let h = addr as *mut c_void;
+                    let mut out = [0u8; 64];
+                    for i in 0..200 {
+                        let n = pea_core_on_message_received(
+                            h,
+                            peer_id.as_bytes().as_ptr(),
+                            heartbeat.as_ptr(),
+                            heartbeat.len(),
+                            out.as_mut_ptr(),
+                            out.len(),
+                        );
+                        assert_eq!(n, 8);
+                        assert_eq!(pea_core_take_output(h, out.as_mut_ptr(), out.len()), 0);
+                        let mut frame = [0u8; 512];
+                        assert!(pea_core_beacon_frame(h, i, frame.as_mut_ptr(), frame.len()) > 0);
+                    }
+                });
+            }
+        });
+        let mut out = vec![0u8; (-r) as usize];
+        assert_eq!(pea_core_take_output(h, out.as_mut_ptr(), out.len()), -r);
+        pea_core_destroy(h);
+    }
+
+    static SUNK: std::sync::atomic::AtomicUsize = std::sync::atomic::AtomicUsize::new(0);
+
+    /// Counts the bytes written; fails the write if the core lock is held while it runs.
+    extern "C" fn unlocked_sink(
+        ctx: *mut c_void,
+        iov: *const PeaIoSlice,
+        iov_count: usize,
+    ) -> c_int {
+        let free = ffi_core(ctx).core.try_lock().is_ok();
+        let iov = unsafe { slice::from_raw_parts(iov, iov_count) };
+        SUNK.fetch_add(
+            iov.iter().map(|v| v.len).sum(),
+            std::sync::atomic::Ordering::Relaxed,
+        );
+        if free {
+            0
+        } else {
+            1
+        }
+    }
+
+    #[test]
+    fn sink_is_written_outside_the_core_lock() {
+        let h = pea_core_create();
+        let peer = Keypair::generate();
+        pea_core_peer_joined(
+            h,
+            peer.device_id().as_bytes().as_ptr(),
+            peer.public_key().as_bytes().as_ptr(),
+        );
+        let url = b"http://example.com/f";
+        let mut out = [0u8; 256];
+        let r = pea_core_on_request(
+            h,
+            url.as_ptr(),
+            url.len(),
+            0,
+            999,
+            out.as_mut_ptr(),
+            out.len(),
+        );
+        assert_eq!(r, 1);
+        let tid = &out[..16];
+        assert_eq!(
+            pea_core_set_transfer_sink(h, tid.as_ptr(), Some(unlocked_sink), h),
+            0
+        );
+        let (mut start, mut end) = (0u64, 0u64);
+        assert_eq!(
+            pea_core_next_self_chunk(h, tid.as_ptr(), &mut start, &mut end),
+            1
+        );
+        assert_eq!((start, end), (0, 1000));
+        let payload = [7u8; 1000];
+        let r = pea_core_on_chunk_received(
+            h,
+            tid.as_ptr(),
+            0,
+            1000,
+            std::ptr::null(),
+            payload.as_ptr(),
+            payload.len(),
+            std::ptr::null_mut(),
+            0,
+        );
+        assert_eq!(r, 1);
+        assert_eq!(SUNK.load(std::sync::atomic::Ordering::Relaxed), 1000);
+        // Completed, so no longer in progress; cancelling still lets go of the sink.
+        assert_eq!(pea_core_cancel_transfer(h, tid.as_ptr()), -1);
+        assert!(ffi_core(h).sinks.lock().unwrap().is_empty());
+        pea_core_destroy(h);
+    }
+
+    #[test]
+    fn bad_hash_counts_an_integrity_failure_against_self() {
+        let h = pea_core_create();
+        // The hash is checked before the transfer is looked up, so any transfer id will do.
+        let tid = [1u8; 16];
+        let payload = [7u8; 1000];
+        let wrong = [0u8; 32];
+        let r = pea_core_on_chunk_received(
+            h,
+            tid.as_ptr(),
+            0,
+            1000,
+            wrong.as_ptr(),
+            payload.as_ptr(),
+            payload.len(),
+            std::ptr::null_mut(),
+            0,
+        );
+        assert_eq!(r, -1);
+        let mut snap = vec![0u8; stats::MAX_SNAPSHOT_LEN];
+        let n = pea_core_stats(h, snap.as_mut_ptr(), snap.len());
+        assert!(n > 0);
+        let word = |off: usize| u64::from_le_bytes(snap[off..off + 8].try_into().unwrap());
+        let core_at = 16 + 3 * (16 + 8 * (2 + stats::HIST_BUCKETS));
+        assert_eq!(word(core_at + 16), 1);
+        // Self's record: 16 device id, chunks, bytes, integrity failures.
+        let me = core_at + 32;
+        assert_eq!(u32::from_le_bytes(snap[12..16].try_into().unwrap()), 1);
+        assert_eq!(
+            snap[me..me + 16],
+            ffi_core(h).keypair.device_id().as_bytes()[..]
+        );
+        assert_eq!(word(me + 32), 1);
+        pea_core_destroy(h);
     }
-    write_outbound_actions(&actions, out_buf, out_buf_len)
 }
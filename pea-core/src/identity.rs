@@ -1,12 +1,17 @@
 //! Device identity and crypto: keypairs, device ID, session keys, wire encryption.
 
-use chacha20poly1305::aead::{Aead, KeyInit};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::Instant;
+
+use chacha20poly1305::aead::{Aead, AeadInPlace, KeyInit};
 use chacha20poly1305::ChaCha20Poly1305;
 use rand::rngs::OsRng;
 use serde::{Deserialize, Serialize};
 use sha2::{Digest, Sha256};
 use x25519_dalek::{PublicKey as X25519PublicKey, StaticSecret};
 
+use crate::stats;
+
 /// Device public key (32 bytes, X25519). Serializable for beacon and handshake.
 #[derive(Clone, Debug, Eq, PartialEq, Hash, Serialize, Deserialize)]
 pub struct PublicKey(#[serde(with = "bytes_32")] [u8; 32]);
@@ -116,6 +121,16 @@ pub fn derive_session_key(shared_secret: &[u8; 32]) -> [u8; 32] {
     hasher.finalize().into()
 }
 
+/// Poly1305 tag appended to every wire ciphertext.
+pub const WIRE_TAG_SIZE: usize = 16;
+
+/// 96-bit wire nonce: 4 zero bytes then the 64-bit counter (LE).
+fn wire_nonce(nonce: u64) -> [u8; 12] {
+    let mut nonce_bytes = [0u8; 12];
+    nonce_bytes[4..12].copy_from_slice(&nonce.to_le_bytes());
+    nonce_bytes
+}
+
 /// Wire encryption: ChaCha20-Poly1305. Nonce: 96-bit counter per direction; never reuse.
 pub fn encrypt_wire(
     key: &[u8; 32],
@@ -123,11 +138,12 @@ pub fn encrypt_wire(
     plaintext: &[u8],
 ) -> Result<Vec<u8>, WireCryptoError> {
     let cipher = ChaCha20Poly1305::new_from_slice(key).map_err(|_| WireCryptoError::Key)?;
-    let mut nonce_bytes = [0u8; 12];
-    nonce_bytes[4..12].copy_from_slice(&nonce.to_le_bytes());
-    cipher
-        .encrypt((&nonce_bytes).into(), plaintext)
-        .map_err(|_| WireCryptoError::Encrypt)
+    let start = Instant::now();
+    let sealed = cipher
+        .encrypt((&wire_nonce(nonce)).into(), plaintext)
+        .map_err(|_| WireCryptoError::Encrypt);
+    stats::WIRE_SEAL.record(stats::elapsed_ns(start), plaintext.len());
+    sealed
 }
 
 /// Wire decryption.
@@ -137,11 +153,84 @@ pub fn decrypt_wire(
     ciphertext: &[u8],
 ) -> Result<Vec<u8>, WireCryptoError> {
     let cipher = ChaCha20Poly1305::new_from_slice(key).map_err(|_| WireCryptoError::Key)?;
-    let mut nonce_bytes = [0u8; 12];
-    nonce_bytes[4..12].copy_from_slice(&nonce.to_le_bytes());
-    cipher
-        .decrypt((&nonce_bytes).into(), ciphertext)
-        .map_err(|_| WireCryptoError::Decrypt)
+    let start = Instant::now();
+    let opened = cipher
+        .decrypt((&wire_nonce(nonce)).into(), ciphertext)
+        .map_err(|_| WireCryptoError::Decrypt);
+    stats::WIRE_OPEN.record(stats::elapsed_ns(start), ciphertext.len());
+    if opened.is_err() {
+        stats::WIRE_OPEN.fail();
+    }
+    opened
+}
+
+/// Per-connection wire cipher: the key schedule is built once and each direction keeps its own
+/// nonce counter (starting at 0), so frames are interchangeable with `encrypt_wire`/`decrypt_wire`.
+/// Seal and open may run on different threads; callers must serialize seals with their socket writes
+/// so frames go out in nonce order.
+pub struct WireCipher {
+    cipher: ChaCha20Poly1305,
+    seal_nonce: AtomicU64,
+    open_nonce: AtomicU64,
+}
+
+impl WireCipher {
+    pub fn new(key: &[u8; 32]) -> Result<Self, WireCryptoError> {
+        let cipher = ChaCha20Poly1305::new_from_slice(key).map_err(|_| WireCryptoError::Key)?;
+        Ok(Self {
+            cipher,
+            seal_nonce: AtomicU64::new(0),
+            open_nonce: AtomicU64::new(0),
+        })
+    }
+
+    /// Encrypt `buf[..plain_len]` in place and append the tag. `buf` must hold `plain_len + 16` bytes.
+    /// Consumes one seal nonce. Returns the ciphertext length.
+    pub fn seal_in_place(
+        &self,
+        buf: &mut [u8],
+        plain_len: usize,
+    ) -> Result<usize, WireCryptoError> {
+        let cipher_len = plain_len + WIRE_TAG_SIZE;
+        if buf.len() < cipher_len {
+            return Err(WireCryptoError::BufferTooSmall);
+        }
+        let nonce = self.seal_nonce.fetch_add(1, Ordering::Relaxed);
+        let (plain, rest) = buf.split_at_mut(plain_len);
+        let start = Instant::now();
+        let tag = self
+            .cipher
+            .encrypt_in_place_detached((&wire_nonce(nonce)).into(), b"", plain)
+            .map_err(|_| WireCryptoError::Encrypt)?;
+        stats::WIRE_SEAL.record(stats::elapsed_ns(start), plain_len);
+        rest[..WIRE_TAG_SIZE].copy_from_slice(tag.as_slice());
+        Ok(cipher_len)
+    }
+
+    /// Decrypt `buf` (ciphertext + tag) in place. The open nonce only advances when the tag verifies.
+    /// Returns the plaintext length; plaintext is `buf[..len]`.
+    pub fn open_in_place(&self, buf: &mut [u8]) -> Result<usize, WireCryptoError> {
+        if buf.len() < WIRE_TAG_SIZE {
+            return Err(WireCryptoError::Decrypt);
+        }
+        let plain_len = buf.len() - WIRE_TAG_SIZE;
+        let nonce = self.open_nonce.load(Ordering::Relaxed);
+        let (data, tag) = buf.split_at_mut(plain_len);
+        let start = Instant::now();
+        let opened = self.cipher.decrypt_in_place_detached(
+            (&wire_nonce(nonce)).into(),
+            b"",
+            data,
+            (&*tag).into(),
+        );
+        stats::WIRE_OPEN.record(stats::elapsed_ns(start), buf.len());
+        opened.map_err(|_| {
+            stats::WIRE_OPEN.fail();
+            WireCryptoError::Decrypt
+        })?;
+        self.open_nonce.store(nonce + 1, Ordering::Relaxed);
+        Ok(plain_len)
+    }
 }
 
 #[derive(Debug, thiserror::Error)]
@@ -152,6 +241,8 @@ pub enum WireCryptoError {
     Encrypt,
     #[error("decryption failed")]
     Decrypt,
+    #[error("output buffer too small")]
+    BufferTooSmall,
 }
 
 #[cfg(test)]
@@ -184,4 +275,35 @@ mod tests {
         let dec = decrypt_wire(&key, 0, &cipher).unwrap();
         assert_eq!(dec.as_slice(), plain);
     }
+
+    #[test]
+    fn wire_cipher_matches_encrypt_wire() {
+        let key = [7u8; 32];
+        let sender = WireCipher::new(&key).unwrap();
+        let receiver = WireCipher::new(&key).unwrap();
+        for (nonce, plain) in [(0u64, &b"first"[..]), (1, &b"second frame"[..])] {
+            let mut buf = vec![0u8; plain.len() + WIRE_TAG_SIZE];
+            buf[..plain.len()].copy_from_slice(plain);
+            let n = sender.seal_in_place(&mut buf, plain.len()).unwrap();
+            assert_eq!(buf[..n], encrypt_wire(&key, nonce, plain).unwrap()[..]);
+            let m = receiver.open_in_place(&mut buf[..n]).unwrap();
+            assert_eq!(&buf[..m], plain);
+        }
+    }
+
+    #[test]
+    fn wire_cipher_open_rejects_tampered_without_advancing() {
+        let key = [9u8; 32];
+        let receiver = WireCipher::new(&key).unwrap();
+        let mut frame = encrypt_wire(&key, 0, b"hello").unwrap();
+        let mut bad = frame.clone();
+        bad[0] ^= 1;
+        assert!(receiver.open_in_place(&mut bad).is_err());
+        assert_eq!(receiver.open_in_place(&mut frame).unwrap(), 5);
+        let mut short = [0u8; 4];
+        assert!(matches!(
+            WireCipher::new(&key).unwrap().seal_in_place(&mut short, 1),
+            Err(WireCryptoError::BufferTooSmall)
+        ));
+    }
 }
@@ -1,17 +1,119 @@
 //! Integrity: per-chunk hash (e.g. SHA-256), verify on receive.
+//! SHA-256 uses the CPU's SHA extensions where present (x86 SHA-NI; ARMv8 SHA2 via the `asm` feature enabled
+//! for aarch64 in Cargo.toml), checked at run time.
+
+use std::time::Instant;
 
 use sha2::{Digest, Sha256};
 
+use crate::{stats, trace};
+
+/// Batches with fewer payload bytes than this are verified on the calling thread (thread start-up would cost more).
+const PARALLEL_VERIFY_MIN_BYTES: usize = 1024 * 1024;
+/// Most threads one batch is spread over.
+const MAX_VERIFY_THREADS: usize = 4;
+
 /// Hash a chunk payload. Returns 32-byte digest.
 pub fn hash_chunk(payload: &[u8]) -> [u8; 32] {
+    let start = Instant::now();
     let mut hasher = Sha256::new();
     hasher.update(payload);
-    hasher.finalize().into()
+    let digest = hasher.finalize().into();
+    stats::HASH.record(stats::elapsed_ns(start), payload.len());
+    digest
 }
 
 /// Verify chunk payload against expected hash.
 pub fn verify_chunk(payload: &[u8], expected_hash: &[u8; 32]) -> bool {
-    hash_chunk(payload) == *expected_hash
+    let _trace = trace::section(trace::VERIFY);
+    let ok = hash_chunk(payload) == *expected_hash;
+    if !ok {
+        stats::HASH.fail();
+    }
+    ok
+}
+
+/// Incremental hash of one chunk, fed as its bytes arrive (e.g. per socket read) so the payload is hashed while
+/// still in cache and verification finishes with the last byte instead of costing another pass.
+#[derive(Default)]
+pub struct ChunkVerifier {
+    hasher: Sha256,
+    /// Time spent in `update` and bytes fed, counted as one hash call by `finish`.
+    ns: u64,
+    bytes: usize,
+}
+
+impl ChunkVerifier {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Hash the next run of payload bytes.
+    pub fn update(&mut self, bytes: &[u8]) {
+        let start = Instant::now();
+        self.hasher.update(bytes);
+        self.ns += stats::elapsed_ns(start);
+        self.bytes += bytes.len();
+    }
+
+    /// Digest of everything fed so far; same as `hash_chunk` over the concatenated runs.
+    pub fn finish(self) -> [u8; 32] {
+        let start = Instant::now();
+        let digest = self.hasher.finalize().into();
+        stats::HASH.record(self.ns + stats::elapsed_ns(start), self.bytes);
+        digest
+    }
+
+    /// Whether the bytes fed so far hash to `expected_hash`.
+    pub fn verify(self, expected_hash: &[u8; 32]) -> bool {
+        let ok = self.finish() == *expected_hash;
+        if !ok {
+            stats::HASH.fail();
+        }
+        ok
+    }
+}
+
+/// Verify several payloads; result `i` is `verify_chunk(items[i])`. A large batch (e.g. chunks from several
+/// peers in one receive burst) is split into runs of whole chunks hashed on scoped threads.
+pub fn verify_chunks(items: &[(&[u8], &[u8; 32])]) -> Vec<bool> {
+    let threads = std::thread::available_parallelism().map_or(1, |n| n.get());
+    verify_chunks_with(items, threads, verify_chunk)
+}
+
+/// `verify_chunks` over up to `threads` threads with the per-chunk check passed in. The result always has one
+/// entry per item (callers zip it with their chunks): a run whose thread panicked counts as failed.
+fn verify_chunks_with<F>(items: &[(&[u8], &[u8; 32])], threads: usize, verify: F) -> Vec<bool>
+where
+    F: Fn(&[u8], &[u8; 32]) -> bool + Sync,
+{
+    let _trace = trace::section(trace::VERIFY);
+    let total: usize = items.iter().map(|(p, _)| p.len()).sum();
+    let threads = threads.min(MAX_VERIFY_THREADS).min(items.len());
+    let sequential = |run: &[(&[u8], &[u8; 32])]| -> Vec<bool> {
+        run.iter().map(|(p, h)| verify(p, h)).collect()
+    };
+    if threads <= 1 || total < PARALLEL_VERIFY_MIN_BYTES {
+        return sequential(items);
+    }
+    let per_thread = items.len().div_ceil(threads);
+    std::thread::scope(|scope| {
+        let handles: Vec<_> = items
+            .chunks(per_thread)
+            .map(|run| {
+                let handle = std::thread::Builder::new().spawn_scoped(scope, || sequential(run));
+                (run, handle)
+            })
+            .collect();
+        handles
+            .into_iter()
+            .flat_map(|(run, h)| match h {
+                Ok(h) => h.join().unwrap_or_else(|_| vec![false; run.len()]),
+                // Could not start a thread: hash that run here instead.
+                Err(_) => sequential(run),
+            })
+            .collect()
+    })
 }
 
 #[cfg(test)]
@@ -31,4 +133,51 @@ mod tests {
         let hash = hash_chunk(payload);
         assert!(!verify_chunk(b"tampered", &hash));
     }
+
+    #[test]
+    fn incremental_verify_matches_one_shot() {
+        let payload: Vec<u8> = (0..100_000u32).map(|i| i as u8).collect();
+        let hash = hash_chunk(&payload);
+        let mut v = ChunkVerifier::new();
+        for run in payload.chunks(1500) {
+            v.update(run);
+        }
+        assert!(v.verify(&hash));
+        let mut v = ChunkVerifier::new();
+        v.update(&payload[..payload.len() - 1]);
+        assert!(!v.verify(&hash));
+    }
+
+    #[test]
+    fn verify_chunks_parallel_matches_sequential() {
+        let payloads: Vec<Vec<u8>> = (0..8u8).map(|i| vec![i; 256 * 1024]).collect();
+        let mut hashes: Vec<[u8; 32]> = payloads.iter().map(|p| hash_chunk(p)).collect();
+        hashes[5][0] ^= 1;
+        let items: Vec<(&[u8], &[u8; 32])> = payloads
+            .iter()
+            .zip(&hashes)
+            .map(|(p, h)| (p.as_slice(), h))
+            .collect();
+        let ok = verify_chunks(&items);
+        assert_eq!(ok.len(), 8);
+        assert!(ok.iter().enumerate().all(|(i, &v)| v == (i != 5)));
+    }
+
+    #[test]
+    fn verify_chunks_returns_one_result_per_item_when_a_worker_panics() {
+        let payloads: Vec<Vec<u8>> = (0..8u8).map(|i| vec![i; 256 * 1024]).collect();
+        let hashes: Vec<[u8; 32]> = payloads.iter().map(|p| hash_chunk(p)).collect();
+        let items: Vec<(&[u8], &[u8; 32])> = payloads
+            .iter()
+            .zip(&hashes)
+            .map(|(p, h)| (p.as_slice(), h))
+            .collect();
+        let ok = verify_chunks_with(&items, MAX_VERIFY_THREADS, |p, h| {
+            assert_ne!(p[0], 5, "worker panics on item 5");
+            verify_chunk(p, h)
+        });
+        assert_eq!(ok.len(), items.len());
+        assert!(!ok[5]);
+        assert!(ok[0] && ok[7]);
+    }
 }
@@ -24,17 +24,26 @@ pub mod wire;
 #[allow(clippy::not_unsafe_ptr_arg_deref)]
 pub mod ffi;
 
-pub use chunk::ChunkId;
+pub use cache::{CacheStats, ChunkCache};
+pub use chunk::{ChunkId, ChunkSink, HostArena, SinkWriter};
 pub use core::{
-    Action, ChunkError, ChunkReceiveOutcome, Config, OnMessageError, OutboundAction, PeaPodCore,
-    PeerMetrics,
+    check_messages, upload_ack, upload_part, upload_part_frame, Action, CheckedMessage, ChunkError,
+    ChunkReceiveOutcome, Config, OnMessageError, OutboundAction, PeaPodCore, PeerMetrics,
+    UploadJob,
 };
 pub use identity::{DeviceId, Keypair, PublicKey};
 pub use protocol::{Message, PROTOCOL_VERSION};
-pub use wire::{decode_frame, encode_frame, FrameDecodeError, FrameEncodeError};
+pub use stats::CoreStats;
+pub use wire::{
+    decode_frame, decode_frame_ref, encode_frame, encode_frame_into, encode_frame_ref, frame_len,
+    FrameDecodeError, FrameEncodeError, FrameRef,
+};
 
 // Stub modules for chunk manager, scheduler, integrity (full impl later).
+pub mod cache;
 pub mod chunk;
 pub mod core;
 pub mod integrity;
 pub mod scheduler;
+pub mod stats;
+pub mod trace;
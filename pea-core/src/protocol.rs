@@ -52,4 +52,22 @@ pub enum Message {
         start: u64,
         end: u64,
     },
+    /// Upload part: bytes [start, end) of a body the sender is uploading, for the receiver to send on to url over
+    /// its own uplink as a ranged PUT (`Content-Range: bytes start-(end-1)/total_length`).
+    UploadPart {
+        transfer_id: [u8; 16],
+        start: u64,
+        end: u64,
+        total_length: u64,
+        url: String,
+        hash: [u8; 32],
+        payload: Vec<u8>,
+    },
+    /// Result of an UploadPart; ok false (origin refused, hash mismatch, receiver busy) reassigns the part.
+    UploadAck {
+        transfer_id: [u8; 16],
+        start: u64,
+        end: u64,
+        ok: bool,
+    },
 }
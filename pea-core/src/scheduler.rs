@@ -1,6 +1,8 @@
 //! Distributed scheduler: assign chunks to peers; reassign when peer leaves.
+//! [`WorkQueue`] is the pull scheduler the core runs transfers with; the static assignment functions
+//! remain for hosts that want a one-shot plan.
 
-use std::collections::HashMap;
+use std::collections::{BTreeSet, HashMap};
 
 use crate::chunk::ChunkId;
 use crate::identity::DeviceId;
@@ -95,6 +97,253 @@ pub fn assignment_map(assignment: &[(ChunkId, DeviceId)]) -> HashMap<ChunkId, De
     assignment.iter().map(|(c, p)| (*c, *p)).collect()
 }
 
+/// In-flight window for a worker with no throughput estimate yet.
+pub const DEFAULT_WINDOW: usize = 2;
+/// Upper bound on any worker's in-flight window.
+pub const MAX_WINDOW: usize = 8;
+/// A worker's window covers about this much transfer time at its measured rate.
+const WINDOW_TARGET_MS: u64 = 2000;
+/// Shortest interval a throughput sample is taken over.
+const RATE_SAMPLE_MS: u64 = 1000;
+
+/// How many chunks to keep requested from a worker: enough to cover WINDOW_TARGET_MS at its rate, so a slow
+/// peer holds one chunk at a time while a fast one stays busy across round trips.
+pub fn window_for(rate_bytes_per_sec: Option<u64>, chunk_len: u64) -> usize {
+    match rate_bytes_per_sec {
+        None => DEFAULT_WINDOW,
+        Some(r) => {
+            let chunks = r.saturating_mul(WINDOW_TARGET_MS) / 1000 / chunk_len.max(1);
+            chunks.clamp(1, MAX_WINDOW as u64) as usize
+        }
+    }
+}
+
+/// Learned throughput of one worker: bytes delivered per sample interval, smoothed (EWMA, 1/4 new sample).
+#[derive(Clone, Debug, Default)]
+pub struct ThroughputEstimate {
+    bytes: u64,
+    since_ms: Option<u64>,
+    bytes_per_sec: Option<u64>,
+}
+
+impl ThroughputEstimate {
+    /// Count bytes the worker delivered.
+    pub fn record(&mut self, bytes: u64) {
+        self.bytes = self.bytes.saturating_add(bytes);
+    }
+
+    /// Close the current sample once RATE_SAMPLE_MS has passed. A sample only starts while the worker is
+    /// `busy` (has chunks in flight), so idle time does not read as a slow link.
+    pub fn sample(&mut self, now_ms: u64, busy: bool) {
+        let Some(start) = self.since_ms else {
+            if busy {
+                self.since_ms = Some(now_ms);
+                self.bytes = 0;
+            }
+            return;
+        };
+        let elapsed = now_ms.saturating_sub(start);
+        if elapsed < RATE_SAMPLE_MS {
+            return;
+        }
+        let rate = self.bytes.saturating_mul(1000) / elapsed;
+        self.bytes_per_sec = Some(match self.bytes_per_sec {
+            Some(old) => (old.saturating_mul(3).saturating_add(rate)) / 4,
+            None => rate,
+        });
+        self.bytes = 0;
+        self.since_ms = busy.then_some(now_ms);
+    }
+
+    pub fn bytes_per_sec(&self) -> Option<u64> {
+        self.bytes_per_sec
+    }
+}
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+enum Slot {
+    Unstarted,
+    /// Requested from `worker` at `since_ms`; in the endgame also speculatively from `dup`.
+    InFlight {
+        worker: DeviceId,
+        dup: Option<DeviceId>,
+        since_ms: u64,
+    },
+    Done,
+}
+
+/// Pull scheduler for one transfer. Unstarted chunks stay in one in-order pool instead of being split up
+/// front, and each worker only holds its in-flight window, so a slow worker can never sit on a backlog:
+/// whoever has room takes the next chunk. Once the pool is empty an idle worker duplicates the oldest
+/// straggler held by someone else (at most one duplicate per chunk); the first copy to land wins.
+pub struct WorkQueue {
+    chunks: Vec<ChunkId>,
+    slots: Vec<Slot>,
+    unstarted: BTreeSet<usize>,
+    in_flight: HashMap<DeviceId, usize>,
+}
+
+impl WorkQueue {
+    /// `chunks` sorted by start (as from `split_into_chunks`).
+    pub fn new(chunks: Vec<ChunkId>) -> Self {
+        Self {
+            slots: vec![Slot::Unstarted; chunks.len()],
+            unstarted: (0..chunks.len()).collect(),
+            chunks,
+            in_flight: HashMap::new(),
+        }
+    }
+
+    /// Chunks currently requested from `worker` (including speculative duplicates).
+    pub fn in_flight(&self, worker: DeviceId) -> usize {
+        self.in_flight.get(&worker).copied().unwrap_or(0)
+    }
+
+    /// Whether any chunk is still waiting for a worker.
+    pub fn has_unstarted(&self) -> bool {
+        !self.unstarted.is_empty()
+    }
+
+    /// Chunks completed so far.
+    pub fn done_count(&self) -> usize {
+        self.slots.iter().filter(|s| **s == Slot::Done).count()
+    }
+
+    /// Next chunk for `worker` if it has fewer than `window` in flight: the lowest unstarted chunk, or in the
+    /// endgame (nothing unstarted, worker idle) a duplicate of the oldest chunk another worker still holds.
+    pub fn next_for(&mut self, worker: DeviceId, window: usize, now_ms: u64) -> Option<ChunkId> {
+        let held = self.in_flight(worker);
+        if held >= window {
+            return None;
+        }
+        if let Some(i) = self.unstarted.pop_first() {
+            self.slots[i] = Slot::InFlight {
+                worker,
+                dup: None,
+                since_ms: now_ms,
+            };
+            *self.in_flight.entry(worker).or_default() += 1;
+            return Some(self.chunks[i]);
+        }
+        if held > 0 {
+            return None;
+        }
+        let (_, i) = self
+            .slots
+            .iter()
+            .enumerate()
+            .filter_map(|(i, s)| match *s {
+                Slot::InFlight {
+                    worker: w,
+                    dup: None,
+                    since_ms,
+                } if w != worker => Some((since_ms, i)),
+                _ => None,
+            })
+            .min()?;
+        if let Slot::InFlight { dup, .. } = &mut self.slots[i] {
+            *dup = Some(worker);
+        }
+        *self.in_flight.entry(worker).or_default() += 1;
+        Some(self.chunks[i])
+    }
+
+    /// The chunk was received and verified. Returns the workers whose window it freed (holder and duplicate).
+    pub fn complete(&mut self, chunk_id: ChunkId) -> Vec<DeviceId> {
+        let Some(i) = self.index_of(chunk_id) else {
+            return vec![];
+        };
+        let freed: Vec<DeviceId> = match std::mem::replace(&mut self.slots[i], Slot::Done) {
+            Slot::InFlight { worker, dup, .. } => std::iter::once(worker).chain(dup).collect(),
+            Slot::Unstarted => {
+                self.unstarted.remove(&i);
+                vec![]
+            }
+            Slot::Done => vec![],
+        };
+        for w in &freed {
+            self.dec(*w);
+        }
+        freed
+    }
+
+    /// `worker` will not deliver the chunk (Nack, integrity failure, gave up). It goes back to the pool
+    /// unless another worker still holds a copy.
+    pub fn release(&mut self, chunk_id: ChunkId, worker: DeviceId) {
+        if let Some(i) = self.index_of(chunk_id) {
+            self.release_index(i, worker);
+        }
+    }
+
+    /// Release every chunk `worker` holds (it left or timed out).
+    pub fn remove_worker(&mut self, worker: DeviceId) {
+        for i in 0..self.slots.len() {
+            self.release_index(i, worker);
+        }
+        self.in_flight.remove(&worker);
+    }
+
+    /// Chunks currently requested, with the worker(s) holding them.
+    pub fn assignment(&self) -> Vec<(ChunkId, DeviceId)> {
+        let mut out = Vec::new();
+        for (i, s) in self.slots.iter().enumerate() {
+            if let Slot::InFlight { worker, dup, .. } = *s {
+                out.push((self.chunks[i], worker));
+                if let Some(d) = dup {
+                    out.push((self.chunks[i], d));
+                }
+            }
+        }
+        out
+    }
+
+    fn release_index(&mut self, i: usize, worker: DeviceId) {
+        let Slot::InFlight {
+            worker: w,
+            dup,
+            since_ms,
+        } = self.slots[i]
+        else {
+            return;
+        };
+        if w == worker {
+            self.slots[i] = match dup {
+                Some(d) => Slot::InFlight {
+                    worker: d,
+                    dup: None,
+                    since_ms,
+                },
+                None => {
+                    self.unstarted.insert(i);
+                    Slot::Unstarted
+                }
+            };
+        } else if dup == Some(worker) {
+            self.slots[i] = Slot::InFlight {
+                worker: w,
+                dup: None,
+                since_ms,
+            };
+        } else {
+            return;
+        }
+        self.dec(worker);
+    }
+
+    fn dec(&mut self, worker: DeviceId) {
+        if let Some(n) = self.in_flight.get_mut(&worker) {
+            *n = n.saturating_sub(1);
+        }
+    }
+
+    fn index_of(&self, chunk_id: ChunkId) -> Option<usize> {
+        self.chunks
+            .binary_search_by_key(&chunk_id.start, |c| c.start)
+            .ok()
+            .filter(|&i| self.chunks[i] == chunk_id)
+    }
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -204,4 +453,54 @@ mod tests {
         assert_eq!(new_assignments.len(), 1);
         assert_eq!(new_assignments[0].1, b.device_id());
     }
+
+    fn chunks(n: u64) -> Vec<ChunkId> {
+        (0..n)
+            .map(|i| ChunkId {
+                transfer_id: [0; 16],
+                start: i * 100,
+                end: (i + 1) * 100,
+            })
+            .collect()
+    }
+
+    #[test]
+    fn work_queue_fast_worker_pulls_more_and_duplicates_straggler() {
+        let slow = Keypair::generate().device_id();
+        let fast = Keypair::generate().device_id();
+        let c = chunks(6);
+        let mut q = WorkQueue::new(c.clone());
+        assert_eq!(q.next_for(slow, 1, 0), Some(c[0]));
+        assert_eq!(q.next_for(slow, 1, 0), None);
+        // The fast worker keeps pulling while the slow one still holds chunk 0.
+        for (t, expected) in c[1..].iter().enumerate() {
+            assert_eq!(q.next_for(fast, 1, t as u64), Some(*expected));
+            assert_eq!(q.complete(*expected), vec![fast]);
+        }
+        assert!(!q.has_unstarted());
+        // Endgame: the idle fast worker duplicates the straggler; the first copy frees both windows.
+        assert_eq!(q.next_for(fast, 1, 10), Some(c[0]));
+        assert_eq!(q.next_for(fast, 2, 10), None);
+        assert_eq!(q.complete(c[0]), vec![slow, fast]);
+        assert_eq!(q.in_flight(slow) + q.in_flight(fast), 0);
+    }
+
+    #[test]
+    fn work_queue_release_returns_chunks_to_pool() {
+        let a = Keypair::generate().device_id();
+        let b = Keypair::generate().device_id();
+        let c = chunks(3);
+        let mut q = WorkQueue::new(c.clone());
+        assert_eq!(q.next_for(a, 2, 0), Some(c[0]));
+        assert_eq!(q.next_for(a, 2, 0), Some(c[1]));
+        q.remove_worker(a);
+        assert_eq!(q.in_flight(a), 0);
+        assert_eq!(q.next_for(b, 8, 0), Some(c[0]));
+        q.release(c[0], b);
+        assert_eq!(q.next_for(b, 8, 0), Some(c[0]));
+        assert_eq!(q.assignment().len(), 1);
+        assert_eq!(window_for(None, 100), DEFAULT_WINDOW);
+        assert_eq!(window_for(Some(50), 100), 1);
+        assert_eq!(window_for(Some(u64::MAX), 100), MAX_WINDOW);
+    }
 }
@@ -0,0 +1,283 @@
+//! Hot-path counters and latency histograms, cheap enough to leave on in production: relaxed atomics only and no
+//! locks, so a host can snapshot them from any thread (a UI or telemetry poll) while transfers run. Wire AEAD and
+//! chunk hashing are free functions, so their counters are process-wide (`WIRE_SEAL`, `WIRE_OPEN`, `HASH`);
+//! chunk, integrity and per-peer counters belong to each core (`CoreStats`).
+//!
+//! `CoreStats::snapshot` writes all of them in a fixed little-endian layout; every field is a u64 unless noted:
+//!
+//! - header: u32 version (`STATS_VERSION`), u32 snapshot length in bytes, u32 histogram buckets, u32 peer count
+//! - wire seal, wire open, chunk hash: each bytes, failures, then a histogram of time per call
+//! - core: chunks received, chunk bytes received, integrity failures, reassignments
+//! - per peer: 16-byte device id, chunks, bytes, integrity failures, reassignments, histogram of chunk latency
+//!
+//! A histogram is count, sum in ns, then `HIST_BUCKETS` counts.
+
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::time::Instant;
+
+use crate::identity::DeviceId;
+
+/// First field of every snapshot; bumped whenever a field is added or moved.
+pub const STATS_VERSION: u32 = 1;
+/// Bucket 0 counts 0 ns, bucket i counts [2^(i-1), 2^i) ns; the last also counts anything longer (2^38 ns is
+/// about 4.6 minutes).
+pub const HIST_BUCKETS: usize = 40;
+/// Peers tracked per core (self included); chunks from further peers still count in the core totals.
+pub const MAX_PEER_STATS: usize = 16;
+
+const HEADER_LEN: usize = 16;
+const HIST_LEN: usize = 8 * (2 + HIST_BUCKETS);
+const OP_LEN: usize = 16 + HIST_LEN;
+const CORE_LEN: usize = 32;
+const PEER_LEN: usize = 16 + 32 + HIST_LEN;
+/// Longest snapshot (every peer slot in use).
+pub const MAX_SNAPSHOT_LEN: usize = HEADER_LEN + 3 * OP_LEN + CORE_LEN + MAX_PEER_STATS * PEER_LEN;
+
+/// Process-wide: `encrypt_wire` and `WireCipher::seal_in_place` (plaintext bytes).
+pub static WIRE_SEAL: OpStats = OpStats::new();
+/// Process-wide: `decrypt_wire` and `WireCipher::open_in_place` (ciphertext bytes; failed tags count as failures).
+pub static WIRE_OPEN: OpStats = OpStats::new();
+/// Process-wide: chunk hashing, one call per chunk whether hashed at once or fed to a `ChunkVerifier`
+/// (hash mismatches count as failures).
+pub static HASH: OpStats = OpStats::new();
+
+/// Nanoseconds since `start`, saturating.
+pub fn elapsed_ns(start: Instant) -> u64 {
+    u64::try_from(start.elapsed().as_nanos()).unwrap_or(u64::MAX)
+}
+
+fn add(counter: &AtomicU64, n: u64) {
+    counter.fetch_add(n, Ordering::Relaxed);
+}
+
+fn put(out: &mut Vec<u8>, counter: &AtomicU64) {
+    out.extend_from_slice(&counter.load(Ordering::Relaxed).to_le_bytes());
+}
+
+/// Log2 histogram of durations.
+pub struct Histogram {
+    count: AtomicU64,
+    sum_ns: AtomicU64,
+    buckets: [AtomicU64; HIST_BUCKETS],
+}
+
+impl Histogram {
+    pub const fn new() -> Self {
+        Self {
+            count: AtomicU64::new(0),
+            sum_ns: AtomicU64::new(0),
+            buckets: [const { AtomicU64::new(0) }; HIST_BUCKETS],
+        }
+    }
+
+    pub fn record_ns(&self, ns: u64) {
+        let bucket = (u64::BITS - ns.leading_zeros()) as usize;
+        add(&self.buckets[bucket.min(HIST_BUCKETS - 1)], 1);
+        add(&self.count, 1);
+        add(&self.sum_ns, ns);
+    }
+
+    pub fn count(&self) -> u64 {
+        self.count.load(Ordering::Relaxed)
+    }
+
+    fn write(&self, out: &mut Vec<u8>) {
+        put(out, &self.count);
+        put(out, &self.sum_ns);
+        for b in &self.buckets {
+            put(out, b);
+        }
+    }
+}
+
+impl Default for Histogram {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// Calls (the histogram count), bytes, failures and time per call of one operation.
+pub struct OpStats {
+    bytes: AtomicU64,
+    failures: AtomicU64,
+    time: Histogram,
+}
+
+impl OpStats {
+    pub const fn new() -> Self {
+        Self {
+            bytes: AtomicU64::new(0),
+            failures: AtomicU64::new(0),
+            time: Histogram::new(),
+        }
+    }
+
+    /// Count one call over `bytes` that took `ns`.
+    pub fn record(&self, ns: u64, bytes: usize) {
+        add(&self.bytes, bytes as u64);
+        self.time.record_ns(ns);
+    }
+
+    pub fn fail(&self) {
+        add(&self.failures, 1);
+    }
+
+    pub fn calls(&self) -> u64 {
+        self.time.count()
+    }
+
+    fn write(&self, out: &mut Vec<u8>) {
+        put(out, &self.bytes);
+        put(out, &self.failures);
+        self.time.write(out);
+    }
+}
+
+impl Default for OpStats {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// One peer's slot. `used` is set (Release) only after `id`, so a reader that sees it set (Acquire) reads the id.
+#[derive(Default)]
+struct PeerStats {
+    used: AtomicBool,
+    id: [AtomicU64; 2],
+    chunks: AtomicU64,
+    bytes: AtomicU64,
+    integrity_failures: AtomicU64,
+    reassignments: AtomicU64,
+    /// From handing the chunk to the peer (ChunkRequest, or self's `next_self_chunk`) to receiving it.
+    latency: Histogram,
+}
+
+/// Counters of one core. Written by the core (which holds it mutably, so slots are claimed by one thread); read
+/// through `snapshot` from any thread.
+#[derive(Default)]
+pub struct CoreStats {
+    chunks: AtomicU64,
+    bytes: AtomicU64,
+    integrity_failures: AtomicU64,
+    /// Chunks taken back from a peer after a Nack or an integrity failure.
+    reassignments: AtomicU64,
+    peers: [PeerStats; MAX_PEER_STATS],
+}
+
+fn id_words(id: DeviceId) -> [u64; 2] {
+    let b = id.as_bytes();
+    [
+        u64::from_le_bytes(b[..8].try_into().expect("8 bytes")),
+        u64::from_le_bytes(b[8..].try_into().expect("8 bytes")),
+    ]
+}
+
+impl CoreStats {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// The slot of `id`, claiming a free one; None once every slot is taken by other peers.
+    fn peer(&self, id: DeviceId) -> Option<&PeerStats> {
+        let words = id_words(id);
+        for slot in &self.peers {
+            if !slot.used.load(Ordering::Acquire) {
+                slot.id[0].store(words[0], Ordering::Relaxed);
+                slot.id[1].store(words[1], Ordering::Relaxed);
+                slot.used.store(true, Ordering::Release);
+                return Some(slot);
+            }
+            if slot.id[0].load(Ordering::Relaxed) == words[0]
+                && slot.id[1].load(Ordering::Relaxed) == words[1]
+            {
+                return Some(slot);
+            }
+        }
+        None
+    }
+
+    /// A chunk of `bytes` from `from` was accepted; `latency_ns` when its request time is known.
+    pub(crate) fn chunk_received(&self, from: DeviceId, bytes: u64, latency_ns: Option<u64>) {
+        add(&self.chunks, 1);
+        add(&self.bytes, bytes);
+        if let Some(p) = self.peer(from) {
+            add(&p.chunks, 1);
+            add(&p.bytes, bytes);
+            if let Some(ns) = latency_ns {
+                p.latency.record_ns(ns);
+            }
+        }
+    }
+
+    pub(crate) fn integrity_failure(&self, from: DeviceId) {
+        add(&self.integrity_failures, 1);
+        if let Some(p) = self.peer(from) {
+            add(&p.integrity_failures, 1);
+        }
+    }
+
+    pub(crate) fn reassigned(&self, from: DeviceId) {
+        add(&self.reassignments, 1);
+        if let Some(p) = self.peer(from) {
+            add(&p.reassignments, 1);
+        }
+    }
+
+    /// Every counter in the layout described at the top of this module (at most `MAX_SNAPSHOT_LEN` bytes).
+    /// Counters are read one by one, so a snapshot taken mid-update may be off by the update in flight.
+    pub fn snapshot(&self) -> Vec<u8> {
+        let peers: Vec<&PeerStats> = self
+            .peers
+            .iter()
+            .filter(|p| p.used.load(Ordering::Acquire))
+            .collect();
+        let len = HEADER_LEN + 3 * OP_LEN + CORE_LEN + peers.len() * PEER_LEN;
+        let mut out = Vec::with_capacity(len);
+        out.extend_from_slice(&STATS_VERSION.to_le_bytes());
+        out.extend_from_slice(&(len as u32).to_le_bytes());
+        out.extend_from_slice(&(HIST_BUCKETS as u32).to_le_bytes());
+        out.extend_from_slice(&(peers.len() as u32).to_le_bytes());
+        for op in [&WIRE_SEAL, &WIRE_OPEN, &HASH] {
+            op.write(&mut out);
+        }
+        put(&mut out, &self.chunks);
+        put(&mut out, &self.bytes);
+        put(&mut out, &self.integrity_failures);
+        put(&mut out, &self.reassignments);
+        for p in peers {
+            put(&mut out, &p.id[0]);
+            put(&mut out, &p.id[1]);
+            put(&mut out, &p.chunks);
+            put(&mut out, &p.bytes);
+            put(&mut out, &p.integrity_failures);
+            put(&mut out, &p.reassignments);
+            p.latency.write(&mut out);
+        }
+        debug_assert_eq!(out.len(), len);
+        out
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn histogram_buckets_by_power_of_two() {
+        let h = Histogram::new();
+        for ns in [0, 1, 2, 3, 4, 1000, u64::MAX] {
+            h.record_ns(ns);
+        }
+        let mut out = Vec::new();
+        h.write(&mut out);
+        let word = |i: usize| u64::from_le_bytes(out[i * 8..i * 8 + 8].try_into().unwrap());
+        assert_eq!(word(0), 7);
+        // Buckets follow count and sum: 0 -> b0, 1 -> b1, 2 and 3 -> b2, 4 -> b3, 1000 -> b10, MAX -> last.
+        let bucket = |i: usize| word(2 + i);
+        assert_eq!(
+            (bucket(0), bucket(1), bucket(2), bucket(3), bucket(10)),
+            (1, 1, 2, 1, 1)
+        );
+        assert_eq!(bucket(HIST_BUCKETS - 1), 1);
+    }
+}
@@ -0,0 +1,143 @@
+//! Trace sections for the host's profiler (Android ATrace, which Perfetto and systrace record), so time inside the
+//! core shows up between the host's own sections. The core does no I/O, so the host installs its tracer's entry
+//! points with `set_hooks` (C: `pea_core_set_trace_hooks`) and removes them to stop. Without hooks a section
+//! costs one atomic load.
+//!
+//! Sections: `pea.assign` (planning a transfer), `pea.verify` (hashing chunks against their hash), `pea.reassemble`
+//! (storing a chunk, and joining the body when it is the last) and `pea.encode` (building a frame). Each transfer
+//! is also an async slice named `pea.transfer` from start to completion or drop, keyed by its first four id bytes.
+
+use std::ffi::{c_char, CStr};
+use std::ptr;
+use std::sync::atomic::{AtomicPtr, Ordering};
+
+pub const ASSIGN: &CStr = c"pea.assign";
+pub const VERIFY: &CStr = c"pea.verify";
+pub const REASSEMBLE: &CStr = c"pea.reassemble";
+pub const ENCODE: &CStr = c"pea.encode";
+pub const TRANSFER: &CStr = c"pea.transfer";
+
+/// A tracer's entry points, with ATrace's signatures. Sections nest per thread and must end on the thread that
+/// began them (the core keeps to that); the async pair may be None where the tracer has none (ATrace before API 29).
+#[repr(C)]
+pub struct TraceHooks {
+    pub begin_section: Option<extern "C" fn(name: *const c_char)>,
+    pub end_section: Option<extern "C" fn()>,
+    pub begin_async_section: Option<extern "C" fn(name: *const c_char, cookie: i32)>,
+    pub end_async_section: Option<extern "C" fn(name: *const c_char, cookie: i32)>,
+}
+
+static HOOKS: AtomicPtr<TraceHooks> = AtomicPtr::new(ptr::null_mut());
+
+/// Send sections to `hooks` from now on, or to nowhere with None. Process-wide. A section already open still
+/// ends through the hooks it began with.
+pub fn set_hooks(hooks: Option<&'static TraceHooks>) {
+    let p = hooks.map_or(ptr::null_mut(), |h| {
+        h as *const TraceHooks as *mut TraceHooks
+    });
+    HOOKS.store(p, Ordering::Release);
+}
+
+fn hooks() -> Option<&'static TraceHooks> {
+    // Only ever set from a &'static in set_hooks (or from a host pointer its caller keeps valid for good).
+    unsafe { HOOKS.load(Ordering::Acquire).as_ref() }
+}
+
+/// An open section; ends when dropped.
+#[must_use]
+pub struct Section(Option<extern "C" fn()>);
+
+impl Drop for Section {
+    fn drop(&mut self) {
+        if let Some(end) = self.0 {
+            end();
+        }
+    }
+}
+
+/// Open section `name` on this thread until the returned guard drops.
+pub fn section(name: &'static CStr) -> Section {
+    let Some(h) = hooks() else {
+        return Section(None);
+    };
+    match (h.begin_section, h.end_section) {
+        (Some(begin), Some(end)) => {
+            begin(name.as_ptr());
+            Section(Some(end))
+        }
+        _ => Section(None),
+    }
+}
+
+/// A transfer's async slice; ends when dropped (the transfer completed, failed or was cancelled).
+pub(crate) struct TransferTrack {
+    end: Option<extern "C" fn(*const c_char, i32)>,
+    cookie: i32,
+}
+
+impl TransferTrack {
+    pub(crate) fn begin(transfer_id: &[u8; 16]) -> Self {
+        let cookie = i32::from_le_bytes([
+            transfer_id[0],
+            transfer_id[1],
+            transfer_id[2],
+            transfer_id[3],
+        ]);
+        let end = hooks().and_then(|h| match (h.begin_async_section, h.end_async_section) {
+            (Some(begin), Some(end)) => {
+                begin(TRANSFER.as_ptr(), cookie);
+                Some(end)
+            }
+            _ => None,
+        });
+        Self { end, cookie }
+    }
+}
+
+impl Drop for TransferTrack {
+    fn drop(&mut self) {
+        if let Some(end) = self.end {
+            end(TRANSFER.as_ptr(), self.cookie);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::cell::Cell;
+
+    thread_local! {
+        // Per thread: other tests may open sections while these hooks are installed.
+        static BEGUN: Cell<u32> = const { Cell::new(0) };
+        static ENDED: Cell<u32> = const { Cell::new(0) };
+    }
+
+    extern "C" fn begin(_name: *const c_char) {
+        BEGUN.set(BEGUN.get() + 1);
+    }
+
+    extern "C" fn end() {
+        ENDED.set(ENDED.get() + 1);
+    }
+
+    static HOOKS_UNDER_TEST: TraceHooks = TraceHooks {
+        begin_section: Some(begin),
+        end_section: Some(end),
+        begin_async_section: None,
+        end_async_section: None,
+    };
+
+    #[test]
+    fn sections_stay_balanced_across_set_hooks() {
+        set_hooks(Some(&HOOKS_UNDER_TEST));
+        let open = section(ENCODE);
+        set_hooks(None);
+        drop(section(ENCODE));
+        assert_eq!(ENDED.get(), 0);
+        drop(open);
+        assert_eq!((BEGUN.get(), ENDED.get()), (1, 1));
+        // No async hooks: the transfer is not tracked, and dropping its track calls nothing.
+        drop(TransferTrack::begin(&[1; 16]));
+    }
+}
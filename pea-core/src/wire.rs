@@ -1,35 +1,278 @@
 //! Framing: length-prefix (4 bytes LE) + bincode payload.
+//!
+//! A frame can be encoded straight into the caller's buffer (`encode_frame_into`), so a host that leaves room for
+//! its own header and the AEAD tag seals it where it was written. ChunkData and UploadPart payloads are written as
+//! one byte run, and `decode_frame_ref` borrows them from the frame instead of copying them out.
+
+use serde::{Deserialize, Serialize, Serializer};
 
 use crate::protocol::Message;
+use crate::trace;
 
 const LEN_SIZE: usize = 4;
 const MAX_FRAME_LEN: u32 = 16 * 1024 * 1024; // 16 MiB
 
+/// Bincode variant indices of the messages with a bulk payload (their position in `Message`).
+const CHUNK_DATA_TAG: u32 = 6;
+const UPLOAD_PART_TAG: u32 = 8;
+
+/// A message as framed on the wire. ChunkData and UploadPart borrow their payload (and url) from the caller: from
+/// the frame bytes when decoded by `decode_frame_ref`, from the host's buffer when encoded. Every other message is
+/// small and held as is.
+#[derive(Debug)]
+pub enum FrameRef<'a> {
+    ChunkData {
+        transfer_id: [u8; 16],
+        start: u64,
+        end: u64,
+        hash: [u8; 32],
+        payload: &'a [u8],
+    },
+    UploadPart {
+        transfer_id: [u8; 16],
+        start: u64,
+        end: u64,
+        total_length: u64,
+        url: &'a str,
+        hash: [u8; 32],
+        payload: &'a [u8],
+    },
+    Other(Message),
+}
+
+impl<'a> From<&'a Message> for FrameRef<'a> {
+    fn from(msg: &'a Message) -> Self {
+        match msg {
+            Message::ChunkData {
+                transfer_id,
+                start,
+                end,
+                hash,
+                payload,
+            } => FrameRef::ChunkData {
+                transfer_id: *transfer_id,
+                start: *start,
+                end: *end,
+                hash: *hash,
+                payload,
+            },
+            Message::UploadPart {
+                transfer_id,
+                start,
+                end,
+                total_length,
+                url,
+                hash,
+                payload,
+            } => FrameRef::UploadPart {
+                transfer_id: *transfer_id,
+                start: *start,
+                end: *end,
+                total_length: *total_length,
+                url,
+                hash: *hash,
+                payload,
+            },
+            other => FrameRef::Other(other.clone()),
+        }
+    }
+}
+
+impl FrameRef<'_> {
+    /// The owned message; copies the payload.
+    pub fn into_owned(self) -> Message {
+        match self {
+            FrameRef::ChunkData {
+                transfer_id,
+                start,
+                end,
+                hash,
+                payload,
+            } => Message::ChunkData {
+                transfer_id,
+                start,
+                end,
+                hash,
+                payload: payload.to_vec(),
+            },
+            FrameRef::UploadPart {
+                transfer_id,
+                start,
+                end,
+                total_length,
+                url,
+                hash,
+                payload,
+            } => Message::UploadPart {
+                transfer_id,
+                start,
+                end,
+                total_length,
+                url: url.to_string(),
+                hash,
+                payload: payload.to_vec(),
+            },
+            FrameRef::Other(msg) => msg,
+        }
+    }
+}
+
+/// Fields of ChunkData and UploadPart after the variant tag, in `Message` order. A byte run and a `Vec<u8>` encode
+/// the same in bincode (u64 length, then the bytes), so these read and write `Message`'s encoding.
+#[derive(Serialize, Deserialize)]
+struct ChunkDataBody<'a> {
+    transfer_id: [u8; 16],
+    start: u64,
+    end: u64,
+    hash: [u8; 32],
+    #[serde(serialize_with = "byte_run")]
+    payload: &'a [u8],
+}
+
+#[derive(Serialize, Deserialize)]
+struct UploadPartBody<'a> {
+    transfer_id: [u8; 16],
+    start: u64,
+    end: u64,
+    total_length: u64,
+    url: &'a str,
+    hash: [u8; 32],
+    #[serde(serialize_with = "byte_run")]
+    payload: &'a [u8],
+}
+
+/// Write a payload in one piece (serde's default for a slice goes byte by byte).
+fn byte_run<S: Serializer>(bytes: &&[u8], s: S) -> Result<S::Ok, S::Error> {
+    s.serialize_bytes(bytes)
+}
+
+/// Bincode payload of a frame.
+enum Body<'a> {
+    ChunkData((u32, ChunkDataBody<'a>)),
+    UploadPart((u32, UploadPartBody<'a>)),
+    Other(&'a Message),
+}
+
+impl<'a> Body<'a> {
+    fn of(frame: &'a FrameRef<'a>) -> Self {
+        match *frame {
+            FrameRef::ChunkData {
+                transfer_id,
+                start,
+                end,
+                hash,
+                payload,
+            } => Body::ChunkData((
+                CHUNK_DATA_TAG,
+                ChunkDataBody {
+                    transfer_id,
+                    start,
+                    end,
+                    hash,
+                    payload,
+                },
+            )),
+            FrameRef::UploadPart {
+                transfer_id,
+                start,
+                end,
+                total_length,
+                url,
+                hash,
+                payload,
+            } => Body::UploadPart((
+                UPLOAD_PART_TAG,
+                UploadPartBody {
+                    transfer_id,
+                    start,
+                    end,
+                    total_length,
+                    url,
+                    hash,
+                    payload,
+                },
+            )),
+            FrameRef::Other(ref msg) => Body::Other(msg),
+        }
+    }
+
+    /// Payload length, checked against the frame limit.
+    fn len(&self) -> Result<usize, FrameEncodeError> {
+        let len = match self {
+            Body::ChunkData(b) => bincode::serialized_size(b)?,
+            Body::UploadPart(b) => bincode::serialized_size(b)?,
+            Body::Other(m) => bincode::serialized_size(m)?,
+        };
+        if len > MAX_FRAME_LEN as u64 {
+            return Err(FrameEncodeError::TooLarge);
+        }
+        Ok(len as usize)
+    }
+
+    /// Write the length prefix and the payload (len from `len`).
+    fn write<W: std::io::Write>(&self, len: usize, mut w: W) -> Result<(), FrameEncodeError> {
+        bincode::serialize_into(&mut w, &(len as u32))?;
+        match self {
+            Body::ChunkData(b) => bincode::serialize_into(w, b)?,
+            Body::UploadPart(b) => bincode::serialize_into(w, b)?,
+            Body::Other(m) => bincode::serialize_into(w, m)?,
+        }
+        Ok(())
+    }
+}
+
 /// Encode a message into a single frame: 4 bytes LE length + bincode payload.
 pub fn encode_frame(msg: &Message) -> Result<Vec<u8>, FrameEncodeError> {
-    let payload = bincode::serialize(msg).map_err(FrameEncodeError::Encode)?;
-    let len = payload.len() as u32;
-    if len > MAX_FRAME_LEN {
-        return Err(FrameEncodeError::TooLarge);
-    }
-    let mut out = Vec::with_capacity(LEN_SIZE + payload.len());
-    out.extend_from_slice(&len.to_le_bytes());
-    out.extend_from_slice(&payload);
+    encode_frame_ref(&FrameRef::from(msg))
+}
+
+/// `encode_frame` for a borrowed message: the payload is written once, into the returned frame.
+pub fn encode_frame_ref(frame: &FrameRef) -> Result<Vec<u8>, FrameEncodeError> {
+    let _trace = trace::section(trace::ENCODE);
+    let body = Body::of(frame);
+    let len = body.len()?;
+    let mut out = Vec::with_capacity(LEN_SIZE + len);
+    body.write(len, &mut out)?;
     Ok(out)
 }
 
-/// Error encoding a message into a frame (bincode or size limit).
+/// Bytes `encode_frame_into` writes for frame.
+pub fn frame_len(frame: &FrameRef) -> Result<usize, FrameEncodeError> {
+    Ok(LEN_SIZE + Body::of(frame).len()?)
+}
+
+/// Encode frame at the front of `out`, with no buffer in between. Returns the bytes written, or
+/// `BufferTooSmall(needed)` when out is shorter than the frame (nothing written).
+pub fn encode_frame_into(frame: &FrameRef, out: &mut [u8]) -> Result<usize, FrameEncodeError> {
+    let _trace = trace::section(trace::ENCODE);
+    let body = Body::of(frame);
+    let len = body.len()?;
+    if out.len() < LEN_SIZE + len {
+        return Err(FrameEncodeError::BufferTooSmall(LEN_SIZE + len));
+    }
+    body.write(len, &mut out[..LEN_SIZE + len])?;
+    Ok(LEN_SIZE + len)
+}
+
+/// Error encoding a message into a frame (bincode, size limit, or a caller's buffer too small).
 #[derive(Debug, thiserror::Error)]
 pub enum FrameEncodeError {
     #[error("encode error: {0}")]
     Encode(#[from] bincode::Error),
     #[error("frame too large")]
     TooLarge,
+    #[error("buffer too small: {0} bytes needed")]
+    BufferTooSmall(usize),
 }
 
 /// Decode one frame from the front of `bytes`. Returns the message and the number of bytes consumed.
 /// Call with partial buffer; returns error if not enough bytes (caller should try again after more data).
 pub fn decode_frame(bytes: &[u8]) -> Result<(Message, usize), FrameDecodeError> {
+    decode_frame_ref(bytes).map(|(frame, n)| (frame.into_owned(), n))
+}
+
+/// `decode_frame` without copying: a ChunkData or UploadPart payload points into `bytes`.
+pub fn decode_frame_ref(bytes: &[u8]) -> Result<(FrameRef<'_>, usize), FrameDecodeError> {
     if bytes.len() < LEN_SIZE {
         return Err(FrameDecodeError::NeedMore);
     }
@@ -40,9 +283,36 @@ pub fn decode_frame(bytes: &[u8]) -> Result<(Message, usize), FrameDecodeError>
     if bytes.len() < LEN_SIZE + len {
         return Err(FrameDecodeError::NeedMore);
     }
-    let msg: Message =
-        bincode::deserialize(&bytes[LEN_SIZE..LEN_SIZE + len]).map_err(FrameDecodeError::Decode)?;
-    Ok((msg, LEN_SIZE + len))
+    let payload = &bytes[LEN_SIZE..LEN_SIZE + len];
+    let tag = payload
+        .get(..4)
+        .map(|t| u32::from_le_bytes([t[0], t[1], t[2], t[3]]));
+    let frame = match tag {
+        Some(CHUNK_DATA_TAG) => {
+            let b: ChunkDataBody = bincode::deserialize(&payload[4..])?;
+            FrameRef::ChunkData {
+                transfer_id: b.transfer_id,
+                start: b.start,
+                end: b.end,
+                hash: b.hash,
+                payload: b.payload,
+            }
+        }
+        Some(UPLOAD_PART_TAG) => {
+            let b: UploadPartBody = bincode::deserialize(&payload[4..])?;
+            FrameRef::UploadPart {
+                transfer_id: b.transfer_id,
+                start: b.start,
+                end: b.end,
+                total_length: b.total_length,
+                url: b.url,
+                hash: b.hash,
+                payload: b.payload,
+            }
+        }
+        _ => FrameRef::Other(bincode::deserialize(payload)?),
+    };
+    Ok((frame, LEN_SIZE + len))
 }
 
 /// Error decoding a frame (need more bytes, too large, or bincode failure).
@@ -98,6 +368,50 @@ mod tests {
         }
     }
 
+    #[test]
+    fn payload_frames_match_message_encoding_and_decode_borrowed() {
+        let chunk = Message::ChunkData {
+            transfer_id: [1; 16],
+            start: 1000,
+            end: 1300,
+            hash: [2; 32],
+            payload: (0..300u32).map(|i| i as u8).collect(),
+        };
+        let part = Message::UploadPart {
+            transfer_id: [3; 16],
+            start: 0,
+            end: 5,
+            total_length: 10,
+            url: "http://x/up".to_string(),
+            hash: [4; 32],
+            payload: b"hello".to_vec(),
+        };
+        for msg in [&chunk, &part] {
+            // The derived encoding of Message is the reference the byte-run path must reproduce.
+            let derived = bincode::serialize(msg).unwrap();
+            let frame = encode_frame(msg).unwrap();
+            assert_eq!(&frame[LEN_SIZE..], &derived[..]);
+            let (decoded, n) = decode_frame_ref(&frame).unwrap();
+            assert_eq!(n, frame.len());
+            let payload = match decoded {
+                FrameRef::ChunkData { payload, .. } | FrameRef::UploadPart { payload, .. } => {
+                    payload
+                }
+                FrameRef::Other(m) => panic!("expected a payload frame, got {:?}", m),
+            };
+            assert!(frame.as_ptr_range().contains(&payload.as_ptr()));
+        }
+        let frame = FrameRef::from(&chunk);
+        let need = frame_len(&frame).unwrap();
+        let mut out = vec![0u8; need + 16];
+        assert!(matches!(
+            encode_frame_into(&frame, &mut out[..need - 1]),
+            Err(FrameEncodeError::BufferTooSmall(n)) if n == need
+        ));
+        assert_eq!(encode_frame_into(&frame, &mut out).unwrap(), need);
+        assert_eq!(out[..need], encode_frame(&chunk).unwrap()[..]);
+    }
+
     #[test]
     fn partial_read_need_more() {
         let msg = sample_beacon();
@@ -4,7 +4,7 @@ use serde::Deserialize;
 use std::path::PathBuf;
 
 /// Daemon configuration. File: ~/.config/peapod/config.toml or /etc/peapod/config.toml.
-/// Env overrides: PEAPOD_PROXY_PORT, PEAPOD_DISCOVERY_PORT, PEAPOD_TRANSPORT_PORT.
+/// Env overrides: PEAPOD_PROXY_PORT, PEAPOD_DISCOVERY_PORT, PEAPOD_TRANSPORT_PORT, PEAPOD_CHUNK_CACHE_BYTES.
 #[derive(Debug, Clone, Deserialize)]
 #[serde(deny_unknown_fields)]
 pub struct Config {
@@ -17,6 +17,9 @@ pub struct Config {
     /// Local transport TCP port (default 45679).
     #[serde(default = "default_transport_port")]
     pub transport_port: u16,
+    /// Chunk cache budget in bytes (default pea_core::cache::DEFAULT_BUDGET_BYTES); 0 turns the cache off.
+    #[serde(default = "default_chunk_cache_bytes")]
+    pub chunk_cache_bytes: u64,
 }
 
 fn default_proxy_port() -> u16 {
@@ -28,6 +31,9 @@ fn default_discovery_port() -> u16 {
 fn default_transport_port() -> u16 {
     45679
 }
+fn default_chunk_cache_bytes() -> u64 {
+    pea_core::cache::DEFAULT_BUDGET_BYTES
+}
 
 impl Default for Config {
     fn default() -> Self {
@@ -35,6 +41,7 @@ impl Default for Config {
             proxy_port: default_proxy_port(),
             discovery_port: default_discovery_port(),
             transport_port: default_transport_port(),
+            chunk_cache_bytes: default_chunk_cache_bytes(),
         }
     }
 }
@@ -57,6 +64,11 @@ pub fn load() -> Config {
             c.transport_port = p;
         }
     }
+    if let Ok(s) = std::env::var("PEAPOD_CHUNK_CACHE_BYTES") {
+        if let Ok(n) = s.parse::<u64>() {
+            c.chunk_cache_bytes = n;
+        }
+    }
     c
 }
 
@@ -37,11 +37,13 @@ fn print_help() {
     println!("      proxy_port = 3128");
     println!("      discovery_port = 45678");
     println!("      transport_port = 45679");
+    println!("      chunk_cache_bytes = 67108864   # 0 disables the chunk cache");
     println!();
     println!("ENVIRONMENT VARIABLES (override config file):");
-    println!("    PEAPOD_PROXY_PORT       Proxy listen port (default: 3128)");
-    println!("    PEAPOD_DISCOVERY_PORT   Discovery UDP port (default: 45678)");
-    println!("    PEAPOD_TRANSPORT_PORT   Transport TCP port (default: 45679)");
+    println!("    PEAPOD_PROXY_PORT         Proxy listen port (default: 3128)");
+    println!("    PEAPOD_DISCOVERY_PORT     Discovery UDP port (default: 45678)");
+    println!("    PEAPOD_TRANSPORT_PORT     Transport TCP port (default: 45679)");
+    println!("    PEAPOD_CHUNK_CACHE_BYTES  Chunk cache budget (default: 64 MiB; 0 = off)");
     println!();
     println!("SYSTEMD:");
     println!("    systemctl --user enable peapod    Enable auto-start on login");
@@ -76,9 +78,11 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
     let cfg = config::load();
 
     let keypair = std::sync::Arc::new(pea_core::Keypair::generate());
-    let core = std::sync::Arc::new(tokio::sync::Mutex::new(
-        pea_core::PeaPodCore::with_keypair_arc(keypair.clone()),
-    ));
+    let mut pea = pea_core::PeaPodCore::with_keypair_arc(keypair.clone());
+    // Ranges fetched once (for this device or a peer) are served again without WAN bytes.
+    let cache_bytes = usize::try_from(cfg.chunk_cache_bytes).unwrap_or(usize::MAX);
+    pea.set_chunk_cache((cache_bytes > 0).then(|| pea_core::ChunkCache::new(cache_bytes)));
+    let core = std::sync::Arc::new(tokio::sync::Mutex::new(pea));
 
     let bind: std::net::SocketAddr = format!("127.0.0.1:{}", cfg.proxy_port).parse()?;
     let (connect_tx, connect_rx) = tokio::sync::mpsc::unbounded_channel();
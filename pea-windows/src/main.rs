@@ -83,9 +83,16 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
     let _ = pea_core::Config::default();
 
     let keypair = std::sync::Arc::new(pea_core::Keypair::generate());
-    let core = std::sync::Arc::new(tokio::sync::Mutex::new(
-        pea_core::PeaPodCore::with_keypair_arc(keypair.clone()),
-    ));
+    let mut pea = pea_core::PeaPodCore::with_keypair_arc(keypair.clone());
+    // Ranges fetched once (for this device or a peer) are served again without WAN bytes.
+    // PEAPOD_CHUNK_CACHE_BYTES sets the budget; 0 turns the cache off.
+    let cache_bytes = std::env::var("PEAPOD_CHUNK_CACHE_BYTES")
+        .ok()
+        .and_then(|s| s.parse::<u64>().ok())
+        .unwrap_or(pea_core::cache::DEFAULT_BUDGET_BYTES);
+    let cache_bytes = usize::try_from(cache_bytes).unwrap_or(usize::MAX);
+    pea.set_chunk_cache((cache_bytes > 0).then(|| pea_core::ChunkCache::new(cache_bytes)));
+    let core = std::sync::Arc::new(tokio::sync::Mutex::new(pea));
     let bind: std::net::SocketAddr = proxy::DEFAULT_PROXY_ADDR.parse()?;
 
     #[cfg(windows)]
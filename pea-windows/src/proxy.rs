@@ -146,6 +146,7 @@ async fn handle_client(
                 total_length,
                 assignment,
                 &url,
+                range_opt.map_or(0, |(s, _)| s),
                 peer_senders,
                 transfer_waiters,
             )
@@ -217,7 +218,7 @@ async fn forward_raw(client: &mut TcpStream, request: &[u8]) -> std::io::Result<
     Ok(())
 }
 
-/// Execute accelerate path: fetch self chunks via HTTP, request peer chunks over transport; wait for reassembled body and send response.
+/// Execute accelerate path: request peer chunks over transport, pull and fetch self chunks via HTTP; wait for reassembled body and send response.
 #[allow(clippy::too_many_arguments)]
 async fn accelerate_response(
     stream: &mut TcpStream,
@@ -226,6 +227,7 @@ async fn accelerate_response(
     _total_length: u64,
     assignment: Vec<(ChunkId, pea_core::DeviceId)>,
     url: &str,
+    base: u64,
     peer_senders: Arc<Mutex<HashMap<pea_core::DeviceId, mpsc::UnboundedSender<Vec<u8>>>>>,
     transfer_waiters: crate::transport::TransferWaiters,
 ) -> std::io::Result<()> {
@@ -241,44 +243,60 @@ async fn accelerate_response(
         .build()
         .map_err(std::io::Error::other)?;
 
+    // Peers get their first window now (and more as they deliver); self pulls its chunks one at a time.
+    let mut next_self = None;
     for (chunk_id, peer_id) in &assignment {
         if *peer_id == self_id {
-            let end_inclusive = chunk_id.end.saturating_sub(1);
-            let range_header = format!("bytes={}-{}", chunk_id.start, end_inclusive);
-            let resp = http_client
-                .get(url)
-                .header("Range", range_header)
-                .send()
-                .await
-                .map_err(std::io::Error::other)?;
-            let bytes = resp.bytes().await.map_err(std::io::Error::other)?;
-            let payload = bytes.to_vec();
-            let hash = pea_core::integrity::hash_chunk(&payload);
-            let mut c = core.lock().await;
-            if let Ok(Some(full_body)) =
-                c.on_chunk_received(transfer_id, chunk_id.start, chunk_id.end, hash, payload)
-            {
-                let _ = transfer_waiters.lock().await.remove(&transfer_id);
-                let len = full_body.len();
-                let status = "HTTP/1.1 200 OK\r\n";
-                let headers = format!("Content-Length: {}\r\nConnection: close\r\n\r\n", len);
-                stream.write_all(status.as_bytes()).await?;
-                stream.write_all(headers.as_bytes()).await?;
-                stream.write_all(&full_body).await?;
-                stream.flush().await?;
-                return Ok(());
-            }
-        } else {
-            let msg = chunk_request_message(*chunk_id, Some(url.to_string()));
-            if let Ok(frame) = encode_frame(&msg) {
-                let senders = peer_senders.lock().await;
-                if let Some(tx) = senders.get(peer_id) {
-                    let _ = tx.send(frame);
-                }
+            next_self = Some(*chunk_id);
+            continue;
+        }
+        // Chunks count from the requested range's start; on the wire offsets are absolute.
+        let absolute = ChunkId {
+            start: base + chunk_id.start,
+            end: base + chunk_id.end,
+            ..*chunk_id
+        };
+        let msg = chunk_request_message(absolute, Some(url.to_string()));
+        if let Ok(frame) = encode_frame(&msg) {
+            let senders = peer_senders.lock().await;
+            if let Some(tx) = senders.get(peer_id) {
+                let _ = tx.send(frame);
             }
         }
     }
 
+    while let Some(chunk_id) = next_self {
+        let end_inclusive = (base + chunk_id.end).saturating_sub(1);
+        let range_header = format!("bytes={}-{}", base + chunk_id.start, end_inclusive);
+        let resp = http_client
+            .get(url)
+            .header("Range", range_header)
+            .send()
+            .await
+            .map_err(std::io::Error::other)?;
+        let validator = crate::transport::origin_validator(&resp);
+        let bytes = resp.bytes().await.map_err(std::io::Error::other)?;
+        let hash = pea_core::integrity::hash_chunk(&bytes);
+        let mut c = core.lock().await;
+        if let Some(v) = validator {
+            c.set_transfer_validator(transfer_id, &v);
+        }
+        if let Ok(Some(full_body)) =
+            c.on_chunk_received(transfer_id, chunk_id.start, chunk_id.end, hash, &bytes)
+        {
+            let _ = transfer_waiters.lock().await.remove(&transfer_id);
+            let len = full_body.len();
+            let status = "HTTP/1.1 200 OK\r\n";
+            let headers = format!("Content-Length: {}\r\nConnection: close\r\n\r\n", len);
+            stream.write_all(status.as_bytes()).await?;
+            stream.write_all(headers.as_bytes()).await?;
+            stream.write_all(&full_body).await?;
+            stream.flush().await?;
+            return Ok(());
+        }
+        next_self = c.next_self_chunk(transfer_id);
+    }
+
     match tokio::time::timeout(Duration::from_secs(30), rx).await {
         Ok(Ok(full_body)) => {
             let _ = transfer_waiters.lock().await.remove(&transfer_id);
@@ -18,7 +18,22 @@ const HANDSHAKE_SIZE: usize = 1 + 16 + 32; // version + device_id + public_key
 const LEN_SIZE: usize = 4;
 const MAX_FRAME_LEN: u32 = 16 * 1024 * 1024;
 
-async fn fetch_range(url: &str, start: u64, end: u64) -> std::io::Result<Vec<u8>> {
+/// The response's ETag, else its Last-Modified, for the core's chunk cache (`set_origin_validator`).
+pub fn origin_validator(resp: &reqwest::Response) -> Option<String> {
+    let headers = resp.headers();
+    headers
+        .get(reqwest::header::ETAG)
+        .or_else(|| headers.get(reqwest::header::LAST_MODIFIED))
+        .and_then(|v| v.to_str().ok())
+        .map(str::to_string)
+}
+
+/// Bytes [start, end) of url and the response's validator.
+async fn fetch_range(
+    url: &str,
+    start: u64,
+    end: u64,
+) -> std::io::Result<(Vec<u8>, Option<String>)> {
     let end_inclusive = end.saturating_sub(1);
     let client = reqwest::Client::builder()
         .timeout(Duration::from_secs(30))
@@ -31,8 +46,9 @@ async fn fetch_range(url: &str, start: u64, end: u64) -> std::io::Result<Vec<u8>
         .send()
         .await
         .map_err(std::io::Error::other)?;
+    let validator = origin_validator(&resp);
     let bytes = resp.bytes().await.map_err(std::io::Error::other)?;
-    Ok(bytes.to_vec())
+    Ok((bytes.to_vec(), validator))
 }
 
 /// Shared: when a transfer completes (reassembled body ready), transport sends it here so the proxy can respond.
@@ -226,8 +242,25 @@ async fn run_connection(
             _,
         )) = decode_frame(&plain)
         {
-            if let Ok(body) = fetch_range(url, start, end).await {
+            let cached = core
+                .lock()
+                .await
+                .cached_chunk_frame(transfer_id, start, end, url);
+            if let Some(frame) = cached {
+                let senders = writer_senders.lock().await;
+                if let Some(tx) = senders.get(&peer_id) {
+                    let _ = tx.send(frame);
+                }
+                continue;
+            }
+            if let Ok((body, validator)) = fetch_range(url, start, end).await {
                 let hash = pea_core::integrity::hash_chunk(&body);
+                let mut c = core.lock().await;
+                if let Some(v) = validator {
+                    c.set_origin_validator(url, &v);
+                }
+                c.cache_chunk(url, start, end, hash, &body);
+                drop(c);
                 let chunk_data = Message::ChunkData {
                     transfer_id,
                     start,